@@ -15,4 +15,8 @@
 // • iOS Driver frame metadata, including GMC smoothing
 //   and per-frame registration with firmware cooperation
 
+// Current experimental features:
+// • Batch opcodes (PS1080Opcodes.h: AHBBatch, I2CTransactionList), probed at connect.
+//   Without this define the host never sends them.
+
 //#define ENABLE_EXPERIMENTAL_FEATURES
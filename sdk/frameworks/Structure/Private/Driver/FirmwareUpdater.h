@@ -10,6 +10,7 @@
 
 #import <Foundation/Foundation.h>
 #import "SensorCommunicationController.h"
+#include "Utils/MappedFirmwarePackage.h"
 
 //------------------------------------------------------------------------------
 
@@ -100,6 +101,17 @@ typedef enum {
 
 -(id) initFromFirmwareUpdateContents:(const struct FirmwareUpdateContents*) firmwareUpdateContents;
 
+// Maps the .fla images instead of reading them (see MappedFirmwarePackage.h). Each PS1080File's contents is an NSData
+// made with dataWithBytesNoCopy over its view, whose deallocator releases the mapping, so the images are never copied
+// and the uploads stream from the mapped pages. Pass nil for images the update does not include.
+-(id) initWithMappedPS1080ApplicationPath:(NSString*)ps1080ApplicationPath
+                    xmegaApplicationPath:(NSString*)xmegaApplicationPath
+                        xmegaUpdaterPath:(NSString*)xmegaUpdaterPath
+                                   error:(NSError**)error;
+
+// The views behind the PS1080File contents. Empty when built from FirmwareUpdateContents.
+@property (nonatomic, readonly) const oc::MappedFirmwarePackage& mappedPackage;
+
 // NOTE: Obfuscated properties are potentially unsafe unless their getters are explicitly specified.
 @property (nonatomic, retain, getter=ps1080Application, setter=setPs1080Application:) PS1080File* ps1080Application;
 @property (nonatomic, retain, getter=xmegaApplication , setter=setXmegaApplication: ) PS1080File* xmegaApplication;
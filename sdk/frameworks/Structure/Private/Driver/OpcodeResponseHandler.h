@@ -18,9 +18,12 @@ typedef void (^OpcodeResponseHandlerBlock)(uint16_t replyCode, const uint16_t* p
 
 /* These objects are used by SensorCommunicationController.  They are created when a PS1080 opcode is sent from 
  SensorCommunicationController (sendOpcode:...).  When the opcode with .opcode and .seq is finished executing on the PS1080, the
- PS1080 sends back a response.  If an OpcodeResponseHandler exists for that .seq and .opcode, its .responseHandler is executed. */
+ PS1080 sends back a response.  If an OpcodeResponseHandler exists for that .seq and .opcode, its .responseHandler is executed.
+ Several handlers can be outstanding at once (see oc::OpcodePipeline); .seq is unique among them, which is what lets the
+ response be routed with a single table lookup. */
 @interface OpcodeResponseHandler : NSObject
 @property (nonatomic, copy) OpcodeResponseHandlerBlock responseHandler;
 @property (nonatomic) uint16_t opcode;
 @property (nonatomic) uint8_t seq; // why 8 bit sequence numbers? See PS_ENCODING_SEQ
+@property (nonatomic) NSTimeInterval timeout; // 0 means wait forever, like before pipelining
 @end
@@ -15,6 +15,8 @@
 #include <Core/SensorInfraredFrame.h>
 #include <Core/CameraColorFrame.h>
 
+#include <Structure/Private/Driver/Utils/FrameBufferPool.h>
+
 #if __OBJC__
 #   include <Structure/StructureDriverSecretAPI.h>
 // TODO(Brandon): GeneralStoreCameraType should be moved into another file...
@@ -28,11 +30,16 @@ typedef enum {
 
 /**
  * This is a visible frame from StructureCore
+ *
+ * The frame owns its pixels through a pooled, refcounted buffer. contents/contentsLength point
+ * into that buffer and stay valid for as long as any copy of the frame is alive, so consumers
+ * can keep the frame around instead of copying the data.
  */
 struct VisibleFrame
 {
     VisibleFrameFormat format;
-    const void* contents; // FIXME: We likely should hold a copy of the buffer data here. This looks dangerous.
+    oc::FrameBufferRef buffer;
+    const void* contents;
     size_t contentsLength;
     double timestampHost;
     oc::Intrinsics intrinsics;
@@ -150,6 +157,9 @@ namespace oc {
     // Only the part retrieveing the data from the sensor flash should differ.
 
     @optional
+    // Pools backing the depth, infrared and visible frames handed to the frame delegate.
+    // Frames hold a buffer from here until their last reference goes away.
+    @property(nonatomic, readonly) oc::FrameBufferPools* frameBufferPools;
     - (void) supportedStreamConfigs:(const STStreamConfig**)configs configsLength:(size_t*)length; //DTMP
     - (void) setStreamPreset:(STStreamPreset) preset;
 @end
@@ -11,9 +11,21 @@
 #import <AVFoundation/AVFoundation.h>
 #import "STSensorDriver.h"
 #import "ExperimentalFeatures.h"
+#import "OpcodeResponseHandler.h"
 #include "Utils/PSConfigs.h"
 #include "XMegaUpdater.h"
 #include "Utils/IRLEDDriver.h"
+#include "Utils/OpcodePipeline.h"
+#include "Utils/AHBBatch.h"
+#include "Utils/I2CTransactionList.h"
+#include "Utils/PipelinedFileDownload.h"
+#include "Utils/FlashFileCache.h"
+#include "Utils/DeltaUpload.h"
+#include "Utils/XmegaProgrammingMonitor.h"
+#include "Utils/ConfigTransition.h"
+#include "Utils/RegistrationPresetCache.h"
+#include "Utils/DepthRegistration.h"
+#include "Utils/RelatchScheduler.h"
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
@@ -83,6 +95,9 @@ typedef enum {
     STError_EEPROMWriteAndVerifyDataMismatch, //117 We wrote values into the Xmega EEPROM, but upon readback the values did not match what we had written
     STError_HealthCheckFailurePreventedOperation, //118 We need to see 0 health check failures to do whatever you were trying to do
     STError_RequestAlreadyOutstanding,
+    STError_OpcodeTimedOut, //120 The PS1080 did not answer a pipelined opcode before its timeout
+    STError_OpcodeCancelled, //121 A pipelined opcode was cancelled before the PS1080 answered it
+    STError_I2CTransactionListRejected, //122 An I2C transaction list had a step too long for the wire format
 } STError;
 
 typedef enum {
@@ -162,6 +177,15 @@ typedef void (^CompletionBlock)(NSError* error);
 
 - (void) writeToConfigSession:(const void*)writeData size:(size_t)writeDataSize;
 
+/* Switches stream configuration by writing only the parameters that differ from the last ones written (see
+ ConfigTransition.h), batched into multi-pair SetParam opcodes when the firmware takes them. Only the streams whose
+ format, resolution or fps change are stopped and restarted. The shadow is invalidated on disconnect and after a
+ failed write, which makes the next transition send the whole sequence again. */
+typedef void (^ConfigTransitionCompletionBlock)(NSError* error, size_t settingsWritten);
+- (void) transitionToConfigSequence:(const struct SensorConfigSequence*)sequence completionBlock:(ConfigTransitionCompletionBlock)completionBlock;
+- (void) invalidateConfigShadow;
+- (bool) firmwareSupportsSetParamBatch;
+
 //! Updates the on-device General Store with a new calibration.
 - (void)uploadCalibrationWithData:(GeneralStoreCalibrationData&) calData;
 
@@ -175,6 +199,31 @@ typedef void (^CompletionBlock)(NSError* error);
 - (void) setAndLatchRegistrationRBTWithCustomVgaRgbIntrinsics:(oc::Intrinsics)rgbVgaIntrinsics completionBlock:(CompletionBlock)completionBlock;
 - (bool) firmwareSupportsLatch;
 
+/* Registration presets (see RegistrationPresetCache.h): the params for every (resolution, fps), computed once per
+ calibration, written to flash as the preset file and mirrored on the host. precomputeRegistrationPresets: does nothing
+ when the flash already holds the presets for the current calibration; uploadCalibrationWithData: recomputes them.
+ Preset blocks carry no latch ID; the firmware finds the one for the depth resolution and fps the stream starts with.
+ applyRegistrationPresetForConfig: sends nothing when a current preset exists for the config, and otherwise falls back
+ to computeAndSendRegistrationParamsForConfig:. */
+@property (nonatomic, readonly) oc::RegistrationPresetCache* registrationPresetCache;
+- (void) precomputeRegistrationPresets:(CompletionBlock)completionBlock;
+- (void) applyRegistrationPresetForConfig:(const struct SensorConfigSequence*)sequence completionBlock:(CompletionBlock)completionBlock;
+
+/* Host-side registration (see DepthRegistration.h): the stream runs an unregistered depth config and each depth frame
+ is reprojected into the color camera of the current iOS device calibration (getIntrinsics640x480AtFocusPositionDuringCalibration
+ scaled to colorWidth x colorHeight, getExtrinsics). After a refocus, updateHostDepthRegistrationColorIntrinsics: takes
+ effect from the next frame, with no latch and no stream restart. */
+- (void) setHostDepthRegistrationEnabled:(BOOL)enabled colorWidth:(int)colorWidth colorHeight:(int)colorHeight;
+- (void) updateHostDepthRegistrationColorIntrinsics:(oc::Intrinsics)rgbIntrinsics640x480;
+
+/* Continuous-focus relatching (see RelatchScheduler.h): lens positions are snapped to a grid whose params are
+ precomputed per calibration, rapid focus changes are coalesced so only the latest position is latched, and the
+ latch IDs of incoming depth frames are checked against the lens position. reportLensPosition: may be called for every
+ color frame; relatchStats tells what share of depth frames were registered for the current lens position. */
+@property (nonatomic, readonly) oc::RelatchScheduler* relatchScheduler;
+- (void) reportLensPosition:(float)lensPosition;
+- (oc::RelatchScheduler::Stats) relatchStats;
+
 @property(nonatomic, assign) id<SensorCommunicationControllerDelegate> fwDelegate;
 // we will use this config id to encode the sequnence (upper 8 bits)
 @property (nonatomic, readwrite) uint8_t sessionID;
@@ -325,6 +374,12 @@ typedef void (^FirmwareFileTableChangeCounterReceivedBlock)(uint16_t fileTableCh
 
 -(void) invalidateCachedFileList;
 
+/* Directory for the on-disk flash file cache (see FlashFileCache.h), nil to disable it. When the sensor's file
+ table change counter matches the cached one, the file table and file downloads are served from disk without
+ touching the sensor. Sensors that report no serial number are never cached. invalidateCachedFileList also drops
+ this sensor's cached files. */
+@property (nonatomic, copy) NSString* flashFileCacheDirectory;
+
 -(bool) stateOfChargeDebugInfoIsSupported;
 typedef void (^StateOfChargeDebugInfoReceivedBlock)(const StateOfChargeDebugInfo* debugInfo, NSError* error);
 -(void) getStateOfChargeDebugInfo:(StateOfChargeDebugInfoReceivedBlock)completionBlock;
@@ -351,6 +406,14 @@ typedef void (^TestIRLEDBlock)(TestIRLEDResult result, NSError* error);
 typedef void (^AHBReadCompletionBlock)(NSError* error, uint32_t value);
 - (void) AHBRead:(uint32_t)address completionBlock:(AHBReadCompletionBlock)completionBlock;
 
+// Runs a list of AHB reads and masked writes, in order, in as few opcodes as the control session MTU allows.
+// Firmware without firmwareSupportsAHBBatch gets one ReadAHB/WriteAHB per operation, still pipelined.
+// error is set if any operation failed; results[i].succeeded tells which ones did.
+typedef void (^AHBBatchCompletionBlock)(NSError* error, const std::vector<oc::AHBResult>& results);
+- (void) AHBBatch:(const std::vector<oc::AHBOperation>&)operations completionBlock:(AHBBatchCompletionBlock)completionBlock;
+// Result of probeAHBBatchSupport at connect; always false unless built with ENABLE_EXPERIMENTAL_FEATURES.
+- (bool) firmwareSupportsAHBBatch;
+
 - (void) pullGMCData;
 - (void) setGMCModeEnabled:(BOOL)isEnabled completionBlock:(CompletionBlock)completionBlock;
 - (void) setGMCDebugModeEnabled:(BOOL)isEnabled completionBlock:(CompletionBlock)completionBlock;
@@ -362,14 +425,21 @@ typedef void (^SetLowPowerModeTimeoutBlock)(NSError* error);
 typedef void (^XmegaRunningProgramReceivedBlock)(XmegaRunningProgram runningProgram, NSError* error);
 -(void) getXmegaRunningProgram:(XmegaRunningProgramReceivedBlock)completionBlock;
 
-// Starts PS1080 programming the xmega and waits for the programming to complete.  Internally it starts a timer and watches the
-// xmega update status, giving you progress updates through the progressBlock, which can be nil if you don't care about
-// progress updates.  This combines the work of startXmegaProgramming: and getXmegaProgrammingStatus: together.
-typedef void (^ProgramXmegaFirmwareProgressBlock)(float progress, size_t programmedBytes, size_t totalFirmwareBytes);
+// Starts PS1080 programming the xmega and waits for the programming to complete.  Internally it watches the xmega
+// update status, with the polls paced by an XmegaProgrammingMonitor, giving you progress updates through the
+// progressBlock, which can be nil if you don't care about progress updates.  The write rate and time left are reported
+// as they are measured (negative until the first progress).  This combines the work of startXmegaProgramming: and
+// getXmegaProgrammingStatus: together.
+// If firmwareImage (the uploaded xmega image) is given, its CRC is computed over the pages as they are acknowledged and
+// compared with crc16 when the last one is; a mismatch fails with STError_CRCMismtach without waiting for the xmega's
+// own check.  An image shorter than xmegaFileSize fails with STError_XmegaProgrammingCouldNotStart.  It may be nil.
+typedef void (^ProgramXmegaFirmwareProgressBlock)(float progress, size_t programmedBytes, size_t totalFirmwareBytes,
+                                                  double bytesPerSecond, double estimatedSecondsRemaining);
 -(void) programXmegaFirmware:(XmegaUpdateType) updateType
               xmegaCRCOfFile:(uint16_t) crc16
                progressBlock:(ProgramXmegaFirmwareProgressBlock)progressBlock
                xmegaFileSize:(size_t)xmegaFileSize
+               firmwareImage:(NSData*)firmwareImage
              completionBlock:(CompletionBlock)completionBlock;
 
 // starts programming either the xmega updater or application
@@ -405,6 +475,16 @@ typedef void (^XmegaEEPROMReadCompleted)(NSData* readData, NSError* error);
 // this will write the EEPROM and then read it back, checking that the contents matches
 -(void) performXmegaEEPROMWriteAndVerify:(uint16_t)EEPROMAddress writeContents:(const uint8_t*)writeContents writeContentsLength:(size_t)writeContentsLength completionBlock:(CompletionBlock)completionBlock;
 
+// Runs a whole I2C transaction list (see I2CTransactionList.h) as one opcode and returns everything it read in one result.
+// On firmware without firmwareSupportsI2CTransactionList the steps are run one performI2CWrite/performI2CWriteRead at a time,
+// with delays done on the host and UpdateBits done as a read then a write, so callers don't need two code paths. error is
+// STError_I2CReadResponseToShort if the reply is malformed, STError_I2CTransactionListRejected without sending anything
+// if transactionList.rejected(); a step failure sets error and leaves result.completedSteps at the failing step.
+typedef void (^I2CTransactionListCompleted)(const oc::I2CTransactionResult& result, NSError* error);
+-(void) performI2CTransactionList:(const oc::I2CTransactionList&)transactionList completionBlock:(I2CTransactionListCompleted)completionBlock;
+// Result of probeI2CTransactionListSupport at connect; always false unless built with ENABLE_EXPERIMENTAL_FEATURES.
+-(bool) firmwareSupportsI2CTransactionList;
+
 /* Hardware info is some 16-bits that live the xmega EEPROM describing some useful properties of the hardware.
  Previously we just relied on the firmware signature for all the hardware info.  The trigger to introduce hardware info
  was needing to know DaughterPCB versions, which are not encoded anywhere besides hardwareInfo */
@@ -445,6 +525,19 @@ typedef void (^DownloadFileProgressBlock)(float progress, size_t downloadedWords
             progressBlock:(DownloadFileProgressBlock)progressBlock
           completionBlock:(DownloadFileCompletionBock) completionBlock;
 
+// Number of chunk reads the file downloads above keep in flight (see PipelinedFileDownload.h). 1 restores the old
+// one-chunk-per-round-trip behavior.
+@property (nonatomic) NSUInteger fileDownloadWindow;
+
+// Same as above, but starts from partialContents, e.g. the downloadedFileContents of the last progress callback
+// before a disconnect, and only downloads the rest. The CRC is checked over the whole file as usual.
+- (void) downloadFileById:(uint16_t) fileId
+          fileSizeInWords:(size_t) fileSizeInWords
+             filePS1080CRC:(uint16_t)filePS1080CRC
+       resumeFromContents:(NSData*)partialContents
+            progressBlock:(DownloadFileProgressBlock)progressBlock
+          completionBlock:(DownloadFileCompletionBock) completionBlock;
+
 typedef void (^DownloadFileFLACompletionBock)(NSData* flaFileContents, NSError* error);
 // this function will give you the full/raw .fla file from the firmware. It's used by the downloadFileById methods. The firmware natively gives back .fla files and this function has the lowest overhead of any of the download functions
 - (void) downloadFLAFileById:(uint16_t) fileId
@@ -481,12 +574,27 @@ typedef void (^UploadFileProgressBlock)(float progress, size_t uploadedWords, si
    completionBlock:(CompletionBlock)completionBlock;
 
 // Uploads a file, knows about .fla file headers so they don't have to be broken out
+// The contents are read in place chunk by chunk (MappedChunkReader), never copied; when they are a mapped view from
+// OCFirmwareUpdatePackage the pages already sent are dropped from memory as the upload goes.
 -(void) uploadFileFLAContents:(NSData*)contentsWithFLAHeader
                        offset:(uint32_t)offset
                     attributes:(uint16_t)attributes
                 progressBlock:(UploadFileProgressBlock)progressBlock
               completionBlock:(CompletionBlock)completionBlock;
 
+typedef void (^DeltaUploadCompletionBlock)(bool fullRewrite, size_t uploadedBytes, NSError* error);
+/* Rewrites only the regions of a flash file that differ from previousContents (see DeltaUpload.h), using
+ startFileUploadFromMemory:...fileOffset: per region. previousContents is what we believe is on the sensor, normally
+ the FlashFileCache copy for the current file table change counter; pass nil to force a full upload. Afterwards the
+ file table is re-read and the file's CRC checked against contents: on a mismatch the whole file is uploaded once
+ more, and if that fails too the completion gets STError_CRCMismtach. */
+-(void) uploadFileDelta:(XFlashMap_FileType)fileType
+               contents:(NSData*)contents
+       previousContents:(NSData*)previousContents
+                version:(uint32_t)version attributes:(uint16_t)attributes
+          progressBlock:(UploadFileProgressBlock)progressBlock
+        completionBlock:(DeltaUploadCompletionBlock)completionBlock;
+
 // Hook for SFU to determine whether or not a file upload was interrupted by the app backgrounding or something
 @property (nonatomic) bool uploadFileWasInterruptedBySensorCloseDueToAppResignActive;
 
@@ -543,6 +651,28 @@ typedef void (^SendRttRequestWithToggleLedBlock)(double rttTime, NSError* error)
 
 - (void)sendSensorStatus;
 
+/* Opcode pipelining. Up to maxOutstandingOpcodes opcodes are kept in flight on the control session; responses are
+ matched by seq (see OpcodeResponseHandler) so independent requests no longer wait on each other. Set it to 1 to get
+ the old one-at-a-time behavior, e.g. for firmware that cannot queue opcodes. */
+@property (nonatomic) NSUInteger maxOutstandingOpcodes;
+
+// Sends an opcode through the pipeline. The handler runs on the accessory thread with error set to
+// STError_OpcodeTimedOut, STError_OpcodeCancelled or STError_NoSensorAttached if no reply arrived.
+// Returns a ticket for cancelPipelinedOpcode:, or 0 if no sensor is attached.
+- (oc::OpcodePipeline::Ticket) sendPipelinedOpcode:(uint16_t)opcode
+                                            payload:(const uint16_t*)payload
+                                 payloadSizeInWords:(size_t)payloadSizeInWords
+                                            timeout:(NSTimeInterval)timeout
+                                    responseHandler:(OpcodeResponseHandlerBlock)responseHandler;
+
+// Cancels an opcode sent with sendPipelinedOpcode:. Returns false if it already completed.
+- (bool) cancelPipelinedOpcode:(oc::OpcodePipeline::Ticket)ticket;
+
+/* Per-opcode counters and round-trip histograms for every opcode this controller sends, including failures by
+ STError code. Lives as long as the controller and survives reconnects; reset it with opcodeStats->reset(). */
+@property (nonatomic, readonly) oc::OpcodeStats* opcodeStats;
+- (NSString*) opcodeStatsJSON;
+
 @end
 
 bool hardwareInfoFromEEPROMBlock(struct HardwareInfo* hardwareInfo, const uint8_t EEPROMBlock[]);
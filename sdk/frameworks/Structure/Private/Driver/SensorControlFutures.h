@@ -0,0 +1,197 @@
+//
+//  SensorControlFutures.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#import "SensorCommunicationController.h"
+#include "Utils/ControlFuture.h"
+#include "Utils/EmitterData.h"
+
+#include <tuple>
+
+/* ControlFuture versions of the SensorCommunicationController control calls, so flows like connect and firmware
+ update can issue independent queries together and join them with oc::whenAll instead of nesting blocks:
+
+     auto queries = oc::whenAll(oc::sensorcontrol::getHardwareInfo(controller),
+                                oc::sensorcontrol::getEmitterData(controller),
+                                oc::sensorcontrol::getFirmwareFileTableChangeCounter(controller));
+     queries.then([] (const auto& results) { ... });
+
+ In a C++20 build the same calls can be co_await-ed from a coroutine returning an oc::ControlFuture.
+ Results resolve on the accessory thread, like the blocks they wrap. */
+
+namespace oc { namespace sensorcontrol {
+
+inline ControlError controlErrorFromNSError (NSError* error)
+{
+    ControlError controlError;
+    if (error)
+    {
+        controlError.code = error.code != 0 ? int(error.code) : -1;
+        controlError.message = error.localizedDescription.UTF8String ?: "";
+    }
+    return controlError;
+}
+
+template <class T>
+inline void resolve (const ControlPromise<T>& promise, T value, NSError* error)
+{
+    if (error)
+        promise.fail(controlErrorFromNSError(error));
+    else
+        promise.succeed(std::move(value));
+}
+
+struct HardwareInfoResult
+{
+    struct HardwareInfo hardwareInfo;
+    std::vector<uint8_t> raw;
+};
+
+struct BatteryStatus
+{
+    float voltage = 0;
+    float current = 0;
+    float socMilliampHours = 0;
+    float socPercent = 0;
+    bool hasACAdapterVoltage = false;
+    float ACAdapterVoltage = 0;
+};
+
+inline ControlFuture<struct EmitterData> getEmitterData (SensorCommunicationController* controller)
+{
+    ControlPromise<struct EmitterData> promise;
+    [controller getEmitterData:^(struct EmitterData emitterData, NSError* error) {
+        resolve(promise, emitterData, error);
+    }];
+    return promise.future();
+}
+
+inline ControlFuture<HardwareInfoResult> getHardwareInfo (SensorCommunicationController* controller)
+{
+    ControlPromise<HardwareInfoResult> promise;
+    [controller getHardwareInfo:^(const struct HardwareInfo* hardwareInfo, const uint8_t* hardwareInfoRaw, size_t hardwareInfoRawLength, NSError* error) {
+        HardwareInfoResult result = {};
+        if (!error && hardwareInfo)
+        {
+            result.hardwareInfo = *hardwareInfo;
+            if (hardwareInfoRaw)
+                result.raw.assign(hardwareInfoRaw, hardwareInfoRaw + hardwareInfoRawLength);
+        }
+        resolve(promise, result, error);
+    }];
+    return promise.future();
+}
+
+inline ControlFuture<IDParamsData> getIDParams (SensorCommunicationController* controller)
+{
+    ControlPromise<IDParamsData> promise;
+    [controller asynchronousIDParamsDownloadWithCompletion:^(struct IDParamsData* idParams, NSError* error) {
+        resolve(promise, (!error && idParams) ? *idParams : IDParamsData(), error);
+    }];
+    return promise.future();
+}
+
+// fileList holds FlashFSFile objects, unsorted, as with downloadFileList:.
+inline ControlFuture<NSArray*> downloadFileList (SensorCommunicationController* controller)
+{
+    ControlPromise<NSArray*> promise;
+    [controller downloadFileList:^(NSArray* fileList, NSError* error) {
+        resolve(promise, fileList, error);
+    }];
+    return promise.future();
+}
+
+inline ControlFuture<uint16_t> getFirmwareFileTableChangeCounter (SensorCommunicationController* controller)
+{
+    ControlPromise<uint16_t> promise;
+    [controller getFirmwareFileTableChangeCounter:^(uint16_t fileTableChangeCounter, NSError* error) {
+        resolve(promise, fileTableChangeCounter, error);
+    }];
+    return promise.future();
+}
+
+inline ControlFuture<BatteryStatus> getBatteryVoltageCurrentSOC (SensorCommunicationController* controller)
+{
+    ControlPromise<BatteryStatus> promise;
+    [controller getBatteryVoltageCurrentSOC:^(float voltage, float current, float socMilliampHours, float socPercent, bool hasACAdapterVoltage, float ACAdapterVoltage, NSError* error) {
+        BatteryStatus status;
+        status.voltage = voltage;
+        status.current = current;
+        status.socMilliampHours = socMilliampHours;
+        status.socPercent = socPercent;
+        status.hasACAdapterVoltage = hasACAdapterVoltage;
+        status.ACAdapterVoltage = ACAdapterVoltage;
+        resolve(promise, status, error);
+    }];
+    return promise.future();
+}
+
+inline ControlFuture<XmegaRunningProgram> getXmegaRunningProgram (SensorCommunicationController* controller)
+{
+    ControlPromise<XmegaRunningProgram> promise;
+    [controller getXmegaRunningProgram:^(XmegaRunningProgram runningProgram, NSError* error) {
+        resolve(promise, runningProgram, error);
+    }];
+    return promise.future();
+}
+
+inline ControlFuture<uint32_t> AHBRead (SensorCommunicationController* controller, uint32_t address)
+{
+    ControlPromise<uint32_t> promise;
+    [controller AHBRead:address completionBlock:^(NSError* error, uint32_t value) {
+        resolve(promise, value, error);
+    }];
+    return promise.future();
+}
+
+inline ControlFuture<ControlNone> AHBWrite (SensorCommunicationController* controller, uint32_t address, uint32_t value, uint32_t mask = 0xffffffff)
+{
+    ControlPromise<ControlNone> promise;
+    [controller AHBWrite:address value:value mask:mask completionBlock:^(NSError* error) {
+        resolve(promise, ControlNone(), error);
+    }];
+    return promise.future();
+}
+
+// progressBlock and firmwareImage may be nil.
+inline ControlFuture<ControlNone> programXmegaFirmware (SensorCommunicationController* controller, XmegaUpdateType updateType,
+                                                        uint16_t crc16, size_t xmegaFileSize, ProgramXmegaFirmwareProgressBlock progressBlock = nil,
+                                                        NSData* firmwareImage = nil)
+{
+    ControlPromise<ControlNone> promise;
+    [controller programXmegaFirmware:updateType
+                      xmegaCRCOfFile:crc16
+                       progressBlock:progressBlock
+                       xmegaFileSize:xmegaFileSize
+                       firmwareImage:firmwareImage
+                     completionBlock:^(NSError* error) {
+        resolve(promise, ControlNone(), error);
+    }];
+    return promise.future();
+}
+
+//------------------------------------------------------------------------------
+
+/* The read-only queries of the connect sequence. None depends on another, so they all go out at once and the
+ sequence costs about one round trip instead of one per query. */
+typedef std::tuple<ControlResult<HardwareInfoResult>,
+                   ControlResult<struct EmitterData>,
+                   ControlResult<IDParamsData>,
+                   ControlResult<uint16_t>,
+                   ControlResult<XmegaRunningProgram>> ConnectQueryResults;
+
+inline ControlFuture<ConnectQueryResults> runConnectQueries (SensorCommunicationController* controller)
+{
+    return whenAll(getHardwareInfo(controller),
+                   getEmitterData(controller),
+                   getIDParams(controller),
+                   getFirmwareFileTableChangeCounter(controller),
+                   getXmegaRunningProgram(controller));
+}
+
+}} // oc::sensorcontrol namespace
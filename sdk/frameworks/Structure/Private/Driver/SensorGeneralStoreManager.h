@@ -10,6 +10,7 @@
 
 #import "CalibrationFilev1Entry.h"
 #import "Utils/ByteStream.h"
+#import "Utils/GeneralStoreIndex.h"
 #import <Core/Intrinsics.h>
 #import <Eigen/Eigen>
 #import <Foundation/Foundation.h>
@@ -132,7 +133,10 @@ void bsInitGeneralStorePreset(struct ByteStream* destinationStream);
 - (int)getCalibrationFileVersion;
 - (void)cleanup;
 - (void)cleanupCalibrationFiles;
+// Indexes the store in place (see GeneralStoreIndex.h); dataStream must stay valid until the next parse or cleanup.
+// The CalibrationFilev1 object graph is only built when the store is modified (updateCalibrationWithData:, removals).
 - (void)parseByteStream:(struct ByteStream&)dataStream length:(size_t)length;
+@property (nonatomic, readonly) const oc::GeneralStoreIndex* generalStoreIndex;
 
 - (void)updateCalibrationWithData:(GeneralStoreCalibrationData&) calData;
 
@@ -158,6 +162,7 @@ void bsInitGeneralStorePreset(struct ByteStream* destinationStream);
 // Debug Only Function
 - (void)addCalibrationFile:(CalibrationFilev1*)calibrationFile;
 
+// Looks the current device up by DeviceNameSha1 in generalStoreIndex, then its entry for cameraType.
 - (bool)getCurrentDeviceCalibration:(GeneralStoreCalibrationData&) calData
                       forCameraType:(GeneralStoreCameraType)cameraType;
 
@@ -0,0 +1,189 @@
+//
+//  OpcodePipelineTests.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+//  Host-only, no sensor needed:
+//      c++ -std=gnu++14 -I../Utils OpcodePipelineTests.cpp ../Utils/OpcodePipeline.cpp ../Utils/OpcodeStats.cpp -lpthread
+//
+
+#include "OpcodePipeline.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace oc;
+
+namespace {
+
+    int failures = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); ++failures; } } while (0)
+
+    struct FakeClock
+    {
+        double time = 100.0;
+        OpcodePipeline::Clock clock () { return [this] { return time; }; }
+    };
+
+    struct Sent
+    {
+        uint16_t opcode;
+        uint8_t seq;
+    };
+
+    void testZeroTimeoutWaitsForever ()
+    {
+        FakeClock clock;
+        std::vector<Sent> sent;
+        OpcodePipeline pipeline ([&] (uint16_t opcode, uint8_t seq, const uint16_t*, size_t) {
+            sent.push_back({ opcode, seq });
+            return true;
+        }, 4, clock.clock());
+
+        int timedOut = 0, completed = 0;
+        pipeline.submit(3, nullptr, 0, 0, [&] (OpcodeRequestStatus status, uint16_t, const uint16_t*, size_t) {
+            (status == OpcodeRequestStatus::TimedOut ? timedOut : completed)++;
+        });
+
+        CHECK(pipeline.nextDeadline() < 0);
+
+        pipeline.checkTimeouts();
+        clock.time += 3600;
+        pipeline.checkTimeouts();
+        CHECK(timedOut == 0);
+        CHECK(pipeline.outstandingCount() == 1);
+
+        const uint16_t ack = 0;
+        CHECK(pipeline.handleResponse(3, sent.at(0).seq, &ack, sizeof(ack)));
+        CHECK(completed == 1);
+    }
+
+    void testPositiveTimeoutExpires ()
+    {
+        FakeClock clock;
+        OpcodePipeline pipeline ([] (uint16_t, uint8_t, const uint16_t*, size_t) { return true; }, 4, clock.clock());
+
+        int timedOut = 0;
+        pipeline.submit(3, nullptr, 0, 0.5, [&] (OpcodeRequestStatus status, uint16_t, const uint16_t*, size_t) {
+            timedOut += status == OpcodeRequestStatus::TimedOut;
+        });
+        pipeline.submit(3, nullptr, 0, 0, [&] (OpcodeRequestStatus status, uint16_t, const uint16_t*, size_t) {
+            timedOut += status == OpcodeRequestStatus::TimedOut;
+        });
+
+        CHECK(pipeline.nextDeadline() == 100.5);
+
+        clock.time += 0.4;
+        pipeline.checkTimeouts();
+        CHECK(timedOut == 0);
+
+        clock.time += 0.2;
+        pipeline.checkTimeouts();
+        CHECK(timedOut == 1);
+        CHECK(pipeline.outstandingCount() == 1);
+    }
+
+    void testTransportMayAnswerFromSend ()
+    {
+        OpcodePipeline* self = nullptr;
+        std::vector<uint16_t> order;
+
+        OpcodePipeline pipeline ([&] (uint16_t opcode, uint8_t seq, const uint16_t*, size_t) {
+            order.push_back(opcode);
+            const uint16_t ack = 0;
+            self->handleResponse(opcode, seq, &ack, sizeof(ack)); // would deadlock if sent under the lock
+            return true;
+        }, 1);
+        self = &pipeline;
+
+        int completed = 0;
+        auto count = [&] (OpcodeRequestStatus status, uint16_t, const uint16_t*, size_t) {
+            completed += status == OpcodeRequestStatus::Completed;
+        };
+
+        pipeline.submit(1, nullptr, 0, 1, [&] (OpcodeRequestStatus status, uint16_t, const uint16_t*, size_t) {
+            count(status, 0, nullptr, 0);
+            pipeline.submit(3, nullptr, 0, 1, count); // submitting from a callback that runs inside send
+        });
+        pipeline.submit(2, nullptr, 0, 1, count);
+
+        CHECK(completed == 3);
+        CHECK((order == std::vector<uint16_t> { 1, 3, 2 })); // 3 was submitted, from inside the first send, before 2
+        CHECK(pipeline.outstandingCount() == 0);
+        CHECK(pipeline.queuedCount() == 0);
+    }
+
+    void testSendFailureDisconnects ()
+    {
+        OpcodePipeline pipeline ([] (uint16_t, uint8_t, const uint16_t*, size_t) { return false; }, 2);
+
+        int disconnected = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            pipeline.submit(3, nullptr, 0, 0, [&] (OpcodeRequestStatus status, uint16_t, const uint16_t*, size_t) {
+                disconnected += status == OpcodeRequestStatus::Disconnected;
+            });
+        }
+
+        CHECK(disconnected == 3);
+        CHECK(pipeline.outstandingCount() == 0);
+    }
+
+    void testStatsRecordErrorsAndMax ()
+    {
+        FakeClock clock;
+        std::vector<Sent> sent;
+        OpcodePipeline pipeline ([&] (uint16_t opcode, uint8_t seq, const uint16_t*, size_t) {
+            sent.push_back({ opcode, seq });
+            return true;
+        }, 4, clock.clock());
+
+        OpcodeStats stats;
+        pipeline.setStats(&stats);
+
+        auto ignore = [] (OpcodeRequestStatus, uint16_t, const uint16_t*, size_t) {};
+        pipeline.submit(20, nullptr, 0, 1, ignore);
+        pipeline.submit(20, nullptr, 0, 1, ignore);
+        const OpcodePipeline::Ticket cancelled = pipeline.submit(20, nullptr, 0, 1, ignore);
+        pipeline.submit(20, nullptr, 0, 0, ignore);
+
+        clock.time += 0.0007;
+        const uint16_t ack = 0, nack = 1;
+        CHECK(pipeline.handleResponse(20, sent.at(0).seq, &ack, sizeof(ack)));
+        clock.time += 0.0001;
+        CHECK(pipeline.handleResponse(20, sent.at(1).seq, &nack, sizeof(nack)));
+        CHECK(pipeline.cancel(cancelled));
+        clock.time += 2;
+        pipeline.checkTimeouts(); // the zero timeout one stays
+        pipeline.failAll(OpcodeRequestStatus::Disconnected);
+
+        const std::vector<OpcodeStats::Snapshot> snapshot = stats.snapshot();
+        CHECK(snapshot.size() == 1);
+        const OpcodeStats::Snapshot& readAHB = snapshot.at(0);
+        CHECK(readAHB.nacked == 1);
+        CHECK(readAHB.errors[104 - OpcodeStats::FirstErrorCode] == 1);
+        CHECK(readAHB.errors[121 - OpcodeStats::FirstErrorCode] == 1);
+        CHECK(readAHB.errors[100 - OpcodeStats::FirstErrorCode] == 1);
+        CHECK(readAHB.errors[120 - OpcodeStats::FirstErrorCode] == 0);
+
+        // 800us falls in a 32us wide bucket starting at 768; max must not report the bucket bound.
+        CHECK(readAHB.roundTrip.max >= 799 && readAHB.roundTrip.max <= 800);
+        CHECK(readAHB.roundTrip.valueAtQuantile(1.0) < readAHB.roundTrip.max);
+    }
+
+} // anonymous namespace
+
+int main ()
+{
+    testZeroTimeoutWaitsForever();
+    testPositiveTimeoutExpires();
+    testTransportMayAnswerFromSend();
+    testSendFailureDisconnects();
+    testStatsRecordErrorsAndMax();
+
+    std::printf(failures == 0 ? "OpcodePipelineTests passed\n" : "OpcodePipelineTests: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+//
+//  PSConfigTablesTests.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+//  Host-only, no sensor needed:
+//      c++ -std=gnu++14 -I../Utils PSConfigTablesTests.cpp ../Utils/ConfigTransition.cpp ../Utils/PSStreamDecoder.cpp
+//          ../Utils/FrameBufferPool.cpp ../Utils/OpcodePipeline.cpp ../Utils/OpcodeStats.cpp -lpthread
+//
+
+#include "ConfigTransition.h"
+#include "PSStreamDecoder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+using namespace oc;
+
+namespace {
+
+    int failures = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); ++failures; } } while (0)
+
+    constexpr SensorSetting qvgaDepthCompressed[] = {
+        { PARAM_GENERAL_STREAM1_MODE, PSStreamMode_Off },
+        { PARAM_DEPTH_FORMAT, PSFormat_CompressedPS },
+        { PARAM_DEPTH_RESOLUTION, PSResolution_QVGA },
+        { PARAM_DEPTH_FPS, 30 },
+        { PARAM_GENERAL_STREAM1_MODE, PSStreamMode_Depth },
+    };
+
+    constexpr SensorSetting sxgaInfrared30[] = {
+        { PARAM_GENERAL_STREAM0_MODE, PSStreamMode_Off },
+        { PARAM_IR_FORMAT, PSFormat_Packed10 },
+        { PARAM_IR_RESOLUTION, PSResolution_SXGA },
+        { PARAM_IR_FPS, 30 },
+        { PARAM_GENERAL_STREAM0_MODE, PSStreamMode_IR },
+    };
+
+    constexpr SensorSetting vgaDepthAt60[] = {
+        { PARAM_DEPTH_FORMAT, PSFormat_Uncompressed16 },
+        { PARAM_DEPTH_RESOLUTION, PSResolution_VGA },
+        { PARAM_DEPTH_FPS, 60 },
+        { PARAM_GENERAL_STREAM1_MODE, PSStreamMode_Depth },
+    };
+
+    constexpr SensorSetting vgaDepthPacked11[] = {
+        { PARAM_DEPTH_FORMAT, PSFormat_Packed11 },
+        { PARAM_DEPTH_RESOLUTION, PSResolution_VGA },
+        { PARAM_DEPTH_FPS, 30 },
+        { PARAM_GENERAL_STREAM1_MODE, PSStreamMode_Depth },
+    };
+
+    // 49.2 MB/s of IR plus 4.6 MB/s of depth is more than USB 2.0 bulk carries.
+    constexpr SensorSetting sxgaInfraredWithQVGADepth[] = {
+        { PARAM_IR_FORMAT, PSFormat_Packed10 },
+        { PARAM_IR_RESOLUTION, PSResolution_SXGA },
+        { PARAM_IR_FPS, 30 },
+        { PARAM_DEPTH_FORMAT, PSFormat_Uncompressed16 },
+        { PARAM_DEPTH_RESOLUTION, PSResolution_QVGA },
+        { PARAM_DEPTH_FPS, 30 },
+        { PARAM_GENERAL_STREAM0_MODE, PSStreamMode_IR },
+        { PARAM_GENERAL_STREAM1_MODE, PSStreamMode_Depth },
+    };
+
+    constexpr SensorSetting qvgaDepthUncompressed[] = {
+        { PARAM_DEPTH_FORMAT, PSFormat_Uncompressed16 },
+        { PARAM_DEPTH_RESOLUTION, PSResolution_QVGA },
+        { PARAM_DEPTH_FPS, 30 },
+        { PARAM_GENERAL_STREAM1_MODE, PSStreamMode_Depth },
+    };
+
+    OC_CHECK_SENSOR_CONFIG_TABLE(sensorConfigTable(qvgaDepthCompressed));
+    OC_CHECK_SENSOR_CONFIG_TABLE(sensorConfigTable(sxgaInfrared30));
+    OC_CHECK_SENSOR_CONFIG_TABLE(sensorConfigTable(qvgaDepthUncompressed));
+    OC_CHECK_SENSOR_CONFIG_TABLE(sensorConfigTable(vgaDepthPacked11));
+    static_assert(!sensorConfigStreamsCompatible(sensorConfigTable(vgaDepthAt60)), "VGA depth only runs at 30 fps");
+    static_assert(!sensorConfigStreamsCompatible(sensorConfigTable(sxgaInfraredWithQVGADepth)), "over the USB budget");
+    static_assert(sensorConfigMetadata(sensorConfigTable(qvgaDepthCompressed)).depth.decode == PSDecodeKernel::DepthCompressedPS,
+                  "compressed depth decodes with uncompressDepthPS");
+
+    void testTransitionRefusesInvalidConfig ()
+    {
+        int sent = 0;
+        OpcodePipeline pipeline ([&] (uint16_t, uint8_t, const uint16_t*, size_t) { ++sent; return true; }, 4);
+        SensorConfigShadow shadow;
+
+        std::vector<SensorSetting> settings (std::begin(vgaDepthAt60), std::end(vgaDepthAt60));
+        const SensorConfigSequence target = { settings.data(), settings.size() };
+
+        int calls = 0;
+        executeConfigTransition(pipeline, shadow, target, 32, true, 1.0, [&] (OpcodeRequestStatus status, bool acked, size_t written) {
+            ++calls;
+            CHECK(status == OpcodeRequestStatus::Cancelled && !acked && written == 0);
+        });
+
+        CHECK(calls == 1);
+        CHECK(sent == 0);
+        CHECK(!shadow.known(PARAM_DEPTH_FPS));
+    }
+
+    void testDecoderUsesConfigMetadata ()
+    {
+        FrameBufferPools pools;
+        PSStreamDecoder decoder (pools);
+
+        std::vector<SensorSetting> settings (std::begin(qvgaDepthUncompressed), std::end(qvgaDepthUncompressed));
+        CHECK(decoder.configure({ settings.data(), settings.size() }));
+        CHECK(decoder.metadata().depth.poolKey() == (FrameBufferPoolKey { FrameBufferStream::Depth, 320, 240, 2 }));
+
+        std::vector<uint16_t> wire (320 * 240);
+        for (size_t i = 0; i < wire.size(); ++i)
+            wire[i] = uint16_t(i);
+
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(wire.data());
+        FrameBufferRef frame = decoder.decode(FrameBufferStream::Depth, bytes, wire.size() * 2);
+        CHECK(frame && frame.size() == wire.size() * 2 && std::memcmp(frame.data(), bytes, frame.size()) == 0);
+        CHECK(frame->capacity() == pools.poolFor(decoder.metadata().depth.poolKey()).bufferCapacity());
+
+        CHECK(!decoder.decode(FrameBufferStream::Depth, bytes, wire.size()));
+        CHECK(!decoder.decode(FrameBufferStream::Infrared, bytes, wire.size() * 2));
+
+        settings.assign(std::begin(vgaDepthAt60), std::end(vgaDepthAt60));
+        CHECK(!decoder.configure({ settings.data(), settings.size() }));
+        CHECK(!decoder.decode(FrameBufferStream::Depth, bytes, wire.size() * 2));
+    }
+
+} // anonymous namespace
+
+// Decompression.cpp is not part of the host build; these tests only decode uncompressed frames.
+extern "C" int uncompressDepthPS (const uint8_t*, const uint32_t, uint16_t*, uint32_t*, uint32_t*, bool) { return -1; }
+extern "C" void unpackBitStreamTo16 (const uint8_t*, size_t, int, uint16_t*, size_t* unpackedStreamSize) { *unpackedStreamSize = 0; }
+
+int main ()
+{
+    testTransitionRefusesInvalidConfig();
+    testDecoderUsesConfigMetadata();
+
+    std::printf(failures == 0 ? "PSConfigTablesTests passed\n" : "PSConfigTablesTests: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+//
+//  PipelinedFileDownloadBenchmark.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+//  Times a 200 KB flash file download from SimulatedPS1080 over a link with 2 ms latency and 2 MB/s, with a window
+//  of 1 and of 8 chunks, then with 5% of the replies lost. Host-only, no sensor needed:
+//      c++ -std=gnu++14 -O2 -I../Utils PipelinedFileDownloadBenchmark.cpp ../Utils/PipelinedFileDownload.cpp ../Utils/CRC16.cpp
+//          ../Utils/SimulatedPS1080.cpp ../Utils/PS1080ControlFraming.cpp ../Utils/OpcodePipeline.cpp
+//          ../Utils/OpcodeStats.cpp ../Utils/AHBBatch.cpp ../Utils/I2CTransactionList.cpp -lpthread
+//
+
+#include "PipelinedFileDownload.h"
+#include "PS1080ControlFraming.h"
+#include "SimulatedPS1080.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace oc;
+
+namespace {
+
+    // The host end of the control session: sends through the pipeline, feeds replies back into it.
+    class Host
+    {
+    public:
+        explicit Host (int fd)
+        : _fd(fd), _pipeline([this] (uint16_t opcode, uint8_t seq, const uint16_t* payload, size_t payloadSizeInWords) {
+              std::vector<uint8_t> bytes;
+              appendPS1080ControlFrame(bytes, PS1080HostMagic, opcode, PS1080ControlId(1, seq), payload, payloadSizeInWords);
+              return write(_fd, bytes.data(), bytes.size()) == ssize_t(bytes.size());
+          }, 32)
+        {
+            _thread = std::thread([this] { run(); });
+        }
+
+        ~Host ()
+        {
+            _stop = true;
+            _thread.join();
+        }
+
+        OpcodePipeline& pipeline () { return _pipeline; }
+
+    private:
+        void run ()
+        {
+            PS1080ControlDecoder decoder (PS1080ReplyMagic);
+            std::vector<uint8_t> buffer (64 * 1024);
+
+            while (!_stop)
+            {
+                pollfd fd = { _fd, POLLIN, 0 };
+                if (poll(&fd, 1, 5) > 0)
+                {
+                    const ssize_t bytesRead = read(_fd, buffer.data(), buffer.size());
+                    if (bytesRead <= 0)
+                        break;
+
+                    decoder.feed(buffer.data(), size_t(bytesRead));
+
+                    PS1080ControlFrame reply;
+                    while (decoder.next(reply))
+                        _pipeline.handleResponse(reply.header.opcode, reply.seq(), reply.payload.data(), reply.payload.size() * sizeof(uint16_t));
+                }
+
+                _pipeline.checkTimeouts();
+            }
+        }
+
+        int _fd;
+        OpcodePipeline _pipeline;
+        std::atomic<bool> _stop { false };
+        std::thread _thread;
+    };
+
+    // Seconds to download the whole file, or a negative value if the download failed or returned other bytes.
+    double timeDownload (Host& host, const SimulatedFlashFile& file, size_t window)
+    {
+        PipelinedFileDownload::Options options;
+        options.fileId = file.id;
+        options.fileSizeInBytes = file.data.size();
+        options.window = window;
+        options.maxReplyPayloadWords = 256;
+        options.chunkTimeoutSeconds = 0.05;
+        options.maxAttemptsPerChunk = 20;
+
+        std::promise<bool> done;
+        const auto start = std::chrono::steady_clock::now();
+
+        auto download = PipelinedFileDownload::create(options, nullptr, [&] (FileDownloadStatus status, const std::vector<uint8_t>& data, size_t) {
+            done.set_value(status == FileDownloadStatus::Completed && data == file.data);
+        });
+        download->start(host.pipeline());
+
+        const bool succeeded = done.get_future().get();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return succeeded ? seconds : -1;
+    }
+
+} // anonymous namespace
+
+int main ()
+{
+    int control[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, control) != 0)
+        return 1;
+
+    SimulatedPS1080 sensor (control[1]);
+
+    SimulatedPS1080Link link;
+    link.latencySeconds = 0.002;
+    link.bandwidthBytesPerSecond = 2e6;
+    sensor.setLink(link);
+
+    SimulatedFlashFile file;
+    file.id = 3;
+    file.data.resize(200001);
+    for (size_t i = 0; i < file.data.size(); ++i)
+        file.data[i] = uint8_t(i * 13 + (i >> 8));
+    sensor.addFile(file);
+
+    sensor.start();
+
+    bool failed = false;
+
+    {
+        Host host (control[0]);
+
+        for (size_t window : { 1, 8 })
+        {
+            const double seconds = timeDownload(host, file, window);
+            failed |= seconds < 0;
+            std::printf("window %zu: %.3f s\n", window, seconds);
+        }
+
+        link.replyLossProbability = 0.05;
+        sensor.setLink(link);
+
+        const double seconds = timeDownload(host, file, 8);
+        failed |= seconds < 0;
+        std::printf("window 8, 5%% replies lost: %.3f s\n", seconds);
+    }
+
+    sensor.stop();
+    close(control[0]);
+    close(control[1]);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+//
+//  iAP2MessageParserFeedBenchmark.c
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+//  Times iAP2MessageParserFeed over a stream of 1000 EA messages with one 60000-byte parameter each (about 60 MB):
+//  once a byte per call with payloadByteReceived, the way iAP2MessageParserPut delivers them, and once as a single
+//  buffer with payloadRunReceived. Host-only (iAP2Platform.h supports macOS), no accessory needed:
+//      cc -std=gnu99 -O2 -I../Utils iAP2MessageParserFeedBenchmark.c ../Utils/iAP2MessageParserFeed.c
+//
+
+#include "iAP2MessageParser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { MessageCount = 1000, PayloadSize = 60000 };
+
+static uint8_t* stream;
+static size_t streamSize;
+static volatile uint32_t sink; // keeps the callbacks from being optimized away
+static uint64_t payloadBytes;
+
+static void put (uint8_t byte)
+{
+    stream[streamSize++] = byte;
+}
+
+static void appendMessage (uint16_t messageID, uint16_t payloadSize)
+{
+    const uint16_t parameterLength = (uint16_t)(payloadSize + 4);
+    const uint16_t messageLength = (uint16_t)(6 + parameterLength);
+    uint16_t i;
+
+    put(0x40); put(0x40);
+    put((uint8_t)(messageLength >> 8)); put((uint8_t)messageLength);
+    put((uint8_t)(messageID >> 8)); put((uint8_t)messageID);
+    put((uint8_t)(parameterLength >> 8)); put((uint8_t)parameterLength);
+    put(0); put(0);
+    for (i = 0; i < payloadSize; ++i)
+        put((uint8_t)rand());
+}
+
+static void headerReceived (struct iAP2MessageParser* parser) { (void)parser; }
+static void parameterHeaderReceived (struct iAP2MessageParser* parser) { (void)parser; }
+static void messageEnded (struct iAP2MessageParser* parser) { (void)parser; }
+
+static void payloadByteReceived (struct iAP2MessageParser* parser, uint8_t byte)
+{
+    (void)parser;
+    sink += byte;
+    ++payloadBytes;
+}
+
+static void payloadRunReceived (struct iAP2MessageParser* parser, const uint8_t* payload, uint16_t length)
+{
+    (void)parser;
+    sink += payload[0];
+    payloadBytes += length;
+}
+
+/* What iAP2MessageParserInit does; its implementation lives outside this tree. */
+static void initParser (struct iAP2MessageParser* parser)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = iAP2MessageParserState_StartOfMessage;
+    parser->mostSignificantByte = true;
+    parser->headerReceived = headerReceived;
+    parser->parameterHeaderReceived = parameterHeaderReceived;
+    parser->payloadByteReceived = payloadByteReceived;
+    parser->messageEnded = messageEnded;
+}
+
+static double milliseconds (clock_t start, clock_t end)
+{
+    return (double)(end - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+int main (void)
+{
+    struct iAP2MessageParser parser;
+    const uint64_t expectedPayloadBytes = (uint64_t)MessageCount * PayloadSize;
+    clock_t start, end;
+    size_t i;
+    int failed = 0;
+
+    stream = malloc((size_t)MessageCount * (PayloadSize + 10));
+    if (!stream)
+        return 1;
+
+    srand(1);
+    for (i = 0; i < MessageCount; ++i)
+        appendMessage(0xda00, PayloadSize);
+
+    /* Without a run callback Feed delivers payload bytes one by one. */
+    initParser(&parser);
+    payloadBytes = 0;
+    start = clock();
+    for (i = 0; i < streamSize; ++i)
+        iAP2MessageParserFeed(&parser, stream + i, 1, NULL);
+    end = clock();
+    failed |= payloadBytes != expectedPayloadBytes;
+    printf("byte at a time: %.1f ms\n", milliseconds(start, end));
+
+    initParser(&parser);
+    payloadBytes = 0;
+    start = clock();
+    iAP2MessageParserFeed(&parser, stream, streamSize, payloadRunReceived);
+    end = clock();
+    failed |= payloadBytes != expectedPayloadBytes;
+    printf("whole buffer with payload runs: %.2f ms (%zu bytes)\n", milliseconds(start, end), streamSize);
+
+    free(stream);
+    return failed;
+}
@@ -0,0 +1,254 @@
+//
+//  AHBBatch.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "AHBBatch.h"
+#include "PS1080Opcodes.h"
+
+#include <memory>
+
+namespace oc {
+
+namespace {
+
+    size_t operationSizeInWords (const AHBOperation& operation)
+    {
+        return operation.type == AHBOperationType::Write ? 7 : 3;
+    }
+
+    void appendUInt32 (std::vector<uint16_t>& payload, uint32_t value)
+    {
+        payload.push_back(uint16_t(value & 0xffff));
+        payload.push_back(uint16_t(value >> 16));
+    }
+
+    uint32_t readUInt32 (const uint16_t* words)
+    {
+        return uint32_t(words[0]) | (uint32_t(words[1]) << 16);
+    }
+
+    AHBBatchRequest singleOperationRequest (const AHBOperation& operation, size_t index)
+    {
+        AHBBatchRequest request;
+        request.firstOperation = index;
+        request.operationCount = 1;
+        appendUInt32(request.payload, operation.address);
+
+        if (operation.type == AHBOperationType::Write)
+        {
+            request.opcode = PS1080Opcode_WriteAHB;
+            appendUInt32(request.payload, operation.value);
+            appendUInt32(request.payload, operation.mask);
+        }
+        else
+        {
+            request.opcode = PS1080Opcode_ReadAHB;
+        }
+
+        return request;
+    }
+
+} // anonymous namespace
+
+std::vector<AHBBatchRequest> planAHBBatch (const std::vector<AHBOperation>& operations, size_t maxPayloadWords, bool firmwareSupportsBatch)
+{
+    std::vector<AHBBatchRequest> requests;
+
+    // A batch needs room for its count word and at least one write.
+    if (!PS1080_EXTENSION_OPCODES_ENABLED || !firmwareSupportsBatch || maxPayloadWords < 8)
+    {
+        for (size_t i = 0; i < operations.size(); ++i)
+            requests.push_back(singleOperationRequest(operations[i], i));
+        return requests;
+    }
+
+    size_t i = 0;
+    while (i < operations.size())
+    {
+        AHBBatchRequest request;
+        request.opcode = PS1080Opcode_AHBBatch;
+        request.firstOperation = i;
+        request.operationCount = 0;
+        request.payload.reserve(maxPayloadWords);
+        request.payload.push_back(0);
+
+        // Replies carry two words per read, after the reply code and completed count.
+        size_t replyWords = 2;
+
+        while (i < operations.size() && request.operationCount < 0xffff)
+        {
+            const AHBOperation& operation = operations[i];
+            const size_t operationReplyWords = operation.type == AHBOperationType::Read ? 2 : 0;
+
+            if (request.payload.size() + operationSizeInWords(operation) > maxPayloadWords
+                || replyWords + operationReplyWords > maxPayloadWords)
+                break;
+
+            request.payload.push_back(uint16_t(operation.type));
+            appendUInt32(request.payload, operation.address);
+            if (operation.type == AHBOperationType::Write)
+            {
+                appendUInt32(request.payload, operation.value);
+                appendUInt32(request.payload, operation.mask);
+            }
+
+            replyWords += operationReplyWords;
+            ++request.operationCount;
+            ++i;
+        }
+
+        request.payload[0] = uint16_t(request.operationCount);
+        requests.push_back(std::move(request));
+    }
+
+    return requests;
+}
+
+bool parseAHBBatchReply (const AHBBatchRequest& request, const std::vector<AHBOperation>& operations,
+                         const uint16_t* payload, size_t payloadSize, std::vector<AHBResult>& results)
+{
+    const size_t payloadWords = payload != nullptr ? payloadSize / sizeof(uint16_t) : 0;
+
+    if (results.size() < request.firstOperation + request.operationCount)
+        results.resize(request.firstOperation + request.operationCount);
+
+    for (size_t i = 0; i < request.operationCount; ++i)
+    {
+        AHBResult& result = results[request.firstOperation + i];
+        result = AHBResult();
+        result.address = operations[request.firstOperation + i].address;
+    }
+
+    if (payloadWords < 1)
+        return false;
+
+    const bool acked = payload[0] == PS1080_REPLY_CODE_ACK;
+
+    if (request.opcode != PS1080Opcode_AHBBatch)
+    {
+        AHBResult& result = results[request.firstOperation];
+
+        if (!acked)
+            return false;
+
+        if (request.opcode == PS1080Opcode_ReadAHB)
+        {
+            if (payloadWords < 3)
+                return false;
+            result.value = readUInt32(payload + 1);
+        }
+
+        result.succeeded = true;
+        return true;
+    }
+
+    // The firmware stops at the first failing operation and reports how far it got, even in a NACK.
+    if (payloadWords < 2)
+        return false;
+
+    const size_t completed = payload[1];
+    if (completed > request.operationCount)
+        return false;
+
+    size_t cursor = 2;
+    for (size_t i = 0; i < completed; ++i)
+    {
+        AHBResult& result = results[request.firstOperation + i];
+
+        if (operations[request.firstOperation + i].type == AHBOperationType::Read)
+        {
+            if (cursor + 2 > payloadWords)
+                return false;
+            result.value = readUInt32(payload + cursor);
+            cursor += 2;
+        }
+
+        result.succeeded = true;
+    }
+
+    return acked && completed == request.operationCount;
+}
+
+void probeAHBBatchSupport (OpcodePipeline& pipeline, double timeoutSeconds, std::function<void (bool supported)> completion)
+{
+    if (!PS1080_EXTENSION_OPCODES_ENABLED)
+    {
+        if (completion)
+            completion(false);
+        return;
+    }
+
+    const uint16_t emptyBatch[] = { 0 };
+    probeOpcodeSupport(pipeline, PS1080Opcode_AHBBatch, emptyBatch, 1, timeoutSeconds, std::move(completion));
+}
+
+void executeAHBBatch (OpcodePipeline& pipeline, const std::vector<AHBOperation>& operations,
+                      size_t maxPayloadWords, bool firmwareSupportsBatch, double timeoutSeconds,
+                      AHBBatchCompletion completion)
+{
+    struct State
+    {
+        std::mutex mutex;
+        std::vector<AHBOperation> operations;
+        std::vector<AHBResult> results;
+        size_t remaining = 0;
+        OpcodeRequestStatus status = OpcodeRequestStatus::Completed;
+        bool failed = false;
+        AHBBatchCompletion completion;
+    };
+
+    std::vector<AHBBatchRequest> requests = planAHBBatch(operations, maxPayloadWords, firmwareSupportsBatch);
+
+    if (requests.empty())
+    {
+        if (completion)
+            completion(OpcodeRequestStatus::Completed, std::vector<AHBResult>());
+        return;
+    }
+
+    auto state = std::make_shared<State>();
+    state->operations = operations;
+    state->results.resize(operations.size());
+    state->remaining = requests.size();
+    state->completion = std::move(completion);
+
+    for (size_t i = 0; i < operations.size(); ++i)
+        state->results[i].address = operations[i].address;
+
+    // Each callback owns its request so the reply can be parsed against it.
+    for (AHBBatchRequest& request : requests)
+    {
+        auto owned = std::make_shared<AHBBatchRequest>(std::move(request));
+
+        pipeline.submit(owned->opcode, owned->payload.data(), owned->payload.size(), timeoutSeconds,
+            [state, owned] (OpcodeRequestStatus status, uint16_t, const uint16_t* payload, size_t payloadSize)
+        {
+            bool done;
+
+            {
+                std::lock_guard<std::mutex> lock (state->mutex);
+
+                bool succeeded = false;
+                if (status == OpcodeRequestStatus::Completed)
+                    succeeded = parseAHBBatchReply(*owned, state->operations, payload, payloadSize, state->results);
+
+                if (!succeeded && !state->failed)
+                {
+                    // A reply that came back but did not check out is reported as a completed opcode with failed results.
+                    state->failed = true;
+                    state->status = status;
+                }
+
+                done = --state->remaining == 0;
+            }
+
+            if (done && state->completion)
+                state->completion(state->status, state->results);
+        });
+    }
+}
+
+} // oc namespace
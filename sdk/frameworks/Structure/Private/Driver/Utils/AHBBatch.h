@@ -0,0 +1,84 @@
+//
+//  AHBBatch.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "OpcodePipeline.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace oc {
+
+enum class AHBOperationType : uint16_t
+{
+    Read  = 0,
+    Write = 1, // masked write, same semantics as AHB_Write32Bits (see AHBWrite:value:mask:completionBlock:)
+};
+
+struct AHBOperation
+{
+    AHBOperationType type;
+    uint32_t address;
+    uint32_t value;
+    uint32_t mask;
+
+    static AHBOperation read (uint32_t address) { return { AHBOperationType::Read, address, 0, 0 }; }
+    static AHBOperation write (uint32_t address, uint32_t value, uint32_t mask = 0xffffffff) { return { AHBOperationType::Write, address, value, mask }; }
+};
+
+struct AHBResult
+{
+    uint32_t address = 0;
+    uint32_t value = 0;      // the value read, 0 for writes
+    bool succeeded = false;
+};
+
+/* One opcode of a batch, covering operations [firstOperation, firstOperation + operationCount). */
+struct AHBBatchRequest
+{
+    uint16_t opcode;
+    std::vector<uint16_t> payload;
+    size_t firstOperation;
+    size_t operationCount;
+};
+
+/**
+ * Splits operations into as few opcodes as maxPayloadWords allows, keeping their order.
+ *
+ * With firmware batch support every opcode is a PS1080Opcode_AHBBatch carrying
+ *     [count] then per operation [type][addressLo][addressHi] and, for writes, [valueLo][valueHi][maskLo][maskHi]
+ * and answered by
+ *     [replyCode][completedCount] then [valueLo][valueHi] for each completed read.
+ * Without it, each operation becomes its own ReadAHB/WriteAHB opcode. Those still go out back to back through
+ * the OpcodePipeline, which is where most of the win is on older firmware.
+ *
+ * PS1080Opcode_AHBBatch is not in any released firmware (see PS1080Opcodes.h): firmwareSupportsBatch is ignored
+ * unless PS1080_EXTENSION_OPCODES_ENABLED, and should be the result of probeAHBBatchSupport() otherwise.
+ */
+std::vector<AHBBatchRequest> planAHBBatch (const std::vector<AHBOperation>& operations, size_t maxPayloadWords, bool firmwareSupportsBatch);
+
+/* Fills results[request.firstOperation ...] from a reply. Returns false if the reply is malformed or not an ACK;
+   operations completed before a firmware failure are still reported as succeeded. */
+bool parseAHBBatchReply (const AHBBatchRequest& request, const std::vector<AHBOperation>& operations,
+                         const uint16_t* payload, size_t payloadSize, std::vector<AHBResult>& results);
+
+/* status is the first transport failure (timeout, cancel, disconnect), or Completed if every opcode got a reply.
+   A NACK still completes: check AHBResult::succeeded for the outcome of each operation. */
+typedef std::function<void (OpcodeRequestStatus status, const std::vector<AHBResult>& results)> AHBBatchCompletion;
+
+/* Sends an empty batch, which batch-capable firmware ACKs without touching the bus. */
+void probeAHBBatchSupport (OpcodePipeline& pipeline, double timeoutSeconds, std::function<void (bool supported)> completion);
+
+/* Sends the whole plan through the pipeline and calls completion once, after the last reply. */
+void executeAHBBatch (OpcodePipeline& pipeline, const std::vector<AHBOperation>& operations,
+                      size_t maxPayloadWords, bool firmwareSupportsBatch, double timeoutSeconds,
+                      AHBBatchCompletion completion);
+
+} // oc namespace
@@ -0,0 +1,323 @@
+//
+//  CRC16.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "CRC16.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   define OC_CRC16_X86_CLMUL 1
+#   include <immintrin.h>
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#   define OC_CRC16_ARM_PMULL 1
+#   include <arm_neon.h>
+#endif
+
+namespace oc {
+
+namespace {
+
+    const uint16_t Polynomial = 0x1021;
+    const uint16_t ReflectedPolynomial = 0x8408;
+
+    // t[k][b] is the CRC of byte b followed by k zero bytes, so eight bytes can be folded in with eight lookups.
+    struct SliceTables
+    {
+        uint16_t msbFirst[8][256];
+        uint16_t lsbFirst[8][256];
+
+        SliceTables ()
+        {
+            for (unsigned b = 0; b < 256; ++b)
+            {
+                uint16_t msb = uint16_t(b << 8);
+                uint16_t lsb = uint16_t(b);
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    msb = uint16_t((msb & 0x8000) ? (msb << 1) ^ Polynomial : (msb << 1));
+                    lsb = uint16_t((lsb & 1) ? (lsb >> 1) ^ ReflectedPolynomial : (lsb >> 1));
+                }
+                msbFirst[0][b] = msb;
+                lsbFirst[0][b] = lsb;
+            }
+
+            for (int k = 1; k < 8; ++k)
+            {
+                for (unsigned b = 0; b < 256; ++b)
+                {
+                    const uint16_t msb = msbFirst[k - 1][b];
+                    const uint16_t lsb = lsbFirst[k - 1][b];
+                    msbFirst[k][b] = uint16_t((msb << 8) ^ msbFirst[0][msb >> 8]);
+                    lsbFirst[k][b] = uint16_t((lsb >> 8) ^ lsbFirst[0][lsb & 0xff]);
+                }
+            }
+        }
+    };
+
+    const SliceTables& tables ()
+    {
+        static const SliceTables instance;
+        return instance;
+    }
+
+    uint16_t sliceMsbFirst (uint16_t crc, const uint8_t* p, size_t size)
+    {
+        const auto& t = tables().msbFirst;
+
+        while (size >= 8)
+        {
+            crc = uint16_t(t[7][p[0] ^ (crc >> 8)] ^ t[6][p[1] ^ (crc & 0xff)] ^ t[5][p[2]] ^ t[4][p[3]]
+                         ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]]);
+            p += 8;
+            size -= 8;
+        }
+
+        while (size--)
+            crc = uint16_t((crc << 8) ^ t[0][(crc >> 8) ^ *p++]);
+
+        return crc;
+    }
+
+    uint16_t sliceLsbFirst (uint16_t crc, const uint8_t* p, size_t size)
+    {
+        const auto& t = tables().lsbFirst;
+
+        while (size >= 8)
+        {
+            crc = uint16_t(t[7][p[0] ^ (crc & 0xff)] ^ t[6][p[1] ^ (crc >> 8)] ^ t[5][p[2]] ^ t[4][p[3]]
+                         ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]]);
+            p += 8;
+            size -= 8;
+        }
+
+        while (size--)
+            crc = uint16_t((crc >> 8) ^ t[0][(crc ^ *p++) & 0xff]);
+
+        return crc;
+    }
+
+#if OC_CRC16_X86_CLMUL || OC_CRC16_ARM_PMULL
+
+    /* Folding: the data is read as one big MSB-first polynomial in 128-bit blocks. An accumulator X = H*x^64 + L that
+       has to move d bits further along is replaced by H*(x^(d+64) mod P) + L*(x^d mod P), which is congruent mod P and
+       fits in 80 bits. At the end the accumulator is turned back into 16 bytes whose CRC equals that of everything
+       folded so far, and the table code finishes the job. */
+
+    const size_t FoldMinimumSize = 64;
+
+    uint64_t xPowerModP (unsigned n)
+    {
+        uint32_t r = 1;
+        while (n--)
+        {
+            r <<= 1;
+            if (r & 0x10000)
+                r ^= 0x10000u | Polynomial;
+        }
+        return r;
+    }
+
+    struct FoldConstants
+    {
+        // {x^d mod P, x^(d+64) mod P} for d = 128, 256, 384 and 512 bits.
+        uint64_t by128[2], by256[2], by384[2], by512[2];
+
+        FoldConstants ()
+        {
+            by128[0] = xPowerModP(128); by128[1] = xPowerModP(192);
+            by256[0] = xPowerModP(256); by256[1] = xPowerModP(320);
+            by384[0] = xPowerModP(384); by384[1] = xPowerModP(448);
+            by512[0] = xPowerModP(512); by512[1] = xPowerModP(576);
+        }
+    };
+
+    const FoldConstants& foldConstants ()
+    {
+        static const FoldConstants instance;
+        return instance;
+    }
+
+#endif
+
+#if OC_CRC16_X86_CLMUL
+
+    __attribute__((target("pclmul,ssse3")))
+    inline __m128i loadReversed (const uint8_t* p)
+    {
+        const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), reverse);
+    }
+
+    __attribute__((target("pclmul,ssse3")))
+    inline __m128i fold (__m128i x, __m128i k)
+    {
+        // Low half of k is x^d mod P, high half x^(d+64) mod P.
+        return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+    }
+
+    __attribute__((target("pclmul,ssse3")))
+    uint16_t foldMsbFirst (uint16_t crc, const uint8_t* p, size_t size)
+    {
+        const FoldConstants& c = foldConstants();
+        const __m128i k128 = _mm_set_epi64x(int64_t(c.by128[1]), int64_t(c.by128[0]));
+        const __m128i k256 = _mm_set_epi64x(int64_t(c.by256[1]), int64_t(c.by256[0]));
+        const __m128i k384 = _mm_set_epi64x(int64_t(c.by384[1]), int64_t(c.by384[0]));
+        const __m128i k512 = _mm_set_epi64x(int64_t(c.by512[1]), int64_t(c.by512[0]));
+
+        // The running CRC goes into the first two message bytes, i.e. the top 16 bits of the first block.
+        __m128i x0 = _mm_xor_si128(loadReversed(p), _mm_slli_si128(_mm_cvtsi32_si128(crc), 14));
+        __m128i x1 = loadReversed(p + 16);
+        __m128i x2 = loadReversed(p + 32);
+        __m128i x3 = loadReversed(p + 48);
+        p += 64;
+        size -= 64;
+
+        while (size >= 64)
+        {
+            x0 = _mm_xor_si128(fold(x0, k512), loadReversed(p));
+            x1 = _mm_xor_si128(fold(x1, k512), loadReversed(p + 16));
+            x2 = _mm_xor_si128(fold(x2, k512), loadReversed(p + 32));
+            x3 = _mm_xor_si128(fold(x3, k512), loadReversed(p + 48));
+            p += 64;
+            size -= 64;
+        }
+
+        __m128i x = _mm_xor_si128(_mm_xor_si128(fold(x0, k384), fold(x1, k256)), _mm_xor_si128(fold(x2, k128), x3));
+
+        while (size >= 16)
+        {
+            x = _mm_xor_si128(fold(x, k128), loadReversed(p));
+            p += 16;
+            size -= 16;
+        }
+
+        const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        uint8_t bytes[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), _mm_shuffle_epi8(x, reverse));
+
+        return sliceMsbFirst(sliceMsbFirst(0, bytes, sizeof(bytes)), p, size);
+    }
+
+    bool cpuHasCarrylessMultiply ()
+    {
+        static const bool supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+        return supported;
+    }
+
+#elif OC_CRC16_ARM_PMULL
+
+    inline uint64x2_t loadReversed (const uint8_t* p)
+    {
+        const uint8x16_t v = vrev64q_u8(vld1q_u8(p));
+        return vreinterpretq_u64_u8(vextq_u8(v, v, 8));
+    }
+
+    inline uint64x2_t fold (uint64x2_t x, const uint64_t k[2])
+    {
+        const poly128_t low = vmull_p64(poly64_t(vgetq_lane_u64(x, 0)), poly64_t(k[0]));
+        const poly128_t high = vmull_p64(poly64_t(vgetq_lane_u64(x, 1)), poly64_t(k[1]));
+        return veorq_u64(vreinterpretq_u64_p128(low), vreinterpretq_u64_p128(high));
+    }
+
+    uint16_t foldMsbFirst (uint16_t crc, const uint8_t* p, size_t size)
+    {
+        const FoldConstants& c = foldConstants();
+
+        uint64x2_t x0 = veorq_u64(loadReversed(p), vsetq_lane_u64(uint64_t(crc) << 48, vdupq_n_u64(0), 1));
+        uint64x2_t x1 = loadReversed(p + 16);
+        uint64x2_t x2 = loadReversed(p + 32);
+        uint64x2_t x3 = loadReversed(p + 48);
+        p += 64;
+        size -= 64;
+
+        while (size >= 64)
+        {
+            x0 = veorq_u64(fold(x0, c.by512), loadReversed(p));
+            x1 = veorq_u64(fold(x1, c.by512), loadReversed(p + 16));
+            x2 = veorq_u64(fold(x2, c.by512), loadReversed(p + 32));
+            x3 = veorq_u64(fold(x3, c.by512), loadReversed(p + 48));
+            p += 64;
+            size -= 64;
+        }
+
+        uint64x2_t x = veorq_u64(veorq_u64(fold(x0, c.by384), fold(x1, c.by256)), veorq_u64(fold(x2, c.by128), x3));
+
+        while (size >= 16)
+        {
+            x = veorq_u64(fold(x, c.by128), loadReversed(p));
+            p += 16;
+            size -= 16;
+        }
+
+        const uint8x16_t v = vrev64q_u8(vreinterpretq_u8_u64(x));
+        uint8_t bytes[16];
+        vst1q_u8(bytes, vextq_u8(v, v, 8));
+
+        return sliceMsbFirst(sliceMsbFirst(0, bytes, sizeof(bytes)), p, size);
+    }
+
+    bool cpuHasCarrylessMultiply () { return true; }
+
+#endif
+
+} // anonymous namespace
+
+uint16_t crc16CCITTUpdate (uint16_t crc, const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+
+#if OC_CRC16_X86_CLMUL || OC_CRC16_ARM_PMULL
+    if (size >= FoldMinimumSize && cpuHasCarrylessMultiply())
+        return foldMsbFirst(crc, p, size);
+#endif
+
+    return sliceMsbFirst(crc, p, size);
+}
+
+uint16_t crc16CCITTReflectedUpdate (uint16_t crc, const void* data, size_t size)
+{
+    return sliceLsbFirst(crc, static_cast<const uint8_t*>(data), size);
+}
+
+uint16_t crc16CCITTUpdateBitwise (uint16_t crc, const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+
+    while (size--)
+    {
+        crc ^= uint16_t(*p++ << 8);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = uint16_t((crc & 0x8000) ? (crc << 1) ^ Polynomial : (crc << 1));
+    }
+
+    return crc;
+}
+
+uint16_t crc16CCITTReflectedUpdateBitwise (uint16_t crc, const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+
+    while (size--)
+    {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = uint16_t((crc & 1) ? (crc >> 1) ^ ReflectedPolynomial : (crc >> 1));
+    }
+
+    return crc;
+}
+
+bool crc16HardwareAccelerated ()
+{
+#if OC_CRC16_X86_CLMUL || OC_CRC16_ARM_PMULL
+    return cpuHasCarrylessMultiply();
+#else
+    return false;
+#endif
+}
+
+} // oc namespace
@@ -0,0 +1,72 @@
+//
+//  CRC16.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace oc {
+
+/**
+ * CRC-16 with the CCITT polynomial (x^16 + x^12 + x^5 + 1), shared by file upload/download and firmware verification.
+ *
+ * Two bit orders are in use:
+ *  - CCITT:          MSB first, polynomial 0x1021 (CRC-16/CCITT-FALSE with init 0xffff, XMODEM with init 0).
+ *  - CCITTReflected: LSB first, polynomial 0x8408 (KERMIT / avr-libc _crc_ccitt_update).
+ *
+ * Both run slice-by-8 tables. MSB-first buffers of 64 bytes and more go through a carry-less multiply folding loop
+ * when the CPU has one (PCLMULQDQ on x86, PMULL on ARMv8 with the crypto extension).
+ *
+ * The update functions take and return the running state, so a CRC can be computed while chunks stream in:
+ *     uint16_t crc = 0xffff;
+ *     for (chunk : chunks) crc = crc16CCITTUpdate(crc, chunk.data, chunk.size);
+ */
+enum class CRC16Variant : uint8_t
+{
+    CCITT,
+    CCITTReflected,
+};
+
+uint16_t crc16CCITTUpdate (uint16_t crc, const void* data, size_t size);
+uint16_t crc16CCITTReflectedUpdate (uint16_t crc, const void* data, size_t size);
+
+// One bit at a time. Only meant as a reference for tests.
+uint16_t crc16CCITTUpdateBitwise (uint16_t crc, const void* data, size_t size);
+uint16_t crc16CCITTReflectedUpdateBitwise (uint16_t crc, const void* data, size_t size);
+
+// Whether crc16CCITTUpdate uses carry-less multiply on this CPU.
+bool crc16HardwareAccelerated ();
+
+/* Incremental CRC over a stream of chunks. */
+class CRC16
+{
+public:
+    explicit CRC16 (CRC16Variant variant = CRC16Variant::CCITT, uint16_t initialValue = 0xffff)
+    : _variant(variant), _initialValue(initialValue), _value(initialValue)
+    {}
+
+    void update (const void* data, size_t size)
+    {
+        _value = (_variant == CRC16Variant::CCITT) ? crc16CCITTUpdate(_value, data, size)
+                                                   : crc16CCITTReflectedUpdate(_value, data, size);
+        _processedBytes += size;
+    }
+
+    void reset () { _value = _initialValue; _processedBytes = 0; }
+
+    uint16_t value () const { return _value; }
+    uint64_t processedBytes () const { return _processedBytes; }
+
+private:
+    CRC16Variant _variant;
+    uint16_t _initialValue;
+    uint16_t _value;
+    uint64_t _processedBytes = 0;
+};
+
+} // oc namespace
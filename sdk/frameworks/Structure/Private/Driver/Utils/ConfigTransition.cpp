@@ -0,0 +1,389 @@
+//
+//  ConfigTransition.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "ConfigTransition.h"
+#include "PS1080Opcodes.h"
+#include "PSConfigTables.h"
+
+#include <memory>
+
+namespace oc {
+
+namespace {
+
+    const int StreamCount = 3;
+
+    const uint16_t streamModeParams[StreamCount] = {
+        PARAM_GENERAL_STREAM0_MODE, // image or IR
+        PARAM_GENERAL_STREAM1_MODE, // depth
+        PARAM_GENERAL_STREAM2_MODE, // audio
+    };
+
+    // Stream whose mode must be 0 while this parameter changes, or -1.
+    int boundStream (uint16_t param)
+    {
+        switch (param)
+        {
+            case PARAM_IMAGE_FORMAT:
+            case PARAM_IMAGE_RESOLUTION:
+            case PARAM_IMAGE_FPS:
+            case PARAM_IMAGE_CROP_SIZE_X:
+            case PARAM_IMAGE_CROP_SIZE_Y:
+            case PARAM_IMAGE_CROP_OFFSET_X:
+            case PARAM_IMAGE_CROP_OFFSET_Y:
+            case PARAM_IMAGE_CROP_ENABLE:
+            case PARAM_IR_FORMAT:
+            case PARAM_IR_RESOLUTION:
+            case PARAM_IR_FPS:
+            case PARAM_IR_CROP_SIZE_X:
+            case PARAM_IR_CROP_SIZE_Y:
+            case PARAM_IR_CROP_OFFSET_X:
+            case PARAM_IR_CROP_OFFSET_Y:
+            case PARAM_IR_CROP_ENABLE:
+                return 0;
+
+            case PARAM_GENERAL_REGISTRATION_ENABLE:
+            case PARAM_DEPTH_FORMAT:
+            case PARAM_DEPTH_RESOLUTION:
+            case PARAM_DEPTH_FPS:
+            case PARAM_DEPTH_DECIMATION:
+            case PARAM_DEPTH_CROP_SIZE_X:
+            case PARAM_DEPTH_CROP_SIZE_Y:
+            case PARAM_DEPTH_CROP_OFFSET_X:
+            case PARAM_DEPTH_CROP_OFFSET_Y:
+            case PARAM_DEPTH_CROP_ENABLE:
+                return 1;
+
+            case PARAM_AUDIO_STEREO_MODE:
+            case PARAM_AUDIO_SAMPLE_RATE:
+                return 2;
+
+            default:
+                return -1;
+        }
+    }
+
+    bool isStreamModeParam (uint16_t param)
+    {
+        return param == PARAM_GENERAL_STREAM0_MODE || param == PARAM_GENERAL_STREAM1_MODE || param == PARAM_GENERAL_STREAM2_MODE;
+    }
+
+} // anonymous namespace
+
+ConfigTransitionPlan SensorConfigShadow::plan (const SensorConfigSequence& target) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    ConfigTransitionPlan plan;
+    const size_t count = target.settings != nullptr ? target.settingsCount : 0;
+
+    // A parameter listed twice ends up with its last value, so only that occurrence counts.
+    size_t lastIndex[PARAM_NUM_OF_PARAMS];
+    std::bitset<PARAM_NUM_OF_PARAMS> inTarget;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint16_t param = target.settings[i].param;
+        if (param < PARAM_NUM_OF_PARAMS)
+        {
+            lastIndex[param] = i;
+            inTarget.set(param);
+        }
+    }
+
+    auto targetValue = [&] (uint16_t param) { return target.settings[lastIndex[param]].value; };
+    auto changes = [&] (uint16_t param) { return !_known[param] || _values[param] != targetValue(param); };
+
+    bool boundChanging[StreamCount] = {};
+    for (size_t param = 0; param < PARAM_NUM_OF_PARAMS; ++param)
+    {
+        const int stream = boundStream(uint16_t(param));
+        if (stream >= 0 && inTarget[param] && changes(uint16_t(param)))
+            boundChanging[stream] = true;
+    }
+
+    // Stream stops, and the modes to restart with that the sequence does not set itself.
+    std::vector<SensorSetting> restarts;
+    bool modeWritten[StreamCount] = {};
+
+    for (int stream = 0; stream < StreamCount; ++stream)
+    {
+        const uint16_t modeParam = streamModeParams[stream];
+        const bool currentKnown = _known[modeParam];
+        const uint16_t current = _values[modeParam];
+
+        if (!inTarget[modeParam] && !currentKnown)
+            continue; // nothing to restart it with
+
+        const uint16_t targetMode = inTarget[modeParam] ? targetValue(modeParam) : current;
+        const bool running = !currentKnown || current != 0;
+
+        if (targetMode == 0)
+        {
+            if (running)
+                plan.settings.push_back({ modeParam, 0 });
+            modeWritten[stream] = true;
+            continue;
+        }
+
+        const bool stop = (boundChanging[stream] && running) || (currentKnown && current != 0 && current != targetMode);
+        if (stop)
+        {
+            plan.settings.push_back({ modeParam, 0 });
+            if (!inTarget[modeParam])
+                restarts.push_back({ modeParam, targetMode });
+        }
+        else if (!inTarget[modeParam] || !changes(modeParam))
+        {
+            modeWritten[stream] = true; // stays as it is
+        }
+    }
+
+    plan.stopCount = plan.settings.size();
+
+    // Everything else, in sequence order.
+    for (size_t i = 0; i < count; ++i)
+    {
+        const SensorSetting& setting = target.settings[i];
+
+        if (setting.param >= PARAM_NUM_OF_PARAMS)
+        {
+            plan.settings.push_back(setting);
+            continue;
+        }
+
+        if (lastIndex[setting.param] != i || isStreamModeParam(setting.param))
+            continue;
+
+        if (changes(setting.param))
+            plan.settings.push_back(setting);
+        else
+            ++plan.unchangedCount;
+    }
+
+    // Stream starts last, once their settings are in.
+    for (size_t i = 0; i < count; ++i)
+    {
+        const SensorSetting& setting = target.settings[i];
+        if (!isStreamModeParam(setting.param) || lastIndex[setting.param] != i)
+            continue;
+
+        const int stream = int(setting.param - PARAM_GENERAL_STREAM0_MODE);
+        if (modeWritten[stream])
+        {
+            if (setting.value != 0 || !changes(setting.param))
+                ++plan.unchangedCount;
+            continue;
+        }
+
+        plan.settings.push_back(setting);
+    }
+
+    plan.settings.insert(plan.settings.end(), restarts.begin(), restarts.end());
+    return plan;
+}
+
+void SensorConfigShadow::record (const SensorSetting* settings, size_t count)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (settings[i].param < PARAM_NUM_OF_PARAMS)
+        {
+            _values[settings[i].param] = settings[i].value;
+            _known.set(settings[i].param);
+        }
+    }
+}
+
+void SensorConfigShadow::invalidate ()
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _known.reset();
+}
+
+void SensorConfigShadow::invalidate (const SensorSetting* settings, size_t count)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    for (size_t i = 0; i < count; ++i)
+        if (settings[i].param < PARAM_NUM_OF_PARAMS)
+            _known.reset(settings[i].param);
+}
+
+bool SensorConfigShadow::known (uint16_t param) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return param < PARAM_NUM_OF_PARAMS && _known[param];
+}
+
+uint16_t SensorConfigShadow::value (uint16_t param) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return param < PARAM_NUM_OF_PARAMS && _known[param] ? _values[param] : 0;
+}
+
+std::vector<ConfigWriteRequest> planConfigWrites (const ConfigTransitionPlan& plan, size_t maxPayloadWords, bool firmwareSupportsBatch)
+{
+    std::vector<ConfigWriteRequest> requests;
+
+    const size_t maxPairs = firmwareSupportsBatch && maxPayloadWords >= 4 ? maxPayloadWords / 2 : 1;
+
+    size_t i = 0;
+    while (i < plan.settings.size())
+    {
+        // The stops go out on their own so they are acknowledged before the settings that need them.
+        const size_t stageEnd = i < plan.stopCount ? plan.stopCount : plan.settings.size();
+
+        ConfigWriteRequest request;
+        request.firstSetting = i;
+        request.settingCount = 0;
+
+        while (i < stageEnd && request.settingCount < maxPairs)
+        {
+            request.payload.push_back(plan.settings[i].param);
+            request.payload.push_back(plan.settings[i].value);
+            ++request.settingCount;
+            ++i;
+        }
+
+        requests.push_back(std::move(request));
+    }
+
+    return requests;
+}
+
+namespace {
+
+    struct ConfigTransitionState
+    {
+        std::mutex mutex;
+        OpcodePipeline* pipeline;
+        SensorConfigShadow* shadow;
+        double timeoutSeconds;
+        std::vector<SensorSetting> settings;
+        std::vector<ConfigWriteRequest> requests;
+        size_t stopRequests = 0;     // requests [0, stopRequests) carry the stream stops
+        size_t submitted = 0;        // requests [0, submitted) went to the pipeline
+        size_t remaining = 0;        // replies outstanding for the submitted requests
+        size_t settingsWritten = 0;
+        OpcodeRequestStatus status = OpcodeRequestStatus::Completed;
+        bool acked = true;
+        ConfigTransitionCompletion completion;
+    };
+
+    void submitConfigRequests (const std::shared_ptr<ConfigTransitionState>& state, size_t begin, size_t end);
+
+    void configRequestFinished (const std::shared_ptr<ConfigTransitionState>& state, const ConfigWriteRequest& request,
+                                OpcodeRequestStatus status, const uint16_t* payload, size_t payloadSize)
+    {
+        const bool acked = status == OpcodeRequestStatus::Completed && payload != nullptr
+                           && payloadSize >= sizeof(uint16_t) && payload[0] == PS1080_REPLY_CODE_ACK;
+        bool submitRest = false;
+        bool done = false;
+
+        {
+            std::lock_guard<std::mutex> lock (state->mutex);
+
+            if (acked)
+            {
+                state->settingsWritten += request.settingCount;
+            }
+            else
+            {
+                // The firmware may have applied part of a batch before failing, so none of it is known any more.
+                state->shadow->invalidate(state->settings.data() + request.firstSetting, request.settingCount);
+
+                if (status != OpcodeRequestStatus::Completed && state->status == OpcodeRequestStatus::Completed)
+                    state->status = status;
+                if (status == OpcodeRequestStatus::Completed)
+                    state->acked = false;
+            }
+
+            if (--state->remaining == 0)
+            {
+                // The stops are all answered: the rest only goes out if every one of them took effect.
+                const bool stopsFailed = state->status != OpcodeRequestStatus::Completed || !state->acked;
+                if (state->submitted < state->requests.size() && !stopsFailed)
+                    submitRest = true;
+                else
+                    done = true;
+            }
+        }
+
+        if (submitRest)
+            submitConfigRequests(state, state->stopRequests, state->requests.size());
+        else if (done && state->completion)
+            state->completion(state->status, state->acked, state->settingsWritten);
+    }
+
+    void submitConfigRequests (const std::shared_ptr<ConfigTransitionState>& state, size_t begin, size_t end)
+    {
+        {
+            std::lock_guard<std::mutex> lock (state->mutex);
+
+            state->submitted = end;
+            state->remaining = end - begin;
+
+            const size_t firstSetting = state->requests[begin].firstSetting;
+            const size_t endSetting = state->requests[end - 1].firstSetting + state->requests[end - 1].settingCount;
+            state->shadow->record(state->settings.data() + firstSetting, endSetting - firstSetting);
+        }
+
+        // Replies may come back before the loop ends; the requests themselves never change.
+        for (size_t i = begin; i < end; ++i)
+        {
+            const ConfigWriteRequest& request = state->requests[i];
+
+            state->pipeline->submit(PS1080Opcode_SetParam, request.payload.data(), request.payload.size(), state->timeoutSeconds,
+                [state, &request] (OpcodeRequestStatus status, uint16_t, const uint16_t* payload, size_t payloadSize)
+            {
+                configRequestFinished(state, request, status, payload, payloadSize);
+            });
+        }
+    }
+
+} // anonymous namespace
+
+void executeConfigTransition (OpcodePipeline& pipeline, SensorConfigShadow& shadow, const SensorConfigSequence& target,
+                              size_t maxPayloadWords, bool firmwareSupportsBatch, double timeoutSeconds,
+                              ConfigTransitionCompletion completion)
+{
+    // Nothing of a config the sensor cannot run goes out, so the streams keep their current settings.
+    if (!sensorConfigValid(SensorConfigTable::fromSequence(target)))
+    {
+        if (completion)
+            completion(OpcodeRequestStatus::Cancelled, false, 0);
+        return;
+    }
+
+    ConfigTransitionPlan plan = shadow.plan(target);
+    std::vector<ConfigWriteRequest> requests = planConfigWrites(plan, maxPayloadWords, firmwareSupportsBatch);
+
+    if (requests.empty())
+    {
+        if (completion)
+            completion(OpcodeRequestStatus::Completed, true, 0);
+        return;
+    }
+
+    auto state = std::make_shared<ConfigTransitionState>();
+    state->pipeline = &pipeline;
+    state->shadow = &shadow;
+    state->timeoutSeconds = timeoutSeconds;
+    state->settings = std::move(plan.settings);
+    state->requests = std::move(requests);
+    state->completion = std::move(completion);
+
+    while (state->stopRequests < state->requests.size() && state->requests[state->stopRequests].firstSetting < plan.stopCount)
+        ++state->stopRequests;
+
+    // Without stops everything can go out back to back.
+    submitConfigRequests(state, 0, state->stopRequests > 0 ? state->stopRequests : state->requests.size());
+}
+
+} // oc namespace
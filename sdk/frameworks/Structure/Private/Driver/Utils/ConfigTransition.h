@@ -0,0 +1,97 @@
+//
+//  ConfigTransition.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "OpcodePipeline.h"
+#include "PSConfigs.h"
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace oc {
+
+/* The settings that take a sensor from what the shadow knows to a target SensorConfigSequence, in write order:
+   first the stream stops (stream mode set to 0), then every other changed parameter in the order the sequence lists
+   them, then the stream modes. */
+struct ConfigTransitionPlan
+{
+    std::vector<SensorSetting> settings;
+    size_t stopCount = 0;        // settings[0, stopCount) stop streams
+    size_t unchangedCount = 0;   // settings of the target already in place and left out
+};
+
+/**
+ * Last value written to each EConfig_Params entry, so stream mode switches only send what differs.
+ *
+ * A parameter is unknown until written through the shadow, and again after invalidate(): unknown parameters are
+ * always written. Parameters outside EConfig_Params are passed through and never shadowed.
+ *
+ * Format, resolution, fps, crop and registration only take effect while their stream is off. plan() stops a running
+ * stream when one of those changes or when its mode changes, writes the new values, and restarts it with the target
+ * mode (the one in the sequence, else the one it was running with). A stream whose mode is unknown and not set by
+ * the sequence cannot be restarted, so it is not stopped either and its settings go out in sequence order, as before.
+ *
+ * All methods are thread safe.
+ */
+class SensorConfigShadow
+{
+public:
+    ConfigTransitionPlan plan (const SensorConfigSequence& target) const;
+
+    // Records settings as written. Done when they are submitted: the pipeline keeps them in order, so the next
+    // plan() can already count on them. A write that then fails must be invalidated.
+    void record (const SensorSetting* settings, size_t count);
+
+    void invalidate ();
+    void invalidate (const SensorSetting* settings, size_t count);
+
+    bool known (uint16_t param) const;
+    uint16_t value (uint16_t param) const;
+
+private:
+    mutable std::mutex _mutex;
+    uint16_t _values[PARAM_NUM_OF_PARAMS] = {};
+    std::bitset<PARAM_NUM_OF_PARAMS> _known;
+};
+
+/* One SetParam opcode, covering plan settings [firstSetting, firstSetting + settingCount). */
+struct ConfigWriteRequest
+{
+    std::vector<uint16_t> payload;
+    size_t firstSetting;
+    size_t settingCount;
+};
+
+/**
+ * Packs settings into PS1080Opcode_SetParam requests of [param][value] pairs, keeping their order. With firmware
+ * batch support a request carries as many pairs as maxPayloadWords allows, except that the stream stops always end
+ * their own request so they are acknowledged before anything that depends on them goes out. Without it, one pair
+ * per request, still back to back through the OpcodePipeline.
+ */
+std::vector<ConfigWriteRequest> planConfigWrites (const ConfigTransitionPlan& plan, size_t maxPayloadWords, bool firmwareSupportsBatch);
+
+/* status is the first transport failure, or Completed if every request got a reply; acked is false if any reply was
+   not an ACK. settingsWritten counts the acknowledged settings. */
+typedef std::function<void (OpcodeRequestStatus status, bool acked, size_t settingsWritten)> ConfigTransitionCompletion;
+
+/* Plans the transition to target and sends it through the pipeline, recording settings in the shadow as they are
+   submitted. The stream stops go first; the other settings are only submitted once every stop is acknowledged, and
+   not at all if one is not (NACK, timeout, disconnect), since they would not take effect on a running stream.
+   Settings whose request fails are invalidated so the next transition writes them again. completion is called once,
+   after the last reply, or at once if nothing needs writing. A target that fails sensorConfigValid (PSConfigTables.h)
+   is refused before anything is sent, with (Cancelled, false, 0). The pipeline and the shadow must outlive the
+   requests, e.g. be owned together. */
+void executeConfigTransition (OpcodePipeline& pipeline, SensorConfigShadow& shadow, const SensorConfigSequence& target,
+                              size_t maxPayloadWords, bool firmwareSupportsBatch, double timeoutSeconds,
+                              ConfigTransitionCompletion completion);
+
+} // oc namespace
@@ -0,0 +1,304 @@
+//
+//  ControlFuture.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#   if __has_include(<coroutine>)
+#       include <coroutine>
+#       define OC_CONTROL_FUTURE_COROUTINES 1
+#   endif
+#endif
+
+namespace oc {
+
+/* code is the NSError code of the failure (an STError for driver errors), 0 on success. */
+struct ControlError
+{
+    int code = 0;
+    std::string message;
+
+    explicit operator bool () const { return code != 0; }
+};
+
+/* Value type for operations that only report success or failure. */
+struct ControlNone {};
+
+template <class T>
+struct ControlResult
+{
+    T value = T();
+    ControlError error;
+
+    bool succeeded () const { return !error; }
+};
+
+template <class T> class ControlFuture;
+
+/**
+ * The producing side of a ControlFuture, typically captured by the completion block of a
+ * SensorCommunicationController call. Resolving twice is ignored, so a block that may fire on both a
+ * timeout and a late reply stays safe.
+ */
+template <class T>
+class ControlPromise
+{
+public:
+    ControlPromise () : _state(std::make_shared<State>()) {}
+
+    ControlFuture<T> future () const { return ControlFuture<T>(_state); }
+
+    void resolve (ControlResult<T> result) const;
+    void succeed (T value) const { ControlResult<T> result; result.value = std::move(value); resolve(std::move(result)); }
+    void fail (ControlError error) const { ControlResult<T> result; result.error = std::move(error); resolve(std::move(result)); }
+
+private:
+    friend class ControlFuture<T>;
+
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable resolved;
+        bool ready = false;
+        ControlResult<T> result;
+        std::vector<std::function<void (const ControlResult<T>&)>> continuations;
+    };
+
+    std::shared_ptr<State> _state;
+};
+
+/**
+ * The result of an asynchronous control operation, for composing sensor control calls without nesting
+ * completion blocks. Continuations run on the thread that resolves the promise (the accessory thread for
+ * driver calls), or immediately if the result is already there.
+ *
+ * Issue independent operations first and join them with whenAll(); with the opcode pipeline they are in
+ * flight together instead of one round trip after another.
+ *
+ * When built as C++20 (or with coroutines enabled), a ControlFuture can also be co_await-ed and used as the
+ * return type of a coroutine.
+ */
+template <class T>
+class ControlFuture
+{
+public:
+    typedef T ValueType;
+
+    ControlFuture () = default;
+
+    bool valid () const { return _state != nullptr; }
+
+    bool ready () const
+    {
+        std::lock_guard<std::mutex> lock (_state->mutex);
+        return _state->ready;
+    }
+
+    void then (std::function<void (const ControlResult<T>&)> continuation) const
+    {
+        std::unique_lock<std::mutex> lock (_state->mutex);
+        if (!_state->ready)
+        {
+            _state->continuations.push_back(std::move(continuation));
+            return;
+        }
+        lock.unlock();
+
+        continuation(_state->result);
+    }
+
+    // Chains a step that only runs if this one succeeded; a failure is passed through unchanged.
+    template <class F>
+    auto map (F function) const -> ControlFuture<decltype(function(std::declval<const T&>()))>
+    {
+        typedef decltype(function(std::declval<const T&>())) U;
+
+        ControlPromise<U> promise;
+        then([promise, function] (const ControlResult<T>& result)
+        {
+            if (result.error)
+                promise.fail(result.error);
+            else
+                promise.succeed(function(result.value));
+        });
+        return promise.future();
+    }
+
+    // Blocks until the result is there. For tools and tests only: never call it on the thread that resolves the promise.
+    ControlResult<T> get () const
+    {
+        std::unique_lock<std::mutex> lock (_state->mutex);
+        _state->resolved.wait(lock, [this] () { return _state->ready; });
+        return _state->result;
+    }
+
+#if OC_CONTROL_FUTURE_COROUTINES
+    struct Awaiter
+    {
+        ControlFuture future;
+
+        bool await_ready () const { return future.ready(); }
+        void await_suspend (std::coroutine_handle<> handle) const { future.then([handle] (const ControlResult<T>&) { handle.resume(); }); }
+        ControlResult<T> await_resume () const { return future.get(); }
+    };
+
+    Awaiter operator co_await () const { return Awaiter { *this }; }
+
+    struct promise_type
+    {
+        ControlPromise<T> promise;
+
+        ControlFuture get_return_object () { return promise.future(); }
+        std::suspend_never initial_suspend () noexcept { return {}; }
+        std::suspend_never final_suspend () noexcept { return {}; }
+        void return_value (ControlResult<T> result) { promise.resolve(std::move(result)); }
+        void unhandled_exception () { promise.fail({ -1, "unhandled exception in control coroutine" }); }
+    };
+#endif
+
+private:
+    friend class ControlPromise<T>;
+
+    explicit ControlFuture (std::shared_ptr<typename ControlPromise<T>::State> state) : _state(std::move(state)) {}
+
+    std::shared_ptr<typename ControlPromise<T>::State> _state;
+};
+
+template <class T>
+void ControlPromise<T>::resolve (ControlResult<T> result) const
+{
+    std::vector<std::function<void (const ControlResult<T>&)>> continuations;
+
+    {
+        std::lock_guard<std::mutex> lock (_state->mutex);
+        if (_state->ready)
+            return;
+
+        _state->result = std::move(result);
+        _state->ready = true;
+        continuations.swap(_state->continuations);
+    }
+
+    _state->resolved.notify_all();
+
+    for (auto& continuation : continuations)
+        continuation(_state->result);
+}
+
+template <class T>
+ControlFuture<T> makeReadyControlFuture (ControlResult<T> result)
+{
+    ControlPromise<T> promise;
+    promise.resolve(std::move(result));
+    return promise.future();
+}
+
+//------------------------------------------------------------------------------
+
+/* Resolves once every future has, with all of their results. Never fails on its own: check each result. */
+template <class T>
+ControlFuture<std::vector<ControlResult<T>>> whenAll (const std::vector<ControlFuture<T>>& futures)
+{
+    typedef std::vector<ControlResult<T>> Results;
+
+    ControlPromise<Results> promise;
+    if (futures.empty())
+    {
+        promise.succeed(Results());
+        return promise.future();
+    }
+
+    struct Join
+    {
+        std::mutex mutex;
+        Results results;
+        std::atomic<size_t> remaining;
+    };
+
+    auto join = std::make_shared<Join>();
+    join->results.resize(futures.size());
+    join->remaining = futures.size();
+
+    for (size_t i = 0; i < futures.size(); ++i)
+    {
+        futures[i].then([join, promise, i] (const ControlResult<T>& result)
+        {
+            {
+                std::lock_guard<std::mutex> lock (join->mutex);
+                join->results[i] = result;
+            }
+
+            if (--join->remaining == 0)
+                promise.succeed(std::move(join->results));
+        });
+    }
+
+    return promise.future();
+}
+
+namespace detail {
+
+    template <class Tuple, class Futures, size_t... I>
+    void whenAllAttach (const std::shared_ptr<Tuple>& results, const std::shared_ptr<std::atomic<size_t>>& remaining,
+                        const std::shared_ptr<std::mutex>& mutex, const ControlPromise<Tuple>& promise,
+                        const Futures& futures, std::index_sequence<I...>)
+    {
+        auto attach = [&] (auto index)
+        {
+            constexpr size_t i = decltype(index)::value;
+            typedef typename std::tuple_element<i, Futures>::type::ValueType Value;
+
+            std::get<i>(futures).then([results, remaining, mutex, promise] (const ControlResult<Value>& result)
+            {
+                {
+                    std::lock_guard<std::mutex> lock (*mutex);
+                    std::get<i>(*results) = result;
+                }
+
+                if (--*remaining == 0)
+                    promise.succeed(std::move(*results));
+            });
+            return 0;
+        };
+
+        int expand[] = { 0, attach(std::integral_constant<size_t, I>())... };
+        (void)expand;
+    }
+
+} // detail namespace
+
+/* Heterogeneous version: whenAll(getHardwareInfo(c), getEmitterData(c)) resolves with a tuple of both results. */
+template <class... T>
+ControlFuture<std::tuple<ControlResult<T>...>> whenAll (const ControlFuture<T>&... futures)
+{
+    static_assert(sizeof...(T) > 0, "whenAll needs at least one future");
+
+    typedef std::tuple<ControlResult<T>...> Results;
+
+    ControlPromise<Results> promise;
+
+    auto results = std::make_shared<Results>();
+    auto remaining = std::make_shared<std::atomic<size_t>>(sizeof...(T));
+    auto mutex = std::make_shared<std::mutex>();
+
+    detail::whenAllAttach(results, remaining, mutex, promise, std::make_tuple(futures...), std::index_sequence_for<T...>());
+
+    return promise.future();
+}
+
+} // oc namespace
@@ -0,0 +1,97 @@
+//
+//  DeltaUpload.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "DeltaUpload.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace oc {
+
+namespace {
+
+    // First offset >= from where the two buffers differ, or size.
+    size_t findDifference (const uint8_t* a, const uint8_t* b, size_t from, size_t size)
+    {
+        const size_t block = 64;
+
+        while (from + block <= size && std::memcmp(a + from, b + from, block) == 0)
+            from += block;
+
+        while (from < size && a[from] == b[from])
+            ++from;
+
+        return from;
+    }
+
+    // First offset >= from where the two buffers agree, or size.
+    size_t findAgreement (const uint8_t* a, const uint8_t* b, size_t from, size_t size)
+    {
+        while (from < size && a[from] != b[from])
+            ++from;
+
+        return from;
+    }
+
+    DeltaUploadPlan fullRewrite (size_t size)
+    {
+        DeltaUploadPlan plan;
+        plan.fullRewrite = true;
+        plan.uploadBytes = size;
+        return plan;
+    }
+
+} // anonymous namespace
+
+DeltaUploadPlan planDeltaUpload (const uint8_t* previousContents, size_t previousSize,
+                                 const uint8_t* newContents, size_t newSize,
+                                 const DeltaUploadOptions& options)
+{
+    if (!previousContents || previousSize != newSize || newSize == 0)
+        return fullRewrite(newSize);
+
+    const size_t alignment = std::max<size_t>(2, options.alignment);
+
+    DeltaUploadPlan plan;
+    plan.fullRewrite = false;
+
+    size_t position = 0;
+    while ((position = findDifference(previousContents, newContents, position, newSize)) < newSize)
+    {
+        const size_t end = findAgreement(previousContents, newContents, position, newSize);
+
+        DeltaRegion region;
+        region.offset = position - position % alignment;
+        region.size = std::min(newSize, (end + alignment - 1) / alignment * alignment) - region.offset;
+
+        if (!plan.regions.empty())
+        {
+            DeltaRegion& last = plan.regions.back();
+            const size_t lastEnd = last.offset + last.size;
+
+            if (region.offset <= lastEnd + options.mergeGapBytes)
+            {
+                last.size = std::max(lastEnd, region.offset + region.size) - last.offset;
+                position = std::max(end, last.offset + last.size);
+                continue;
+            }
+        }
+
+        plan.regions.push_back(region);
+        position = std::max(end, region.offset + region.size);
+    }
+
+    for (const DeltaRegion& region : plan.regions)
+        plan.uploadBytes += region.size;
+
+    if (double(plan.uploadBytes) > options.fullRewriteRatio * double(newSize))
+        return fullRewrite(newSize);
+
+    return plan;
+}
+
+} // oc namespace
@@ -0,0 +1,58 @@
+//
+//  DeltaUpload.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace oc {
+
+/* A byte range of the new file contents that has to be written to the sensor. */
+struct DeltaRegion
+{
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+struct DeltaUploadOptions
+{
+    // Regions start and end on multiples of this. WriteFileUpload offsets and sizes are in words, so at least 2.
+    size_t alignment = 2;
+
+    // Two changed regions separated by fewer unchanged bytes than this are sent as one: a few redundant bytes are
+    // cheaper than another round trip.
+    size_t mergeGapBytes = 64;
+
+    // If the regions cover more than this fraction of the file, a plain full upload is cheaper and is planned instead.
+    double fullRewriteRatio = 0.5;
+};
+
+struct DeltaUploadPlan
+{
+    // true when the whole file has to be uploaded: no previous contents, a size change, or too much changed.
+    bool fullRewrite = true;
+
+    // Sorted, non-overlapping, aligned. Empty with fullRewrite == false means nothing changed.
+    std::vector<DeltaRegion> regions;
+
+    size_t uploadBytes = 0;
+};
+
+/**
+ * Diffs newContents against the copy believed to be on the sensor (usually from FlashFileCache) and returns the
+ * regions to upload with startFileUploadFromMemory:...fileOffset:.
+ *
+ * The flash file table fixes a file's size, so any size change plans a full rewrite. The plan trusts previousContents;
+ * callers must verify the file CRC from the file table afterwards and fall back to a full upload on a mismatch.
+ */
+DeltaUploadPlan planDeltaUpload (const uint8_t* previousContents, size_t previousSize,
+                                 const uint8_t* newContents, size_t newSize,
+                                 const DeltaUploadOptions& options = DeltaUploadOptions());
+
+} // oc namespace
@@ -0,0 +1,453 @@
+//
+//  DepthRegistration.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "DepthRegistration.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#   define DEPTH_REGISTRATION_SSE2 1
+#   include <emmintrin.h>
+#endif
+
+// arm64 only, for vdivq_f32 and the round-towards-minus-infinity conversion.
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#   define DEPTH_REGISTRATION_NEON 1
+#   include <arm_neon.h>
+#endif
+
+// The SIMD paths multiply and add separately, so the scalar path must not be fused into FMAs either (clang contracts
+// within expressions by default, and does so on arm64). Same as building this file with -ffp-contract=off.
+#if defined(__clang__)
+#   pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#   pragma GCC optimize ("fp-contract=off")
+#else
+#   pragma STDC FP_CONTRACT OFF
+#endif
+
+namespace oc {
+
+// Worker threads for bands 1.. of forEachBand; band 0 runs on the calling thread. Started with the DepthRegistration
+// and parked on a condition variable between frames, so registering a frame creates no threads.
+class DepthRegistrationWorkers
+{
+public:
+    explicit DepthRegistrationWorkers (int workerCount)
+    {
+        _threads.reserve(workerCount);
+        for (int worker = 0; worker < workerCount; ++worker)
+            _threads.emplace_back([this, worker] { run(worker + 1); });
+    }
+
+    ~DepthRegistrationWorkers ()
+    {
+        {
+            std::lock_guard<std::mutex> lock (_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+
+        for (std::thread& thread : _threads)
+            thread.join();
+    }
+
+    // Calls function(band) for every band in [0, bands), bands at most workerCount + 1, and returns once all are done.
+    void dispatch (int bands, const std::function<void (int band)>& function)
+    {
+        {
+            std::lock_guard<std::mutex> lock (_mutex);
+            _function = &function;
+            _bands = bands;
+            _pending = bands - 1;
+            ++_generation;
+        }
+        _wake.notify_all();
+
+        function(0);
+
+        std::unique_lock<std::mutex> lock (_mutex);
+        _done.wait(lock, [this] { return _pending == 0; });
+        _function = nullptr;
+    }
+
+private:
+    void run (int band)
+    {
+        uint64_t seenGeneration = 0;
+        std::unique_lock<std::mutex> lock (_mutex);
+
+        while (true)
+        {
+            _wake.wait(lock, [&] { return _stop || _generation != seenGeneration; });
+            if (_stop)
+                return;
+
+            seenGeneration = _generation;
+            if (band >= _bands)
+                continue;
+
+            const std::function<void (int)>& function = *_function;
+            lock.unlock();
+            function(band);
+            lock.lock();
+
+            if (--_pending == 0)
+                _done.notify_one();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const std::function<void (int)>* _function = nullptr;
+    uint64_t _generation = 0;
+    int _bands = 0;
+    int _pending = 0;
+    bool _stop = false;
+    std::vector<std::thread> _threads;
+};
+
+namespace {
+
+    // Keeps projected coordinates far from int32 overflow; anything this far out is off the image anyway.
+    const float coordinateLimit = 1e6f;
+
+    struct Projection
+    {
+        float rowX, rowY, rowZ;
+        float tx, ty, tz;
+        float fx, fy, cx, cy;
+        int32_t minDepth, maxDepth;
+    };
+
+    // The reference the SIMD paths must match: same operations, same order.
+    void projectScalar (const Projection& p, const float* columnX, const float* columnY, const float* columnZ,
+                        const uint16_t* depth, int begin, int end, int32_t* u, int32_t* v, int32_t* z)
+    {
+        for (int x = begin; x < end; ++x)
+        {
+            const int32_t depthValue = depth[x];
+            const float zf = float(depthValue);
+            const float X = zf * (columnX[x] + p.rowX) + p.tx;
+            const float Y = zf * (columnY[x] + p.rowY) + p.ty;
+            const float Z = zf * (columnZ[x] + p.rowZ) + p.tz;
+
+            if (depthValue < p.minDepth || depthValue > p.maxDepth || !(Z > 0.f))
+            {
+                u[x] = v[x] = z[x] = 0;
+                continue;
+            }
+
+            const float uf = std::min(std::max(p.fx * (X / Z) + p.cx, -coordinateLimit), coordinateLimit);
+            const float vf = std::min(std::max(p.fy * (Y / Z) + p.cy, -coordinateLimit), coordinateLimit);
+
+            u[x] = int32_t(std::floor(uf + 0.5f));
+            v[x] = int32_t(std::floor(vf + 0.5f));
+            z[x] = int32_t(std::floor(std::min(Z, 65535.f) + 0.5f));
+        }
+    }
+
+#if DEPTH_REGISTRATION_SSE2
+
+    inline __m128i floorSSE2 (__m128 values)
+    {
+        const __m128i truncated = _mm_cvttps_epi32(values);
+        // Truncation rounds negative values up; take one off where that happened.
+        const __m128 roundedUp = _mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), values);
+        return _mm_add_epi32(truncated, _mm_castps_si128(roundedUp));
+    }
+
+    int projectSSE2 (const Projection& p, const float* columnX, const float* columnY, const float* columnZ,
+                     const uint16_t* depth, int width, int32_t* u, int32_t* v, int32_t* z)
+    {
+        const __m128 rowX = _mm_set1_ps(p.rowX), rowY = _mm_set1_ps(p.rowY), rowZ = _mm_set1_ps(p.rowZ);
+        const __m128 tx = _mm_set1_ps(p.tx), ty = _mm_set1_ps(p.ty), tz = _mm_set1_ps(p.tz);
+        const __m128 fx = _mm_set1_ps(p.fx), fy = _mm_set1_ps(p.fy), cx = _mm_set1_ps(p.cx), cy = _mm_set1_ps(p.cy);
+        const __m128 half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps(), maxZ = _mm_set1_ps(65535.f);
+        const __m128 lower = _mm_set1_ps(-coordinateLimit), upper = _mm_set1_ps(coordinateLimit);
+        const __m128i minDepth = _mm_set1_epi32(p.minDepth - 1), maxDepth = _mm_set1_epi32(p.maxDepth + 1);
+
+        int x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            const __m128i depthValues = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth + x)), _mm_setzero_si128());
+            const __m128 zf = _mm_cvtepi32_ps(depthValues);
+
+            const __m128 X = _mm_add_ps(_mm_mul_ps(zf, _mm_add_ps(_mm_loadu_ps(columnX + x), rowX)), tx);
+            const __m128 Y = _mm_add_ps(_mm_mul_ps(zf, _mm_add_ps(_mm_loadu_ps(columnY + x), rowY)), ty);
+            const __m128 Z = _mm_add_ps(_mm_mul_ps(zf, _mm_add_ps(_mm_loadu_ps(columnZ + x), rowZ)), tz);
+
+            const __m128i valid = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(depthValues, minDepth), _mm_cmplt_epi32(depthValues, maxDepth)),
+                                                _mm_castps_si128(_mm_cmpgt_ps(Z, zero)));
+
+            // max/min return their second operand for NaN, so invalid lanes stay finite before they are masked.
+            const __m128 uf = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(fx, _mm_div_ps(X, Z)), cx), lower), upper);
+            const __m128 vf = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(fy, _mm_div_ps(Y, Z)), cy), lower), upper);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_and_si128(floorSSE2(_mm_add_ps(uf, half)), valid));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x), _mm_and_si128(floorSSE2(_mm_add_ps(vf, half)), valid));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(z + x), _mm_and_si128(floorSSE2(_mm_add_ps(_mm_min_ps(Z, maxZ), half)), valid));
+        }
+
+        return x;
+    }
+
+#endif // DEPTH_REGISTRATION_SSE2
+
+#if DEPTH_REGISTRATION_NEON
+
+    int projectNEON (const Projection& p, const float* columnX, const float* columnY, const float* columnZ,
+                     const uint16_t* depth, int width, int32_t* u, int32_t* v, int32_t* z)
+    {
+        const float32x4_t rowX = vdupq_n_f32(p.rowX), rowY = vdupq_n_f32(p.rowY), rowZ = vdupq_n_f32(p.rowZ);
+        const float32x4_t tx = vdupq_n_f32(p.tx), ty = vdupq_n_f32(p.ty), tz = vdupq_n_f32(p.tz);
+        const float32x4_t fx = vdupq_n_f32(p.fx), fy = vdupq_n_f32(p.fy), cx = vdupq_n_f32(p.cx), cy = vdupq_n_f32(p.cy);
+        const float32x4_t half = vdupq_n_f32(0.5f), zero = vdupq_n_f32(0.f), maxZ = vdupq_n_f32(65535.f);
+        const float32x4_t lower = vdupq_n_f32(-coordinateLimit), upper = vdupq_n_f32(coordinateLimit);
+        const int32x4_t minDepth = vdupq_n_s32(p.minDepth), maxDepth = vdupq_n_s32(p.maxDepth);
+
+        int x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            const int32x4_t depthValues = vreinterpretq_s32_u32(vmovl_u16(vld1_u16(depth + x)));
+            const float32x4_t zf = vcvtq_f32_s32(depthValues);
+
+            // Separate multiply and add (no vfma) to round like the scalar path.
+            const float32x4_t X = vaddq_f32(vmulq_f32(zf, vaddq_f32(vld1q_f32(columnX + x), rowX)), tx);
+            const float32x4_t Y = vaddq_f32(vmulq_f32(zf, vaddq_f32(vld1q_f32(columnY + x), rowY)), ty);
+            const float32x4_t Z = vaddq_f32(vmulq_f32(zf, vaddq_f32(vld1q_f32(columnZ + x), rowZ)), tz);
+
+            const uint32x4_t valid = vandq_u32(vandq_u32(vcgeq_s32(depthValues, minDepth), vcleq_s32(depthValues, maxDepth)), vcgtq_f32(Z, zero));
+
+            const float32x4_t uf = vminnmq_f32(vmaxnmq_f32(vaddq_f32(vmulq_f32(fx, vdivq_f32(X, Z)), cx), lower), upper);
+            const float32x4_t vf = vminnmq_f32(vmaxnmq_f32(vaddq_f32(vmulq_f32(fy, vdivq_f32(Y, Z)), cy), lower), upper);
+
+            vst1q_s32(u + x, vandq_s32(vcvtmq_s32_f32(vaddq_f32(uf, half)), vreinterpretq_s32_u32(valid)));
+            vst1q_s32(v + x, vandq_s32(vcvtmq_s32_f32(vaddq_f32(vf, half)), vreinterpretq_s32_u32(valid)));
+            vst1q_s32(z + x, vandq_s32(vcvtmq_s32_f32(vaddq_f32(vminq_f32(Z, maxZ), half)), vreinterpretq_s32_u32(valid)));
+        }
+
+        return x;
+    }
+
+#endif // DEPTH_REGISTRATION_NEON
+
+    DepthRegistrationBackend resolveBackend (DepthRegistrationBackend backend)
+    {
+        switch (backend)
+        {
+#if DEPTH_REGISTRATION_SSE2
+            case DepthRegistrationBackend::Automatic:
+            case DepthRegistrationBackend::SSE2:
+                return DepthRegistrationBackend::SSE2;
+#elif DEPTH_REGISTRATION_NEON
+            case DepthRegistrationBackend::Automatic:
+            case DepthRegistrationBackend::NEON:
+                return DepthRegistrationBackend::NEON;
+#endif
+            default:
+                return DepthRegistrationBackend::Scalar;
+        }
+    }
+
+} // anonymous namespace
+
+DepthRegistration::DepthRegistration (const DepthRegistrationCamera& depth, const DepthRegistrationCamera& color,
+                                      const DepthRegistrationExtrinsics& depthToColor, const Options& options)
+: _depth(depth), _color(color), _extrinsics(depthToColor), _options(options)
+{
+    _backend = resolveBackend(options.backend);
+
+    _threadCount = options.threadCount;
+    if (_threadCount <= 0)
+        _threadCount = std::max(1, std::min(4, int(std::thread::hardware_concurrency())));
+
+    if (_threadCount > 1)
+        _workers.reset(new DepthRegistrationWorkers (_threadCount - 1));
+
+    const size_t pixels = size_t(std::max(0, _depth.width)) * size_t(std::max(0, _depth.height));
+    _u.resize(pixels);
+    _v.resize(pixels);
+    _z.resize(pixels);
+    _rowMinV.resize(std::max(0, _depth.height));
+    _rowMaxV.resize(std::max(0, _depth.height));
+
+    prepare();
+}
+
+DepthRegistration::~DepthRegistration () = default;
+
+void DepthRegistration::setCalibration (const DepthRegistrationCamera& color, const DepthRegistrationExtrinsics& depthToColor)
+{
+    _color = color;
+    _extrinsics = depthToColor;
+    prepare();
+}
+
+void DepthRegistration::prepare ()
+{
+    const float* R = _extrinsics.rotation;
+
+    _columnX.resize(std::max(0, _depth.width));
+    _columnY.resize(_columnX.size());
+    _columnZ.resize(_columnX.size());
+    for (int x = 0; x < _depth.width; ++x)
+    {
+        const float a = (float(x) - _depth.cx) / _depth.fx;
+        _columnX[x] = R[0] * a;
+        _columnY[x] = R[3] * a;
+        _columnZ[x] = R[6] * a;
+    }
+
+    _rowX.resize(std::max(0, _depth.height));
+    _rowY.resize(_rowX.size());
+    _rowZ.resize(_rowX.size());
+    for (int y = 0; y < _depth.height; ++y)
+    {
+        const float b = (float(y) - _depth.cy) / _depth.fy;
+        _rowX[y] = R[1] * b + R[2];
+        _rowY[y] = R[4] * b + R[5];
+        _rowZ[y] = R[7] * b + R[8];
+    }
+
+    // One depth pixel covers about color focal / depth focal color pixels; squares that size leave no gaps.
+    _splatSize = _options.splatSize;
+    if (_splatSize <= 0)
+    {
+        const float ratio = std::max(_color.fx / _depth.fx, _color.fy / _depth.fy);
+        _splatSize = std::max(1, std::min(8, int(std::ceil(ratio))));
+    }
+}
+
+void DepthRegistration::projectRows (const uint16_t* depth, size_t depthStride, int firstRow, int endRow)
+{
+    Projection p;
+    p.tx = _extrinsics.translation[0];
+    p.ty = _extrinsics.translation[1];
+    p.tz = _extrinsics.translation[2];
+    p.fx = _color.fx;
+    p.fy = _color.fy;
+    p.cx = _color.cx;
+    p.cy = _color.cy;
+    p.minDepth = _options.minDepth;
+    p.maxDepth = _options.maxDepth;
+
+    const int width = _depth.width;
+
+    for (int y = firstRow; y < endRow; ++y)
+    {
+        const uint16_t* depthRow = reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(depth) + size_t(y) * depthStride);
+        int32_t* u = _u.data() + size_t(y) * width;
+        int32_t* v = _v.data() + size_t(y) * width;
+        int32_t* z = _z.data() + size_t(y) * width;
+
+        p.rowX = _rowX[y];
+        p.rowY = _rowY[y];
+        p.rowZ = _rowZ[y];
+
+        int done = 0;
+#if DEPTH_REGISTRATION_SSE2
+        if (_backend == DepthRegistrationBackend::SSE2)
+            done = projectSSE2(p, _columnX.data(), _columnY.data(), _columnZ.data(), depthRow, width, u, v, z);
+#endif
+#if DEPTH_REGISTRATION_NEON
+        if (_backend == DepthRegistrationBackend::NEON)
+            done = projectNEON(p, _columnX.data(), _columnY.data(), _columnZ.data(), depthRow, width, u, v, z);
+#endif
+        projectScalar(p, _columnX.data(), _columnY.data(), _columnZ.data(), depthRow, done, width, u, v, z);
+
+        int32_t minV = INT_MAX;
+        int32_t maxV = INT_MIN;
+        for (int x = 0; x < width; ++x)
+        {
+            if (z[x] != 0)
+            {
+                minV = std::min(minV, v[x]);
+                maxV = std::max(maxV, v[x]);
+            }
+        }
+        _rowMinV[y] = minV;
+        _rowMaxV[y] = maxV;
+    }
+}
+
+void DepthRegistration::splatRows (uint16_t* registered, size_t registeredStride, int firstRow, int endRow) const
+{
+    const int width = _depth.width;
+    const int colorWidth = _color.width;
+    const int size = _splatSize;
+    const int before = (size - 1) / 2;
+
+    for (int row = firstRow; row < endRow; ++row)
+        std::memset(reinterpret_cast<uint8_t*>(registered) + size_t(row) * registeredStride, 0, size_t(colorWidth) * sizeof(uint16_t));
+
+    for (int y = 0; y < _depth.height; ++y)
+    {
+        // Skip depth rows whose squares cannot reach this band.
+        if (_rowMinV[y] > _rowMaxV[y] || _rowMaxV[y] - before + size <= firstRow || _rowMinV[y] - before >= endRow)
+            continue;
+
+        const size_t rowOffset = size_t(y) * width;
+        for (int x = 0; x < width; ++x)
+        {
+            const int32_t depthValue = _z[rowOffset + x];
+            if (depthValue == 0)
+                continue;
+
+            const int32_t top = _v[rowOffset + x] - before;
+            const int32_t left = _u[rowOffset + x] - before;
+            const int rowBegin = std::max(top, firstRow);
+            const int rowEnd = std::min(top + size, endRow);
+            const int columnBegin = std::max(left, 0);
+            const int columnEnd = std::min(left + size, colorWidth);
+
+            for (int row = rowBegin; row < rowEnd; ++row)
+            {
+                uint16_t* out = reinterpret_cast<uint16_t*>(reinterpret_cast<uint8_t*>(registered) + size_t(row) * registeredStride);
+                for (int column = columnBegin; column < columnEnd; ++column)
+                    if (out[column] == 0 || depthValue < out[column])
+                        out[column] = uint16_t(depthValue);
+            }
+        }
+    }
+}
+
+template <class Function>
+void DepthRegistration::forEachBand (int rows, const Function& function)
+{
+    const int bands = std::max(1, std::min(_threadCount, rows));
+    if (bands == 1 || !_workers)
+    {
+        function(0, rows);
+        return;
+    }
+
+    _workers->dispatch(bands, [&] (int band) {
+        function(rows * band / bands, rows * (band + 1) / bands);
+    });
+}
+
+void DepthRegistration::registerDepth (const uint16_t* depth, size_t depthStride, uint16_t* registered, size_t registeredStride)
+{
+    forEachBand(_depth.height, [&] (int firstRow, int endRow) {
+        projectRows(depth, depthStride, firstRow, endRow);
+    });
+
+    forEachBand(_color.height, [&] (int firstRow, int endRow) {
+        splatRows(registered, registeredStride, firstRow, endRow);
+    });
+}
+
+} // oc namespace
@@ -0,0 +1,125 @@
+//
+//  DepthRegistration.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace oc {
+
+class DepthRegistrationWorkers;
+
+/* Pinhole camera at the resolution it is used at. The ObjC side fills it from oc::Intrinsics, e.g. the depth
+   intrinsics scaled to the depth resolution and getIntrinsics640x480AtFocusPositionDuringCalibration scaled to the
+   color resolution. */
+struct DepthRegistrationCamera
+{
+    float fx = 0;
+    float fy = 0;
+    float cx = 0;
+    float cy = 0;
+    int width = 0;
+    int height = 0;
+};
+
+/* Depth camera to color camera, p_color = rotation * p_depth + translation. Rotation is row major, translation in
+   millimeters like the depth values (getExtrinsics is in meters). */
+struct DepthRegistrationExtrinsics
+{
+    float rotation[9] = { 1, 0, 0,  0, 1, 0,  0, 0, 1 };
+    float translation[3] = { 0, 0, 0 };
+};
+
+enum class DepthRegistrationBackend
+{
+    Automatic, // best one the CPU supports
+    Scalar,
+    SSE2,
+    NEON,
+};
+
+/**
+ * Host-side depth to color registration, for color resolutions and lens positions the firmware registration
+ * (QVGADepthRegisteredSequence, VGADepthRegisteredSequence) does not cover.
+ *
+ * Every depth pixel is unprojected, moved into the color camera and projected there; it is drawn as a
+ * splatSize x splatSize square so upsampling leaves no holes, and a z-buffer keeps the nearest surface where
+ * squares overlap. Output pixels nothing lands on are 0, as are depth pixels outside [minDepth, maxDepth].
+ *
+ * Projection runs 4 pixels at a time (SSE2, or NEON on arm64) and both passes are split across threads: the
+ * projection by depth rows, the splatting by output rows, each thread only visiting the depth rows whose projection
+ * can reach its band. The threads are started once per instance and wait between frames. The SIMD paths give the same
+ * result as the scalar one (the .cpp is compiled without multiply-add contraction).
+ *
+ * Calibration can change between frames (setCalibration), e.g. after a refocus, without restarting the depth stream.
+ * Not thread safe: one instance per stream.
+ */
+class DepthRegistration
+{
+public:
+    struct Options
+    {
+        int threadCount = 0;       // 0: up to 4, depending on the cores available
+        int splatSize = 0;         // 0: from the ratio of color to depth focal lengths
+        uint16_t minDepth = 1;
+        uint16_t maxDepth = 0xffff;
+        DepthRegistrationBackend backend = DepthRegistrationBackend::Automatic;
+    };
+
+    DepthRegistration (const DepthRegistrationCamera& depth, const DepthRegistrationCamera& color,
+                       const DepthRegistrationExtrinsics& depthToColor, const Options& options);
+
+    DepthRegistration (const DepthRegistrationCamera& depth, const DepthRegistrationCamera& color,
+                       const DepthRegistrationExtrinsics& depthToColor)
+    : DepthRegistration(depth, color, depthToColor, Options()) {}
+
+    ~DepthRegistration ();
+
+    void setCalibration (const DepthRegistrationCamera& color, const DepthRegistrationExtrinsics& depthToColor);
+
+    // depth is depthCamera().width x height in millimeters, registered is colorCamera().width x height. Strides in bytes.
+    void registerDepth (const uint16_t* depth, size_t depthStride, uint16_t* registered, size_t registeredStride);
+
+    const DepthRegistrationCamera& depthCamera () const { return _depth; }
+    const DepthRegistrationCamera& colorCamera () const { return _color; }
+    int splatSize () const { return _splatSize; }
+    int threadCount () const { return _threadCount; }
+
+    // Falls back to Scalar for a backend the CPU does not have. Mostly for checking the SIMD path.
+    DepthRegistrationBackend backend () const { return _backend; }
+
+private:
+    void prepare ();
+    void projectRows (const uint16_t* depth, size_t depthStride, int firstRow, int endRow);
+    void splatRows (uint16_t* registered, size_t registeredStride, int firstRow, int endRow) const;
+
+    // Runs function(firstRow, endRow) over up to threadCount bands of rows.
+    template <class Function>
+    void forEachBand (int rows, const Function& function);
+
+    DepthRegistrationCamera _depth;
+    DepthRegistrationCamera _color;
+    DepthRegistrationExtrinsics _extrinsics;
+    Options _options;
+    DepthRegistrationBackend _backend = DepthRegistrationBackend::Scalar;
+    int _threadCount = 1;
+    int _splatSize = 1;
+    std::unique_ptr<DepthRegistrationWorkers> _workers; // threadCount - 1 threads, null for one
+
+    // Rotation applied to each column's normalized x, and per row the rest of the rotated ray.
+    std::vector<float> _columnX, _columnY, _columnZ;
+    std::vector<float> _rowX, _rowY, _rowZ;
+
+    // Projection of every depth pixel: rounded color coordinates and depth in the color camera (0 if invalid).
+    std::vector<int32_t> _u, _v, _z;
+    std::vector<int32_t> _rowMinV, _rowMaxV;
+};
+
+} // oc namespace
@@ -0,0 +1,216 @@
+//
+//  FlashFileCache.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "FlashFileCache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <dirent.h>
+
+namespace oc {
+
+namespace {
+
+    struct CacheFileHeader
+    {
+        enum : uint32_t { Magic = 0x4346434f }; // "OCFC"
+        enum : uint32_t { FormatVersion = 1 };
+
+        uint32_t magic;
+        uint32_t formatVersion;
+        uint64_t size;
+        uint64_t checksum;
+        uint64_t reserved; // keeps the payload 32-byte aligned in the mapping
+    };
+
+    static_assert(sizeof(CacheFileHeader) == 32, "cache file header layout changed");
+
+    uint64_t fnv1a (const uint8_t* data, size_t size)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= data[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    // Letters, digits and '-' are kept, every other byte (including '_') becomes _XX, so distinct serials always get
+    // distinct directories.
+    std::string sanitizedSerial (const std::string& serial)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        std::string sanitized;
+        sanitized.reserve(serial.size());
+        for (char c : serial)
+        {
+            const bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-';
+            if (safe)
+            {
+                sanitized += c;
+            }
+            else
+            {
+                sanitized += '_';
+                sanitized += hex[uint8_t(c) >> 4];
+                sanitized += hex[uint8_t(c) & 0xf];
+            }
+        }
+        return sanitized;
+    }
+
+    std::string fileName (const FlashFileCacheKey& key)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%u-%u-%04x.bin", unsigned(key.fileId), unsigned(key.version), unsigned(key.crc));
+        return name;
+    }
+
+} // anonymous namespace
+
+FlashFileCache::FlashFileCache (const std::string& rootDirectory)
+: _root(rootDirectory)
+{
+    while (_root.size() > 1 && _root.back() == '/')
+        _root.pop_back();
+}
+
+std::string FlashFileCache::sensorDirectory (const std::string& sensorSerial) const
+{
+    return _root + "/" + sanitizedSerial(sensorSerial);
+}
+
+std::string FlashFileCache::counterDirectory (const std::string& sensorSerial, uint16_t fileTableChangeCounter) const
+{
+    return sensorDirectory(sensorSerial) + "/" + std::to_string(fileTableChangeCounter);
+}
+
+std::shared_ptr<const CachedFlashFile> FlashFileCache::lookup (const FlashFileCacheKey& key) const
+{
+    if (key.sensorSerial.empty())
+        return nullptr;
+
+    return load(counterDirectory(key.sensorSerial, key.fileTableChangeCounter) + "/" + fileName(key));
+}
+
+bool FlashFileCache::store (const FlashFileCacheKey& key, const void* data, size_t size)
+{
+    if (key.sensorSerial.empty())
+        return false;
+
+    return save(key.sensorSerial, key.fileTableChangeCounter,
+                counterDirectory(key.sensorSerial, key.fileTableChangeCounter) + "/" + fileName(key), data, size);
+}
+
+std::shared_ptr<const CachedFlashFile> FlashFileCache::lookupFileList (const std::string& sensorSerial, uint16_t fileTableChangeCounter) const
+{
+    if (sensorSerial.empty())
+        return nullptr;
+
+    return load(counterDirectory(sensorSerial, fileTableChangeCounter) + "/filelist.bin");
+}
+
+bool FlashFileCache::storeFileList (const std::string& sensorSerial, uint16_t fileTableChangeCounter, const void* data, size_t size)
+{
+    if (sensorSerial.empty())
+        return false;
+
+    return save(sensorSerial, fileTableChangeCounter, counterDirectory(sensorSerial, fileTableChangeCounter) + "/filelist.bin", data, size);
+}
+
+void FlashFileCache::invalidate (const std::string& sensorSerial)
+{
+    if (sensorSerial.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock (_mutex);
+    removeRecursively(sensorDirectory(sensorSerial));
+}
+
+std::shared_ptr<const CachedFlashFile> FlashFileCache::load (const std::string& path) const
+{
+    auto cached = std::make_shared<CachedFlashFile>();
+
+    {
+        // Only guards against a concurrent prune; the mapping itself outlives a later unlink.
+        std::lock_guard<std::mutex> lock (_mutex);
+        if (!cached->_file.open(path))
+            return nullptr;
+    }
+
+    if (cached->_file.size() < sizeof(CacheFileHeader))
+        return nullptr;
+
+    CacheFileHeader header;
+    std::memcpy(&header, cached->_file.data(), sizeof(header));
+
+    if (header.magic != CacheFileHeader::Magic || header.formatVersion != CacheFileHeader::FormatVersion
+        || header.size != cached->_file.size() - sizeof(CacheFileHeader))
+        return nullptr;
+
+    cached->_offset = sizeof(CacheFileHeader);
+    cached->_size = size_t(header.size);
+
+    if (verifyChecksums && fnv1a(cached->data(), cached->size()) != header.checksum)
+        return nullptr;
+
+    return cached;
+}
+
+bool FlashFileCache::save (const std::string& sensorSerial, uint16_t fileTableChangeCounter, const std::string& path, const void* data, size_t size)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    if (!createDirectories(counterDirectory(sensorSerial, fileTableChangeCounter)))
+        return false;
+
+    CacheFileHeader header = {};
+    header.magic = CacheFileHeader::Magic;
+    header.formatVersion = CacheFileHeader::FormatVersion;
+    header.size = size;
+    header.checksum = fnv1a(static_cast<const uint8_t*>(data), size);
+
+    std::vector<uint8_t> contents (sizeof(header) + size);
+    std::memcpy(contents.data(), &header, sizeof(header));
+    if (size > 0)
+        std::memcpy(contents.data() + sizeof(header), data, size);
+
+    if (!writeFileAtomically(path, contents.data(), contents.size()))
+        return false;
+
+    pruneOtherCounters(sensorSerial, fileTableChangeCounter);
+    return true;
+}
+
+void FlashFileCache::pruneOtherCounters (const std::string& sensorSerial, uint16_t fileTableChangeCounter)
+{
+    const std::string directory = sensorDirectory(sensorSerial);
+    const std::string keep = std::to_string(fileTableChangeCounter);
+
+    std::vector<std::string> stale;
+
+    if (DIR* listing = opendir(directory.c_str()))
+    {
+        while (struct dirent* entry = readdir(listing))
+        {
+            const std::string name = entry->d_name;
+            if (name != "." && name != ".." && name != keep)
+                stale.push_back(directory + "/" + name);
+        }
+        closedir(listing);
+    }
+
+    for (const std::string& path : stale)
+        removeRecursively(path);
+}
+
+} // oc namespace
@@ -0,0 +1,91 @@
+//
+//  FlashFileCache.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace oc {
+
+/* Identifies one flash file as the PS1080 file table describes it. */
+struct FlashFileCacheKey
+{
+    std::string sensorSerial;
+    uint16_t fileTableChangeCounter = 0;
+    uint16_t fileId = 0;
+    uint32_t version = 0;
+    uint16_t crc = 0;
+};
+
+/* Cached contents, mapped read-only straight from the cache file. Holding it keeps the mapping alive. */
+class CachedFlashFile
+{
+public:
+    const uint8_t* data () const { return _file.data() + _offset; }
+    size_t size () const { return _size; }
+
+private:
+    friend class FlashFileCache;
+
+    MappedFile _file;
+    size_t _offset = 0;
+    size_t _size = 0;
+};
+
+/**
+ * On-disk cache of sensor flash files, so a sensor whose file table has not changed since the last connect
+ * needs no flash downloads at all.
+ *
+ * Layout: <root>/<serial>/<fileTableChangeCounter>/filelist.bin and <fileId>-<version>-<crc>.bin. Any write to the
+ * flash bumps the change counter, so a connect only has to read the counter: if its directory exists, the cached
+ * file list and files are current. Storing under a new counter removes the directories of older ones for that
+ * sensor, so each sensor costs at most one copy of its files.
+ *
+ * Every cache file starts with a small header holding the payload size and an FNV-1a checksum. Writes are atomic
+ * (temporary file + rename), so a crash leaves either the old entry or the new one. Lookups map the file and verify
+ * the checksum; with verifyChecksums cleared they only check the size.
+ *
+ * Thread safe. Serials are escaped before they are used as directory names, keeping distinct serials apart. A sensor
+ * without a serial cannot be told apart from others, so an empty serial is never cached: lookups miss, stores fail.
+ */
+class FlashFileCache
+{
+public:
+    explicit FlashFileCache (const std::string& rootDirectory);
+
+    std::shared_ptr<const CachedFlashFile> lookup (const FlashFileCacheKey& key) const;
+    bool store (const FlashFileCacheKey& key, const void* data, size_t size);
+
+    // The serialized file table for a (serial, counter). The format is up to the caller.
+    std::shared_ptr<const CachedFlashFile> lookupFileList (const std::string& sensorSerial, uint16_t fileTableChangeCounter) const;
+    bool storeFileList (const std::string& sensorSerial, uint16_t fileTableChangeCounter, const void* data, size_t size);
+
+    // Drops everything cached for a sensor, e.g. after invalidateCachedFileList.
+    void invalidate (const std::string& sensorSerial);
+
+    bool verifyChecksums = true;
+
+    const std::string& rootDirectory () const { return _root; }
+
+private:
+    std::string sensorDirectory (const std::string& sensorSerial) const;
+    std::string counterDirectory (const std::string& sensorSerial, uint16_t fileTableChangeCounter) const;
+    std::shared_ptr<const CachedFlashFile> load (const std::string& path) const;
+    bool save (const std::string& sensorSerial, uint16_t fileTableChangeCounter, const std::string& path, const void* data, size_t size);
+    void pruneOtherCounters (const std::string& sensorSerial, uint16_t fileTableChangeCounter);
+
+    std::string _root;
+    mutable std::mutex _mutex;
+};
+
+} // oc namespace
@@ -0,0 +1,225 @@
+//
+//  FrameBufferPool.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "FrameBufferPool.h"
+
+#include <cstdlib>
+
+namespace oc {
+
+namespace {
+
+// Frame rows get handed to SIMD decoders, keep the data cache-line aligned.
+const size_t FrameBufferAlignment = 64;
+
+}
+
+struct FrameBufferPoolShelf
+{
+    FrameBufferPoolShelf (size_t capacity, size_t limit)
+    : bufferCapacity(capacity), maxBuffers(limit)
+    {
+        // Reserve up front so returning a buffer never grows the vector.
+        freeBuffers.reserve(limit);
+    }
+
+    ~FrameBufferPoolShelf ()
+    {
+        for (FrameBuffer* buffer : freeBuffers)
+            delete buffer;
+    }
+
+    FrameBufferRef acquire (const std::shared_ptr<FrameBufferPoolShelf>& self)
+    {
+        FrameBuffer* buffer = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+
+            if (!freeBuffers.empty())
+            {
+                buffer = freeBuffers.back();
+                freeBuffers.pop_back();
+                ++stats.reusedBuffers;
+            }
+            else if (createdBuffers < maxBuffers)
+            {
+                ++createdBuffers;
+                ++stats.allocatedBuffers;
+            }
+            else
+            {
+                ++stats.exhaustedCount;
+                return FrameBufferRef();
+            }
+        }
+
+        if (buffer == nullptr)
+        {
+            buffer = new FrameBuffer(bufferCapacity);
+
+            if (buffer->data() == nullptr)
+            {
+                delete buffer;
+
+                std::lock_guard<std::mutex> lock (mutex);
+                --createdBuffers;
+                --stats.allocatedBuffers;
+                ++stats.failedAllocations;
+                return FrameBufferRef();
+            }
+
+            buffer->_shelf = self;
+        }
+
+        buffer->_size = 0;
+        buffer->_refCount.store(1, std::memory_order_relaxed);
+        return FrameBufferRef(buffer);
+    }
+
+    void giveBack (FrameBuffer* buffer)
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+
+            if (open)
+            {
+                freeBuffers.push_back(buffer);
+                return;
+            }
+
+            --createdBuffers;
+        }
+
+        // The pool is gone, nobody will reuse this one. Deleting it may drop the last shelf reference.
+        delete buffer;
+    }
+
+    void trim ()
+    {
+        std::vector<FrameBuffer*> toDelete;
+
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            toDelete.swap(freeBuffers);
+            freeBuffers.reserve(maxBuffers);
+            createdBuffers -= toDelete.size();
+        }
+
+        for (FrameBuffer* buffer : toDelete)
+            delete buffer;
+    }
+
+    void close ()
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            open = false;
+        }
+
+        trim();
+    }
+
+    const size_t bufferCapacity;
+    const size_t maxBuffers;
+
+    mutable std::mutex mutex;
+    std::vector<FrameBuffer*> freeBuffers;
+    size_t createdBuffers = 0;
+    bool open = true;
+    FrameBufferPoolStats stats;
+};
+
+//------------------------------------------------------------------------------
+
+FrameBuffer::FrameBuffer (size_t capacity)
+: _refCount(0), _capacity(capacity)
+{
+    _allocation = std::malloc(capacity + FrameBufferAlignment);
+    if (_allocation == nullptr)
+        return; // _data stays null, the shelf refuses the acquire
+
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(_allocation) + FrameBufferAlignment - 1) & ~uintptr_t(FrameBufferAlignment - 1);
+    _data = reinterpret_cast<uint8_t*>(aligned);
+}
+
+FrameBuffer::~FrameBuffer ()
+{
+    std::free(_allocation);
+}
+
+void FrameBuffer::release ()
+{
+    if (_refCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    // Hold the shelf locally, giveBack may delete this buffer and its reference along with it.
+    std::shared_ptr<FrameBufferPoolShelf> shelf = _shelf;
+    shelf->giveBack(this);
+}
+
+//------------------------------------------------------------------------------
+
+FrameBufferPool::FrameBufferPool (const FrameBufferPoolKey& key, size_t maxBuffers)
+: _key(key), _shelf(std::make_shared<FrameBufferPoolShelf>(key.frameSizeInBytes(), maxBuffers))
+{
+}
+
+FrameBufferPool::~FrameBufferPool ()
+{
+    _shelf->close();
+}
+
+FrameBufferRef FrameBufferPool::acquire ()
+{
+    return _shelf->acquire(_shelf);
+}
+
+void FrameBufferPool::trim ()
+{
+    _shelf->trim();
+}
+
+FrameBufferPoolStats FrameBufferPool::stats () const
+{
+    std::lock_guard<std::mutex> lock (_shelf->mutex);
+    FrameBufferPoolStats stats = _shelf->stats;
+    stats.buffersOnShelf = _shelf->freeBuffers.size();
+    return stats;
+}
+
+//------------------------------------------------------------------------------
+
+FrameBufferPools::FrameBufferPools (size_t maxBuffersPerPool)
+: _maxBuffersPerPool(maxBuffersPerPool)
+{
+}
+
+FrameBufferPool& FrameBufferPools::poolFor (const FrameBufferPoolKey& key)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    // Only a handful of stream configs ever exist, a linear scan beats hashing here.
+    for (const std::unique_ptr<FrameBufferPool>& pool : _pools)
+    {
+        if (pool->key() == key)
+            return *pool;
+    }
+
+    _pools.emplace_back(new FrameBufferPool(key, _maxBuffersPerPool));
+    return *_pools.back();
+}
+
+void FrameBufferPools::trim ()
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    for (const std::unique_ptr<FrameBufferPool>& pool : _pools)
+        pool->trim();
+}
+
+} // oc namespace
@@ -0,0 +1,214 @@
+//
+//  FrameBufferPool.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace oc {
+
+/* Which sensor stream a pool of frame buffers belongs to. Pools are never shared across
+   streams, so a slow depth consumer cannot starve the visible stream and vice versa. */
+enum class FrameBufferStream : uint8_t
+{
+    Depth    = 0,
+    Infrared = 1,
+    Visible  = 2,
+};
+
+struct FrameBufferPoolKey
+{
+    FrameBufferStream stream;
+    uint16_t width;
+    uint16_t height;
+    uint8_t bytesPerPixel;
+
+    size_t frameSizeInBytes () const { return size_t(width) * size_t(height) * size_t(bytesPerPixel); }
+};
+
+inline bool operator == (const FrameBufferPoolKey& first, const FrameBufferPoolKey& second)
+{
+    return first.stream == second.stream
+        && first.width == second.width
+        && first.height == second.height
+        && first.bytesPerPixel == second.bytesPerPixel;
+}
+
+struct FrameBufferPoolShelf;
+
+/**
+ * A chunk of frame memory handed out by a FrameBufferPool. It is intrusively refcounted:
+ * copying a FrameBufferRef bumps the count, and the last release puts the buffer back on its
+ * pool's shelf instead of freeing it.
+ */
+class FrameBuffer
+{
+public:
+    uint8_t* data () { return _data; }
+    const uint8_t* data () const { return _data; }
+
+    size_t capacity () const { return _capacity; }
+
+    // Number of meaningful bytes, set by the producer once the frame has been filled.
+    size_t size () const { return _size; }
+    void setSize (size_t size) { _size = size <= _capacity ? size : _capacity; }
+
+    void retain () { _refCount.fetch_add(1, std::memory_order_relaxed); }
+    void release ();
+
+    int useCount () const { return _refCount.load(std::memory_order_relaxed); }
+
+private:
+    friend struct FrameBufferPoolShelf;
+
+    FrameBuffer (size_t capacity);
+    ~FrameBuffer ();
+
+    FrameBuffer (const FrameBuffer&) = delete;
+    FrameBuffer& operator= (const FrameBuffer&) = delete;
+
+    std::atomic<int> _refCount;
+    uint8_t* _data = nullptr;
+    void* _allocation = nullptr;
+    size_t _capacity = 0;
+    size_t _size = 0;
+
+    // Keeps the shelf alive while the buffer is out, so frames can outlive the driver's pools.
+    std::shared_ptr<FrameBufferPoolShelf> _shelf;
+};
+
+/**
+ * Smart pointer over a pooled FrameBuffer. Cheap to copy, never allocates.
+ */
+class FrameBufferRef
+{
+public:
+    FrameBufferRef () = default;
+    FrameBufferRef (std::nullptr_t) {}
+
+    FrameBufferRef (const FrameBufferRef& other) : _buffer(other._buffer) { if (_buffer) _buffer->retain(); }
+    FrameBufferRef (FrameBufferRef&& other) : _buffer(other._buffer) { other._buffer = nullptr; }
+    ~FrameBufferRef () { reset(); }
+
+    FrameBufferRef& operator= (const FrameBufferRef& other)
+    {
+        if (other._buffer)
+            other._buffer->retain();
+        reset();
+        _buffer = other._buffer;
+        return *this;
+    }
+
+    FrameBufferRef& operator= (FrameBufferRef&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            _buffer = other._buffer;
+            other._buffer = nullptr;
+        }
+        return *this;
+    }
+
+    void reset ()
+    {
+        if (_buffer)
+            _buffer->release();
+        _buffer = nullptr;
+    }
+
+    FrameBuffer* get () const { return _buffer; }
+    FrameBuffer* operator-> () const { return _buffer; }
+    FrameBuffer& operator* () const { return *_buffer; }
+    explicit operator bool () const { return _buffer != nullptr; }
+
+    const uint8_t* data () const { return _buffer ? _buffer->data() : nullptr; }
+    size_t size () const { return _buffer ? _buffer->size() : 0; }
+
+private:
+    friend struct FrameBufferPoolShelf;
+
+    // Adopts a buffer whose refcount was already set to one.
+    explicit FrameBufferRef (FrameBuffer* adopted) : _buffer(adopted) {}
+
+    FrameBuffer* _buffer = nullptr;
+};
+
+struct FrameBufferPoolStats
+{
+    size_t allocatedBuffers = 0;  // buffers created since the pool was made
+    size_t reusedBuffers = 0;     // acquisitions served from the shelf
+    size_t exhaustedCount = 0;    // acquisitions refused because maxBuffers were all out
+    size_t failedAllocations = 0; // acquisitions refused because a new buffer could not be allocated
+    size_t buffersOnShelf = 0;
+};
+
+/**
+ * Hands out buffers of a single size for one stream at one resolution. The first few frames
+ * allocate; once maxBuffers have been created every frame reuses one that came back, so
+ * steady-state streaming does not touch the allocator.
+ *
+ * acquire() is safe to call from the accessory thread while consumers release on other threads.
+ */
+class FrameBufferPool
+{
+public:
+    FrameBufferPool (const FrameBufferPoolKey& key, size_t maxBuffers);
+    ~FrameBufferPool ();
+
+    const FrameBufferPoolKey& key () const { return _key; }
+    size_t bufferCapacity () const { return _key.frameSizeInBytes(); }
+
+    // Returns an empty ref if maxBuffers are all held by consumers, or if a new buffer could not be allocated.
+    // Callers should drop the frame.
+    FrameBufferRef acquire ();
+
+    // Frees the buffers sitting on the shelf. Buffers still held are freed on their last release.
+    void trim ();
+
+    FrameBufferPoolStats stats () const;
+
+private:
+    FrameBufferPool (const FrameBufferPool&) = delete;
+    FrameBufferPool& operator= (const FrameBufferPool&) = delete;
+
+    FrameBufferPoolKey _key;
+    std::shared_ptr<FrameBufferPoolShelf> _shelf;
+};
+
+/**
+ * The set of pools used by a sensor driver, one per (stream, resolution). Pools are created
+ * lazily on the first frame of a new configuration and kept around, so switching back and forth
+ * between stream configs does not reallocate.
+ */
+class FrameBufferPools
+{
+public:
+    // Default number of frames a consumer may hold on to per stream before frames get dropped.
+    enum { DefaultMaxBuffersPerPool = 8 };
+
+    explicit FrameBufferPools (size_t maxBuffersPerPool = DefaultMaxBuffersPerPool);
+
+    FrameBufferPool& poolFor (const FrameBufferPoolKey& key);
+
+    FrameBufferRef acquire (const FrameBufferPoolKey& key) { return poolFor(key).acquire(); }
+
+    // Releases shelved buffers for every pool, e.g. when streaming stops.
+    void trim ();
+
+private:
+    std::mutex _mutex;
+    size_t _maxBuffersPerPool;
+    std::vector<std::unique_ptr<FrameBufferPool>> _pools;
+};
+
+} // oc namespace
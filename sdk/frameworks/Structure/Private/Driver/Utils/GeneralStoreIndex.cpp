@@ -0,0 +1,193 @@
+//
+//  GeneralStoreIndex.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "GeneralStoreIndex.h"
+
+namespace oc {
+
+namespace {
+
+    const uint8_t ErasedHeaderType = 0xff;
+
+    inline uint16_t readLittleEndian16 (const uint8_t* p)
+    {
+        return uint16_t(p[0] | (p[1] << 8));
+    }
+
+    inline bool allZero (const uint8_t* p, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+            if (p[i] != 0)
+                return false;
+        return true;
+    }
+
+} // anonymous namespace
+
+void GeneralStoreIndex::clear ()
+{
+    _status = Status::NoCalibrationFile;
+    _corruptedOffset = 0;
+    _newerVersionDetected = false;
+    _hasCalibrationFile = false;
+    _calibrationFile = GeneralStoreCalibrationFileView {};
+    _entries.clear();
+    _values.clear();
+    _devices.clear();
+    _duplicates = 0;
+}
+
+GeneralStoreIndex::Status GeneralStoreIndex::fail (size_t offset)
+{
+    clear();
+    _status = Status::Corrupted;
+    _corruptedOffset = offset;
+    return _status;
+}
+
+GeneralStoreIndex::Status GeneralStoreIndex::parse (const uint8_t* data, size_t size, uint8_t calibrationFileVersion)
+{
+    clear();
+
+    size_t offset = 0;
+    while (offset < size)
+    {
+        const uint8_t* header = data + offset;
+        if (header[0] == ErasedHeaderType)
+            break;
+        if (size - offset < FileHeaderSize)
+            return fail(offset);
+
+        const uint8_t type = header[0];
+        const uint8_t encodingVersion = header[1];
+        const uint16_t typeSpecificInfo = readLittleEndian16(header + 2);
+        const size_t bodySize = size_t(readLittleEndian16(header + 4)) * 2;
+
+        if (size - offset - FileHeaderSize < bodySize)
+            return fail(offset);
+
+        const uint8_t* body = header + FileHeaderSize;
+
+        if (type == CalibrationFileDataType)
+        {
+            if (encodingVersion > calibrationFileVersion)
+            {
+                _newerVersionDetected = true;
+            }
+            else if (encodingVersion == calibrationFileVersion && !_hasCalibrationFile)
+            {
+                if (!parseCalibrationFile(data, body, bodySize))
+                    return fail(_corruptedOffset);
+
+                _hasCalibrationFile = true;
+                _calibrationFile.fileVersion = encodingVersion;
+                _calibrationFile.calibratorAppIdentifier = typeSpecificInfo;
+                _calibrationFile.body = GeneralStoreSpan { body, bodySize };
+            }
+        }
+
+        offset += FileHeaderSize + bodySize;
+    }
+
+    _status = _hasCalibrationFile ? Status::Ok : Status::NoCalibrationFile;
+    return _status;
+}
+
+bool GeneralStoreIndex::parseCalibrationFile (const uint8_t* base, const uint8_t* body, size_t size)
+{
+    size_t offset = 0;
+    while (offset < size)
+    {
+        const uint8_t* entry = body + offset;
+        const size_t remaining = size - offset;
+
+        // Padding up to the next word.
+        if (remaining < EntryHeaderSize && allZero(entry, remaining))
+            break;
+
+        const size_t entrySize = remaining >= EntryHeaderSize ? readLittleEndian16(entry + 1) : 0;
+        if (remaining < EntryHeaderSize || remaining - EntryHeaderSize < entrySize)
+        {
+            _corruptedOffset = size_t(entry - base);
+            return false;
+        }
+
+        if (!parseEntry(base, entry, EntryHeaderSize + entrySize))
+            return false;
+
+        offset += EntryHeaderSize + entrySize;
+    }
+
+    return true;
+}
+
+bool GeneralStoreIndex::parseEntry (const uint8_t* base, const uint8_t* entry, size_t size)
+{
+    const uint8_t entryType = entry[0];
+    int deviceIdentifier = NoDevice;
+    const uint8_t* deviceNameSha1 = nullptr;
+
+    _scratch.clear();
+
+    for (size_t offset = EntryHeaderSize; offset < size; )
+    {
+        const uint8_t* value = entry + offset;
+        const size_t remaining = size - offset;
+        const size_t valueSize = remaining >= ValueHeaderSize ? readLittleEndian16(value + 1) : 0;
+
+        if (remaining < ValueHeaderSize || remaining - ValueHeaderSize < valueSize)
+        {
+            _corruptedOffset = size_t(value - base);
+            return false;
+        }
+
+        const ValueHeader header { value[0], GeneralStoreSpan { value + ValueHeaderSize, valueSize } };
+
+        if (header.type == DeviceIdentifierValueType && valueSize == 1 && deviceIdentifier == NoDevice)
+            deviceIdentifier = header.value.data[0];
+        else if (header.type == DeviceNameSha1ValueType && valueSize == sizeof(Sha1) && deviceNameSha1 == nullptr)
+            deviceNameSha1 = header.value.data;
+
+        _scratch.push_back(header);
+        offset += ValueHeaderSize + valueSize;
+    }
+
+    if (deviceNameSha1 != nullptr && deviceIdentifier != NoDevice)
+    {
+        Sha1 sha1;
+        std::memcpy(sha1.data(), deviceNameSha1, sha1.size());
+        if (!_devices.emplace(sha1, deviceIdentifier).second)
+            ++_duplicates;
+    }
+
+    for (const ValueHeader& header : _scratch)
+        if (!_values.emplace(key(deviceIdentifier, entryType, header.type), header.value).second)
+            ++_duplicates;
+
+    _entries.push_back(GeneralStoreEntryView { entryType, deviceIdentifier, GeneralStoreSpan { entry, size } });
+    return true;
+}
+
+int GeneralStoreIndex::deviceIdentifier (const Sha1& deviceNameSha1) const
+{
+    auto found = _devices.find(deviceNameSha1);
+    return found != _devices.end() ? found->second : NoDevice;
+}
+
+GeneralStoreSpan GeneralStoreIndex::find (int deviceIdentifier, uint8_t entryType, uint8_t valueType) const
+{
+    auto found = _values.find(key(deviceIdentifier, entryType, valueType));
+    return found != _values.end() ? found->second : GeneralStoreSpan {};
+}
+
+GeneralStoreSpan GeneralStoreIndex::find (const Sha1& deviceNameSha1, uint8_t entryType, uint8_t valueType) const
+{
+    const int identifier = deviceIdentifier(deviceNameSha1);
+    return identifier != NoDevice ? find(identifier, entryType, valueType) : GeneralStoreSpan {};
+}
+
+} // oc namespace
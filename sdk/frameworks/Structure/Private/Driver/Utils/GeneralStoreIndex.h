@@ -0,0 +1,160 @@
+//
+//  GeneralStoreIndex.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace oc {
+
+/* Bytes inside the buffer passed to GeneralStoreIndex::parse(). */
+struct GeneralStoreSpan
+{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    bool empty () const { return data == nullptr; }
+
+    // Copies a fixed-size value (oc::Intrinsics, float, ...), only if the stored size matches exactly.
+    template <class T>
+    bool read (T& value) const
+    {
+        if (data == nullptr || size != sizeof(T))
+            return false;
+        std::memcpy(&value, data, sizeof(T));
+        return true;
+    }
+};
+
+/* One CalibratorEntryHeader and its values, as found in the calibration file. */
+struct GeneralStoreEntryView
+{
+    uint8_t type;               // GeneralStoreVersion2EntryType
+    int deviceIdentifier;       // GeneralStoreIndex::NoDevice for entries that are not device specific
+    GeneralStoreSpan bytes;     // header included, for writing the entry back unchanged
+};
+
+/* One GeneralStoreFileHeader with type GENERAL_STORE_DATA_TYPE_CALIBRATION_FILE. */
+struct GeneralStoreCalibrationFileView
+{
+    uint8_t fileVersion;        // encodingVersion
+    uint16_t calibratorAppIdentifier;
+    GeneralStoreSpan body;      // after the header
+};
+
+/**
+ * Index over a General Store image, replacing the object graph parseByteStream:length: builds.
+ *
+ * parse() walks the TLV structure once and validates every size against its container:
+ *
+ *     GeneralStoreFileHeader   type, encodingVersion, typeSpecificInfo, entrySizeInWords (16-bit words, header excluded)
+ *       CalibratorEntryHeader  type, entrySizeInBytes (header excluded)
+ *         CalibratorValueHeader type, valueSizeInBytes (header excluded)
+ *
+ * All integers are little endian, and a word of padding may follow the last entry of a file. A header type of 0xff
+ * (erased flash) ends the store.
+ *
+ * Values of the calibration file with fileVersion are indexed by (device identifier, entry type, value type). The
+ * device identifier of an entry is its DeviceIdentifier value, and entries holding a DeviceNameSha1 also map that SHA1
+ * to their identifier, so finding the current device's calibration is two hash lookups. The camera type is the entry
+ * type (built-in, wide angle, front facing). Entries without a DeviceIdentifier are indexed under NoDevice. When a
+ * key occurs twice, the first one wins, as in getCurrentDeviceCalibration:forCameraType:.
+ *
+ * Nothing is copied: spans point into the parsed buffer, which must outlive the index (or the next parse()). A
+ * corrupt image leaves the index empty. Not thread safe; parse once, then look up from any thread.
+ */
+class GeneralStoreIndex
+{
+public:
+    static const int NoDevice = -1;
+
+    enum class Status
+    {
+        Ok,
+        NoCalibrationFile,
+        Corrupted,
+    };
+
+    typedef std::array<uint8_t, 20> Sha1;
+
+    // Wire values this parser needs; see GeneralStoreDataType and CalibrationValueType.
+    static const uint8_t CalibrationFileDataType = 3;
+    static const uint8_t DeviceIdentifierValueType = 1;
+    static const uint8_t DeviceNameSha1ValueType = 6;
+
+    static const size_t FileHeaderSize = 6;
+    static const size_t EntryHeaderSize = 3;
+    static const size_t ValueHeaderSize = 3;
+
+    Status parse (const uint8_t* data, size_t size, uint8_t calibrationFileVersion);
+    void clear ();
+
+    Status status () const { return _status; }
+    // Byte offset of the first header that did not fit, when Corrupted.
+    size_t corruptedOffset () const { return _corruptedOffset; }
+    // A calibration file with a higher version than the one indexed (getNewerVersionCalibrationFilesDetected).
+    bool newerVersionDetected () const { return _newerVersionDetected; }
+
+    // Device identifier for a DeviceNameSha1, or NoDevice.
+    int deviceIdentifier (const Sha1& deviceNameSha1) const;
+
+    // Empty span if absent.
+    GeneralStoreSpan find (int deviceIdentifier, uint8_t entryType, uint8_t valueType) const;
+    GeneralStoreSpan find (const Sha1& deviceNameSha1, uint8_t entryType, uint8_t valueType) const;
+
+    const GeneralStoreCalibrationFileView* calibrationFile () const { return _hasCalibrationFile ? &_calibrationFile : nullptr; }
+    // In file order.
+    const std::vector<GeneralStoreEntryView>& entries () const { return _entries; }
+    size_t valueCount () const { return _values.size(); }
+    size_t duplicateCount () const { return _duplicates; }
+
+private:
+    struct Sha1Hash
+    {
+        size_t operator() (const Sha1& sha1) const
+        {
+            size_t hash;
+            std::memcpy(&hash, sha1.data(), sizeof(hash)); // already uniformly distributed
+            return hash;
+        }
+    };
+
+    struct ValueHeader
+    {
+        uint8_t type;
+        GeneralStoreSpan value;
+    };
+
+    static uint32_t key (int deviceIdentifier, uint8_t entryType, uint8_t valueType)
+    {
+        return (uint32_t(deviceIdentifier + 1) << 16) | (uint32_t(entryType) << 8) | valueType;
+    }
+
+    bool parseCalibrationFile (const uint8_t* base, const uint8_t* body, size_t size);
+    bool parseEntry (const uint8_t* base, const uint8_t* entry, size_t size);
+    Status fail (size_t offset);
+
+    Status _status = Status::NoCalibrationFile;
+    size_t _corruptedOffset = 0;
+    bool _newerVersionDetected = false;
+
+    bool _hasCalibrationFile = false;
+    GeneralStoreCalibrationFileView _calibrationFile {};
+    std::vector<GeneralStoreEntryView> _entries;
+    std::unordered_map<uint32_t, GeneralStoreSpan> _values;
+    std::unordered_map<Sha1, int, Sha1Hash> _devices;
+    size_t _duplicates = 0;
+
+    std::vector<ValueHeader> _scratch; // values of the entry being parsed
+};
+
+} // oc namespace
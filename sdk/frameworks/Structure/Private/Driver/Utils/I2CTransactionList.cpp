@@ -0,0 +1,283 @@
+//
+//  I2CTransactionList.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "I2CTransactionList.h"
+#include "PS1080Opcodes.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace oc {
+
+size_t I2CTransactionList::appendStep (I2CStepType type, uint8_t busId, uint8_t slaveAddress, const std::vector<uint8_t>& writeData, size_t readLength)
+{
+    if (writeData.size() > MaxStepBytes || readLength > MaxStepBytes)
+    {
+        _rejected = true;
+        return InvalidStep;
+    }
+
+    _payload.push_back(uint16_t(uint16_t(type) | (uint16_t(busId) << 8)));
+    _payload.push_back(slaveAddress);
+    _payload.push_back(uint16_t(writeData.size()));
+    _payload.push_back(uint16_t(readLength));
+
+    for (size_t i = 0; i < writeData.size(); i += 2)
+    {
+        const uint16_t low = writeData[i];
+        const uint16_t high = i + 1 < writeData.size() ? writeData[i + 1] : 0;
+        _payload.push_back(uint16_t(low | (high << 8)));
+    }
+
+    _steps.push_back({ type, type == I2CStepType::Delay ? uint16_t(0) : uint16_t(readLength) });
+    _payload[0] = uint16_t(_steps.size());
+    return _steps.size() - 1;
+}
+
+size_t I2CTransactionList::write (uint8_t busId, uint8_t slaveAddress, const uint8_t* data, size_t length)
+{
+    return appendStep(I2CStepType::Write, busId, slaveAddress, std::vector<uint8_t>(data, data + length), 0);
+}
+
+size_t I2CTransactionList::read (uint8_t busId, uint8_t slaveAddress, size_t length)
+{
+    return appendStep(I2CStepType::Read, busId, slaveAddress, std::vector<uint8_t>(), length);
+}
+
+size_t I2CTransactionList::writeRead (uint8_t busId, uint8_t slaveAddress, const uint8_t* data, size_t length, size_t readLength)
+{
+    return appendStep(I2CStepType::WriteRead, busId, slaveAddress, std::vector<uint8_t>(data, data + length), readLength);
+}
+
+size_t I2CTransactionList::delay (uint16_t microseconds)
+{
+    return appendStep(I2CStepType::Delay, 0, 0, std::vector<uint8_t>(), microseconds);
+}
+
+size_t I2CTransactionList::updateBits (uint8_t busId, uint8_t slaveAddress, const uint8_t* registerAddress, size_t registerAddressLength,
+                                       const uint8_t* mask, const uint8_t* value, size_t length)
+{
+    if (registerAddressLength + 2 * length > MaxStepBytes)
+    {
+        _rejected = true;
+        return InvalidStep;
+    }
+
+    std::vector<uint8_t> writeData (registerAddress, registerAddress + registerAddressLength);
+    writeData.insert(writeData.end(), mask, mask + length);
+    writeData.insert(writeData.end(), value, value + length);
+
+    return appendStep(I2CStepType::UpdateBits, busId, slaveAddress, writeData, length);
+}
+
+size_t I2CTransactionList::stepReadLength (size_t step) const
+{
+    // UpdateBits reads internally but returns nothing.
+    if (_steps[step].type == I2CStepType::UpdateBits)
+        return 0;
+
+    return _steps[step].readLength;
+}
+
+size_t I2CTransactionList::resultSizeInBytes () const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < _steps.size(); ++i)
+        size += stepReadLength(i);
+    return size;
+}
+
+size_t I2CTransactionList::replySizeInWords () const
+{
+    size_t words = 2;
+    for (size_t i = 0; i < _steps.size(); ++i)
+        words += (stepReadLength(i) + 1) / 2;
+    return words;
+}
+
+void I2CTransactionList::clear ()
+{
+    _steps.clear();
+    _rejected = false;
+    _payload.assign(1, 0);
+}
+
+const uint8_t* I2CTransactionResult::stepData (size_t step, size_t* length) const
+{
+    if (step >= completedSteps || step >= stepOffsets.size())
+        return nullptr;
+
+    const size_t end = step + 1 < stepOffsets.size() ? stepOffsets[step + 1] : data.size();
+    if (end == stepOffsets[step] || end > data.size())
+        return nullptr;
+
+    if (length)
+        *length = end - stepOffsets[step];
+
+    return data.data() + stepOffsets[step];
+}
+
+bool parseI2CTransactionReply (const I2CTransactionList& list, const uint16_t* payload, size_t payloadSize, I2CTransactionResult& result)
+{
+    result = I2CTransactionResult();
+
+    const size_t payloadWords = payload != nullptr ? payloadSize / sizeof(uint16_t) : 0;
+    if (payloadWords < 2)
+        return false;
+
+    result.acked = payload[0] == PS1080_REPLY_CODE_ACK;
+    result.completedSteps = payload[1];
+    if (result.completedSteps > list.stepCount())
+        return false;
+
+    result.data.reserve(list.resultSizeInBytes());
+    result.stepOffsets.resize(list.stepCount());
+
+    size_t cursor = 2;
+    for (size_t step = 0; step < list.stepCount(); ++step)
+    {
+        result.stepOffsets[step] = result.data.size();
+        if (step >= result.completedSteps)
+            continue;
+
+        const size_t length = list.stepReadLength(step);
+        const size_t words = (length + 1) / 2;
+        if (cursor + words > payloadWords)
+            return false;
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            const uint16_t word = payload[cursor + i / 2];
+            result.data.push_back(uint8_t((i & 1) ? word >> 8 : word & 0xff));
+        }
+        cursor += words;
+    }
+
+    return true;
+}
+
+namespace {
+
+    // Big endian, like the word address of every 24Cxx part
+    void encodeEEPROMAddress (uint16_t address, size_t addressLength, std::vector<uint8_t>& bytes)
+    {
+        if (addressLength > 1)
+            bytes.push_back(uint8_t(address >> 8));
+        bytes.push_back(uint8_t(address & 0xff));
+    }
+
+    // Calls appendPage(pageAddress, offset, chunk) for every page-bounded piece of [address, address + length).
+    template <class AppendPage>
+    bool forEachEEPROMPage (uint16_t address, size_t pageSize, size_t length, AppendPage&& appendPage)
+    {
+        size_t offset = 0;
+        while (offset < length)
+        {
+            const uint16_t pageAddress = uint16_t(address + offset);
+            size_t chunk = length - offset;
+            if (pageSize > 0)
+                chunk = std::min(chunk, pageSize - pageAddress % pageSize);
+
+            if (!appendPage(pageAddress, offset, chunk))
+                return false;
+
+            offset += chunk;
+        }
+        return true;
+    }
+
+    size_t appendEEPROMReadback (I2CTransactionList& list, uint8_t busId, uint8_t slaveAddress,
+                                 uint16_t address, size_t addressLength, size_t length)
+    {
+        std::vector<uint8_t> addressBytes;
+        encodeEEPROMAddress(address, addressLength, addressBytes);
+        return list.writeRead(busId, slaveAddress, addressBytes.data(), addressBytes.size(), length);
+    }
+
+} // anonymous namespace
+
+size_t appendI2CEEPROMWriteAndVerify (I2CTransactionList& list, uint8_t busId, uint8_t slaveAddress,
+                                      uint16_t address, size_t addressLength, size_t pageSize, uint16_t writeCycleMicroseconds,
+                                      const uint8_t* data, size_t length)
+{
+    const bool appended = forEachEEPROMPage(address, pageSize, length, [&] (uint16_t pageAddress, size_t offset, size_t chunk) {
+        std::vector<uint8_t> bytes;
+        encodeEEPROMAddress(pageAddress, addressLength, bytes);
+        bytes.insert(bytes.end(), data + offset, data + offset + chunk);
+
+        if (list.write(busId, slaveAddress, bytes.data(), bytes.size()) == I2CTransactionList::InvalidStep)
+            return false;
+        if (writeCycleMicroseconds > 0)
+            list.delay(writeCycleMicroseconds);
+        return true;
+    });
+
+    if (!appended)
+        return I2CTransactionList::InvalidStep;
+
+    return appendEEPROMReadback(list, busId, slaveAddress, address, addressLength, length);
+}
+
+bool verifyI2CEEPROMWrite (const I2CTransactionResult& result, size_t readbackStep, const uint8_t* data, size_t length)
+{
+    size_t readLength = 0;
+    const uint8_t* readback = result.stepData(readbackStep, &readLength);
+
+    return readback != nullptr && readLength == length && std::memcmp(readback, data, length) == 0;
+}
+
+size_t appendI2CEEPROMUpdateAndVerify (I2CTransactionList& list, uint8_t busId, uint8_t slaveAddress,
+                                       uint16_t address, size_t addressLength, size_t pageSize, uint16_t writeCycleMicroseconds,
+                                       const uint8_t* mask, const uint8_t* value, size_t length)
+{
+    const bool appended = forEachEEPROMPage(address, pageSize, length, [&] (uint16_t pageAddress, size_t offset, size_t chunk) {
+        std::vector<uint8_t> addressBytes;
+        encodeEEPROMAddress(pageAddress, addressLength, addressBytes);
+
+        if (list.updateBits(busId, slaveAddress, addressBytes.data(), addressBytes.size(),
+                            mask + offset, value + offset, chunk) == I2CTransactionList::InvalidStep)
+            return false;
+        if (writeCycleMicroseconds > 0)
+            list.delay(writeCycleMicroseconds);
+        return true;
+    });
+
+    if (!appended)
+        return I2CTransactionList::InvalidStep;
+
+    return appendEEPROMReadback(list, busId, slaveAddress, address, addressLength, length);
+}
+
+bool verifyI2CEEPROMUpdate (const I2CTransactionResult& result, size_t readbackStep, const uint8_t* mask, const uint8_t* value, size_t length)
+{
+    size_t readLength = 0;
+    const uint8_t* readback = result.stepData(readbackStep, &readLength);
+    if (readback == nullptr || readLength != length)
+        return false;
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        if ((readback[i] & mask[i]) != (value[i] & mask[i]))
+            return false;
+    }
+    return true;
+}
+
+void probeI2CTransactionListSupport (OpcodePipeline& pipeline, double timeoutSeconds, std::function<void (bool supported)> completion)
+{
+    if (!PS1080_EXTENSION_OPCODES_ENABLED)
+    {
+        if (completion)
+            completion(false);
+        return;
+    }
+
+    const uint16_t emptyList[] = { 0 };
+    probeOpcodeSupport(pipeline, PS1080Opcode_I2CTransactionList, emptyList, 1, timeoutSeconds, std::move(completion));
+}
+
+} // oc namespace
@@ -0,0 +1,135 @@
+//
+//  I2CTransactionList.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "OpcodePipeline.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace oc {
+
+enum class I2CStepType : uint8_t
+{
+    Write      = 1,
+    Read       = 2,
+    WriteRead  = 3, // write then repeated-start read, e.g. set a register pointer and read from it
+    Delay      = 4,
+    UpdateBits = 5, // firmware side read-modify-write: reads length bytes at a register, applies mask/value, writes them back
+};
+
+/**
+ * A list of I2C steps, possibly across several buses and slaves, executed by the firmware as one
+ * PS1080Opcode_I2CTransactionList request with a single reply.
+ *
+ * Request payload: [stepCount] then per step a 4-word header
+ *     [type | busId << 8][slaveAddress][writeLength][readLength]
+ * followed by writeLength bytes packed little-endian into words. Delay steps carry the delay in microseconds
+ * in readLength. UpdateBits steps carry the register address, then readLength mask bytes, then readLength
+ * value bytes, in that order, and writeLength counts all of them.
+ *
+ * Reply payload: [replyCode][completedSteps] then, for each completed step that reads, its bytes padded to a word.
+ * The firmware stops at the first step that fails (NACK from the slave, bus timeout).
+ *
+ * Lengths are 16-bit on the wire. A step whose write data or read length does not fit is not appended: the method
+ * returns InvalidStep and the list is marked rejected, so it can't be sent with a step silently missing.
+ *
+ * PS1080Opcode_I2CTransactionList is not in any released firmware (see PS1080Opcodes.h). Only send a list after
+ * probeI2CTransactionListSupport() succeeded; otherwise run the steps one I2C opcode at a time.
+ */
+class I2CTransactionList
+{
+public:
+    static const size_t InvalidStep = size_t(-1);
+    static const size_t MaxStepBytes = 0xffff;
+
+    // Each returns the index of the step, used to find its data in I2CTransactionResult, or InvalidStep.
+    size_t write (uint8_t busId, uint8_t slaveAddress, const uint8_t* data, size_t length);
+    size_t read (uint8_t busId, uint8_t slaveAddress, size_t length);
+    size_t writeRead (uint8_t busId, uint8_t slaveAddress, const uint8_t* data, size_t length, size_t readLength);
+    size_t delay (uint16_t microseconds);
+    size_t updateBits (uint8_t busId, uint8_t slaveAddress, const uint8_t* registerAddress, size_t registerAddressLength,
+                       const uint8_t* mask, const uint8_t* value, size_t length);
+
+    size_t stepCount () const { return _steps.size(); }
+    // A step was refused; the list must not be sent.
+    bool rejected () const { return _rejected; }
+    I2CStepType stepType (size_t step) const { return _steps[step].type; }
+    size_t stepReadLength (size_t step) const;
+
+    // Total read bytes, before padding.
+    size_t resultSizeInBytes () const;
+
+    // The reply is 2 words plus every read padded to a word; check it against the session MTU as well as the payload.
+    size_t replySizeInWords () const;
+
+    const std::vector<uint16_t>& payload () const { return _payload; }
+
+    void clear ();
+
+private:
+    struct Step
+    {
+        I2CStepType type;
+        uint16_t readLength;
+    };
+
+    size_t appendStep (I2CStepType type, uint8_t busId, uint8_t slaveAddress, const std::vector<uint8_t>& writeData, size_t readLength);
+
+    std::vector<Step> _steps;
+    bool _rejected = false;
+    std::vector<uint16_t> _payload = std::vector<uint16_t>(1, 0);
+};
+
+/* The data read by a list, one contiguous buffer with an offset per step. */
+struct I2CTransactionResult
+{
+    bool acked = false;
+    size_t completedSteps = 0;
+    std::vector<uint8_t> data;
+    std::vector<size_t> stepOffsets; // one per step of the list; reads of steps that did not complete are not in data
+
+    bool succeeded (size_t stepCount) const { return acked && completedSteps == stepCount; }
+
+    // Returns null if the step did not complete or does not read.
+    const uint8_t* stepData (size_t step, size_t* length = nullptr) const;
+};
+
+/* payloadSize is in bytes and includes the reply code. Returns false if the reply is malformed. */
+bool parseI2CTransactionReply (const I2CTransactionList& list, const uint16_t* payload, size_t payloadSize, I2CTransactionResult& result);
+
+/**
+ * Appends a page-aware write and verify of a 24Cxx-style EEPROM: writes are split at pageSize boundaries, each
+ * followed by writeCycleMicroseconds of delay, then the whole range is read back. Returns the step index of the
+ * readback, compare it with verifyI2CEEPROMWrite(), or InvalidStep.
+ */
+size_t appendI2CEEPROMWriteAndVerify (I2CTransactionList& list, uint8_t busId, uint8_t slaveAddress,
+                                      uint16_t address, size_t addressLength, size_t pageSize, uint16_t writeCycleMicroseconds,
+                                      const uint8_t* data, size_t length);
+
+bool verifyI2CEEPROMWrite (const I2CTransactionResult& result, size_t readbackStep, const uint8_t* data, size_t length);
+
+/**
+ * Read-modify-write-verify in one request: for every page, an UpdateBits step sets the bits in mask to value
+ * (the firmware reads the bytes, merges and writes them back), then writeCycleMicroseconds of delay; the whole
+ * range is read back at the end. Bits outside mask keep whatever the EEPROM held. Returns the step index of the
+ * readback, compare it with verifyI2CEEPROMUpdate(), or InvalidStep.
+ */
+size_t appendI2CEEPROMUpdateAndVerify (I2CTransactionList& list, uint8_t busId, uint8_t slaveAddress,
+                                       uint16_t address, size_t addressLength, size_t pageSize, uint16_t writeCycleMicroseconds,
+                                       const uint8_t* mask, const uint8_t* value, size_t length);
+
+// True if the readback has value in every bit of mask.
+bool verifyI2CEEPROMUpdate (const I2CTransactionResult& result, size_t readbackStep, const uint8_t* mask, const uint8_t* value, size_t length);
+
+/* Sends an empty list, which firmware implementing the opcode ACKs. Always reports false unless
+   PS1080_EXTENSION_OPCODES_ENABLED. */
+void probeI2CTransactionListSupport (OpcodePipeline& pipeline, double timeoutSeconds, std::function<void (bool supported)> completion);
+
+} // oc namespace
@@ -0,0 +1,195 @@
+//
+//  MappedFile.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace oc {
+
+MappedFile::~MappedFile ()
+{
+    close();
+}
+
+MappedFile::MappedFile (MappedFile&& other)
+: _data(other._data), _size(other._size), _open(other._open)
+{
+    other._data = nullptr;
+    other._size = 0;
+    other._open = false;
+}
+
+MappedFile& MappedFile::operator= (MappedFile&& other)
+{
+    if (this != &other)
+    {
+        close();
+        _data = other._data;
+        _size = other._size;
+        _open = other._open;
+        other._data = nullptr;
+        other._size = 0;
+        other._open = false;
+    }
+    return *this;
+}
+
+bool MappedFile::open (const std::string& path)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    if (info.st_size > 0)
+    {
+        void* mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        _data = static_cast<const uint8_t*>(mapping);
+        _size = size_t(info.st_size);
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    _open = true;
+    return true;
+}
+
+void MappedFile::close ()
+{
+    if (_data)
+        munmap(const_cast<uint8_t*>(_data), _size);
+
+    _data = nullptr;
+    _size = 0;
+    _open = false;
+}
+
+void MappedFile::adviseSequential () const
+{
+    if (_data)
+        madvise(const_cast<uint8_t*>(_data), _size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::evict (size_t offset, size_t size) const
+{
+    if (!_data || offset >= _size)
+        return;
+
+    const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+    const size_t end = std::min(_size, offset + std::min(size, _size - offset));
+    const size_t first = (offset + pageSize - 1) / pageSize * pageSize;
+    const size_t last = (end == _size) ? end : end / pageSize * pageSize;
+
+    if (last > first)
+        madvise(const_cast<uint8_t*>(_data) + first, last - first, MADV_DONTNEED);
+}
+
+bool writeFileAtomically (const std::string& path, const void* data, size_t size)
+{
+    std::string temporary = path + ".XXXXXX";
+
+    const int fd = mkstemp(&temporary[0]);
+    if (fd < 0)
+        return false;
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    size_t written = 0;
+    bool succeeded = true;
+
+    while (written < size)
+    {
+        const ssize_t result = write(fd, bytes + written, size - written);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+        {
+            succeeded = false;
+            break;
+        }
+        written += size_t(result);
+    }
+
+    succeeded = succeeded && fsync(fd) == 0;
+    succeeded = (::close(fd) == 0) && succeeded;
+    succeeded = succeeded && rename(temporary.c_str(), path.c_str()) == 0;
+
+    if (!succeeded)
+        unlink(temporary.c_str());
+
+    return succeeded;
+}
+
+bool createDirectories (const std::string& path)
+{
+    if (path.empty())
+        return false;
+
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+    {
+        const std::string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+
+        if (slash == std::string::npos)
+            break;
+    }
+
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+bool removeRecursively (const std::string& path)
+{
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0)
+        return errno == ENOENT;
+
+    if (S_ISDIR(info.st_mode))
+    {
+        DIR* directory = opendir(path.c_str());
+        if (directory)
+        {
+            while (struct dirent* entry = readdir(directory))
+            {
+                if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+                    continue;
+                removeRecursively(path + "/" + entry->d_name);
+            }
+            closedir(directory);
+        }
+        return rmdir(path.c_str()) == 0;
+    }
+
+    return unlink(path.c_str()) == 0;
+}
+
+} // oc namespace
@@ -0,0 +1,58 @@
+//
+//  MappedFile.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace oc {
+
+/* A read-only memory mapping of a whole file, unmapped on destruction. Empty files open fine and have data() == nullptr. */
+class MappedFile
+{
+public:
+    MappedFile () = default;
+    ~MappedFile ();
+
+    MappedFile (MappedFile&& other);
+    MappedFile& operator= (MappedFile&& other);
+
+    MappedFile (const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    // Returns false (and leaves the object closed) if the file cannot be opened or mapped.
+    bool open (const std::string& path);
+    void close ();
+
+    bool isOpen () const { return _open; }
+    const uint8_t* data () const { return _data; }
+    size_t size () const { return _size; }
+
+    // Hints for large read-once files such as firmware images. The pages are clean and file backed, so evicting them
+    // only costs a re-read from disk if they are touched again. evict() rounds inwards to whole pages.
+    void adviseSequential () const;
+    void evict (size_t offset, size_t size) const;
+
+private:
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+    bool _open = false;
+};
+
+/* Writes data to path atomically: a temporary file in the same directory is written, flushed to disk and renamed
+   over path, so readers see either the old file or the new one, never a torn write. */
+bool writeFileAtomically (const std::string& path, const void* data, size_t size);
+
+// Creates path and its missing parents, like mkdir -p.
+bool createDirectories (const std::string& path);
+
+// Removes path and everything below it. Returns true if nothing is left.
+bool removeRecursively (const std::string& path);
+
+} // oc namespace
@@ -0,0 +1,70 @@
+//
+//  MappedFirmwarePackage.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "MappedFirmwarePackage.h"
+
+#include <algorithm>
+
+namespace oc {
+
+MappedByteView mapFileView (const std::string& path)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path))
+        return MappedByteView();
+
+    file->adviseSequential();
+
+    const size_t size = file->size();
+    return MappedByteView(std::move(file), 0, size);
+}
+
+MappedChunkReader::MappedChunkReader (const MappedByteView& view, size_t maxChunkBytes)
+: _view(view),
+  _maxChunkBytes(std::max<size_t>(1, maxChunkBytes))
+{
+}
+
+MappedByteView MappedChunkReader::next ()
+{
+    if (_previousChunkStart > _evictedBytes)
+    {
+        _view.evict(_evictedBytes, _previousChunkStart - _evictedBytes);
+        _evictedBytes = _previousChunkStart;
+    }
+
+    MappedByteView chunk = _view.subview(_position, _maxChunkBytes);
+    _previousChunkStart = _position;
+    _position += chunk.size();
+    return chunk;
+}
+
+void MappedChunkReader::seek (size_t offset)
+{
+    _position = std::min(offset, _view.size());
+    _previousChunkStart = _position;
+    _evictedBytes = std::min(_evictedBytes, _position);
+}
+
+bool MappedFirmwarePackage::open (const std::string& ps1080ApplicationPath, const std::string& xmegaApplicationPath, const std::string& xmegaUpdaterPath)
+{
+    MappedByteView ps1080, xmega, updater;
+
+    if (!ps1080ApplicationPath.empty() && !(ps1080 = mapFileView(ps1080ApplicationPath)).file())
+        return false;
+    if (!xmegaApplicationPath.empty() && !(xmega = mapFileView(xmegaApplicationPath)).file())
+        return false;
+    if (!xmegaUpdaterPath.empty() && !(updater = mapFileView(xmegaUpdaterPath)).file())
+        return false;
+
+    ps1080Application = ps1080;
+    xmegaApplication = xmega;
+    xmegaUpdater = updater;
+    return true;
+}
+
+} // oc namespace
@@ -0,0 +1,122 @@
+//
+//  MappedFirmwarePackage.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace oc {
+
+/* A read-only byte range that keeps its mapping alive. Copies share the mapping; a view with no file wraps memory
+   owned elsewhere (e.g. images compiled into the binary) and must not outlive it. */
+class MappedByteView
+{
+public:
+    MappedByteView () = default;
+
+    MappedByteView (std::shared_ptr<const MappedFile> file, size_t offset, size_t size)
+    : _file(std::move(file))
+    {
+        if (_file && offset < _file->size())
+        {
+            _data = _file->data() + offset;
+            _size = std::min(size, _file->size() - offset);
+        }
+    }
+
+    static MappedByteView unowned (const uint8_t* data, size_t size)
+    {
+        MappedByteView view;
+        view._data = data;
+        view._size = size;
+        return view;
+    }
+
+    const uint8_t* data () const { return _data; }
+    size_t size () const { return _size; }
+    bool empty () const { return _size == 0; }
+
+    // Clamped to this view.
+    MappedByteView subview (size_t offset, size_t size) const
+    {
+        MappedByteView view (*this);
+        offset = std::min(offset, _size);
+        view._data = _data ? _data + offset : nullptr;
+        view._size = std::min(size, _size - offset);
+        return view;
+    }
+
+    // Drops the pages of [offset, offset + size) of this view from memory. No-op for unowned views.
+    void evict (size_t offset, size_t size) const
+    {
+        if (_file && _data && offset < _size)
+            _file->evict(size_t(_data - _file->data()) + offset, std::min(size, _size - offset));
+    }
+
+    const std::shared_ptr<const MappedFile>& file () const { return _file; }
+
+private:
+    std::shared_ptr<const MappedFile> _file;
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+};
+
+// Maps a whole file. Returns an empty view if it cannot be mapped.
+MappedByteView mapFileView (const std::string& path);
+
+/**
+ * Hands out a view in chunks of at most maxChunkBytes, for upload loops that send the image straight from the
+ * mapping. Everything before the previous chunk is evicted as it goes, so resident memory stays around two chunks
+ * plus read-ahead however large the image is. The previous chunk stays resident for a resend.
+ */
+class MappedChunkReader
+{
+public:
+    MappedChunkReader (const MappedByteView& view, size_t maxChunkBytes);
+
+    // Returns an empty view at the end.
+    MappedByteView next ();
+
+    // Goes back to offset, e.g. to resend after an upload error. Pages fault back in from the file.
+    void seek (size_t offset);
+
+    size_t position () const { return _position; }
+    bool finished () const { return _position >= _view.size(); }
+
+private:
+    MappedByteView _view;
+    size_t _maxChunkBytes;
+    size_t _position = 0;
+    size_t _previousChunkStart = 0;
+    size_t _evictedBytes = 0;
+};
+
+/**
+ * The images of a firmware update, each mapped straight from its .fla file. The PS1080File objects built from it
+ * wrap the views without copying, and the uploads read from them with MappedChunkReader, so each image is in memory
+ * at most once, as clean pages the OS can drop under pressure.
+ */
+struct MappedFirmwarePackage
+{
+    MappedByteView ps1080Application;
+    MappedByteView xmegaApplication;
+    MappedByteView xmegaUpdater;
+
+    // Empty paths leave the corresponding view empty. Returns false if a non-empty path cannot be mapped.
+    bool open (const std::string& ps1080ApplicationPath, const std::string& xmegaApplicationPath, const std::string& xmegaUpdaterPath);
+
+    size_t mappedBytes () const { return ps1080Application.size() + xmegaApplication.size() + xmegaUpdater.size(); }
+};
+
+} // oc namespace
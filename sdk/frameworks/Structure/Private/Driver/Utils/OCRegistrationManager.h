@@ -10,6 +10,7 @@
 #import <Foundation/Foundation.h>
 
 #include "PSConfigs.h"
+#include "RegistrationParamsCache.h"
 
 #include <Core/Intrinsics.h>
 
@@ -46,6 +47,12 @@ typedef struct {
                                        registrationParams:(struct Registration*)registrationParams
                                          forceZeroLatchID:(bool)forceZeroLatchID;
 
+// Both compute methods above look their result up here first (see RegistrationParamsCache.h), keyed by the RGB
+// intrinsics, the extrinsics, the config and the quantized lens position; only the latch ID bookkeeping runs on a hit.
+// uploadCalibrationWithData: invalidates it.
+@property (nonatomic, readonly) oc::RegistrationParamsCache* registrationParamsCache;
+- (void) invalidateRegistrationParamsCache;
+
 //- (void) createAndUploadGeneralStore:(bool)includeIntrinsics;
 
 
@@ -0,0 +1,379 @@
+//
+//  OpcodePipeline.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "OpcodePipeline.h"
+#include "PS1080ControlFraming.h"
+#include "PS1080Opcodes.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace oc {
+
+namespace {
+
+    // STError codes (SensorCommunicationController.h) surfaced to callers for each way a request can fail.
+    enum
+    {
+        NoSensorAttachedError = 100,
+        FirmwareReplyCodeBadError = 104,
+        OpcodeTimedOutError = 120,
+        OpcodeCancelledError = 121,
+    };
+
+    void recordFailure (OpcodeStats& stats, uint16_t opcode, OpcodeRequestStatus status)
+    {
+        switch (status)
+        {
+            case OpcodeRequestStatus::TimedOut:
+                stats.recordTimedOut(opcode);
+                stats.recordError(opcode, OpcodeTimedOutError);
+                break;
+            case OpcodeRequestStatus::Cancelled:
+                stats.recordCancelled(opcode);
+                stats.recordError(opcode, OpcodeCancelledError);
+                break;
+            default:
+                stats.recordDisconnected(opcode);
+                stats.recordError(opcode, NoSensorAttachedError);
+                break;
+        }
+    }
+
+} // anonymous namespace
+
+OpcodePipeline::OpcodePipeline (SendFunction send, size_t maxOutstanding, Clock clock)
+: _send(std::move(send)), _clock(std::move(clock))
+{
+    _maxOutstanding = std::max<size_t>(1, std::min<size_t>(maxOutstanding, MaxOutstandingLimit));
+}
+
+double OpcodePipeline::now () const
+{
+    if (_clock)
+        return _clock();
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+OpcodePipeline::Ticket OpcodePipeline::submit (uint16_t opcode, const uint16_t* payload, size_t payloadSizeInWords,
+                                               double timeoutSeconds, OpcodeResponseCallback callback)
+{
+    Ticket ticket;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        ticket = _nextTicket++;
+        if (_nextTicket == 0)
+            _nextTicket = 1;
+
+        Request request;
+        request.ticket = ticket;
+        request.opcode = opcode;
+        request.payload.assign(payload, payload + payloadSizeInWords);
+        request.timeoutSeconds = timeoutSeconds;
+        request.callback = std::move(callback);
+        _queue.push_back(std::move(request));
+
+        pumpLocked();
+    }
+
+    flushSends();
+    return ticket;
+}
+
+bool OpcodePipeline::allocateSeqLocked (double now, uint8_t& seq)
+{
+    for (int attempt = 0; attempt < 256; ++attempt)
+    {
+        const uint8_t candidate = _nextSeq++;
+        const Slot& slot = _slots[candidate];
+
+        if (!slot.inFlight && slot.quarantinedUntil <= now)
+        {
+            seq = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void OpcodePipeline::pumpLocked ()
+{
+    const double time = now();
+
+    while (!_queue.empty() && _outstanding < _maxOutstanding)
+    {
+        uint8_t seq;
+        if (!allocateSeqLocked(time, seq))
+            break; // everything is in flight or quarantined, try again on the next response or timeout check
+
+        Request request = std::move(_queue.front());
+        _queue.pop_front();
+
+        Slot& slot = _slots[seq];
+        slot.inFlight = true;
+        slot.opcode = request.opcode;
+        slot.ticket = request.ticket;
+        slot.sentAt = time;
+        slot.deadline = request.timeoutSeconds > 0 ? time + request.timeoutSeconds : NoDeadline;
+        slot.callback = std::move(request.callback);
+        ++_outstanding;
+
+        _outgoing.push_back({ seq, request.ticket, request.opcode, std::move(request.payload) });
+    }
+}
+
+void OpcodePipeline::flushSends ()
+{
+    std::unique_lock<std::mutex> lock (_mutex);
+
+    // Whoever is already sending drains the queue, which keeps the wire in submission order.
+    if (_sending)
+        return;
+    _sending = true;
+
+    while (!_outgoing.empty())
+    {
+        Outgoing message = std::move(_outgoing.front());
+        _outgoing.pop_front();
+
+        // Cancelled or failed before it went out.
+        if (!_slots[message.seq].inFlight || _slots[message.seq].ticket != message.ticket)
+            continue;
+
+        _slots[message.seq].sentAt = now();
+        if (_stats)
+            _stats->recordSent(message.opcode, sizeof(PS1080ControlHeader) + message.payload.size() * sizeof(uint16_t));
+
+        // The send happens without the lock, so a transport may answer from inside it.
+        lock.unlock();
+        const bool sent = _send(message.opcode, message.seq, message.payload.data(), message.payload.size());
+        lock.lock();
+
+        Slot& slot = _slots[message.seq];
+        if (sent || !slot.inFlight || slot.ticket != message.ticket)
+            continue;
+
+        if (_stats)
+            recordFailure(*_stats, message.opcode, OpcodeRequestStatus::Disconnected);
+
+        std::vector<Finished> failed;
+        failed.push_back({ std::move(slot.callback), OpcodeRequestStatus::Disconnected });
+        slot = Slot();
+        --_outstanding;
+        pumpLocked();
+
+        lock.unlock();
+        notify(failed);
+        lock.lock();
+    }
+
+    _sending = false;
+}
+
+void OpcodePipeline::notify (std::vector<Finished>& finished)
+{
+    for (Finished& request : finished)
+    {
+        if (request.callback)
+            request.callback(request.status, 0xffff, nullptr, 0);
+    }
+}
+
+bool OpcodePipeline::cancel (Ticket ticket)
+{
+    std::vector<Finished> finished;
+    bool found = false;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        auto queued = std::find_if(_queue.begin(), _queue.end(), [ticket] (const Request& request) { return request.ticket == ticket; });
+        if (queued != _queue.end())
+        {
+            finished.push_back({ std::move(queued->callback), OpcodeRequestStatus::Cancelled });
+            _queue.erase(queued);
+            found = true;
+        }
+        else
+        {
+            const double time = now();
+            for (Slot& slot : _slots)
+            {
+                if (slot.inFlight && slot.ticket == ticket)
+                {
+                    if (_stats)
+                        recordFailure(*_stats, slot.opcode, OpcodeRequestStatus::Cancelled);
+
+                    finished.push_back({ std::move(slot.callback), OpcodeRequestStatus::Cancelled });
+                    slot = Slot();
+                    slot.quarantinedUntil = time + quarantineSeconds;
+                    --_outstanding;
+                    found = true;
+                    break;
+                }
+            }
+
+            pumpLocked();
+        }
+    }
+
+    notify(finished);
+    flushSends();
+    return found;
+}
+
+bool OpcodePipeline::handleResponse (uint16_t opcode, uint8_t seq, const uint16_t* payload, size_t payloadSize)
+{
+    OpcodeResponseCallback callback;
+    const uint16_t replyCode = (payload != nullptr && payloadSize >= sizeof(uint16_t)) ? payload[0] : 0xffff;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        Slot& slot = _slots[seq];
+        if (!slot.inFlight || slot.opcode != opcode)
+            return false;
+
+        if (_stats)
+        {
+            _stats->recordCompleted(opcode, replyCode, sizeof(PS1080ControlHeader) + payloadSize, now() - slot.sentAt);
+            if (replyCode != PS1080_REPLY_CODE_ACK)
+                _stats->recordError(opcode, FirmwareReplyCodeBadError);
+        }
+
+        callback = std::move(slot.callback);
+        slot = Slot();
+        --_outstanding;
+
+        pumpLocked();
+    }
+
+    if (callback)
+        callback(OpcodeRequestStatus::Completed, replyCode, payload, payloadSize);
+
+    flushSends();
+    return true;
+}
+
+void OpcodePipeline::checkTimeouts ()
+{
+    std::vector<Finished> finished;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        const double time = now();
+        for (Slot& slot : _slots)
+        {
+            if (slot.inFlight && slot.deadline != NoDeadline && slot.deadline <= time)
+            {
+                if (_stats)
+                    recordFailure(*_stats, slot.opcode, OpcodeRequestStatus::TimedOut);
+
+                finished.push_back({ std::move(slot.callback), OpcodeRequestStatus::TimedOut });
+                slot = Slot();
+                slot.quarantinedUntil = time + quarantineSeconds;
+                --_outstanding;
+            }
+        }
+
+        pumpLocked();
+    }
+
+    notify(finished);
+    flushSends();
+}
+
+void OpcodePipeline::failAll (OpcodeRequestStatus status)
+{
+    std::vector<Finished> finished;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        for (Slot& slot : _slots)
+        {
+            if (slot.inFlight)
+            {
+                if (_stats)
+                    recordFailure(*_stats, slot.opcode, status);
+
+                finished.push_back({ std::move(slot.callback), status });
+            }
+
+            // A new session starts with a clean seq space.
+            slot = Slot();
+        }
+
+        for (Request& request : _queue)
+            finished.push_back({ std::move(request.callback), status });
+
+        _queue.clear();
+        _outgoing.clear();
+        _outstanding = 0;
+    }
+
+    notify(finished);
+}
+
+double OpcodePipeline::nextDeadline () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    double deadline = -1;
+    for (const Slot& slot : _slots)
+    {
+        if (slot.inFlight && slot.deadline != NoDeadline && (deadline < 0 || slot.deadline < deadline))
+            deadline = slot.deadline;
+    }
+    return deadline;
+}
+
+void OpcodePipeline::setMaxOutstanding (size_t maxOutstanding)
+{
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        _maxOutstanding = std::max<size_t>(1, std::min<size_t>(maxOutstanding, MaxOutstandingLimit));
+        pumpLocked();
+    }
+
+    flushSends();
+}
+
+size_t OpcodePipeline::maxOutstanding () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _maxOutstanding;
+}
+
+size_t OpcodePipeline::outstandingCount () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _outstanding;
+}
+
+size_t OpcodePipeline::queuedCount () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _queue.size();
+}
+
+void probeOpcodeSupport (OpcodePipeline& pipeline, uint16_t opcode, const uint16_t* payload, size_t payloadSizeInWords,
+                         double timeoutSeconds, std::function<void (bool supported)> completion)
+{
+    pipeline.submit(opcode, payload, payloadSizeInWords, timeoutSeconds,
+                    [completion] (OpcodeRequestStatus status, uint16_t replyCode, const uint16_t*, size_t) {
+        if (completion)
+            completion(status == OpcodeRequestStatus::Completed && replyCode == PS1080_REPLY_CODE_ACK);
+    });
+}
+
+} // oc namespace
@@ -0,0 +1,160 @@
+//
+//  OpcodePipeline.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "OpcodeStats.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace oc {
+
+enum class OpcodeRequestStatus
+{
+    Completed,
+    TimedOut,
+    Cancelled,
+    Disconnected, // failAll() was called, usually because the control session closed
+};
+
+/* replyCode/payload/payloadSize follow OpcodeResponseHandlerBlock: payload includes the reply code and
+   payloadSize is in bytes. payload is only valid for the duration of the call, and is null unless status is Completed. */
+typedef std::function<void (OpcodeRequestStatus status, uint16_t replyCode, const uint16_t* payload, size_t payloadSize)> OpcodeResponseCallback;
+
+/**
+ * Keeps up to maxOutstanding PS1080 opcodes in flight on the control session.
+ *
+ * Every request gets an 8-bit seq (see PS_ENCODING_SEQ) that is unique among the requests in flight. Responses
+ * are matched through a 256-entry table indexed by seq, so dispatch is O(1) no matter how deep the window is.
+ * Requests beyond the window wait in FIFO order and are sent as soon as a slot frees up.
+ *
+ * A seq whose request timed out or was cancelled is not handed out again for quarantineSeconds, so a late reply
+ * cannot be mistaken for the answer to a newer request.
+ *
+ * A timeout of 0 (or less) means the request waits for its reply forever, as with OpcodeResponseHandler.
+ *
+ * All methods are thread safe. Callbacks and the send function are invoked without the internal lock held, on the
+ * thread that triggered them (submit, handleResponse, checkTimeouts, cancel or failAll), so a transport may answer
+ * synchronously from inside send. Requests still reach send in submission order: only one thread sends at a time,
+ * and the others leave their requests to it.
+ */
+class OpcodePipeline
+{
+public:
+    // Writes one framed opcode to the sensor. Returns false if the write failed, which fails the request as Disconnected.
+    typedef std::function<bool (uint16_t opcode, uint8_t seq, const uint16_t* payload, size_t payloadSizeInWords)> SendFunction;
+
+    // Monotonic time in seconds.
+    typedef std::function<double ()> Clock;
+
+    // Handed back by submit(), used to cancel a request. Never 0.
+    typedef uint32_t Ticket;
+
+    enum { DefaultMaxOutstanding = 8 };
+    enum { MaxOutstandingLimit = 128 }; // half the seq space, leaves room for quarantined seqs
+
+    explicit OpcodePipeline (SendFunction send, size_t maxOutstanding = DefaultMaxOutstanding, Clock clock = Clock());
+
+    Ticket submit (uint16_t opcode, const uint16_t* payload, size_t payloadSizeInWords, double timeoutSeconds, OpcodeResponseCallback callback);
+
+    // Returns false if the request already finished.
+    bool cancel (Ticket ticket);
+
+    // Returns false if no request in flight matches (opcode, seq), e.g. a reply that arrived after its request timed out.
+    bool handleResponse (uint16_t opcode, uint8_t seq, const uint16_t* payload, size_t payloadSize);
+
+    // Fails every request whose deadline has passed, then fills the freed slots. Call periodically, e.g. from the accessory thread's timer.
+    void checkTimeouts ();
+
+    // Fails every queued and in-flight request with the given status. Used on disconnect.
+    void failAll (OpcodeRequestStatus status = OpcodeRequestStatus::Disconnected);
+
+    // Earliest deadline among the requests in flight, or a negative number if none of them has one.
+    double nextDeadline () const;
+
+    void setMaxOutstanding (size_t maxOutstanding);
+    size_t maxOutstanding () const;
+
+    size_t outstandingCount () const;
+    size_t queuedCount () const;
+
+    double quarantineSeconds = 2.0;
+
+    // Every opcode sent, answered, timed out or cancelled is recorded here. Set it before the first submit(); not owned.
+    void setStats (OpcodeStats* stats) { _stats = stats; }
+    OpcodeStats* stats () const { return _stats; }
+
+private:
+    static constexpr double NoDeadline = -1;
+
+    struct Request
+    {
+        Ticket ticket = 0;
+        uint16_t opcode = 0;
+        std::vector<uint16_t> payload;
+        double timeoutSeconds = 0;
+        OpcodeResponseCallback callback;
+    };
+
+    struct Slot
+    {
+        bool inFlight = false;
+        uint16_t opcode = 0;
+        Ticket ticket = 0;
+        double sentAt = 0;
+        double deadline = NoDeadline;
+        double quarantinedUntil = 0;
+        OpcodeResponseCallback callback;
+    };
+
+    struct Outgoing
+    {
+        uint8_t seq;
+        Ticket ticket;
+        uint16_t opcode;
+        std::vector<uint16_t> payload;
+    };
+
+    struct Finished
+    {
+        OpcodeResponseCallback callback;
+        OpcodeRequestStatus status;
+    };
+
+    double now () const;
+    bool allocateSeqLocked (double now, uint8_t& seq);
+    void pumpLocked ();
+    void flushSends ();
+    static void notify (std::vector<Finished>& finished);
+
+    SendFunction _send;
+    Clock _clock;
+    OpcodeStats* _stats = nullptr;
+
+    mutable std::mutex _mutex;
+    size_t _maxOutstanding;
+    size_t _outstanding = 0;
+    uint8_t _nextSeq = 0;
+    Ticket _nextTicket = 1;
+    Slot _slots[256];
+    std::deque<Request> _queue;
+    std::deque<Outgoing> _outgoing; // assigned a seq, not sent yet
+    bool _sending = false;
+};
+
+/* Sends opcode once with the given payload and reports whether the firmware ACKed it. ILLEGAL_OPCODE, any other
+   reply code or a transport failure mean no. Used at connect to detect the optional extension opcodes
+   (PS1080_EXTENSION_OPCODES_ENABLED); the payload should be a no-op for firmware that does implement the opcode. */
+void probeOpcodeSupport (OpcodePipeline& pipeline, uint16_t opcode, const uint16_t* payload, size_t payloadSizeInWords,
+                         double timeoutSeconds, std::function<void (bool supported)> completion);
+
+} // oc namespace
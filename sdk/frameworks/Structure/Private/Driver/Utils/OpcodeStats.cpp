@@ -0,0 +1,302 @@
+//
+//  OpcodeStats.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "OpcodeStats.h"
+#include "PS1080Opcodes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace oc {
+
+namespace {
+
+    int highestBit (uint64_t value)
+    {
+        int bit = -1;
+        while (value)
+        {
+            value >>= 1;
+            ++bit;
+        }
+        return bit;
+    }
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+size_t LatencyHistogram::bucketIndex (uint64_t microseconds)
+{
+    if (microseconds < SubBucketCount)
+        return size_t(microseconds);
+
+    // Values in [2^(shift + SubBucketBits), 2^(shift + SubBucketBits + 1)) share the shift, and the top SubBucketBits
+    // bits below the leading one pick the sub-bucket.
+    const int shift = highestBit(microseconds) - SubBucketBits;
+    const size_t index = size_t(shift + 1) * SubBucketCount + size_t((microseconds >> shift) & (SubBucketCount - 1));
+
+    return index < BucketCount ? index : BucketCount - 1;
+}
+
+uint64_t LatencyHistogram::bucketLowerBound (size_t index)
+{
+    if (index < SubBucketCount)
+        return index;
+
+    const int shift = int(index / SubBucketCount) - 1;
+    return uint64_t(SubBucketCount + index % SubBucketCount) << shift;
+}
+
+void LatencyHistogram::record (uint64_t microseconds)
+{
+    _counts[bucketIndex(microseconds)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = _max.load(std::memory_order_relaxed);
+    while (microseconds > max && !_max.compare_exchange_weak(max, microseconds, std::memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::reset ()
+{
+    for (std::atomic<uint64_t>& count : _counts)
+        count.store(0, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot () const
+{
+    Snapshot snapshot;
+    for (size_t i = 0; i < BucketCount; ++i)
+    {
+        snapshot.counts[i] = _counts[i].load(std::memory_order_relaxed);
+        snapshot.total += snapshot.counts[i];
+    }
+    snapshot.max = _max.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+uint64_t LatencyHistogram::Snapshot::valueAtQuantile (double quantile) const
+{
+    if (total == 0)
+        return 0;
+
+    const uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(quantile * double(total))));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BucketCount; ++i)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return bucketLowerBound(i);
+    }
+
+    return bucketLowerBound(BucketCount - 1);
+}
+
+//------------------------------------------------------------------------------
+
+OpcodeStats::~OpcodeStats ()
+{
+    for (std::atomic<Entry*>& entry : _entries)
+        delete entry.load();
+}
+
+OpcodeStats::Entry& OpcodeStats::entry (uint16_t opcode)
+{
+    std::atomic<Entry*>& slot = _entries[std::min<size_t>(opcode, MaxOpcode)];
+
+    Entry* existing = slot.load(std::memory_order_acquire);
+    if (existing)
+        return *existing;
+
+    // Two threads may race to create the entry; the loser frees its copy.
+    Entry* created = new Entry();
+    if (slot.compare_exchange_strong(existing, created, std::memory_order_acq_rel))
+        return *created;
+
+    delete created;
+    return *existing;
+}
+
+void OpcodeStats::recordSent (uint16_t opcode, size_t bytesOut)
+{
+    Entry& stats = entry(opcode);
+    stats.sent.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesOut.fetch_add(bytesOut, std::memory_order_relaxed);
+}
+
+void OpcodeStats::recordCompleted (uint16_t opcode, uint16_t replyCode, size_t bytesIn, double roundTripSeconds)
+{
+    Entry& stats = entry(opcode);
+    stats.completed.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesIn.fetch_add(bytesIn, std::memory_order_relaxed);
+    if (replyCode != PS1080_REPLY_CODE_ACK)
+        stats.nacked.fetch_add(1, std::memory_order_relaxed);
+
+    stats.roundTrip.record(roundTripSeconds > 0 ? uint64_t(roundTripSeconds * 1e6) : 0);
+}
+
+void OpcodeStats::recordTimedOut (uint16_t opcode)
+{
+    entry(opcode).timedOut.fetch_add(1, std::memory_order_relaxed);
+}
+
+void OpcodeStats::recordCancelled (uint16_t opcode)
+{
+    entry(opcode).cancelled.fetch_add(1, std::memory_order_relaxed);
+}
+
+void OpcodeStats::recordDisconnected (uint16_t opcode)
+{
+    entry(opcode).disconnected.fetch_add(1, std::memory_order_relaxed);
+}
+
+void OpcodeStats::recordError (uint16_t opcode, int errorCode)
+{
+    Entry& stats = entry(opcode);
+
+    if (errorCode >= FirstErrorCode && errorCode < FirstErrorCode + ErrorCodeCount)
+        stats.errors[errorCode - FirstErrorCode].fetch_add(1, std::memory_order_relaxed);
+    else
+        stats.otherErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+void OpcodeStats::reset ()
+{
+    for (std::atomic<Entry*>& slot : _entries)
+    {
+        Entry* stats = slot.load(std::memory_order_acquire);
+        if (!stats)
+            continue;
+
+        stats->sent = 0;
+        stats->completed = 0;
+        stats->nacked = 0;
+        stats->timedOut = 0;
+        stats->cancelled = 0;
+        stats->disconnected = 0;
+        stats->bytesOut = 0;
+        stats->bytesIn = 0;
+        for (std::atomic<uint64_t>& error : stats->errors)
+            error = 0;
+        stats->otherErrors = 0;
+        stats->roundTrip.reset();
+    }
+}
+
+std::vector<OpcodeStats::Snapshot> OpcodeStats::snapshot () const
+{
+    std::vector<Snapshot> snapshots;
+
+    for (size_t opcode = 0; opcode <= MaxOpcode; ++opcode)
+    {
+        const Entry* stats = _entries[opcode].load(std::memory_order_acquire);
+        if (!stats || stats->sent.load(std::memory_order_relaxed) == 0)
+            continue;
+
+        Snapshot snapshot;
+        snapshot.opcode = uint16_t(opcode);
+        snapshot.sent = stats->sent.load(std::memory_order_relaxed);
+        snapshot.completed = stats->completed.load(std::memory_order_relaxed);
+        snapshot.nacked = stats->nacked.load(std::memory_order_relaxed);
+        snapshot.timedOut = stats->timedOut.load(std::memory_order_relaxed);
+        snapshot.cancelled = stats->cancelled.load(std::memory_order_relaxed);
+        snapshot.disconnected = stats->disconnected.load(std::memory_order_relaxed);
+        snapshot.bytesOut = stats->bytesOut.load(std::memory_order_relaxed);
+        snapshot.bytesIn = stats->bytesIn.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < ErrorCodeCount; ++i)
+            snapshot.errors[i] = stats->errors[i].load(std::memory_order_relaxed);
+        snapshot.otherErrors = stats->otherErrors.load(std::memory_order_relaxed);
+        snapshot.roundTrip = stats->roundTrip.snapshot();
+
+        snapshots.push_back(snapshot);
+    }
+
+    return snapshots;
+}
+
+std::string OpcodeStats::toJSON () const
+{
+    std::ostringstream json;
+    json << "{\"opcodes\":[";
+
+    bool first = true;
+    for (const Snapshot& stats : snapshot())
+    {
+        if (!first)
+            json << ',';
+        first = false;
+
+        json << "{\"opcode\":" << stats.opcode
+             << ",\"name\":\"" << PS1080OpcodeName(stats.opcode) << '"'
+             << ",\"sent\":" << stats.sent
+             << ",\"completed\":" << stats.completed
+             << ",\"nacked\":" << stats.nacked
+             << ",\"timedOut\":" << stats.timedOut
+             << ",\"cancelled\":" << stats.cancelled
+             << ",\"disconnected\":" << stats.disconnected
+             << ",\"bytesOut\":" << stats.bytesOut
+             << ",\"bytesIn\":" << stats.bytesIn
+             << ",\"rttMicroseconds\":{"
+             << "\"count\":" << stats.roundTrip.total
+             << ",\"p50\":" << stats.roundTrip.valueAtQuantile(0.5)
+             << ",\"p90\":" << stats.roundTrip.valueAtQuantile(0.9)
+             << ",\"p99\":" << stats.roundTrip.valueAtQuantile(0.99)
+             << ",\"max\":" << stats.roundTrip.max
+             << "},\"errors\":{";
+
+        bool firstError = true;
+        for (size_t i = 0; i < ErrorCodeCount; ++i)
+        {
+            if (stats.errors[i] == 0)
+                continue;
+            if (!firstError)
+                json << ',';
+            firstError = false;
+            json << '"' << (FirstErrorCode + i) << "\":" << stats.errors[i];
+        }
+        if (stats.otherErrors)
+            json << (firstError ? "" : ",") << "\"other\":" << stats.otherErrors;
+
+        json << "}}";
+    }
+
+    json << "]}";
+    return json.str();
+}
+
+const char* PS1080OpcodeName (uint16_t opcode)
+{
+    switch (opcode)
+    {
+        case PS1080Opcode_GetVersion:           return "GetVersion";
+        case PS1080Opcode_KeepAlive:            return "KeepAlive";
+        case PS1080Opcode_GetParam:             return "GetParam";
+        case PS1080Opcode_SetParam:             return "SetParam";
+        case PS1080Opcode_GetFixedParams:       return "GetFixedParams";
+        case PS1080Opcode_I2CWrite:             return "I2CWrite";
+        case PS1080Opcode_I2CRead:              return "I2CRead";
+        case PS1080Opcode_InitFileUpload:       return "InitFileUpload";
+        case PS1080Opcode_WriteFileUpload:      return "WriteFileUpload";
+        case PS1080Opcode_FinishFileUpload:     return "FinishFileUpload";
+        case PS1080Opcode_DownloadFile:         return "DownloadFile";
+        case PS1080Opcode_DeleteFile:           return "DeleteFile";
+        case PS1080Opcode_GetFileList:          return "GetFileList";
+        case PS1080Opcode_ReadAHB:              return "ReadAHB";
+        case PS1080Opcode_WriteAHB:             return "WriteAHB";
+        case PS1080Opcode_SetFileAttributes:    return "SetFileAttributes";
+        case PS1080Opcode_ReadFlash:            return "ReadFlash";
+        case PS1080Opcode_GetTECData:           return "GetTECData";
+        case PS1080Opcode_GetEmitterData:       return "GetEmitterData";
+        case PS1080Opcode_AHBBatch:             return "AHBBatch";
+        case PS1080Opcode_I2CTransactionList:   return "I2CTransactionList";
+        default:                                return "Unknown";
+    }
+}
+
+} // oc namespace
@@ -0,0 +1,136 @@
+//
+//  OpcodeStats.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace oc {
+
+/**
+ * Log-linear latency histogram in the spirit of HdrHistogram: 16 linear sub-buckets per power of two, so any
+ * recorded value is off by at most 1/16 (6.25%). Values are in microseconds, from 1us to about a minute;
+ * anything above lands in the last bucket. Recording is a relaxed atomic increment, plus a compare-exchange when
+ * the value is a new maximum, which is kept exactly.
+ */
+class LatencyHistogram
+{
+public:
+    enum { SubBucketBits = 4 };
+    enum { SubBucketCount = 1 << SubBucketBits };
+    enum { BucketCount = 24 * SubBucketCount };
+
+    void record (uint64_t microseconds);
+    void reset ();
+
+    static size_t bucketIndex (uint64_t microseconds);
+    static uint64_t bucketLowerBound (size_t index);
+
+    struct Snapshot
+    {
+        uint64_t counts[BucketCount] = {};
+        uint64_t total = 0;
+        uint64_t max = 0;         // largest recorded value, exact
+
+        // Lower bound of the bucket holding the given quantile (0..1), 0 if empty.
+        uint64_t valueAtQuantile (double quantile) const;
+    };
+
+    Snapshot snapshot () const;
+
+private:
+    std::atomic<uint64_t> _counts[BucketCount] = {};
+    std::atomic<uint64_t> _max { 0 };
+};
+
+/**
+ * Lock-free per-opcode counters for the control session. Writers (the opcode pipeline, the completion paths of
+ * SensorCommunicationController) only do relaxed atomic increments, so recording costs a few nanoseconds and
+ * never blocks the accessory thread. Readers take a snapshot; fields of a snapshot may be a few events apart
+ * from each other while opcodes are in flight.
+ *
+ * Opcodes from MaxOpcode up share the last entry.
+ */
+class OpcodeStats
+{
+public:
+    enum { MaxOpcode = 0xff };
+
+    // Failures are bucketed by STError code, from FirstErrorCode on. Codes outside the range go to otherErrors.
+    enum { FirstErrorCode = 100 };
+    enum { ErrorCodeCount = 32 };
+
+    OpcodeStats () = default;
+    ~OpcodeStats ();
+
+    OpcodeStats (const OpcodeStats&) = delete;
+    OpcodeStats& operator= (const OpcodeStats&) = delete;
+
+    struct Snapshot
+    {
+        uint16_t opcode = 0;
+        uint64_t sent = 0;
+        uint64_t completed = 0;
+        uint64_t nacked = 0;        // completed with a reply code other than ACK
+        uint64_t timedOut = 0;
+        uint64_t cancelled = 0;
+        uint64_t disconnected = 0;
+        uint64_t bytesOut = 0;
+        uint64_t bytesIn = 0;
+        uint64_t errors[ErrorCodeCount] = {};
+        uint64_t otherErrors = 0;
+        LatencyHistogram::Snapshot roundTrip;
+    };
+
+    void recordSent (uint16_t opcode, size_t bytesOut);
+    void recordCompleted (uint16_t opcode, uint16_t replyCode, size_t bytesIn, double roundTripSeconds);
+    void recordTimedOut (uint16_t opcode);
+    void recordCancelled (uint16_t opcode);
+    void recordDisconnected (uint16_t opcode);
+
+    // Called where an operation surfaces an NSError to its caller, with the STError code. OpcodePipeline records
+    // the codes its failures map to (timed out, cancelled, no sensor attached, reply code bad).
+    void recordError (uint16_t opcode, int errorCode);
+
+    void reset ();
+
+    // Opcodes that were sent at least once, in opcode order.
+    std::vector<Snapshot> snapshot () const;
+
+    /* {"opcodes":[{"opcode":20,"name":"ReadAHB","sent":..,"rttMicroseconds":{"p50":..,"p90":..,"p99":..,"max":..},
+        "errors":{"120":3}, ...}]} */
+    std::string toJSON () const;
+
+private:
+    struct Entry
+    {
+        std::atomic<uint64_t> sent { 0 };
+        std::atomic<uint64_t> completed { 0 };
+        std::atomic<uint64_t> nacked { 0 };
+        std::atomic<uint64_t> timedOut { 0 };
+        std::atomic<uint64_t> cancelled { 0 };
+        std::atomic<uint64_t> disconnected { 0 };
+        std::atomic<uint64_t> bytesOut { 0 };
+        std::atomic<uint64_t> bytesIn { 0 };
+        std::atomic<uint64_t> errors[ErrorCodeCount] = {};
+        std::atomic<uint64_t> otherErrors { 0 };
+        LatencyHistogram roundTrip;
+    };
+
+    // Entries are allocated on first use (a few KB each, most opcodes are never sent) and live as long as the table.
+    Entry& entry (uint16_t opcode);
+
+    std::atomic<Entry*> _entries[MaxOpcode + 1] = {};
+};
+
+const char* PS1080OpcodeName (uint16_t opcode);
+
+} // oc namespace
@@ -0,0 +1,96 @@
+//
+//  PS1080ControlFraming.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "PS1080ControlFraming.h"
+
+namespace oc {
+
+namespace {
+
+    void appendWord (std::vector<uint8_t>& output, uint16_t word)
+    {
+        output.push_back(uint8_t(word & 0xff));
+        output.push_back(uint8_t(word >> 8));
+    }
+
+    uint16_t readWord (const uint8_t* bytes)
+    {
+        return uint16_t(bytes[0] | (bytes[1] << 8));
+    }
+
+} // anonymous namespace
+
+void appendPS1080ControlFrame (std::vector<uint8_t>& output, uint16_t magic, uint16_t opcode, uint16_t id,
+                               const uint16_t* payload, size_t payloadSizeInWords)
+{
+    output.reserve(output.size() + sizeof(PS1080ControlHeader) + payloadSizeInWords * sizeof(uint16_t));
+
+    appendWord(output, magic);
+    appendWord(output, uint16_t(payloadSizeInWords));
+    appendWord(output, opcode);
+    appendWord(output, id);
+
+    for (size_t i = 0; i < payloadSizeInWords; ++i)
+        appendWord(output, payload[i]);
+}
+
+PS1080ControlDecoder::PS1080ControlDecoder (uint16_t magic, size_t maxPayloadWords)
+: _magic(magic), _maxPayloadWords(maxPayloadWords)
+{
+}
+
+void PS1080ControlDecoder::feed (const uint8_t* data, size_t size)
+{
+    // Compact lazily, only once the consumed prefix dominates the buffer.
+    if (_readOffset > 0 && _readOffset * 2 >= _buffer.size())
+    {
+        _buffer.erase(_buffer.begin(), _buffer.begin() + _readOffset);
+        _readOffset = 0;
+    }
+
+    _buffer.insert(_buffer.end(), data, data + size);
+}
+
+bool PS1080ControlDecoder::next (PS1080ControlFrame& frame)
+{
+    const size_t headerSize = sizeof(PS1080ControlHeader);
+
+    while (_buffer.size() - _readOffset >= headerSize)
+    {
+        const uint8_t* bytes = _buffer.data() + _readOffset;
+
+        const uint16_t magic = readWord(bytes);
+        const uint16_t sizeInWords = readWord(bytes + 2);
+
+        if (magic != _magic || sizeInWords > _maxPayloadWords)
+        {
+            ++_readOffset;
+            ++_discardedBytes;
+            continue;
+        }
+
+        const size_t frameSize = headerSize + sizeInWords * sizeof(uint16_t);
+        if (_buffer.size() - _readOffset < frameSize)
+            return false;
+
+        frame.header.magic = magic;
+        frame.header.sizeInWords = sizeInWords;
+        frame.header.opcode = readWord(bytes + 4);
+        frame.header.id = readWord(bytes + 6);
+
+        frame.payload.resize(sizeInWords);
+        for (size_t i = 0; i < sizeInWords; ++i)
+            frame.payload[i] = readWord(bytes + headerSize + i * 2);
+
+        _readOffset += frameSize;
+        return true;
+    }
+
+    return false;
+}
+
+} // oc namespace
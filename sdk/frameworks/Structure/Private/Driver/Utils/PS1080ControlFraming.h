@@ -0,0 +1,71 @@
+//
+//  PS1080ControlFraming.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace oc {
+
+enum : uint16_t
+{
+    PS1080HostMagic  = 0x4d47, // requests, host to sensor
+    PS1080ReplyMagic = 0x4252, // replies, sensor to host
+};
+
+/* Every control session message is this header followed by sizeInWords little-endian words of payload.
+   id is (sessionID << 8) | seq, see PS_ENCODING_SEQ. */
+struct PS1080ControlHeader
+{
+    uint16_t magic;
+    uint16_t sizeInWords;
+    uint16_t opcode;
+    uint16_t id;
+};
+
+struct PS1080ControlFrame
+{
+    PS1080ControlHeader header;
+    std::vector<uint16_t> payload;
+
+    uint8_t seq () const { return uint8_t(header.id & 0xff); }
+};
+
+inline uint16_t PS1080ControlId (uint8_t sessionID, uint8_t seq) { return uint16_t((uint16_t(sessionID) << 8) | seq); }
+
+void appendPS1080ControlFrame (std::vector<uint8_t>& output, uint16_t magic, uint16_t opcode, uint16_t id,
+                               const uint16_t* payload, size_t payloadSizeInWords);
+
+/**
+ * Reassembles control frames from a byte stream (a socket, a pipe, an iAP2 session) that may split or merge them.
+ * Bytes that cannot start a frame with the expected magic are skipped, so the decoder resynchronizes after garbage.
+ */
+class PS1080ControlDecoder
+{
+public:
+    enum { DefaultMaxPayloadWords = 0x1000 };
+
+    explicit PS1080ControlDecoder (uint16_t magic, size_t maxPayloadWords = DefaultMaxPayloadWords);
+
+    void feed (const uint8_t* data, size_t size);
+
+    // Returns false when no complete frame is buffered.
+    bool next (PS1080ControlFrame& frame);
+
+    size_t discardedBytes () const { return _discardedBytes; }
+
+private:
+    uint16_t _magic;
+    size_t _maxPayloadWords;
+    std::vector<uint8_t> _buffer;
+    size_t _readOffset = 0;
+    size_t _discardedBytes = 0;
+};
+
+} // oc namespace
@@ -0,0 +1,57 @@
+//
+//  PS1080Opcodes.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "../ExperimentalFeatures.h"
+
+#include <stdint.h>
+
+/* Control session opcodes used by the portable (non Objective-C) host code. The numbering follows the PS1080
+   host protocol.
+
+   The batch opcodes at the end are proposed Occipital extensions that no released firmware implements yet, and
+   their numbers are not reserved. The host only uses them when built with ENABLE_EXPERIMENTAL_FEATURES, and then
+   only after probeOpcodeSupport() (OpcodePipeline.h) got an ACK for them at connect; that result is what the
+   firmwareSupports... methods on SensorCommunicationController return. Otherwise those methods return false and
+   every caller takes the fallback path built from standard opcodes. */
+typedef enum {
+    PS1080Opcode_GetVersion         = 0,
+    PS1080Opcode_KeepAlive          = 1,
+    PS1080Opcode_GetParam           = 2,
+    PS1080Opcode_SetParam           = 3,
+    PS1080Opcode_GetFixedParams     = 4,
+    PS1080Opcode_I2CWrite           = 10,
+    PS1080Opcode_I2CRead            = 11,
+    PS1080Opcode_InitFileUpload     = 13,
+    PS1080Opcode_WriteFileUpload    = 14,
+    PS1080Opcode_FinishFileUpload   = 15,
+    PS1080Opcode_DownloadFile       = 16,
+    PS1080Opcode_DeleteFile         = 17,
+    PS1080Opcode_GetFileList        = 19,
+    PS1080Opcode_ReadAHB            = 20,
+    PS1080Opcode_WriteAHB           = 21,
+    PS1080Opcode_SetFileAttributes  = 23,
+    PS1080Opcode_ReadFlash          = 25,
+    PS1080Opcode_GetTECData         = 30,
+    PS1080Opcode_GetEmitterData     = 32,
+
+    // Occipital extensions, see above
+    PS1080Opcode_AHBBatch           = 0x80,
+    PS1080Opcode_I2CTransactionList = 0x81,
+} PS1080Opcode;
+
+#ifdef ENABLE_EXPERIMENTAL_FEATURES
+#   define PS1080_EXTENSION_OPCODES_ENABLED 1
+#else
+#   define PS1080_EXTENSION_OPCODES_ENABLED 0
+#endif
+
+/* First word of every reply payload */
+#define PS1080_REPLY_CODE_ACK               0
+#define PS1080_REPLY_CODE_NACK              1
+#define PS1080_REPLY_CODE_ILLEGAL_OPCODE    2
@@ -0,0 +1,283 @@
+//
+//  PSConfigTables.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "FrameBufferPool.h"
+#include "PSConfigs.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace oc {
+
+/* Parameter values, in the firmware's encoding. */
+enum PSStreamMode : uint16_t
+{
+    PSStreamMode_Off   = 0,
+    PSStreamMode_Color = 1,
+    PSStreamMode_Depth = 2,
+    PSStreamMode_IR    = 3,
+    PSStreamMode_Audio = 4,
+};
+
+enum PSResolution : uint16_t // same values as PresetMakerResolution
+{
+    PSResolution_QVGA  = 0,
+    PSResolution_VGA   = 1,
+    PSResolution_SXGA  = 2,
+    PSResolution_QQVGA = 4,
+};
+
+enum PSFormat : uint16_t // PARAM_DEPTH_FORMAT and PARAM_IR_FORMAT
+{
+    PSFormat_Uncompressed16 = 0,
+    PSFormat_CompressedPS   = 1, // depth only, uncompressDepthPS
+    PSFormat_Packed10       = 2, // unpackBitStreamTo16 with 10 bits per pixel
+    PSFormat_Packed11       = 3, // depth only, 11 bits per pixel
+    PSFormat_Packed12       = 4, // depth only, 12 bits per pixel
+};
+
+// What the streams of one config can share on the USB 2.0 high-speed link, in bytes per second: at most 13 bulk
+// packets of 512 bytes per 125 us microframe (USB 2.0 specification, table 5-9), so 53.248 MB/s. IR SXGA at 30 fps
+// packed to 10 bits (49.2 MB/s) fits, but only with depth off or at QQVGA.
+constexpr double PSMaxStreamBandwidth = 13 * 512 * 8000.0;
+
+/* A view over a config sequence, usable in constant expressions when built from a constexpr SensorSetting array. */
+struct SensorConfigTable
+{
+    const SensorSetting* settings;
+    size_t count;
+
+    static SensorConfigTable fromSequence (const SensorConfigSequence& sequence)
+    {
+        return { sequence.settings, sequence.settingsCount };
+    }
+
+    constexpr bool contains (uint16_t param) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            if (settings[i].param == param)
+                return true;
+        return false;
+    }
+
+    // Last value written to param, which is what the firmware ends up with.
+    constexpr uint16_t valueOf (uint16_t param, uint16_t fallback = 0) const
+    {
+        uint16_t value = fallback;
+        for (size_t i = 0; i < count; ++i)
+            if (settings[i].param == param)
+                value = settings[i].value;
+        return value;
+    }
+
+    // For the C API (ConfigTransition, OCRegistrationManager); they only read the settings.
+    SensorConfigSequence sequence () const
+    {
+        return { const_cast<SensorSetting*>(settings), count };
+    }
+};
+
+template <size_t N>
+constexpr SensorConfigTable sensorConfigTable (const SensorSetting (&settings)[N])
+{
+    return { settings, N };
+}
+
+//------------------------------------------------------------------------------
+// Derived metadata
+
+enum class PSDecodeKernel : uint8_t
+{
+    None,
+    Copy16,             // uncompressed 16-bit pixels
+    DepthCompressedPS,  // uncompressDepthPS
+    UnpackBits,         // unpackBitStreamTo16, PSStreamMetadata::packedBits per pixel
+};
+
+struct PSStreamMetadata
+{
+    FrameBufferStream stream = FrameBufferStream::Depth;
+    bool enabled = false;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint16_t fps = 0;
+    PSDecodeKernel decode = PSDecodeKernel::None;
+    uint8_t packedBits = 0;        // bits per pixel on the wire for UnpackBits
+    size_t maxWireFrameSize = 0;   // bytes of one frame on the wire, at most
+
+    // Decoded frames are 16 bits per pixel.
+    constexpr size_t frameSizeInBytes () const { return size_t(width) * size_t(height) * 2; }
+    constexpr double bandwidth () const { return double(maxWireFrameSize) * fps; }
+    constexpr FrameBufferPoolKey poolKey () const { return { stream, width, height, 2 }; }
+};
+
+struct PSConfigMetadata
+{
+    PSStreamMetadata depth;
+    PSStreamMetadata infrared;
+    bool registered = false;
+
+    constexpr double bandwidth () const { return depth.bandwidth() + infrared.bandwidth(); }
+};
+
+namespace psconfig_detail {
+
+    constexpr bool dimensions (FrameBufferStream stream, uint16_t resolution, uint16_t& width, uint16_t& height)
+    {
+        // IR frames carry 8 extra rows (IR_PACKED_10_QVGA_SIZE and friends in Decompression.h).
+        const uint16_t extraRows = stream == FrameBufferStream::Infrared ? 8 : 0;
+
+        switch (resolution)
+        {
+            case PSResolution_QQVGA: width = 160;  height = 120;  return stream == FrameBufferStream::Depth;
+            case PSResolution_QVGA:  width = 320;  height = uint16_t(240 + extraRows); return true;
+            case PSResolution_VGA:   width = 640;  height = uint16_t(480 + extraRows); return true;
+            case PSResolution_SXGA:  width = 1280; height = 1024; return stream == FrameBufferStream::Infrared;
+            default:                 width = 0;    height = 0;    return false;
+        }
+    }
+
+    constexpr bool fpsSupported (uint16_t resolution, uint16_t fps)
+    {
+        switch (resolution)
+        {
+            case PSResolution_QQVGA:
+            case PSResolution_QVGA:  return fps == 30 || fps == 60;
+            case PSResolution_VGA:   return fps == 30;
+            case PSResolution_SXGA:  return fps == 15 || fps == 30;
+            default:                 return false;
+        }
+    }
+
+    constexpr PSDecodeKernel decodeKernel (FrameBufferStream stream, uint16_t format)
+    {
+        if (format == PSFormat_Uncompressed16)
+            return PSDecodeKernel::Copy16;
+        if (format == PSFormat_CompressedPS && stream == FrameBufferStream::Depth)
+            return PSDecodeKernel::DepthCompressedPS;
+        if (format == PSFormat_Packed10 || ((format == PSFormat_Packed11 || format == PSFormat_Packed12) && stream == FrameBufferStream::Depth))
+            return PSDecodeKernel::UnpackBits;
+        return PSDecodeKernel::None;
+    }
+
+    constexpr uint8_t packedBits (uint16_t format)
+    {
+        return format == PSFormat_Packed10 ? 10 : format == PSFormat_Packed11 ? 11 : format == PSFormat_Packed12 ? 12 : 0;
+    }
+
+    // False if the stream is on but its resolution, fps or format is missing, unknown or not supported together.
+    constexpr bool streamMetadata (const SensorConfigTable& table, FrameBufferStream stream, PSStreamMetadata& metadata)
+    {
+        const bool depth = stream == FrameBufferStream::Depth;
+        const uint16_t modeParam = depth ? PARAM_GENERAL_STREAM1_MODE : PARAM_GENERAL_STREAM0_MODE;
+        const uint16_t formatParam = depth ? PARAM_DEPTH_FORMAT : PARAM_IR_FORMAT;
+        const uint16_t resolutionParam = depth ? PARAM_DEPTH_RESOLUTION : PARAM_IR_RESOLUTION;
+        const uint16_t fpsParam = depth ? PARAM_DEPTH_FPS : PARAM_IR_FPS;
+
+        metadata = PSStreamMetadata();
+        metadata.stream = stream;
+
+        const uint16_t mode = table.valueOf(modeParam, PSStreamMode_Off);
+        if (mode == PSStreamMode_Off)
+            return true;
+        if (mode != (depth ? PSStreamMode_Depth : PSStreamMode_IR))
+            return false;
+
+        if (!table.contains(formatParam) || !table.contains(resolutionParam) || !table.contains(fpsParam))
+            return false;
+
+        const uint16_t resolution = table.valueOf(resolutionParam);
+        metadata.enabled = true;
+        metadata.fps = table.valueOf(fpsParam);
+        metadata.decode = decodeKernel(stream, table.valueOf(formatParam));
+        metadata.packedBits = metadata.decode == PSDecodeKernel::UnpackBits ? packedBits(table.valueOf(formatParam)) : 0;
+
+        if (!dimensions(stream, resolution, metadata.width, metadata.height) || !fpsSupported(resolution, metadata.fps)
+            || metadata.decode == PSDecodeKernel::None)
+            return false;
+
+        const size_t pixels = size_t(metadata.width) * size_t(metadata.height);
+        // PS compression does not reliably shrink noisy frames, so budget for uncompressed ones.
+        metadata.maxWireFrameSize = metadata.decode == PSDecodeKernel::UnpackBits ? (pixels * metadata.packedBits + 7) / 8 : pixels * 2;
+        return true;
+    }
+
+} // psconfig_detail namespace
+
+//------------------------------------------------------------------------------
+// Checks, at compile time for constexpr tables (OC_CHECK_SENSOR_CONFIG_TABLE) or at run time (sensorConfigValid)
+
+// Every parameter is set once, except stream modes, which may be switched off and set again (stop, then start).
+constexpr bool sensorConfigHasDuplicateParams (const SensorConfigTable& table)
+{
+    for (size_t i = 0; i < table.count; ++i)
+    {
+        for (size_t j = i + 1; j < table.count; ++j)
+        {
+            if (table.settings[i].param != table.settings[j].param)
+                continue;
+
+            const uint16_t param = table.settings[i].param;
+            const bool streamMode = param == PARAM_GENERAL_STREAM0_MODE || param == PARAM_GENERAL_STREAM1_MODE
+                                 || param == PARAM_GENERAL_STREAM2_MODE;
+            if (!streamMode || table.settings[i].value != PSStreamMode_Off)
+                return true;
+        }
+    }
+    return false;
+}
+
+constexpr bool sensorConfigParamsInRange (const SensorConfigTable& table)
+{
+    for (size_t i = 0; i < table.count; ++i)
+        if (table.settings[i].param >= PARAM_NUM_OF_PARAMS)
+            return false;
+    return true;
+}
+
+constexpr bool sensorConfigStreamsCompatible (const SensorConfigTable& table)
+{
+    PSStreamMetadata depth, infrared;
+    if (!psconfig_detail::streamMetadata(table, FrameBufferStream::Depth, depth)
+        || !psconfig_detail::streamMetadata(table, FrameBufferStream::Infrared, infrared))
+        return false;
+
+    // Depth and IR come out of the same sensor readout, so they run at the same rate.
+    if (depth.enabled && infrared.enabled && depth.fps != infrared.fps)
+        return false;
+
+    // Registration maps depth onto the color camera, which only exists for VGA and QVGA depth.
+    if (table.valueOf(PARAM_GENERAL_REGISTRATION_ENABLE) != 0 && (!depth.enabled || depth.width < 320))
+        return false;
+
+    return depth.bandwidth() + infrared.bandwidth() <= PSMaxStreamBandwidth;
+}
+
+// Only meaningful for tables that pass sensorConfigStreamsCompatible.
+constexpr PSConfigMetadata sensorConfigMetadata (const SensorConfigTable& table)
+{
+    PSConfigMetadata metadata;
+    psconfig_detail::streamMetadata(table, FrameBufferStream::Depth, metadata.depth);
+    psconfig_detail::streamMetadata(table, FrameBufferStream::Infrared, metadata.infrared);
+    metadata.registered = table.valueOf(PARAM_GENERAL_REGISTRATION_ENABLE) != 0;
+    return metadata;
+}
+
+#define OC_CHECK_SENSOR_CONFIG_TABLE(table) \
+    static_assert(!oc::sensorConfigHasDuplicateParams(table), #table ": a parameter is set twice"); \
+    static_assert(oc::sensorConfigParamsInRange(table), #table ": parameter outside EConfig_Params"); \
+    static_assert(oc::sensorConfigStreamsCompatible(table), #table ": unsupported resolution/fps/format combination")
+
+// Runtime form of the checks, for sequences that are not constexpr, such as the PSConfigs.h globals (defined in C).
+inline bool sensorConfigValid (const SensorConfigTable& table)
+{
+    return !sensorConfigHasDuplicateParams(table) && sensorConfigParamsInRange(table) && sensorConfigStreamsCompatible(table);
+}
+
+} // oc namespace
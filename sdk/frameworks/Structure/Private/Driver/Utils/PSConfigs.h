@@ -18,6 +18,10 @@ extern "C" {
 /**
  * SensorConfigSequence holds different sequences of config commands to send to a
  * PS1080 device to do things like start streaming depth or IR
+ *
+ * From C++, PSConfigTables.h checks a sequence (SensorConfigTable::fromSequence, sensorConfigValid) and derives
+ * its frame sizes, decode kernels and bandwidth (sensorConfigMetadata). executeConfigTransition refuses sequences
+ * that fail the check, and PSStreamDecoder takes its pools and decode kernels from the metadata.
  */
 
 #pragma pack(push, 1) // Make sure the compiler aligns these with no padding
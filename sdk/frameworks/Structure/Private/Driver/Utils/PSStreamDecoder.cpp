@@ -0,0 +1,99 @@
+//
+//  PSStreamDecoder.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "PSStreamDecoder.h"
+#include "Decompression.h"
+
+#include <cstring>
+
+namespace oc {
+
+bool PSStreamDecoder::configure (const SensorConfigSequence& sequence)
+{
+    reset();
+
+    const SensorConfigTable table = SensorConfigTable::fromSequence(sequence);
+    if (!sensorConfigValid(table))
+        return false;
+
+    _metadata = sensorConfigMetadata(table);
+
+    if (_metadata.depth.enabled)
+        _depthPool = &_pools.poolFor(_metadata.depth.poolKey());
+    if (_metadata.infrared.enabled)
+        _infraredPool = &_pools.poolFor(_metadata.infrared.poolKey());
+
+    return true;
+}
+
+void PSStreamDecoder::reset ()
+{
+    _metadata = PSConfigMetadata();
+    _depthPool = nullptr;
+    _infraredPool = nullptr;
+}
+
+const PSStreamMetadata* PSStreamDecoder::streamMetadata (FrameBufferStream stream) const
+{
+    if (stream == FrameBufferStream::Depth && _depthPool)
+        return &_metadata.depth;
+    if (stream == FrameBufferStream::Infrared && _infraredPool)
+        return &_metadata.infrared;
+    return nullptr;
+}
+
+FrameBufferRef PSStreamDecoder::decode (FrameBufferStream stream, const uint8_t* wire, size_t wireSize)
+{
+    const PSStreamMetadata* metadata = streamMetadata(stream);
+    if (metadata == nullptr || wire == nullptr || wireSize == 0 || wireSize > metadata->maxWireFrameSize)
+        return FrameBufferRef();
+
+    FrameBufferPool* pool = stream == FrameBufferStream::Depth ? _depthPool : _infraredPool;
+    FrameBufferRef frame = pool->acquire();
+    if (!frame)
+        return FrameBufferRef();
+
+    const size_t frameSize = metadata->frameSizeInBytes();
+    uint16_t* pixels = reinterpret_cast<uint16_t*>(frame->data());
+
+    switch (metadata->decode)
+    {
+        case PSDecodeKernel::Copy16:
+            if (wireSize != frameSize)
+                return FrameBufferRef();
+            std::memcpy(pixels, wire, frameSize);
+            break;
+
+        case PSDecodeKernel::DepthCompressedPS:
+        {
+            // In: room in the output, in bytes. Out: bytes written.
+            uint32_t outputSize = uint32_t(frameSize);
+            uint32_t bytesRead = 0;
+            if (uncompressDepthPS(wire, uint32_t(wireSize), pixels, &outputSize, &bytesRead, true) != 0 || outputSize != frameSize)
+                return FrameBufferRef();
+            break;
+        }
+
+        case PSDecodeKernel::UnpackBits:
+        {
+            // Only a whole frame unpacks into exactly frameSize bytes.
+            if (wireSize != metadata->maxWireFrameSize)
+                return FrameBufferRef();
+            size_t unpackedSize = 0;
+            unpackBitStreamTo16(wire, wireSize, metadata->packedBits, pixels, &unpackedSize);
+            break;
+        }
+
+        case PSDecodeKernel::None:
+            return FrameBufferRef();
+    }
+
+    frame->setSize(frameSize);
+    return frame;
+}
+
+} // oc namespace
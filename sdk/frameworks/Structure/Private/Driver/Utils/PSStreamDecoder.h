@@ -0,0 +1,48 @@
+//
+//  PSStreamDecoder.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "FrameBufferPool.h"
+#include "PSConfigTables.h"
+
+namespace oc {
+
+/**
+ * Turns the depth and IR frames of the running config into 16-bit frames in pooled buffers.
+ *
+ * configure() is called when a config starts streaming. It takes each stream's pool key (stream, decoded size) and
+ * decode kernel from sensorConfigMetadata, so buffers and decoding always match what the config asked the firmware for.
+ * The depth and IR pools are looked up once there, not per frame.
+ *
+ * Not thread safe: configure() and decode() run on the thread that receives the frames.
+ */
+class PSStreamDecoder
+{
+public:
+    explicit PSStreamDecoder (FrameBufferPools& pools) : _pools(pools) {}
+
+    // False, and no stream decodes, if the sequence fails sensorConfigValid.
+    bool configure (const SensorConfigSequence& sequence);
+    void reset ();
+
+    const PSConfigMetadata& metadata () const { return _metadata; }
+
+    // One complete frame as it came off the wire. Empty if the stream is not running in this config, the frame is not
+    // the size the config produces, decoding fails or the pool is exhausted; callers drop the frame.
+    FrameBufferRef decode (FrameBufferStream stream, const uint8_t* wire, size_t wireSize);
+
+private:
+    const PSStreamMetadata* streamMetadata (FrameBufferStream stream) const;
+
+    FrameBufferPools& _pools;
+    PSConfigMetadata _metadata;
+    FrameBufferPool* _depthPool = nullptr;
+    FrameBufferPool* _infraredPool = nullptr;
+};
+
+} // oc namespace
@@ -0,0 +1,312 @@
+//
+//  PipelinedFileDownload.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "PipelinedFileDownload.h"
+#include "PS1080Opcodes.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace oc {
+
+std::shared_ptr<PipelinedFileDownload> PipelinedFileDownload::create (const Options& options,
+                                                                      ProgressCallback progress, CompletionCallback completion,
+                                                                      const uint8_t* resumePrefix, size_t resumePrefixSize)
+{
+    return std::shared_ptr<PipelinedFileDownload>(new PipelinedFileDownload(options, std::move(progress), std::move(completion),
+                                                                            resumePrefix, resumePrefixSize));
+}
+
+PipelinedFileDownload::PipelinedFileDownload (const Options& options, ProgressCallback progress, CompletionCallback completion,
+                                              const uint8_t* resumePrefix, size_t resumePrefixSize)
+: _options(options),
+  _chunkSize(std::max<size_t>(1, std::min<size_t>(options.maxReplyPayloadWords, 0x10000) - 1) * sizeof(uint16_t)),
+  _progress(std::move(progress)),
+  _completion(std::move(completion)),
+  _crc(options.crcVariant, options.crcInitialValue)
+{
+    const size_t chunks = (options.fileSizeInBytes + _chunkSize - 1) / _chunkSize;
+
+    _data.assign(options.fileSizeInBytes, 0);
+    _chunkDone.assign(chunks, false);
+    _chunkInFlight.assign(chunks, 0);
+    _chunkAttempts.assign(chunks, 0);
+    _tickets.assign(chunks, 0);
+
+    if (resumePrefix && resumePrefixSize > 0)
+    {
+        const size_t prefix = std::min(resumePrefixSize, options.fileSizeInBytes);
+        std::memcpy(_data.data(), resumePrefix, prefix);
+
+        // Only whole chunks (or the tail of the file) count as downloaded.
+        for (size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            const size_t end = std::min((chunk + 1) * _chunkSize, options.fileSizeInBytes);
+            if (end > prefix)
+                break;
+
+            _chunkDone[chunk] = true;
+            ++_doneChunks;
+            _downloadedBytes = end;
+        }
+
+        advanceCRCLocked();
+    }
+}
+
+bool PipelinedFileDownload::start (OpcodePipeline& pipeline)
+{
+    return launch(pipeline, false);
+}
+
+bool PipelinedFileDownload::resume (OpcodePipeline& pipeline)
+{
+    return launch(pipeline, true);
+}
+
+bool PipelinedFileDownload::launch (OpcodePipeline& pipeline, bool resuming)
+{
+    Deferred deferred;
+    uint32_t generation;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        if (_status != (resuming ? FileDownloadStatus::Interrupted : FileDownloadStatus::NotStarted))
+            return false;
+
+        _pipeline = &pipeline;
+        _status = FileDownloadStatus::InProgress;
+        generation = ++_generation;
+
+        std::fill(_chunkInFlight.begin(), _chunkInFlight.end(), 0);
+        std::fill(_chunkAttempts.begin(), _chunkAttempts.end(), 0);
+        _inFlight = 0;
+        _nextChunk = 0;
+
+        if (_doneChunks == _chunkDone.size())
+            finishLocked(FileDownloadStatus::Completed, deferred);
+        else
+            fillWindowLocked(deferred);
+    }
+
+    run(&pipeline, generation, deferred);
+    return true;
+}
+
+void PipelinedFileDownload::cancel ()
+{
+    Deferred deferred;
+    OpcodePipeline* pipeline;
+    uint32_t generation;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        if (_status != FileDownloadStatus::InProgress)
+            return;
+
+        pipeline = _pipeline;
+        generation = _generation;
+        finishLocked(FileDownloadStatus::Cancelled, deferred);
+    }
+
+    run(pipeline, generation, deferred);
+}
+
+FileDownloadStatus PipelinedFileDownload::status () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _status;
+}
+
+size_t PipelinedFileDownload::contiguousBytes () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return contiguousBytesLocked();
+}
+
+uint16_t PipelinedFileDownload::contiguousCRC () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _crc.value();
+}
+
+void PipelinedFileDownload::advanceCRCLocked ()
+{
+    while (_crcChunks < _chunkDone.size() && _chunkDone[_crcChunks])
+    {
+        const size_t offset = _crcChunks * _chunkSize;
+        _crc.update(_data.data() + offset, std::min(_chunkSize, _options.fileSizeInBytes - offset));
+        ++_crcChunks;
+    }
+}
+
+size_t PipelinedFileDownload::contiguousBytesLocked () const
+{
+    return std::min(_crcChunks * _chunkSize, _options.fileSizeInBytes);
+}
+
+void PipelinedFileDownload::fillWindowLocked (Deferred& deferred)
+{
+    const size_t window = std::max<size_t>(1, _options.window);
+
+    while (_inFlight < window)
+    {
+        while (_nextChunk < _chunkDone.size() && (_chunkDone[_nextChunk] || _chunkInFlight[_nextChunk]))
+            ++_nextChunk;
+
+        if (_nextChunk == _chunkDone.size())
+            break;
+
+        const size_t chunk = _nextChunk++;
+        const size_t offset = chunk * _chunkSize;
+        const size_t size = std::min(_chunkSize, _options.fileSizeInBytes - offset);
+
+        _chunkInFlight[chunk] = 1;
+        ++_chunkAttempts[chunk];
+        ++_inFlight;
+
+        Submission submission;
+        submission.chunk = chunk;
+        submission.payload[0] = _options.fileId;
+        submission.payload[1] = uint16_t(offset & 0xffff);
+        submission.payload[2] = uint16_t(offset >> 16);
+        submission.payload[3] = uint16_t((size + 1) / 2);
+        deferred.submissions.push_back(submission);
+    }
+}
+
+void PipelinedFileDownload::finishLocked (FileDownloadStatus status, Deferred& deferred)
+{
+    _status = status;
+
+    // Give the pipeline its slots back. Not needed on Interrupted: the pipeline already failed everything.
+    if (status == FileDownloadStatus::Failed || status == FileDownloadStatus::Cancelled)
+    {
+        for (size_t chunk = 0; chunk < _chunkInFlight.size(); ++chunk)
+        {
+            if (_chunkInFlight[chunk] && _tickets[chunk] != 0)
+                deferred.cancels.push_back(_tickets[chunk]);
+        }
+    }
+
+    std::fill(_chunkInFlight.begin(), _chunkInFlight.end(), 0);
+    _inFlight = 0;
+
+    deferred.finished = true;
+    deferred.status = status;
+    deferred.contiguousBytes = contiguousBytesLocked();
+}
+
+void PipelinedFileDownload::run (OpcodePipeline* pipeline, uint32_t generation, Deferred& deferred)
+{
+    if (deferred.reportProgress && _progress)
+        _progress(deferred.downloadedBytes, _options.fileSizeInBytes);
+
+    if (pipeline)
+    {
+        for (OpcodePipeline::Ticket ticket : deferred.cancels)
+            pipeline->cancel(ticket);
+
+        std::shared_ptr<PipelinedFileDownload> self = shared_from_this();
+        for (const Submission& submission : deferred.submissions)
+        {
+            const size_t chunk = submission.chunk;
+            const OpcodePipeline::Ticket ticket = pipeline->submit(PS1080Opcode_DownloadFile, submission.payload, 4, _options.chunkTimeoutSeconds,
+                [self, chunk, generation] (OpcodeRequestStatus status, uint16_t replyCode, const uint16_t* payload, size_t payloadSize)
+            {
+                self->handleReply(chunk, generation, status, replyCode, payload, payloadSize);
+            });
+
+            std::lock_guard<std::mutex> lock (_mutex);
+            if (generation == _generation && _chunkInFlight[chunk])
+                _tickets[chunk] = ticket;
+        }
+    }
+
+    // _data is not touched again until the next resume(), which callers only do after this.
+    if (deferred.finished && _completion)
+        _completion(deferred.status, _data, deferred.contiguousBytes);
+}
+
+void PipelinedFileDownload::handleReply (size_t chunk, uint32_t generation, OpcodeRequestStatus status,
+                                         uint16_t replyCode, const uint16_t* payload, size_t payloadSize)
+{
+    Deferred deferred;
+    OpcodePipeline* pipeline;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        if (generation != _generation || _status != FileDownloadStatus::InProgress || !_chunkInFlight[chunk])
+            return;
+
+        pipeline = _pipeline;
+        _chunkInFlight[chunk] = 0;
+        _tickets[chunk] = 0;
+        --_inFlight;
+
+        switch (status)
+        {
+            case OpcodeRequestStatus::Completed:
+            {
+                const size_t offset = chunk * _chunkSize;
+                const size_t expected = std::min(_chunkSize, _options.fileSizeInBytes - offset);
+                const size_t received = payloadSize >= sizeof(uint16_t) ? payloadSize - sizeof(uint16_t) : 0;
+
+                if (replyCode != PS1080_REPLY_CODE_ACK || received < expected)
+                {
+                    finishLocked(FileDownloadStatus::Failed, deferred);
+                    break;
+                }
+
+                // Payload words are little endian, like every host we run on, so the bytes copy straight over.
+                std::memcpy(_data.data() + offset, reinterpret_cast<const uint8_t*>(payload + 1), expected);
+                _chunkDone[chunk] = true;
+                ++_doneChunks;
+                _downloadedBytes += expected;
+                advanceCRCLocked();
+
+                deferred.reportProgress = true;
+                deferred.downloadedBytes = _downloadedBytes;
+                break;
+            }
+
+            case OpcodeRequestStatus::TimedOut:
+                if (_chunkAttempts[chunk] >= _options.maxAttemptsPerChunk)
+                    finishLocked(FileDownloadStatus::Failed, deferred);
+                else
+                    _nextChunk = std::min(_nextChunk, chunk); // ask again on the next fill
+                break;
+
+            case OpcodeRequestStatus::Cancelled:
+                // Somebody else cancelled the ticket: treat the chunk like a failed attempt.
+                if (_chunkAttempts[chunk] >= _options.maxAttemptsPerChunk)
+                    finishLocked(FileDownloadStatus::Failed, deferred);
+                else
+                    _nextChunk = std::min(_nextChunk, chunk);
+                break;
+
+            case OpcodeRequestStatus::Disconnected:
+                finishLocked(FileDownloadStatus::Interrupted, deferred);
+                break;
+        }
+
+        if (_status == FileDownloadStatus::InProgress)
+        {
+            if (_doneChunks == _chunkDone.size())
+                finishLocked(FileDownloadStatus::Completed, deferred);
+            else
+                fillWindowLocked(deferred);
+        }
+    }
+
+    run(pipeline, generation, deferred);
+}
+
+} // oc namespace
@@ -0,0 +1,138 @@
+//
+//  PipelinedFileDownload.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "CRC16.h"
+#include "OpcodePipeline.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace oc {
+
+enum class FileDownloadStatus
+{
+    NotStarted,
+    InProgress,
+    Completed,
+    Interrupted, // the session went away; resume() fetches only what is still missing
+    Failed,      // NACK, malformed reply, or a chunk timed out too many times
+    Cancelled,
+};
+
+/**
+ * Downloads a flash file with several PS1080Opcode_DownloadFile chunk reads in flight at once.
+ *
+ * Chunks are sized to fill the reply MTU and requested in file order, at most window of them outstanding.
+ * Replies may come back in any order: each one is copied straight to its place in a buffer allocated once for
+ * the whole file, and a per-chunk bitmap tracks what has arrived.
+ *
+ * If the session drops, the download stops as Interrupted and keeps what it has; resume() on the new session
+ * only asks for the missing chunks. A download can also start from data kept from an earlier session
+ * (e.g. the NSData handed to DownloadFileProgressBlock): pass it as the resume prefix.
+ *
+ * The CRC of the contiguous prefix is updated as chunks land, so the file CRC is ready as soon as the last one does.
+ *
+ * Request: [fileId][offsetLo][offsetHi][sizeInWords], offset in bytes. Reply: [replyCode][data], short only at the end of the file.
+ */
+class PipelinedFileDownload : public std::enable_shared_from_this<PipelinedFileDownload>
+{
+public:
+    struct Options
+    {
+        uint16_t fileId = 0;
+        size_t fileSizeInBytes = 0;
+        size_t maxReplyPayloadWords = 256;  // transport MTU for replies, including the reply code
+        size_t window = 8;
+        double chunkTimeoutSeconds = 1.0;
+        int maxAttemptsPerChunk = 3;
+
+        // Must match how the file table CRC is computed.
+        CRC16Variant crcVariant = CRC16Variant::CCITT;
+        uint16_t crcInitialValue = 0xffff;
+    };
+
+    // downloadedBytes counts every byte received, not only the contiguous prefix.
+    typedef std::function<void (size_t downloadedBytes, size_t fileSizeInBytes)> ProgressCallback;
+
+    // data always has the full file size; contiguousBytes tells how much of it is valid from the start.
+    typedef std::function<void (FileDownloadStatus status, const std::vector<uint8_t>& data, size_t contiguousBytes)> CompletionCallback;
+
+    static std::shared_ptr<PipelinedFileDownload> create (const Options& options,
+                                                          ProgressCallback progress, CompletionCallback completion,
+                                                          const uint8_t* resumePrefix = nullptr, size_t resumePrefixSize = 0);
+
+    // start() only works once, resume() only after Interrupted. Both return false otherwise.
+    bool start (OpcodePipeline& pipeline);
+    bool resume (OpcodePipeline& pipeline);
+
+    void cancel ();
+
+    FileDownloadStatus status () const;
+    size_t contiguousBytes () const;
+    uint16_t contiguousCRC () const; // CRC over the first contiguousBytes()
+    size_t chunkSizeInBytes () const { return _chunkSize; }
+    size_t chunkCount () const { return _chunkDone.size(); }
+
+private:
+    PipelinedFileDownload (const Options& options, ProgressCallback progress, CompletionCallback completion,
+                           const uint8_t* resumePrefix, size_t resumePrefixSize);
+
+    struct Submission
+    {
+        size_t chunk;
+        uint16_t payload[4];
+    };
+
+    // Work collected under the lock and carried out after releasing it, since the pipeline may call back synchronously.
+    struct Deferred
+    {
+        std::vector<Submission> submissions;
+        std::vector<OpcodePipeline::Ticket> cancels;
+        bool reportProgress = false;
+        size_t downloadedBytes = 0;
+        bool finished = false;
+        FileDownloadStatus status = FileDownloadStatus::InProgress;
+        size_t contiguousBytes = 0;
+    };
+
+    bool launch (OpcodePipeline& pipeline, bool resuming);
+    void fillWindowLocked (Deferred& deferred);
+    void finishLocked (FileDownloadStatus status, Deferred& deferred);
+    void run (OpcodePipeline* pipeline, uint32_t generation, Deferred& deferred);
+    void handleReply (size_t chunk, uint32_t generation, OpcodeRequestStatus status, uint16_t replyCode, const uint16_t* payload, size_t payloadSize);
+    size_t contiguousBytesLocked () const;
+    void advanceCRCLocked ();
+
+    const Options _options;
+    const size_t _chunkSize;
+    ProgressCallback _progress;
+    CompletionCallback _completion;
+
+    mutable std::mutex _mutex;
+    OpcodePipeline* _pipeline = nullptr;
+    FileDownloadStatus _status = FileDownloadStatus::NotStarted;
+    uint32_t _generation = 0; // replies from a previous start/resume are ignored
+    std::vector<uint8_t> _data;
+    std::vector<bool> _chunkDone;
+    std::vector<uint8_t> _chunkInFlight;
+    std::vector<int> _chunkAttempts;
+    std::vector<OpcodePipeline::Ticket> _tickets;
+    size_t _nextChunk = 0;     // lowest chunk that may still need a request
+    size_t _inFlight = 0;
+    size_t _doneChunks = 0;
+    size_t _downloadedBytes = 0;
+    CRC16 _crc;
+    size_t _crcChunks = 0;     // chunks folded into _crc, always a contiguous prefix
+};
+
+} // oc namespace
@@ -0,0 +1,116 @@
+//
+//  RegistrationParamsCache.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "RegistrationParamsCache.h"
+
+#include <cmath>
+
+namespace oc {
+
+RegistrationParamsKey& RegistrationParamsKey::addBytes (const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        _hash ^= bytes[i];
+        _hash *= 1099511628211ull;
+    }
+    return *this;
+}
+
+RegistrationParamsKey& RegistrationParamsKey::addConfig (const SensorConfigSequence& sequence)
+{
+    const size_t count = sequence.settings != nullptr ? sequence.settingsCount : 0;
+    addBytes(&count, sizeof(count));
+
+    // SensorSetting is packed, so the settings hash as they are.
+    if (count > 0)
+        addBytes(sequence.settings, count * sizeof(SensorSetting));
+    return *this;
+}
+
+RegistrationParamsKey& RegistrationParamsKey::addLensPosition (float lensPosition, float lensPositionQuantum)
+{
+    const int64_t step = lensPositionQuantum > 0 ? int64_t(std::lround(lensPosition / lensPositionQuantum)) : 0;
+    return addBytes(&step, sizeof(step));
+}
+
+bool RegistrationParamsCache::lookup (uint64_t key, RegistrationParamsValue& value)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    auto found = _index.find(key);
+    if (found == _index.end())
+    {
+        ++_misses;
+        return false;
+    }
+
+    _entries.splice(_entries.begin(), _entries, found->second);
+    value = found->second->second;
+    ++_hits;
+    return true;
+}
+
+void RegistrationParamsCache::store (uint64_t key, const RegistrationParamsValue& value, uint64_t generation)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    if (generation != _generation)
+        return; // computed from a calibration that has been replaced since
+
+    auto found = _index.find(key);
+    if (found != _index.end())
+    {
+        found->second->second = value;
+        _entries.splice(_entries.begin(), _entries, found->second);
+        return;
+    }
+
+    _entries.emplace_front(key, value);
+    _index[key] = _entries.begin();
+
+    if (_entries.size() > _capacity)
+    {
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
+    }
+}
+
+void RegistrationParamsCache::invalidate ()
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _entries.clear();
+    _index.clear();
+    ++_generation;
+}
+
+uint64_t RegistrationParamsCache::generation () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _generation;
+}
+
+size_t RegistrationParamsCache::size () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _entries.size();
+}
+
+uint64_t RegistrationParamsCache::hits () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _hits;
+}
+
+uint64_t RegistrationParamsCache::misses () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _misses;
+}
+
+} // oc namespace
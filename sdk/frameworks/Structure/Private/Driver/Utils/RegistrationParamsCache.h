@@ -0,0 +1,99 @@
+//
+//  RegistrationParamsCache.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "PSConfigs.h"
+#include "PresetMaker.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace oc {
+
+/* The 29 registration params plus padding, as OCRegistrationManager computes them for struct Registration. */
+struct RegistrationParamsValue
+{
+    uint32_t params[PRESET_MAKER_NUM_REGISTRATION_PARAMS] = {};
+    uint16_t paddingParams[PRESET_MAKER_NUM_PADDING_PARAMS] = {};
+};
+
+/**
+ * 64-bit FNV-1a over everything registration params depend on. Intrinsics and extrinsics are hashed as raw bytes
+ * (pass &intrinsics, sizeof(intrinsics)), the config by its settings rather than its address, and the lens position
+ * after rounding to lensPositionQuantum so positions the autofocus reports with a little jitter share an entry.
+ */
+class RegistrationParamsKey
+{
+public:
+    RegistrationParamsKey& addBytes (const void* data, size_t size);
+    RegistrationParamsKey& addConfig (const SensorConfigSequence& sequence);
+    RegistrationParamsKey& addLensPosition (float lensPosition, float lensPositionQuantum = 1.f / 1024.f);
+
+    uint64_t value () const { return _hash; }
+
+private:
+    uint64_t _hash = 14695981039346656037ull;
+};
+
+/**
+ * LRU memo of computeRegistrationParamsForVgaRgbIntrinsics:config:registrationParams:forceZeroLatchID: results, for
+ * autofocus-driven relatching that keeps coming back to the same few lens positions.
+ *
+ * Entries only depend on the key, so the cache must be cleared whenever the calibration behind it changes
+ * (uploadCalibrationWithData:, a new general store). invalidate() also bumps generation(): a computation that started
+ * before the invalidation passes the generation it read to store(), which then drops the stale result.
+ *
+ * Thread safe.
+ */
+class RegistrationParamsCache
+{
+public:
+    explicit RegistrationParamsCache (size_t capacity = 32) : _capacity(capacity > 0 ? capacity : 1) {}
+
+    bool lookup (uint64_t key, RegistrationParamsValue& value);
+    void store (uint64_t key, const RegistrationParamsValue& value, uint64_t generation);
+
+    // Returns the cached value, or runs compute(RegistrationParamsValue&) -> bool and caches what it produced.
+    template <class Compute>
+    bool getOrCompute (uint64_t key, RegistrationParamsValue& value, Compute&& compute)
+    {
+        if (lookup(key, value))
+            return true;
+
+        const uint64_t startGeneration = generation();
+        if (!compute(value))
+            return false;
+
+        store(key, value, startGeneration);
+        return true;
+    }
+
+    void invalidate ();
+    uint64_t generation () const;
+
+    size_t size () const;
+    size_t capacity () const { return _capacity; }
+    uint64_t hits () const;
+    uint64_t misses () const;
+
+private:
+    typedef std::list<std::pair<uint64_t, RegistrationParamsValue>> EntryList;
+
+    const size_t _capacity;
+    mutable std::mutex _mutex;
+    EntryList _entries; // most recently used first
+    std::unordered_map<uint64_t, EntryList::iterator> _index;
+    uint64_t _generation = 0;
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+};
+
+} // oc namespace
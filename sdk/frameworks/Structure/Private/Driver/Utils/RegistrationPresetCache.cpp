@@ -0,0 +1,226 @@
+//
+//  RegistrationPresetCache.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "RegistrationPresetCache.h"
+
+#include <cstdlib>
+
+namespace oc {
+
+namespace {
+
+    const PresetMakerResolution presetResolutions[] = {
+        PRESET_MAKER_RESOLUTION_QQVGA,
+        PRESET_MAKER_RESOLUTION_QVGA,
+        PRESET_MAKER_RESOLUTION_VGA,
+    };
+
+    const PresetMakerFPS presetFPS[] = {
+        PRESET_MAKER_FPS_30,
+        PRESET_MAKER_FPS_60,
+    };
+
+    int resolutionIndex (PresetMakerResolution resolution)
+    {
+        for (size_t i = 0; i < sizeof(presetResolutions) / sizeof(presetResolutions[0]); ++i)
+            if (presetResolutions[i] == resolution)
+                return int(i);
+        return -1;
+    }
+
+    int fpsIndex (PresetMakerFPS fps)
+    {
+        for (size_t i = 0; i < sizeof(presetFPS) / sizeof(presetFPS[0]); ++i)
+            if (presetFPS[i] == fps)
+                return int(i);
+        return -1;
+    }
+
+    struct PresetFileLayout
+    {
+        size_t headerSize = 0;
+        size_t blockSize = 0;
+        size_t trailerSize = 0;
+    };
+
+    // What PresetMaker writes for the file header, one preset block and the terminator. Every block has the same
+    // size (fixed param and padding counts), so one probe into a scratch buffer far larger than its params gives the
+    // exact layout; a PresetMaker that writes past the scratch has already corrupted memory, hence the abort.
+    const PresetFileLayout& presetFileLayout ()
+    {
+        static const PresetFileLayout layout = [] {
+            std::vector<uint8_t> scratch (4096);
+            uint32_t params[PRESET_MAKER_NUM_REGISTRATION_PARAMS] = {};
+            uint16_t paddingParams[PRESET_MAKER_NUM_PADDING_PARAMS] = {};
+
+            ByteStream stream;
+            bsInit(&stream, scratch.data());
+
+            PresetFileLayout probed;
+            bsInitRegistrationPreset(&stream);
+            probed.headerSize = bsGetOffset(&stream);
+            bsAddRegistrationPreset(&stream, PRESET_MAKER_RESOLUTION_QVGA, PRESET_MAKER_FPS_30, params, paddingParams);
+            probed.blockSize = bsGetOffset(&stream) - probed.headerSize;
+            bsFinishPreset(&stream);
+            probed.trailerSize = bsGetOffset(&stream) - probed.headerSize - probed.blockSize;
+
+            if (bsGetOffset(&stream) > scratch.size())
+                std::abort();
+
+            return probed;
+        }();
+
+        return layout;
+    }
+
+} // anonymous namespace
+
+bool RegistrationPresetCache::supports (PresetMakerResolution resolution, PresetMakerFPS fps)
+{
+    return resolutionIndex(resolution) >= 0 && fpsIndex(fps) >= 0;
+}
+
+uint32_t RegistrationPresetCache::fingerprint (const void* calibrationData, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(calibrationData);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+size_t RegistrationPresetCache::rebuild (uint32_t calibrationFingerprint, const ComputeFunction& compute)
+{
+    // Computed outside the lock: the registration math is the slow part, lookups keep serving the old presets.
+    std::vector<RegistrationPreset> presets;
+    presets.reserve(PresetCount);
+
+    for (PresetMakerResolution resolution : presetResolutions)
+    {
+        for (PresetMakerFPS fps : presetFPS)
+        {
+            RegistrationPreset preset;
+            preset.resolution = resolution;
+            preset.fps = fps;
+
+            if (compute && compute(preset))
+                presets.push_back(preset);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock (_mutex);
+    _presets.swap(presets);
+    _calibrationFingerprint = calibrationFingerprint;
+    _built = true;
+    return _presets.size();
+}
+
+void RegistrationPresetCache::clear ()
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _presets.clear();
+    _calibrationFingerprint = 0;
+    _built = false;
+}
+
+bool RegistrationPresetCache::isCurrent (uint32_t calibrationFingerprint) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _built && _calibrationFingerprint == calibrationFingerprint;
+}
+
+uint32_t RegistrationPresetCache::calibrationFingerprint () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _calibrationFingerprint;
+}
+
+bool RegistrationPresetCache::find (PresetMakerResolution resolution, PresetMakerFPS fps, RegistrationPreset& preset) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    for (const RegistrationPreset& candidate : _presets)
+    {
+        if (candidate.resolution == resolution && candidate.fps == fps)
+        {
+            preset = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool RegistrationPresetCache::findForConfig (const SensorConfigSequence& sequence, RegistrationPreset& preset) const
+{
+    bool haveResolution = false;
+    bool haveFPS = false;
+    uint16_t resolution = 0;
+    uint16_t fps = 0;
+
+    // PARAM_DEPTH_RESOLUTION uses the PresetMakerResolution values; the last write wins.
+    for (size_t i = 0; sequence.settings != nullptr && i < sequence.settingsCount; ++i)
+    {
+        if (sequence.settings[i].param == PARAM_DEPTH_RESOLUTION)
+        {
+            resolution = sequence.settings[i].value;
+            haveResolution = true;
+        }
+        else if (sequence.settings[i].param == PARAM_DEPTH_FPS)
+        {
+            fps = sequence.settings[i].value;
+            haveFPS = true;
+        }
+    }
+
+    if (!haveResolution || !haveFPS)
+        return false;
+
+    return find(PresetMakerResolution(resolution), PresetMakerFPS(fps), preset);
+}
+
+std::vector<uint8_t> RegistrationPresetCache::presetFile () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    std::vector<uint8_t> file;
+    if (_presets.empty())
+        return file;
+
+    const PresetFileLayout& layout = presetFileLayout();
+    file.resize(layout.headerSize + _presets.size() * layout.blockSize + layout.trailerSize);
+
+    ByteStream stream;
+    bsInit(&stream, file.data());
+    bsInitRegistrationPreset(&stream);
+
+    for (const RegistrationPreset& preset : _presets)
+    {
+        // PresetMaker takes non-const arrays but only reads them.
+        RegistrationPreset copy = preset;
+        bsAddRegistrationPreset(&stream, copy.resolution, copy.fps, copy.params, copy.paddingParams);
+    }
+
+    bsFinishPreset(&stream);
+
+    // Blocks are fixed size, so anything else means the probe did not describe this file.
+    if (bsGetOffset(&stream) != file.size())
+        std::abort();
+
+    return file;
+}
+
+size_t RegistrationPresetCache::presetCount () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _presets.size();
+}
+
+} // oc namespace
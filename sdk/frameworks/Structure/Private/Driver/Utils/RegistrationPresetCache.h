@@ -0,0 +1,86 @@
+//
+//  RegistrationPresetCache.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "PSConfigs.h"
+#include "PresetMaker.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace oc {
+
+/* Registration params for one (resolution, fps), as bsAddRegistrationPreset writes them. */
+struct RegistrationPreset
+{
+    PresetMakerResolution resolution = PRESET_MAKER_RESOLUTION_QVGA;
+    PresetMakerFPS fps = PRESET_MAKER_FPS_30;
+    uint32_t params[PRESET_MAKER_NUM_REGISTRATION_PARAMS] = {};
+    uint16_t paddingParams[PRESET_MAKER_NUM_PADDING_PARAMS] = {};
+};
+
+/**
+ * Registration presets for every (resolution, fps) the firmware can register, computed once per calibration.
+ *
+ * rebuild() runs the registration computation for each combination and keeps the results; presetFile() serializes
+ * them with PresetMaker into the preset file the firmware looks up in flash. A preset block carries only its
+ * resolution, fps and params, no latch ID: the firmware's Preset_Find picks the block by the depth resolution and fps
+ * the stream starts with. So while the flash presets are current, starting registered depth needs no params from the
+ * host; the host side lookups are keyed the same way.
+ *
+ * The calibration fingerprint is stored as the preset file version, so after a reconnect a file table entry with the
+ * same version means the flash presets are current.
+ *
+ * Thread safe.
+ */
+class RegistrationPresetCache
+{
+public:
+    enum { PresetCount = 6 }; // QQVGA, QVGA, VGA at 30 and 60 fps
+
+    // Fills params and paddingParams for resolution/fps. Returns false if that combination cannot be registered.
+    typedef std::function<bool (RegistrationPreset& preset)> ComputeFunction;
+
+    // Recomputes every preset. calibrationFingerprint identifies the calibration they came from (see fingerprint()).
+    // Returns how many presets were computed.
+    size_t rebuild (uint32_t calibrationFingerprint, const ComputeFunction& compute);
+
+    void clear ();
+
+    // True if the presets were computed from this calibration.
+    bool isCurrent (uint32_t calibrationFingerprint) const;
+    uint32_t calibrationFingerprint () const;
+
+    bool find (PresetMakerResolution resolution, PresetMakerFPS fps, RegistrationPreset& preset) const;
+
+    // The preset for the depth resolution and fps a config sequence sets, e.g. QVGADepthRegisteredSequence.
+    bool findForConfig (const SensorConfigSequence& sequence, RegistrationPreset& preset) const;
+
+    // Preset file contents: bsInitRegistrationPreset, one block per preset, bsFinishPreset. Empty if there are none.
+    // The buffer is sized from the block sizes PresetMaker actually writes (see presetFileLayout in the .cpp).
+    std::vector<uint8_t> presetFile () const;
+
+    size_t presetCount () const;
+
+    // True for the combinations PresetMaker can write a preset for.
+    static bool supports (PresetMakerResolution resolution, PresetMakerFPS fps);
+
+    // FNV-1a of the calibration bytes the presets derive from (intrinsics, extrinsics, depth calibration).
+    static uint32_t fingerprint (const void* calibrationData, size_t size);
+
+private:
+    mutable std::mutex _mutex;
+    std::vector<RegistrationPreset> _presets;
+    uint32_t _calibrationFingerprint = 0;
+    bool _built = false;
+};
+
+} // oc namespace
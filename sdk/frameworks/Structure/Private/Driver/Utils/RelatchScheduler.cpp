@@ -0,0 +1,342 @@
+//
+//  RelatchScheduler.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "RelatchScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace oc {
+
+namespace {
+
+    void run (std::vector<std::function<void ()>>& actions)
+    {
+        for (auto& action : actions)
+            action();
+    }
+
+} // anonymous namespace
+
+RelatchScheduler::RelatchScheduler (const Options& options, Callbacks callbacks)
+: _options(options), _callbacks(std::move(callbacks))
+{
+    _cells.resize(std::max<size_t>(1, options.gridSize));
+}
+
+float RelatchScheduler::lensPositionForCell (size_t cell) const
+{
+    return _cells.size() > 1 ? float(cell) / float(_cells.size() - 1) : 0.f;
+}
+
+size_t RelatchScheduler::cellForLensPosition (float lensPosition) const
+{
+    if (!(lensPosition > 0.f))
+        return 0;
+
+    const size_t last = _cells.size() - 1;
+    return std::min(last, size_t(std::lround(std::min(lensPosition, 1.f) * float(last))));
+}
+
+uint16_t RelatchScheduler::latchIDForLensPosition (float lensPosition) const
+{
+    return latchIDLocked(cellForLensPosition(lensPosition));
+}
+
+size_t RelatchScheduler::precompute ()
+{
+    size_t computed = 0;
+    RegistrationParamsValue value;
+
+    for (size_t cell = 0; cell < _cells.size(); ++cell)
+        if (cellValue(cell, value))
+            ++computed;
+
+    return computed;
+}
+
+void RelatchScheduler::invalidate ()
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    ++_generation;
+    for (Cell& cell : _cells)
+        cell.computed = false;
+    _staged.clear();
+}
+
+bool RelatchScheduler::cellValue (size_t cell, RegistrationParamsValue& value)
+{
+    uint64_t generation;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        if (_cells[cell].computed)
+        {
+            value = _cells[cell].value;
+            return true;
+        }
+        generation = _generation;
+    }
+
+    if (!_callbacks.compute || !_callbacks.compute(lensPositionForCell(cell), value))
+        return false;
+
+    std::lock_guard<std::mutex> lock (_mutex);
+    if (generation == _generation)
+    {
+        _cells[cell].value = value;
+        _cells[cell].computed = true;
+    }
+    return true;
+}
+
+bool RelatchScheduler::isStagedLocked (size_t cell) const
+{
+    return std::find(_staged.begin(), _staged.end(), cell) != _staged.end();
+}
+
+void RelatchScheduler::markStagedLocked (size_t cell)
+{
+    // The firmware is assumed to overwrite its least recently used entry, which is what this mirrors.
+    auto found = std::find(_staged.begin(), _staged.end(), cell);
+    if (found != _staged.end())
+        _staged.erase(found);
+
+    _staged.push_back(cell);
+    while (_staged.size() > _options.stagingSlots)
+        _staged.pop_front();
+}
+
+void RelatchScheduler::setLensPosition (float lensPosition)
+{
+    Actions actions;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        const size_t cell = cellForLensPosition(lensPosition);
+        if (cell == _target)
+            return;
+
+        _target = cell;
+        ++_stats.lensChanges;
+        _retries = 0;
+
+        if (_inFlight != NoCell)
+        {
+            if (_pending != NoCell)
+                ++_stats.coalesced;
+            _pending = cell != _inFlight ? cell : NoCell;
+        }
+        else if (latchIDLocked(cell) != _latchedID)
+        {
+            startLatchLocked(cell, actions);
+        }
+    }
+
+    run(actions);
+}
+
+void RelatchScheduler::startLatchLocked (size_t cell, Actions& actions)
+{
+    _inFlight = cell;
+    _pending = NoCell;
+
+    const uint64_t generation = _generation;
+    const uint16_t latchID = latchIDLocked(cell);
+    const bool staged = _options.stagingSlots > 0 && _callbacks.stage && _callbacks.latch && isStagedLocked(cell);
+
+    if (staged)
+    {
+        markStagedLocked(cell);
+        actions.push_back([this, cell, generation, latchID] {
+            _callbacks.latch(latchID, [this, cell, generation] (bool succeeded) {
+                latchCompleted(cell, generation, true, succeeded);
+            });
+        });
+        return;
+    }
+
+    actions.push_back([this, cell, generation, latchID] {
+        RegistrationParamsValue value;
+        if (!_callbacks.uploadAndLatch || !cellValue(cell, value))
+        {
+            latchCompleted(cell, generation, false, false);
+            return;
+        }
+
+        _callbacks.uploadAndLatch(latchID, value, [this, cell, generation] (bool succeeded) {
+            latchCompleted(cell, generation, false, succeeded);
+        });
+    });
+}
+
+void RelatchScheduler::latchCompleted (size_t cell, uint64_t generation, bool staged, bool succeeded)
+{
+    Actions actions;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        _inFlight = NoCell;
+
+        if (succeeded)
+        {
+            _latchedID = latchIDLocked(cell);
+            ++_stats.latches;
+            if (staged)
+                ++_stats.stagedLatches;
+            // An upload leaves the params in the firmware's table as well.
+            if (!staged && _options.stagingSlots > 0 && generation == _generation)
+                markStagedLocked(cell);
+            if (_pending == cell)
+                _pending = NoCell;
+        }
+        else
+        {
+            ++_stats.failures;
+            if (staged)
+            {
+                auto found = std::find(_staged.begin(), _staged.end(), cell);
+                if (found != _staged.end())
+                    _staged.erase(found);
+            }
+            if (_pending == NoCell && _target == cell)
+            {
+                if (_retries < _options.maxRetries)
+                {
+                    ++_retries;
+                    _pending = cell;
+                }
+                else
+                {
+                    // Given up on this cell: forget it, so the next report of the same lens position latches again.
+                    _target = NoCell;
+                    _retries = 0;
+                }
+            }
+        }
+
+        if (_pending != NoCell)
+            startLatchLocked(_pending, actions);
+        else
+            prefetchLocked(actions);
+    }
+
+    run(actions);
+}
+
+void RelatchScheduler::prefetchLocked (Actions& actions)
+{
+    if (_options.stagingSlots == 0 || !_callbacks.stage || !_callbacks.latch)
+        return;
+    if (_staging || _inFlight != NoCell || _pending != NoCell || _target == NoCell)
+        return;
+
+    // Never stage more neighbors than the table holds along with the latched cell.
+    const size_t radius = std::min(_options.prefetchRadius, (_options.stagingSlots - 1) / 2);
+
+    for (size_t distance = 1; distance <= radius; ++distance)
+    {
+        for (int side = 0; side < 2; ++side)
+        {
+            if (side == 0 && _target < distance)
+                continue;
+
+            const size_t cell = side == 0 ? _target - distance : _target + distance;
+            if (cell >= _cells.size() || isStagedLocked(cell))
+                continue;
+
+            _staging = true;
+            const uint64_t generation = _generation;
+            const uint16_t latchID = latchIDLocked(cell);
+
+            actions.push_back([this, cell, generation, latchID] {
+                RegistrationParamsValue value;
+                if (!cellValue(cell, value))
+                {
+                    stageCompleted(cell, generation, false);
+                    return;
+                }
+
+                _callbacks.stage(latchID, value, [this, cell, generation] (bool succeeded) {
+                    stageCompleted(cell, generation, succeeded);
+                });
+            });
+            return;
+        }
+    }
+}
+
+void RelatchScheduler::stageCompleted (size_t cell, uint64_t generation, bool succeeded)
+{
+    Actions actions;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+
+        _staging = false;
+
+        if (succeeded)
+        {
+            ++_stats.stages;
+            if (generation == _generation)
+                markStagedLocked(cell);
+            prefetchLocked(actions);
+        }
+        else
+        {
+            ++_stats.failures; // stop prefetching until the next latch
+        }
+    }
+
+    run(actions);
+}
+
+void RelatchScheduler::onDepthFrame (uint16_t latchID)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    ++_stats.frames;
+    if (_target != NoCell && latchID == latchIDLocked(_target))
+        ++_stats.framesCurrent;
+    else
+        ++_stats.framesStale;
+}
+
+uint16_t RelatchScheduler::latchedID () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _latchedID;
+}
+
+uint16_t RelatchScheduler::targetID () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _target != NoCell ? latchIDLocked(_target) : 0;
+}
+
+bool RelatchScheduler::idle () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _inFlight == NoCell && _pending == NoCell && !_staging;
+}
+
+RelatchScheduler::Stats RelatchScheduler::stats () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _stats;
+}
+
+void RelatchScheduler::resetStats ()
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _stats = Stats();
+}
+
+} // oc namespace
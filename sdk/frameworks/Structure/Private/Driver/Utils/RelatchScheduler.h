@@ -0,0 +1,146 @@
+//
+//  RelatchScheduler.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "RegistrationParamsCache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace oc {
+
+/**
+ * Keeps the latched registration params following the color lens while it focuses.
+ *
+ * Lens positions in [0, 1] are snapped to a grid of gridSize cells; each cell has its own latch ID
+ * (firstLatchID + cell) and its params are computed once per calibration by precompute(), or on first use.
+ *
+ * Only one relatch is in flight at a time. Lens changes that arrive meanwhile are coalesced: when it completes, only
+ * the latest target is latched, never the positions the lens went through on the way.
+ *
+ * With stagingSlots > 0 and the stage/latch callbacks set, the params of the cells around the latched one are
+ * uploaded ahead of time while nothing else is pending, and latching a staged cell is a single latch opcode. Without
+ * them every relatch goes through uploadAndLatch (setAndLatchRegistrationParams:latchID:).
+ *
+ * onDepthFrame() compares the latch ID of each depth frame with the one the current lens position calls for, which
+ * gives the share of frames that were registered for where the lens actually was.
+ *
+ * Thread safe. Callbacks run without the internal lock held; completions may be called from any thread, including
+ * from inside the callback.
+ */
+class RelatchScheduler
+{
+public:
+    typedef std::function<void (bool succeeded)> Completion;
+
+    struct Options
+    {
+        size_t gridSize = 64;
+        uint16_t firstLatchID = 0xE000;  // cell i latches as firstLatchID + i
+        size_t stagingSlots = 0;         // latch table entries the firmware keeps, 0 if it cannot stage
+        size_t prefetchRadius = 2;       // cells on each side of the latched one to stage
+        int maxRetries = 2;              // then the target is dropped until its lens position is reported again
+    };
+
+    struct Callbacks
+    {
+        // Registration params for a lens position (computeRegistrationParamsForVgaRgbIntrinsics:..., or the cache).
+        std::function<bool (float lensPosition, RegistrationParamsValue& value)> compute;
+        std::function<void (uint16_t latchID, const RegistrationParamsValue& value, Completion completion)> uploadAndLatch;
+        // Optional, both or neither.
+        std::function<void (uint16_t latchID, const RegistrationParamsValue& value, Completion completion)> stage;
+        std::function<void (uint16_t latchID, Completion completion)> latch;
+    };
+
+    struct Stats
+    {
+        uint64_t lensChanges = 0;
+        uint64_t coalesced = 0;          // targets replaced before they were latched
+        uint64_t latches = 0;
+        uint64_t stagedLatches = 0;      // of which only needed the latch opcode
+        uint64_t stages = 0;
+        uint64_t failures = 0;
+        uint64_t frames = 0;
+        uint64_t framesCurrent = 0;      // latch ID matched the lens position
+        uint64_t framesStale = 0;
+
+        double currentFraction () const { return frames > 0 ? double(framesCurrent) / double(frames) : 0.0; }
+    };
+
+    RelatchScheduler (const Options& options, Callbacks callbacks);
+
+    // Computes every grid cell that is missing. Slow; run it off the accessory thread after a calibration change.
+    // Returns how many cells have params.
+    size_t precompute ();
+
+    // The calibration changed: forgets computed params and what is staged. The latched ID stays until the next relatch.
+    void invalidate ();
+
+    void setLensPosition (float lensPosition);
+    void onDepthFrame (uint16_t latchID);
+
+    uint16_t latchIDForLensPosition (float lensPosition) const;
+    size_t cellForLensPosition (float lensPosition) const;
+
+    // 0 until something is latched.
+    uint16_t latchedID () const;
+    // 0 without a target, also after the target's latch failed maxRetries + 1 times.
+    uint16_t targetID () const;
+    bool idle () const;
+
+    Stats stats () const;
+    void resetStats ();
+
+private:
+    static const size_t NoCell = size_t(-1);
+
+    struct Cell
+    {
+        bool computed = false;
+        RegistrationParamsValue value;
+    };
+
+    typedef std::vector<std::function<void ()>> Actions;
+
+    uint16_t latchIDLocked (size_t cell) const { return uint16_t(_options.firstLatchID + cell); }
+    float lensPositionForCell (size_t cell) const;
+    bool isStagedLocked (size_t cell) const;
+    void markStagedLocked (size_t cell);
+
+    void startLatchLocked (size_t cell, Actions& actions);
+    void latchCompleted (size_t cell, uint64_t generation, bool staged, bool succeeded);
+    void prefetchLocked (Actions& actions);
+    void stageCompleted (size_t cell, uint64_t generation, bool succeeded);
+
+    // Params for a cell, computing them outside the lock if needed.
+    bool cellValue (size_t cell, RegistrationParamsValue& value);
+
+    const Options _options;
+    const Callbacks _callbacks;
+
+    mutable std::mutex _mutex;
+    std::vector<Cell> _cells;
+    uint64_t _generation = 0;
+
+    size_t _target = NoCell;
+    size_t _inFlight = NoCell;
+    size_t _pending = NoCell;
+    int _retries = 0;
+    uint16_t _latchedID = 0;
+
+    std::deque<size_t> _staged;  // most recently used last
+    bool _staging = false;
+
+    Stats _stats;
+};
+
+} // oc namespace
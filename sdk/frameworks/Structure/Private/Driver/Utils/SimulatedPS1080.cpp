@@ -0,0 +1,898 @@
+//
+//  SimulatedPS1080.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "SimulatedPS1080.h"
+#include "PS1080Opcodes.h"
+#include "PSConfigs.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace oc {
+
+namespace {
+
+    double monotonicSeconds ()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint32_t readUInt32 (const std::vector<uint16_t>& words, size_t index)
+    {
+        return uint32_t(words[index]) | (uint32_t(words[index + 1]) << 16);
+    }
+
+    void appendUInt32 (std::vector<uint16_t>& words, uint32_t value)
+    {
+        words.push_back(uint16_t(value & 0xffff));
+        words.push_back(uint16_t(value >> 16));
+    }
+
+    // Bytes packed little-endian into words, as the I2C opcodes carry them.
+    std::vector<uint8_t> unpackBytes (const std::vector<uint16_t>& words, size_t firstWord, size_t length)
+    {
+        std::vector<uint8_t> bytes (length);
+        for (size_t i = 0; i < length; ++i)
+        {
+            const uint16_t word = words[firstWord + i / 2];
+            bytes[i] = uint8_t((i & 1) ? word >> 8 : word & 0xff);
+        }
+        return bytes;
+    }
+
+    void packBytes (std::vector<uint16_t>& words, const uint8_t* bytes, size_t length)
+    {
+        for (size_t i = 0; i < length; i += 2)
+            words.push_back(uint16_t(bytes[i] | (i + 1 < length ? bytes[i + 1] << 8 : 0)));
+    }
+
+    void resolutionSize (uint16_t resolution, int& width, int& height)
+    {
+        switch (resolution)
+        {
+            case 1:  width = 640;  height = 480;  break; // VGA
+            case 2:  width = 1280; height = 1024; break; // SXGA
+            case 4:  width = 160;  height = 120;  break; // QQVGA
+            default: width = 320;  height = 240;  break; // QVGA
+        }
+    }
+
+    uint16_t i2cKey (uint8_t busId, uint8_t slaveAddress)
+    {
+        return uint16_t((uint16_t(busId) << 8) | slaveAddress);
+    }
+
+} // anonymous namespace
+
+SimulatedPS1080::SimulatedPS1080 (int controlFd, int streamFd)
+: _controlFd(controlFd), _streamFd(streamFd)
+{
+    setLink(SimulatedPS1080Link());
+}
+
+SimulatedPS1080::~SimulatedPS1080 ()
+{
+    stop();
+}
+
+void SimulatedPS1080::start ()
+{
+    if (_running.exchange(true))
+        return;
+
+    if (pipe(_wakePipe) != 0)
+    {
+        _running = false;
+        return;
+    }
+
+    fcntl(_wakePipe[0], F_SETFL, fcntl(_wakePipe[0], F_GETFL) | O_NONBLOCK);
+    if (_streamFd >= 0)
+        fcntl(_streamFd, F_SETFL, fcntl(_streamFd, F_GETFL) | O_NONBLOCK);
+
+    _thread = std::thread([this] () { run(); });
+}
+
+void SimulatedPS1080::stop ()
+{
+    if (!_running.exchange(false))
+        return;
+
+    const uint8_t wake = 0;
+    if (write(_wakePipe[1], &wake, 1) < 0) {} // the thread also wakes up on its own timeout
+
+    _thread.join();
+
+    close(_wakePipe[0]);
+    close(_wakePipe[1]);
+    _wakePipe[0] = _wakePipe[1] = -1;
+}
+
+void SimulatedPS1080::setLink (const SimulatedPS1080Link& link)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _link = link;
+    _randomState = link.randomSeed != 0 ? link.randomSeed : 1;
+}
+
+void SimulatedPS1080::setFirmwareVersion (uint16_t major, uint16_t minor, uint16_t build)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _version[0] = major;
+    _version[1] = minor;
+    _version[2] = build;
+}
+
+void SimulatedPS1080::setSupportsBatchOpcodes (bool supported)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _supportsBatchOpcodes = supported;
+}
+
+void SimulatedPS1080::addFile (const SimulatedFlashFile& file)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _files[file.id] = file;
+    ++_fileTableChangeCounter;
+}
+
+bool SimulatedPS1080::file (uint16_t id, SimulatedFlashFile& file) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    auto found = _files.find(id);
+    if (found == _files.end())
+        return false;
+
+    file = found->second;
+    return true;
+}
+
+uint16_t SimulatedPS1080::fileTableChangeCounter () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _fileTableChangeCounter;
+}
+
+void SimulatedPS1080::setAHB (uint32_t address, uint32_t value)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _ahb[address] = value;
+}
+
+uint32_t SimulatedPS1080::AHB (uint32_t address) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    auto found = _ahb.find(address);
+    return found != _ahb.end() ? found->second : 0;
+}
+
+void SimulatedPS1080::setI2CDevice (uint8_t busId, uint8_t slaveAddress, const std::vector<uint8_t>& memory, size_t addressLength)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    I2CDevice& device = _i2c[i2cKey(busId, slaveAddress)];
+    device.memory = memory;
+    device.addressLength = addressLength;
+    device.pointer = 0;
+}
+
+std::vector<uint8_t> SimulatedPS1080::I2CDeviceMemory (uint8_t busId, uint8_t slaveAddress) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    auto found = _i2c.find(i2cKey(busId, slaveAddress));
+    return found != _i2c.end() ? found->second.memory : std::vector<uint8_t>();
+}
+
+void SimulatedPS1080::setParam (uint16_t param, uint16_t value)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _params[param] = value;
+}
+
+uint16_t SimulatedPS1080::param (uint16_t param) const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    auto found = _params.find(param);
+    return found != _params.end() ? found->second : 0;
+}
+
+void SimulatedPS1080::setOpcodeHandler (uint16_t opcode, OpcodeHandler handler)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    if (handler)
+        _handlers[opcode] = std::move(handler);
+    else
+        _handlers.erase(opcode);
+}
+
+void SimulatedPS1080::setFrameScript (FrameScript script)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _frameScript = std::move(script);
+}
+
+SimulatedPS1080::Stats SimulatedPS1080::stats () const
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _stats;
+}
+
+double SimulatedPS1080::random ()
+{
+    // xorshift64*, deterministic for a given seed so lossy runs can be replayed
+    _randomState ^= _randomState >> 12;
+    _randomState ^= _randomState << 25;
+    _randomState ^= _randomState >> 27;
+    return double((_randomState * 0x2545f4914f6cdd1dULL) >> 11) / double(1ULL << 53);
+}
+
+//------------------------------------------------------------------------------
+
+void SimulatedPS1080::run ()
+{
+    PS1080ControlDecoder decoder (PS1080HostMagic);
+    std::vector<uint8_t> readBuffer (16 * 1024);
+
+    while (_running)
+    {
+        int timeoutMilliseconds;
+        bool streamPending;
+
+        {
+            std::lock_guard<std::mutex> lock (_mutex);
+
+            const double now = monotonicSeconds();
+            const double wake = nextWakeLocked(now);
+            timeoutMilliseconds = wake < 0 ? 100 : int(std::ceil(std::max(0.0, wake - now) * 1000.0));
+            streamPending = streamPendingLocked();
+        }
+
+        pollfd fds[3];
+        nfds_t count = 0;
+        fds[count++] = { _wakePipe[0], POLLIN, 0 };
+        fds[count++] = { _controlFd, POLLIN, 0 };
+        if (_streamFd >= 0 && streamPending)
+            fds[count++] = { _streamFd, POLLOUT, 0 };
+
+        if (poll(fds, count, timeoutMilliseconds) < 0 && errno != EINTR)
+            break;
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint8_t drain[16];
+            while (read(_wakePipe[0], drain, sizeof(drain)) > 0) {}
+        }
+
+        if (fds[1].revents & (POLLHUP | POLLERR | POLLNVAL))
+            break; // host closed the session
+
+        if (fds[1].revents & POLLIN)
+        {
+            const ssize_t bytesRead = read(_controlFd, readBuffer.data(), readBuffer.size());
+            if (bytesRead <= 0)
+                break;
+
+            decoder.feed(readBuffer.data(), size_t(bytesRead));
+
+            PS1080ControlFrame request;
+            while (decoder.next(request))
+            {
+                OpcodeHandler handler;
+
+                {
+                    std::lock_guard<std::mutex> lock (_mutex);
+
+                    _stats.bytesIn += sizeof(PS1080ControlHeader) + request.payload.size() * sizeof(uint16_t);
+                    ++_stats.requests;
+
+                    if (random() < _link.requestLossProbability)
+                    {
+                        ++_stats.droppedRequests;
+                        continue;
+                    }
+
+                    auto found = _handlers.find(request.header.opcode);
+                    if (found != _handlers.end())
+                        handler = found->second;
+                }
+
+                std::vector<uint16_t> reply (1, PS1080_REPLY_CODE_ACK);
+                const bool handled = handler && handler(request, reply);
+
+                std::lock_guard<std::mutex> lock (_mutex);
+
+                _executionDelay = 0;
+                if (!handled)
+                {
+                    reply.assign(1, PS1080_REPLY_CODE_ACK);
+                    handleFrameLocked(request, reply);
+                }
+
+                if (random() < _link.replyLossProbability)
+                {
+                    ++_stats.droppedReplies;
+                    continue;
+                }
+
+                std::vector<uint8_t> bytes;
+                appendPS1080ControlFrame(bytes, PS1080ReplyMagic, request.header.opcode, request.header.id, reply.data(), reply.size());
+                scheduleReplyLocked(monotonicSeconds() + _executionDelay, std::move(bytes));
+            }
+        }
+
+        std::vector<std::vector<uint8_t>> due;
+        std::vector<DueFrame> frames;
+        FrameScript frameScript;
+
+        {
+            std::lock_guard<std::mutex> lock (_mutex);
+
+            const double now = monotonicSeconds();
+
+            // Replies are scheduled in order, so the due ones are a prefix.
+            size_t dueCount = 0;
+            while (dueCount < _pendingReplies.size() && _pendingReplies[dueCount].due <= now)
+                ++dueCount;
+
+            for (size_t i = 0; i < dueCount; ++i)
+            {
+                _stats.bytesOut += _pendingReplies[i].bytes.size();
+                ++_stats.replies;
+                due.push_back(std::move(_pendingReplies[i].bytes));
+            }
+            _pendingReplies.erase(_pendingReplies.begin(), _pendingReplies.begin() + dueCount);
+
+            pumpStreamsLocked(now, frames);
+            if (!frames.empty())
+                frameScript = _frameScript;
+        }
+
+        for (const std::vector<uint8_t>& bytes : due)
+        {
+            size_t written = 0;
+            while (written < bytes.size())
+            {
+                const ssize_t result = write(_controlFd, bytes.data() + written, bytes.size() - written);
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result <= 0)
+                    break;
+                written += size_t(result);
+            }
+        }
+
+        if (!frames.empty())
+        {
+            for (DueFrame& frame : frames)
+            {
+                uint16_t* pixels = reinterpret_cast<uint16_t*>(frame.bytes.data() + sizeof(SimulatedStreamFrameHeader));
+                if (frameScript)
+                {
+                    frameScript(frame.type, frame.frameIndex, frame.width, frame.height, pixels);
+                }
+                else
+                {
+                    for (int y = 0; y < frame.height; ++y)
+                        for (int x = 0; x < frame.width; ++x)
+                            pixels[y * frame.width + x] = uint16_t(500 + ((x + y + int(frame.frameIndex)) % 256) * 10);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock (_mutex);
+            for (DueFrame& frame : frames)
+            {
+                _streams[frame.stream].buffer = std::move(frame.bytes);
+                _streams[frame.stream].offset = 0;
+            }
+        }
+
+        flushStream();
+    }
+}
+
+double SimulatedPS1080::nextWakeLocked (double now) const
+{
+    double wake = -1;
+
+    if (!_pendingReplies.empty())
+        wake = _pendingReplies.front().due;
+
+    for (const StreamState& stream : _streams)
+    {
+        if (stream.active && (wake < 0 || stream.nextFrame < wake))
+            wake = stream.nextFrame;
+    }
+
+    // Streams are (de)activated by SetParam, look again soon even if nothing is scheduled.
+    if (_streamFd >= 0 && (wake < 0 || wake > now + 0.01))
+        wake = now + 0.01;
+
+    return wake;
+}
+
+void SimulatedPS1080::scheduleReplyLocked (double now, std::vector<uint8_t> bytes)
+{
+    double due = now + _link.latencySeconds;
+
+    if (_link.bandwidthBytesPerSecond > 0)
+    {
+        const double start = std::max(due, _linkFreeAt);
+        due = start + double(bytes.size()) / _link.bandwidthBytesPerSecond;
+        _linkFreeAt = due;
+    }
+
+    // Keep the queue ordered even if the latency was lowered while replies were pending.
+    if (!_pendingReplies.empty())
+        due = std::max(due, _pendingReplies.back().due);
+
+    _pendingReplies.push_back({ due, std::move(bytes) });
+}
+
+//------------------------------------------------------------------------------
+
+void SimulatedPS1080::handleFrameLocked (const PS1080ControlFrame& request, std::vector<uint16_t>& reply)
+{
+    if (!handleBuiltinLocked(request, reply))
+        reply.assign(1, PS1080_REPLY_CODE_ILLEGAL_OPCODE);
+}
+
+bool SimulatedPS1080::handleBuiltinLocked (const PS1080ControlFrame& request, std::vector<uint16_t>& reply)
+{
+    const std::vector<uint16_t>& payload = request.payload;
+
+    auto nack = [&reply] () { reply.assign(1, PS1080_REPLY_CODE_NACK); return true; };
+
+    switch (request.header.opcode)
+    {
+        case PS1080Opcode_GetVersion:
+            reply.insert(reply.end(), _version, _version + 3);
+            return true;
+
+        case PS1080Opcode_KeepAlive:
+            return true;
+
+        case PS1080Opcode_GetParam:
+        {
+            if (payload.size() < 1)
+                return nack();
+            auto found = _params.find(payload[0]);
+            reply.push_back(found != _params.end() ? found->second : 0);
+            return true;
+        }
+
+        case PS1080Opcode_SetParam:
+            if (payload.empty() || payload.size() % 2 != 0)
+                return nack();
+            for (size_t i = 0; i < payload.size(); i += 2)
+                _params[payload[i]] = payload[i + 1];
+            return true;
+
+        case PS1080Opcode_ReadAHB:
+        {
+            if (payload.size() < 2)
+                return nack();
+            appendUInt32(reply, _ahb[readUInt32(payload, 0)]);
+            return true;
+        }
+
+        case PS1080Opcode_WriteAHB:
+        {
+            if (payload.size() < 6)
+                return nack();
+            uint32_t& value = _ahb[readUInt32(payload, 0)];
+            const uint32_t mask = readUInt32(payload, 4);
+            value = (value & ~mask) | (readUInt32(payload, 2) & mask);
+            return true;
+        }
+
+        case PS1080Opcode_AHBBatch:
+            if (!_supportsBatchOpcodes)
+                return false;
+            handleAHBBatchLocked(payload, reply);
+            return true;
+
+        case PS1080Opcode_I2CWrite:
+        {
+            if (payload.size() < 3 || payload.size() < 3 + (payload[2] + 1) / 2u)
+                return nack();
+            const std::vector<uint8_t> bytes = unpackBytes(payload, 3, payload[2]);
+            if (!I2CTransferLocked(uint8_t(payload[0]), uint8_t(payload[1]), bytes.data(), bytes.size(), nullptr, 0))
+                return nack();
+            return true;
+        }
+
+        case PS1080Opcode_I2CRead:
+        {
+            if (payload.size() < 4 || payload.size() < 4 + (payload[2] + 1) / 2u)
+                return nack();
+            const std::vector<uint8_t> bytes = unpackBytes(payload, 4, payload[2]);
+            std::vector<uint8_t> readBytes (payload[3]);
+            if (!I2CTransferLocked(uint8_t(payload[0]), uint8_t(payload[1]), bytes.data(), bytes.size(), readBytes.data(), readBytes.size()))
+                return nack();
+            packBytes(reply, readBytes.data(), readBytes.size());
+            return true;
+        }
+
+        case PS1080Opcode_I2CTransactionList:
+            if (!_supportsBatchOpcodes)
+                return false;
+            handleI2CTransactionListLocked(payload, reply);
+            return true;
+
+        case PS1080Opcode_GetFileList:
+            reply.push_back(_fileTableChangeCounter);
+            reply.push_back(uint16_t(_files.size()));
+            for (const auto& entry : _files)
+            {
+                const SimulatedFlashFile& file = entry.second;
+                reply.push_back(file.id);
+                reply.push_back(file.attributes);
+                reply.push_back(file.version);
+                appendUInt32(reply, uint32_t(file.data.size()));
+            }
+            return true;
+
+        case PS1080Opcode_DownloadFile:
+        {
+            if (payload.size() < 4)
+                return nack();
+
+            auto found = _files.find(payload[0]);
+            const size_t offset = readUInt32(payload, 1);
+            if (found == _files.end() || offset > found->second.data.size())
+                return nack();
+
+            const std::vector<uint8_t>& data = found->second.data;
+            const size_t length = std::min<size_t>(size_t(payload[3]) * 2, data.size() - offset);
+            packBytes(reply, data.data() + offset, length);
+            return true;
+        }
+
+        case PS1080Opcode_InitFileUpload:
+            if (payload.size() < 4)
+                return nack();
+            _upload = Upload();
+            _upload.active = true;
+            _upload.file.id = payload[0];
+            _upload.file.attributes = payload[1];
+            _upload.size = readUInt32(payload, 2);
+            _upload.file.data.assign(_upload.size, 0xff); // erased flash
+            return true;
+
+        case PS1080Opcode_WriteFileUpload:
+        {
+            if (!_upload.active || payload.size() < 2)
+                return nack();
+
+            const size_t offset = readUInt32(payload, 0);
+            const size_t length = (payload.size() - 2) * 2;
+            if (offset > _upload.size)
+                return nack();
+
+            const std::vector<uint8_t> bytes = unpackBytes(payload, 2, length);
+            std::copy(bytes.begin(), bytes.begin() + std::min(length, _upload.size - offset), _upload.file.data.begin() + offset);
+            return true;
+        }
+
+        case PS1080Opcode_FinishFileUpload:
+        {
+            if (!_upload.active)
+                return nack();
+
+            auto existing = _files.find(_upload.file.id);
+            _upload.file.version = existing != _files.end() ? uint16_t(existing->second.version + 1) : 0;
+            _files[_upload.file.id] = _upload.file;
+            ++_fileTableChangeCounter;
+            _upload = Upload();
+            return true;
+        }
+
+        case PS1080Opcode_DeleteFile:
+            if (payload.size() < 1 || _files.erase(payload[0]) == 0)
+                return nack();
+            ++_fileTableChangeCounter;
+            return true;
+
+        case PS1080Opcode_SetFileAttributes:
+        {
+            if (payload.size() < 2)
+                return nack();
+            auto found = _files.find(payload[0]);
+            if (found == _files.end())
+                return nack();
+            found->second.attributes = payload[1];
+            ++_fileTableChangeCounter;
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+void SimulatedPS1080::handleAHBBatchLocked (const std::vector<uint16_t>& request, std::vector<uint16_t>& reply)
+{
+    reply.push_back(0); // completed count
+
+    const size_t count = request.empty() ? 0 : request[0];
+    size_t cursor = 1;
+    size_t completed = 0;
+
+    for (; completed < count; ++completed)
+    {
+        if (cursor + 3 > request.size())
+            break;
+
+        const uint16_t type = request[cursor];
+        const uint32_t address = readUInt32(request, cursor + 1);
+        cursor += 3;
+
+        if (type == 0)
+        {
+            appendUInt32(reply, _ahb[address]);
+        }
+        else if (type == 1 && cursor + 4 <= request.size())
+        {
+            uint32_t& value = _ahb[address];
+            const uint32_t mask = readUInt32(request, cursor + 2);
+            value = (value & ~mask) | (readUInt32(request, cursor) & mask);
+            cursor += 4;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    reply[0] = completed == count ? PS1080_REPLY_CODE_ACK : PS1080_REPLY_CODE_NACK;
+    reply[1] = uint16_t(completed);
+}
+
+void SimulatedPS1080::handleI2CTransactionListLocked (const std::vector<uint16_t>& request, std::vector<uint16_t>& reply)
+{
+    reply.push_back(0); // completed count
+
+    const size_t count = request.empty() ? 0 : request[0];
+    size_t cursor = 1;
+    size_t completed = 0;
+
+    for (; completed < count; ++completed)
+    {
+        if (cursor + 4 > request.size())
+            break;
+
+        const uint8_t type = uint8_t(request[cursor] & 0xff);
+        const uint8_t busId = uint8_t(request[cursor] >> 8);
+        const uint8_t slaveAddress = uint8_t(request[cursor + 1]);
+        const size_t writeLength = request[cursor + 2];
+        const size_t readLength = request[cursor + 3];
+        cursor += 4;
+
+        const size_t writeWords = (writeLength + 1) / 2;
+        if (cursor + writeWords > request.size())
+            break;
+
+        const std::vector<uint8_t> writeData = unpackBytes(request, cursor, writeLength);
+        cursor += writeWords;
+
+        bool succeeded = true;
+        switch (type)
+        {
+            case 1: // Write
+                succeeded = I2CTransferLocked(busId, slaveAddress, writeData.data(), writeData.size(), nullptr, 0);
+                break;
+
+            case 2: // Read
+            case 3: // WriteRead
+            {
+                std::vector<uint8_t> readData (readLength);
+                succeeded = I2CTransferLocked(busId, slaveAddress, writeData.data(), writeData.size(), readData.data(), readData.size());
+                if (succeeded)
+                    packBytes(reply, readData.data(), readData.size());
+                break;
+            }
+
+            case 4: // Delay
+                _executionDelay += readLength * 1e-6;
+                break;
+
+            case 5: // UpdateBits
+            {
+                if (writeLength < readLength * 2)
+                {
+                    succeeded = false;
+                    break;
+                }
+
+                const size_t registerLength = writeLength - readLength * 2;
+                std::vector<uint8_t> current (readLength);
+                succeeded = I2CTransferLocked(busId, slaveAddress, writeData.data(), registerLength, current.data(), current.size());
+                if (!succeeded)
+                    break;
+
+                std::vector<uint8_t> update (writeData.begin(), writeData.begin() + registerLength);
+                for (size_t i = 0; i < readLength; ++i)
+                {
+                    const uint8_t mask = writeData[registerLength + i];
+                    const uint8_t value = writeData[registerLength + readLength + i];
+                    update.push_back(uint8_t((current[i] & ~mask) | (value & mask)));
+                }
+                succeeded = I2CTransferLocked(busId, slaveAddress, update.data(), update.size(), nullptr, 0);
+                break;
+            }
+
+            default:
+                succeeded = false;
+                break;
+        }
+
+        if (!succeeded)
+            break;
+    }
+
+    reply[0] = completed == count ? PS1080_REPLY_CODE_ACK : PS1080_REPLY_CODE_NACK;
+    reply[1] = uint16_t(completed);
+}
+
+bool SimulatedPS1080::I2CTransferLocked (uint8_t busId, uint8_t slaveAddress, const uint8_t* write, size_t writeLength, uint8_t* read, size_t readLength)
+{
+    auto found = _i2c.find(i2cKey(busId, slaveAddress));
+    if (found == _i2c.end() || found->second.memory.empty())
+        return false; // nobody ACKs the address
+
+    I2CDevice& device = found->second;
+    const size_t size = device.memory.size();
+
+    size_t i = 0;
+    if (writeLength >= device.addressLength)
+    {
+        size_t pointer = 0;
+        for (; i < device.addressLength; ++i)
+            pointer = (pointer << 8) | write[i];
+        device.pointer = pointer % size;
+    }
+
+    for (; i < writeLength; ++i)
+    {
+        device.memory[device.pointer] = write[i];
+        device.pointer = (device.pointer + 1) % size;
+    }
+
+    for (size_t j = 0; j < readLength; ++j)
+    {
+        read[j] = device.memory[device.pointer];
+        device.pointer = (device.pointer + 1) % size;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool SimulatedPS1080::streamPendingLocked () const
+{
+    for (const StreamState& stream : _streams)
+        if (stream.offset < stream.buffer.size())
+            return true;
+    return false;
+}
+
+void SimulatedPS1080::pumpStreamsLocked (double now, std::vector<DueFrame>& frames)
+{
+    if (_streamFd < 0)
+        return;
+
+    struct StreamConfig
+    {
+        FrameBufferStream stream;
+        uint16_t modeParam;
+        uint16_t activeMode;
+        uint16_t resolutionParam;
+        uint16_t fpsParam;
+    };
+
+    static const StreamConfig configs[2] = {
+        { FrameBufferStream::Depth,    PARAM_GENERAL_STREAM1_MODE, 2, PARAM_DEPTH_RESOLUTION, PARAM_DEPTH_FPS },
+        { FrameBufferStream::Infrared, PARAM_GENERAL_STREAM0_MODE, 3, PARAM_IR_RESOLUTION,    PARAM_IR_FPS },
+    };
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const StreamConfig& config = configs[i];
+        StreamState& state = _streams[i];
+
+        const bool active = _params[config.modeParam] == config.activeMode;
+        if (active && !state.active)
+        {
+            state.frameIndex = 0;
+            state.nextFrame = now;
+        }
+        state.active = active;
+
+        if (!active || state.nextFrame > now)
+            continue;
+
+        const uint16_t fps = _params[config.fpsParam] != 0 ? _params[config.fpsParam] : 30;
+        const double period = 1.0 / fps;
+
+        // Resync instead of bursting if the simulator fell far behind.
+        state.nextFrame = (now - state.nextFrame > 4 * period) ? now + period : state.nextFrame + period;
+
+        // Only this stream's previous frame holds it back, the other stream has its own buffer.
+        if (state.offset < state.buffer.size())
+        {
+            ++_stats.framesDropped;
+            ++state.frameIndex;
+            continue;
+        }
+
+        int width, height;
+        resolutionSize(_params[config.resolutionParam], width, height);
+
+        SimulatedStreamFrameHeader header = {};
+        header.magic = SimulatedStreamFrameHeader::Magic;
+        header.stream = uint16_t(config.stream);
+        header.bytesPerPixel = sizeof(uint16_t);
+        header.frameIndex = state.frameIndex;
+        header.width = uint16_t(width);
+        header.height = uint16_t(height);
+        header.timestampMicroseconds = uint64_t(now * 1e6);
+        header.sizeInBytes = uint32_t(width * height * sizeof(uint16_t));
+
+        // Reuse the sent frame's allocation; the buffer is empty until the rendered frame comes back.
+        DueFrame frame { i, config.stream, state.frameIndex, width, height, std::move(state.buffer) };
+        state.buffer.clear();
+        state.offset = 0;
+
+        frame.bytes.resize(sizeof(header) + header.sizeInBytes);
+        std::memcpy(frame.bytes.data(), &header, sizeof(header));
+        frames.push_back(std::move(frame));
+
+        ++state.frameIndex;
+        ++_stats.framesSent;
+    }
+}
+
+bool SimulatedPS1080::flushStream ()
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    for (size_t turn = 0; turn < 2; ++turn)
+    {
+        StreamState& state = _streams[_streamCursor];
+
+        while (state.offset < state.buffer.size())
+        {
+            const ssize_t written = write(_streamFd, state.buffer.data() + state.offset, state.buffer.size() - state.offset);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false; // EAGAIN, finish this frame when poll says the host drained some
+
+            state.offset += size_t(written);
+        }
+
+        // Alternate so a stream with frames always due cannot starve the other.
+        _streamCursor = (_streamCursor + 1) % 2;
+    }
+
+    return true;
+}
+
+} // oc namespace
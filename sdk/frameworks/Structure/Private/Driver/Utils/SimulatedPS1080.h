@@ -0,0 +1,220 @@
+//
+//  SimulatedPS1080.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "FrameBufferPool.h"
+#include "PS1080ControlFraming.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace oc {
+
+struct SimulatedPS1080Link
+{
+    double latencySeconds = 0.0005;      // added to every reply
+    double bandwidthBytesPerSecond = 0;  // replies are serialized at this rate, 0 for unlimited
+    double requestLossProbability = 0;   // request dropped before it is executed
+    double replyLossProbability = 0;     // request executed, reply dropped: the nasty case for retries
+    uint32_t randomSeed = 1;
+};
+
+struct SimulatedFlashFile
+{
+    uint16_t id = 0;
+    uint16_t attributes = 0;
+    uint16_t version = 0;
+    std::vector<uint8_t> data;
+};
+
+/* Header written to the stream descriptor before every frame's pixels. Host byte order, it never leaves the machine. */
+struct SimulatedStreamFrameHeader
+{
+    enum : uint32_t { Magic = 0x4653434f }; // "OCSF"
+
+    uint32_t magic;
+    uint16_t stream;          // FrameBufferStream
+    uint16_t bytesPerPixel;
+    uint32_t frameIndex;
+    uint16_t width;
+    uint16_t height;
+    uint64_t timestampMicroseconds;
+    uint32_t sizeInBytes;
+    uint32_t reserved;
+};
+
+/**
+ * A software stand-in for a PS1080 + Xmega, for exercising the control and streaming stack without hardware,
+ * e.g. on Linux CI. It speaks the control session framing (PS1080ControlFraming.h) on one end of a socketpair
+ * (the control descriptor is both read and written), and writes scripted depth/IR frames on an optional second one.
+ *
+ * Built-in opcodes (payloads in words, replies start with the reply code):
+ *   GetVersion         -> [major][minor][build]
+ *   KeepAlive          -> []
+ *   GetParam   [param] -> [value]
+ *   SetParam   [param][value]... (several pairs allowed)
+ *   ReadAHB, WriteAHB, AHBBatch          as in AHBBatch.h
+ *   I2CWrite   [bus][slave][length][bytes]
+ *   I2CRead    [bus][slave][writeLength][readLength][bytes] -> [bytes]
+ *   I2CTransactionList                   as in I2CTransactionList.h
+ *   GetFileList        -> [changeCounter][count] then per file [id][attributes][version][sizeLo][sizeHi]
+ *   DownloadFile [id][offsetLo][offsetHi][sizeInWords] -> [data], offset in bytes, short at end of file
+ *   InitFileUpload [id][attributes][sizeLo][sizeHi], WriteFileUpload [offsetLo][offsetHi][data], FinishFileUpload
+ *   DeleteFile [id], SetFileAttributes [id][attributes]
+ * Anything else gets PS1080_REPLY_CODE_ILLEGAL_OPCODE unless a handler is installed with setOpcodeHandler(),
+ * which is also how tests provide battery, TEC or latch replies and inject failures. Handlers run on the simulator
+ * thread without its lock held, so they may call the setters below.
+ *
+ * I2C slaves are modeled as memories with a big-endian register pointer of addressLength bytes.
+ * Depth streams while PARAM_GENERAL_STREAM1_MODE is 2, IR while PARAM_GENERAL_STREAM0_MODE is 3, at the
+ * resolution and fps of the matching params. Each stream holds one frame in flight and the two take turns on the
+ * stream descriptor; a frame that is due while its stream's previous one is still unsent is dropped, like USB
+ * overflow on the real thing.
+ */
+class SimulatedPS1080
+{
+public:
+    // Return false to fall through to the built-in behavior. replyPayload starts out as [ACK].
+    typedef std::function<bool (const PS1080ControlFrame& request, std::vector<uint16_t>& replyPayload)> OpcodeHandler;
+
+    // Fills one frame; the default is a moving ramp. Runs on the simulator thread without its lock held.
+    typedef std::function<void (FrameBufferStream stream, uint32_t frameIndex, int width, int height, uint16_t* pixels)> FrameScript;
+
+    struct Stats
+    {
+        uint64_t requests = 0;
+        uint64_t replies = 0;
+        uint64_t droppedRequests = 0;
+        uint64_t droppedReplies = 0;
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        uint64_t framesSent = 0;
+        uint64_t framesDropped = 0;
+    };
+
+    // Does not take ownership of the descriptors.
+    explicit SimulatedPS1080 (int controlFd, int streamFd = -1);
+    ~SimulatedPS1080 ();
+
+    SimulatedPS1080 (const SimulatedPS1080&) = delete;
+    SimulatedPS1080& operator= (const SimulatedPS1080&) = delete;
+
+    void start ();
+    void stop ();
+
+    // Everything below is thread safe and can be changed while running.
+    void setLink (const SimulatedPS1080Link& link);
+    void setFirmwareVersion (uint16_t major, uint16_t minor, uint16_t build);
+    void setSupportsBatchOpcodes (bool supported);
+
+    void addFile (const SimulatedFlashFile& file);
+    bool file (uint16_t id, SimulatedFlashFile& file) const;
+    uint16_t fileTableChangeCounter () const;
+
+    void setAHB (uint32_t address, uint32_t value);
+    uint32_t AHB (uint32_t address) const;
+
+    void setI2CDevice (uint8_t busId, uint8_t slaveAddress, const std::vector<uint8_t>& memory, size_t addressLength = 1);
+    std::vector<uint8_t> I2CDeviceMemory (uint8_t busId, uint8_t slaveAddress) const;
+
+    void setParam (uint16_t param, uint16_t value);
+    uint16_t param (uint16_t param) const;
+
+    void setOpcodeHandler (uint16_t opcode, OpcodeHandler handler);
+    void setFrameScript (FrameScript script);
+
+    Stats stats () const;
+
+private:
+    struct I2CDevice
+    {
+        std::vector<uint8_t> memory;
+        size_t addressLength = 1;
+        size_t pointer = 0;
+    };
+
+    struct PendingReply
+    {
+        double due;
+        std::vector<uint8_t> bytes;
+    };
+
+    struct StreamState
+    {
+        bool active = false;
+        uint32_t frameIndex = 0;
+        double nextFrame = 0;
+        std::vector<uint8_t> buffer; // header and pixels of the frame being sent
+        size_t offset = 0;
+    };
+
+    // A frame due for rendering, filled by the frame script outside the lock.
+    struct DueFrame
+    {
+        size_t stream;
+        FrameBufferStream type;
+        uint32_t frameIndex;
+        int width;
+        int height;
+        std::vector<uint8_t> bytes;
+    };
+
+    struct Upload
+    {
+        bool active = false;
+        SimulatedFlashFile file;
+        size_t size = 0;
+    };
+
+    void run ();
+    void handleFrameLocked (const PS1080ControlFrame& request, std::vector<uint16_t>& reply);
+    bool handleBuiltinLocked (const PS1080ControlFrame& request, std::vector<uint16_t>& reply);
+    void handleAHBBatchLocked (const std::vector<uint16_t>& request, std::vector<uint16_t>& reply);
+    void handleI2CTransactionListLocked (const std::vector<uint16_t>& request, std::vector<uint16_t>& reply);
+    bool I2CTransferLocked (uint8_t busId, uint8_t slaveAddress, const uint8_t* write, size_t writeLength, uint8_t* read, size_t readLength);
+    void scheduleReplyLocked (double now, std::vector<uint8_t> bytes);
+    void pumpStreamsLocked (double now, std::vector<DueFrame>& frames);
+    bool streamPendingLocked () const;
+    bool flushStream ();
+    double nextWakeLocked (double now) const;
+    double random ();
+
+    int _controlFd;
+    int _streamFd;
+    int _wakePipe[2] = { -1, -1 };
+    std::thread _thread;
+    std::atomic<bool> _running { false };
+
+    mutable std::mutex _mutex;
+    SimulatedPS1080Link _link;
+    uint64_t _randomState = 1;
+    uint16_t _version[3] = { 1, 0, 0 };
+    bool _supportsBatchOpcodes = true;
+    std::map<uint16_t, SimulatedFlashFile> _files;
+    uint16_t _fileTableChangeCounter = 0;
+    Upload _upload;
+    std::map<uint32_t, uint32_t> _ahb;
+    std::map<uint16_t, I2CDevice> _i2c; // keyed by (busId << 8) | slaveAddress
+    std::map<uint16_t, uint16_t> _params;
+    std::map<uint16_t, OpcodeHandler> _handlers;
+    FrameScript _frameScript;
+    std::vector<PendingReply> _pendingReplies;
+    double _linkFreeAt = 0;
+    double _executionDelay = 0; // Delay steps of the request being handled
+    StreamState _streams[2]; // depth, IR
+    size_t _streamCursor = 0; // stream whose frame is being written, frames are never interleaved
+    Stats _stats;
+};
+
+} // oc namespace
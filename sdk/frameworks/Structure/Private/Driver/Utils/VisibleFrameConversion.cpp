@@ -0,0 +1,1048 @@
+//
+//  VisibleFrameConversion.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "VisibleFrameConversion.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#   define VISIBLE_FRAME_CONVERSION_SSE2 1
+#   include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled with a per-function target attribute and only used when the CPU has AVX2.
+#if VISIBLE_FRAME_CONVERSION_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#   define VISIBLE_FRAME_CONVERSION_AVX2 1
+#   include <immintrin.h>
+#   define VISIBLE_FRAME_CONVERSION_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Only arm64 has the round-to-nearest conversions that keep NEON bit-exact with the scalar path.
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#   define VISIBLE_FRAME_CONVERSION_NEON 1
+#   include <arm_neon.h>
+#endif
+
+namespace oc {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// Scalar reference kernels. Every SIMD kernel must produce exactly the same bytes.
+
+inline void decodeRGB565 (uint16_t pixel, int& r, int& g, int& b)
+{
+    const int r5 = pixel >> 11;
+    const int g6 = (pixel >> 5) & 0x3f;
+    const int b5 = pixel & 0x1f;
+    r = (r5 << 3) | (r5 >> 2);
+    g = (g6 << 2) | (g6 >> 4);
+    b = (b5 << 3) | (b5 >> 2);
+}
+
+inline void writeRGBA8 (uint8_t* dst, int r, int g, int b, bool bgra)
+{
+    dst[0] = uint8_t(bgra ? b : r);
+    dst[1] = uint8_t(g);
+    dst[2] = uint8_t(bgra ? r : b);
+    dst[3] = 255;
+}
+
+// BT.601 video range, 8-bit fixed point.
+inline uint8_t lumaFromRGB (int r, int g, int b) { return uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16); }
+inline uint8_t cbFromRGB (int r, int g, int b) { return uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128); }
+inline uint8_t crFromRGB (int r, int g, int b) { return uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128); }
+
+inline uint8_t mono8FromMono16 (uint32_t value, float gain, float offset)
+{
+    float scaled = float(value) * gain;
+    scaled += offset;
+    scaled = std::min(std::max(scaled, 0.f), 255.f);
+    return uint8_t(std::lrint(scaled));
+}
+
+inline float floatFromMono16 (uint32_t value, float scale, float offset)
+{
+    float scaled = float(value) * scale;
+    scaled += offset;
+    return scaled;
+}
+
+inline uint32_t average2x2 (uint32_t a, uint32_t b, uint32_t c, uint32_t d) { return (a + b + c + d + 2) >> 2; }
+
+void rgb565ToRGBA8RowScalar (const uint16_t* src, uint8_t* dst, int count, bool bgra)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int r, g, b;
+        decodeRGB565(src[i], r, g, b);
+        writeRGBA8(dst + 4 * i, r, g, b, bgra);
+    }
+}
+
+void rgb565Average2x2 (const uint16_t* row0, const uint16_t* row1, int i, int& r, int& g, int& b)
+{
+    int r0, g0, b0, r1, g1, b1, r2, g2, b2, r3, g3, b3;
+    decodeRGB565(row0[2 * i], r0, g0, b0);
+    decodeRGB565(row0[2 * i + 1], r1, g1, b1);
+    decodeRGB565(row1[2 * i], r2, g2, b2);
+    decodeRGB565(row1[2 * i + 1], r3, g3, b3);
+    r = int(average2x2(r0, r1, r2, r3));
+    g = int(average2x2(g0, g1, g2, g3));
+    b = int(average2x2(b0, b1, b2, b3));
+}
+
+void rgb565ToRGBA8Row2xScalar (const uint16_t* row0, const uint16_t* row1, uint8_t* dst, int count, bool bgra)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int r, g, b;
+        rgb565Average2x2(row0, row1, i, r, g, b);
+        writeRGBA8(dst + 4 * i, r, g, b, bgra);
+    }
+}
+
+void rgb565ToYRowScalar (const uint16_t* src, uint8_t* dst, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int r, g, b;
+        decodeRGB565(src[i], r, g, b);
+        dst[i] = lumaFromRGB(r, g, b);
+    }
+}
+
+void rgb565ToUVRow2xScalar (const uint16_t* row0, const uint16_t* row1, uint8_t* dstUV, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int r, g, b;
+        rgb565Average2x2(row0, row1, i, r, g, b);
+        dstUV[2 * i] = cbFromRGB(r, g, b);
+        dstUV[2 * i + 1] = crFromRGB(r, g, b);
+    }
+}
+
+void rgb565ToYRow2xScalar (const uint16_t* row0, const uint16_t* row1, uint8_t* dst, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int r, g, b;
+        rgb565Average2x2(row0, row1, i, r, g, b);
+        dst[i] = lumaFromRGB(r, g, b);
+    }
+}
+
+// Chroma of NV12 at 2x: each sample is the rounded average of a 4x4 source block.
+void rgb565ToUVRow4xScalar (const uint16_t* const rows[4], uint8_t* dstUV, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int sumR = 0, sumG = 0, sumB = 0;
+        for (int row = 0; row < 4; ++row)
+        {
+            for (int dx = 0; dx < 4; ++dx)
+            {
+                int r, g, b;
+                decodeRGB565(rows[row][4 * i + dx], r, g, b);
+                sumR += r;
+                sumG += g;
+                sumB += b;
+            }
+        }
+
+        const int r = (sumR + 8) >> 4;
+        const int g = (sumG + 8) >> 4;
+        const int b = (sumB + 8) >> 4;
+        dstUV[2 * i] = cbFromRGB(r, g, b);
+        dstUV[2 * i + 1] = crFromRGB(r, g, b);
+    }
+}
+
+void mono16ToMono8RowScalar (const uint16_t* src, uint8_t* dst, int count, float gain, float offset)
+{
+    for (int i = 0; i < count; ++i)
+        dst[i] = mono8FromMono16(src[i], gain, offset);
+}
+
+void mono16ToMono8Row2xScalar (const uint16_t* row0, const uint16_t* row1, uint8_t* dst, int count, float gain, float offset)
+{
+    for (int i = 0; i < count; ++i)
+        dst[i] = mono8FromMono16(average2x2(row0[2 * i], row0[2 * i + 1], row1[2 * i], row1[2 * i + 1]), gain, offset);
+}
+
+void mono16ToFloatRowScalar (const uint16_t* src, float* dst, int count, float scale, float offset)
+{
+    for (int i = 0; i < count; ++i)
+        dst[i] = floatFromMono16(src[i], scale, offset);
+}
+
+void mono16ToFloatRow2xScalar (const uint16_t* row0, const uint16_t* row1, float* dst, int count, float scale, float offset)
+{
+    for (int i = 0; i < count; ++i)
+        dst[i] = floatFromMono16(average2x2(row0[2 * i], row0[2 * i + 1], row1[2 * i], row1[2 * i + 1]), scale, offset);
+}
+
+//------------------------------------------------------------------------------
+
+#if VISIBLE_FRAME_CONVERSION_SSE2
+
+inline void decodeRGB565SSE2 (__m128i pixels, __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i r5 = _mm_srli_epi16(pixels, 11);
+    const __m128i g6 = _mm_and_si128(_mm_srli_epi16(pixels, 5), _mm_set1_epi16(0x3f));
+    const __m128i b5 = _mm_and_si128(pixels, _mm_set1_epi16(0x1f));
+    r = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g6, 2), _mm_srli_epi16(g6, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
+}
+
+// Sums adjacent 16-bit lanes of two rows and rounds the 2x2 average, giving four 32-bit results.
+inline __m128i average2x2SSE2 (__m128i row0, __m128i row1)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i sum = _mm_add_epi32(_mm_madd_epi16(row0, ones), _mm_madd_epi16(row1, ones));
+    return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+}
+
+// Same as above for full-range 16-bit values, which madd would treat as signed.
+inline __m128i average2x2U16SSE2 (__m128i row0, __m128i row1)
+{
+    const __m128i lowMask = _mm_set1_epi32(0xffff);
+    const __m128i sum0 = _mm_add_epi32(_mm_and_si128(row0, lowMask), _mm_srli_epi32(row0, 16));
+    const __m128i sum1 = _mm_add_epi32(_mm_and_si128(row1, lowMask), _mm_srli_epi32(row1, 16));
+    return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(sum0, sum1), _mm_set1_epi32(2)), 2);
+}
+
+// Eight 16-bit Y values from 16-bit r, g, b. The weighted sum peaks at 56228, so unsigned 16-bit lanes are enough.
+inline __m128i lumaSSE2 (__m128i r, __m128i g, __m128i b)
+{
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+    y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+// Writes four interleaved Cb/Cr pairs from four 32-bit r, g, b values.
+inline void storeUV4SSE2 (__m128i r32, __m128i g32, __m128i b32, uint8_t* dstUV)
+{
+    const __m128i r = _mm_packs_epi32(r32, _mm_setzero_si128());
+    const __m128i g = _mm_packs_epi32(g32, _mm_setzero_si128());
+    const __m128i b = _mm_packs_epi32(b32, _mm_setzero_si128());
+    const __m128i bias = _mm_set1_epi16(128);
+
+    // Chroma sums stay within +/-28688, signed 16-bit lanes are enough.
+    __m128i u = _mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)), _mm_mullo_epi16(r, _mm_set1_epi16(38)));
+    u = _mm_sub_epi16(u, _mm_mullo_epi16(g, _mm_set1_epi16(74)));
+    u = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(u, bias), 8), bias);
+
+    __m128i v = _mm_sub_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)), _mm_mullo_epi16(g, _mm_set1_epi16(94)));
+    v = _mm_sub_epi16(v, _mm_mullo_epi16(b, _mm_set1_epi16(18)));
+    v = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(v, bias), 8), bias);
+
+    const __m128i uv = _mm_unpacklo_epi16(u, v);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dstUV), _mm_packus_epi16(uv, uv));
+}
+
+// Rounded averages of two 4x4 blocks from the per-row sums of eight 16-bit lanes, in 32-bit lanes 0 and 1.
+inline __m128i average4x4SSE2 (__m128i columnSums)
+{
+    const __m128i pairs = _mm_madd_epi16(columnSums, _mm_set1_epi16(1));
+    const __m128i quads = _mm_add_epi32(pairs, _mm_srli_epi64(pairs, 32));
+    const __m128i sums = _mm_shuffle_epi32(quads, _MM_SHUFFLE(3, 3, 2, 0));
+    return _mm_srli_epi32(_mm_add_epi32(sums, _mm_set1_epi32(8)), 4);
+}
+
+inline __m128i mono8FromFloatsSSE2 (__m128 values, __m128 gain, __m128 offset)
+{
+    values = _mm_add_ps(_mm_mul_ps(values, gain), offset);
+    values = _mm_min_ps(_mm_max_ps(values, _mm_setzero_ps()), _mm_set1_ps(255.f));
+    return _mm_cvtps_epi32(values);
+}
+
+void rgb565ToRGBA8RowSSE2 (const uint16_t* src, uint8_t* dst, int count, bool bgra)
+{
+    const __m128i alpha = _mm_set1_epi16(int16_t(0xff00));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i r, g, b;
+        decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), r, g, b);
+
+        // 16-bit lanes holding (byte0 | byte1 << 8) and (byte2 | alpha << 8), then interleaved into pixels.
+        const __m128i low = _mm_or_si128(bgra ? b : r, _mm_slli_epi16(g, 8));
+        const __m128i high = _mm_or_si128(bgra ? r : b, alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), _mm_unpacklo_epi16(low, high));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i + 16), _mm_unpackhi_epi16(low, high));
+    }
+
+    rgb565ToRGBA8RowScalar(src + i, dst + 4 * i, count - i, bgra);
+}
+
+void rgb565ToRGBA8Row2xSSE2 (const uint16_t* row0, const uint16_t* row1, uint8_t* dst, int count, bool bgra)
+{
+    const __m128i alpha = _mm_set1_epi32(int32_t(0xff000000));
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i r0, g0, b0, r1, g1, b1;
+        decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * i)), r0, g0, b0);
+        decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * i)), r1, g1, b1);
+
+        const __m128i r = average2x2SSE2(r0, r1);
+        const __m128i g = average2x2SSE2(g0, g1);
+        const __m128i b = average2x2SSE2(b0, b1);
+
+        __m128i pixels = _mm_or_si128(bgra ? b : r, _mm_slli_epi32(g, 8));
+        pixels = _mm_or_si128(pixels, _mm_or_si128(_mm_slli_epi32(bgra ? r : b, 16), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), pixels);
+    }
+
+    rgb565ToRGBA8Row2xScalar(row0 + 2 * i, row1 + 2 * i, dst + 4 * i, count - i, bgra);
+}
+
+void rgb565ToYRowSSE2 (const uint16_t* src, uint8_t* dst, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i r, g, b;
+        decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), r, g, b);
+
+        const __m128i y = lumaSSE2(r, g, b);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(y, y));
+    }
+
+    rgb565ToYRowScalar(src + i, dst + i, count - i);
+}
+
+void rgb565ToUVRow2xSSE2 (const uint16_t* row0, const uint16_t* row1, uint8_t* dstUV, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i r0, g0, b0, r1, g1, b1;
+        decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * i)), r0, g0, b0);
+        decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * i)), r1, g1, b1);
+
+        storeUV4SSE2(average2x2SSE2(r0, r1), average2x2SSE2(g0, g1), average2x2SSE2(b0, b1), dstUV + 2 * i);
+    }
+
+    rgb565ToUVRow2xScalar(row0 + 2 * i, row1 + 2 * i, dstUV + 2 * i, count - i);
+}
+
+void rgb565ToYRow2xSSE2 (const uint16_t* row0, const uint16_t* row1, uint8_t* dst, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i r[2], g[2], b[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            __m128i r0, g0, b0, r1, g1, b1;
+            decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * i + 8 * half)), r0, g0, b0);
+            decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * i + 8 * half)), r1, g1, b1);
+            r[half] = average2x2SSE2(r0, r1);
+            g[half] = average2x2SSE2(g0, g1);
+            b[half] = average2x2SSE2(b0, b1);
+        }
+
+        const __m128i y = lumaSSE2(_mm_packs_epi32(r[0], r[1]), _mm_packs_epi32(g[0], g[1]), _mm_packs_epi32(b[0], b[1]));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(y, y));
+    }
+
+    rgb565ToYRow2xScalar(row0 + 2 * i, row1 + 2 * i, dst + i, count - i);
+}
+
+void rgb565ToUVRow4xSSE2 (const uint16_t* const rows[4], uint8_t* dstUV, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        // Each half covers eight source columns, i.e. two chroma samples. Four rows of 255 fit in 16 bits.
+        __m128i r[2], g[2], b[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            __m128i sumR = _mm_setzero_si128(), sumG = _mm_setzero_si128(), sumB = _mm_setzero_si128();
+            for (int row = 0; row < 4; ++row)
+            {
+                __m128i pixelR, pixelG, pixelB;
+                decodeRGB565SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[row] + 4 * i + 8 * half)), pixelR, pixelG, pixelB);
+                sumR = _mm_add_epi16(sumR, pixelR);
+                sumG = _mm_add_epi16(sumG, pixelG);
+                sumB = _mm_add_epi16(sumB, pixelB);
+            }
+            r[half] = average4x4SSE2(sumR);
+            g[half] = average4x4SSE2(sumG);
+            b[half] = average4x4SSE2(sumB);
+        }
+
+        storeUV4SSE2(_mm_unpacklo_epi64(r[0], r[1]), _mm_unpacklo_epi64(g[0], g[1]), _mm_unpacklo_epi64(b[0], b[1]), dstUV + 2 * i);
+    }
+
+    const uint16_t* const rest[4] = { rows[0] + 4 * i, rows[1] + 4 * i, rows[2] + 4 * i, rows[3] + 4 * i };
+    rgb565ToUVRow4xScalar(rest, dstUV + 2 * i, count - i);
+}
+
+void mono16ToMono8RowSSE2 (const uint16_t* src, uint8_t* dst, int count, float gain, float offset)
+{
+    const __m128 gains = _mm_set1_ps(gain);
+    const __m128 offsets = _mm_set1_ps(offset);
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i low = mono8FromFloatsSSE2(_mm_cvtepi32_ps(_mm_unpacklo_epi16(values, zero)), gains, offsets);
+        const __m128i high = mono8FromFloatsSSE2(_mm_cvtepi32_ps(_mm_unpackhi_epi16(values, zero)), gains, offsets);
+        const __m128i packed = _mm_packs_epi32(low, high);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(packed, packed));
+    }
+
+    mono16ToMono8RowScalar(src + i, dst + i, count - i, gain, offset);
+}
+
+void mono16ToMono8Row2xSSE2 (const uint16_t* row0, const uint16_t* row1, uint8_t* dst, int count, float gain, float offset)
+{
+    const __m128 gains = _mm_set1_ps(gain);
+    const __m128 offsets = _mm_set1_ps(offset);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i averages = average2x2U16SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * i)),
+                                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * i)));
+        __m128i packed = mono8FromFloatsSSE2(_mm_cvtepi32_ps(averages), gains, offsets);
+        packed = _mm_packs_epi32(packed, packed);
+        packed = _mm_packus_epi16(packed, packed);
+
+        const int32_t fourPixels = _mm_cvtsi128_si32(packed);
+        std::memcpy(dst + i, &fourPixels, sizeof(fourPixels));
+    }
+
+    mono16ToMono8Row2xScalar(row0 + 2 * i, row1 + 2 * i, dst + i, count - i, gain, offset);
+}
+
+void mono16ToFloatRowSSE2 (const uint16_t* src, float* dst, int count, float scale, float offset)
+{
+    const __m128 scales = _mm_set1_ps(scale);
+    const __m128 offsets = _mm_set1_ps(offset);
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(values, zero));
+        const __m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(values, zero));
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(low, scales), offsets));
+        _mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_mul_ps(high, scales), offsets));
+    }
+
+    mono16ToFloatRowScalar(src + i, dst + i, count - i, scale, offset);
+}
+
+void mono16ToFloatRow2xSSE2 (const uint16_t* row0, const uint16_t* row1, float* dst, int count, float scale, float offset)
+{
+    const __m128 scales = _mm_set1_ps(scale);
+    const __m128 offsets = _mm_set1_ps(offset);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i averages = average2x2U16SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * i)),
+                                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * i)));
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(averages), scales), offsets));
+    }
+
+    mono16ToFloatRow2xScalar(row0 + 2 * i, row1 + 2 * i, dst + i, count - i, scale, offset);
+}
+
+#endif // VISIBLE_FRAME_CONVERSION_SSE2
+
+//------------------------------------------------------------------------------
+
+#if VISIBLE_FRAME_CONVERSION_AVX2
+
+VISIBLE_FRAME_CONVERSION_TARGET_AVX2
+void rgb565ToRGBA8RowAVX2 (const uint16_t* src, uint8_t* dst, int count, bool bgra)
+{
+    const __m256i alpha = _mm256_set1_epi16(int16_t(0xff00));
+    const __m256i mask6 = _mm256_set1_epi16(0x3f);
+    const __m256i mask5 = _mm256_set1_epi16(0x1f);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i r5 = _mm256_srli_epi16(pixels, 11);
+        const __m256i g6 = _mm256_and_si256(_mm256_srli_epi16(pixels, 5), mask6);
+        const __m256i b5 = _mm256_and_si256(pixels, mask5);
+        const __m256i r = _mm256_or_si256(_mm256_slli_epi16(r5, 3), _mm256_srli_epi16(r5, 2));
+        const __m256i g = _mm256_or_si256(_mm256_slli_epi16(g6, 2), _mm256_srli_epi16(g6, 4));
+        const __m256i b = _mm256_or_si256(_mm256_slli_epi16(b5, 3), _mm256_srli_epi16(b5, 2));
+
+        const __m256i low = _mm256_or_si256(bgra ? b : r, _mm256_slli_epi16(g, 8));
+        const __m256i high = _mm256_or_si256(bgra ? r : b, alpha);
+
+        // Unpacks work per 128-bit lane: [0-3 | 8-11] and [4-7 | 12-15]. Put the pixels back in order.
+        const __m256i first = _mm256_unpacklo_epi16(low, high);
+        const __m256i second = _mm256_unpackhi_epi16(low, high);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * i), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+
+    rgb565ToRGBA8RowSSE2(src + i, dst + 4 * i, count - i, bgra);
+}
+
+VISIBLE_FRAME_CONVERSION_TARGET_AVX2
+void mono16ToMono8RowAVX2 (const uint16_t* src, uint8_t* dst, int count, float gain, float offset)
+{
+    const __m256 gains = _mm256_set1_ps(gain);
+    const __m256 offsets = _mm256_set1_ps(offset);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 maximum = _mm256_set1_ps(255.f);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+        __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(values)));
+        __m256 high = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(values, 1)));
+        low = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(low, gains), offsets), zero), maximum);
+        high = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(high, gains), offsets), zero), maximum);
+
+        // packs works per 128-bit lane, the permute restores pixel order before the final narrowing.
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(low), _mm256_cvtps_epi32(high));
+        packed = _mm256_permute4x64_epi64(packed, 0xd8);
+        const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), bytes);
+    }
+
+    mono16ToMono8RowSSE2(src + i, dst + i, count - i, gain, offset);
+}
+
+VISIBLE_FRAME_CONVERSION_TARGET_AVX2
+void mono16ToFloatRowAVX2 (const uint16_t* src, float* dst, int count, float scale, float offset)
+{
+    const __m256 scales = _mm256_set1_ps(scale);
+    const __m256 offsets = _mm256_set1_ps(offset);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m256 floats = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(values));
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_mul_ps(floats, scales), offsets));
+    }
+
+    mono16ToFloatRowSSE2(src + i, dst + i, count - i, scale, offset);
+}
+
+#endif // VISIBLE_FRAME_CONVERSION_AVX2
+
+//------------------------------------------------------------------------------
+
+#if VISIBLE_FRAME_CONVERSION_NEON
+
+inline void decodeRGB565NEON (uint16x8_t pixels, uint16x8_t& r, uint16x8_t& g, uint16x8_t& b)
+{
+    const uint16x8_t r5 = vshrq_n_u16(pixels, 11);
+    const uint16x8_t g6 = vandq_u16(vshrq_n_u16(pixels, 5), vdupq_n_u16(0x3f));
+    const uint16x8_t b5 = vandq_u16(pixels, vdupq_n_u16(0x1f));
+    r = vorrq_u16(vshlq_n_u16(r5, 3), vshrq_n_u16(r5, 2));
+    g = vorrq_u16(vshlq_n_u16(g6, 2), vshrq_n_u16(g6, 4));
+    b = vorrq_u16(vshlq_n_u16(b5, 3), vshrq_n_u16(b5, 2));
+}
+
+inline uint16x4_t mono8FromFloatsNEON (float32x4_t values, float32x4_t gain, float32x4_t offset)
+{
+    values = vaddq_f32(vmulq_f32(values, gain), offset);
+    values = vminq_f32(vmaxq_f32(values, vdupq_n_f32(0.f)), vdupq_n_f32(255.f));
+    return vmovn_u32(vcvtnq_u32_f32(values));
+}
+
+void rgb565ToRGBA8RowNEON (const uint16_t* src, uint8_t* dst, int count, bool bgra)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t r, g, b;
+        decodeRGB565NEON(vld1q_u16(src + i), r, g, b);
+
+        uint8x8x4_t pixels;
+        pixels.val[0] = vmovn_u16(bgra ? b : r);
+        pixels.val[1] = vmovn_u16(g);
+        pixels.val[2] = vmovn_u16(bgra ? r : b);
+        pixels.val[3] = vdup_n_u8(255);
+        vst4_u8(dst + 4 * i, pixels);
+    }
+
+    rgb565ToRGBA8RowScalar(src + i, dst + 4 * i, count - i, bgra);
+}
+
+void rgb565ToYRowNEON (const uint16_t* src, uint8_t* dst, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t r, g, b;
+        decodeRGB565NEON(vld1q_u16(src + i), r, g, b);
+
+        uint16x8_t y = vmulq_n_u16(r, 66);
+        y = vmlaq_n_u16(y, g, 129);
+        y = vmlaq_n_u16(y, b, 25);
+        y = vshrq_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8);
+        vst1_u8(dst + i, vmovn_u16(vaddq_u16(y, vdupq_n_u16(16))));
+    }
+
+    rgb565ToYRowScalar(src + i, dst + i, count - i);
+}
+
+void mono16ToMono8RowNEON (const uint16_t* src, uint8_t* dst, int count, float gain, float offset)
+{
+    const float32x4_t gains = vdupq_n_f32(gain);
+    const float32x4_t offsets = vdupq_n_f32(offset);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16x8_t values = vld1q_u16(src + i);
+        const uint16x4_t low = mono8FromFloatsNEON(vcvtq_f32_u32(vmovl_u16(vget_low_u16(values))), gains, offsets);
+        const uint16x4_t high = mono8FromFloatsNEON(vcvtq_f32_u32(vmovl_u16(vget_high_u16(values))), gains, offsets);
+        vst1_u8(dst + i, vmovn_u16(vcombine_u16(low, high)));
+    }
+
+    mono16ToMono8RowScalar(src + i, dst + i, count - i, gain, offset);
+}
+
+void mono16ToFloatRowNEON (const uint16_t* src, float* dst, int count, float scale, float offset)
+{
+    const float32x4_t scales = vdupq_n_f32(scale);
+    const float32x4_t offsets = vdupq_n_f32(offset);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint16x8_t values = vld1q_u16(src + i);
+        const float32x4_t low = vcvtq_f32_u32(vmovl_u16(vget_low_u16(values)));
+        const float32x4_t high = vcvtq_f32_u32(vmovl_u16(vget_high_u16(values)));
+        vst1q_f32(dst + i, vaddq_f32(vmulq_f32(low, scales), offsets));
+        vst1q_f32(dst + i + 4, vaddq_f32(vmulq_f32(high, scales), offsets));
+    }
+
+    mono16ToFloatRowScalar(src + i, dst + i, count - i, scale, offset);
+}
+
+#endif // VISIBLE_FRAME_CONVERSION_NEON
+
+//------------------------------------------------------------------------------
+// Runtime dispatch
+
+struct ConversionKernels
+{
+    void (*rgb565ToRGBA8Row) (const uint16_t*, uint8_t*, int, bool);
+    void (*rgb565ToRGBA8Row2x) (const uint16_t*, const uint16_t*, uint8_t*, int, bool);
+    void (*rgb565ToYRow) (const uint16_t*, uint8_t*, int);
+    void (*rgb565ToUVRow2x) (const uint16_t*, const uint16_t*, uint8_t*, int);
+    void (*rgb565ToYRow2x) (const uint16_t*, const uint16_t*, uint8_t*, int);
+    void (*rgb565ToUVRow4x) (const uint16_t* const[4], uint8_t*, int);
+    void (*mono16ToMono8Row) (const uint16_t*, uint8_t*, int, float, float);
+    void (*mono16ToMono8Row2x) (const uint16_t*, const uint16_t*, uint8_t*, int, float, float);
+    void (*mono16ToFloatRow) (const uint16_t*, float*, int, float, float);
+    void (*mono16ToFloatRow2x) (const uint16_t*, const uint16_t*, float*, int, float, float);
+};
+
+const ConversionKernels scalarKernels = {
+    rgb565ToRGBA8RowScalar,
+    rgb565ToRGBA8Row2xScalar,
+    rgb565ToYRowScalar,
+    rgb565ToUVRow2xScalar,
+    rgb565ToYRow2xScalar,
+    rgb565ToUVRow4xScalar,
+    mono16ToMono8RowScalar,
+    mono16ToMono8Row2xScalar,
+    mono16ToFloatRowScalar,
+    mono16ToFloatRow2xScalar,
+};
+
+#if VISIBLE_FRAME_CONVERSION_SSE2
+const ConversionKernels sse2Kernels = {
+    rgb565ToRGBA8RowSSE2,
+    rgb565ToRGBA8Row2xSSE2,
+    rgb565ToYRowSSE2,
+    rgb565ToUVRow2xSSE2,
+    rgb565ToYRow2xSSE2,
+    rgb565ToUVRow4xSSE2,
+    mono16ToMono8RowSSE2,
+    mono16ToMono8Row2xSSE2,
+    mono16ToFloatRowSSE2,
+    mono16ToFloatRow2xSSE2,
+};
+#endif
+
+#if VISIBLE_FRAME_CONVERSION_AVX2
+// AVX2 only pays off on the full-resolution paths, the rest are memory bound at SSE2 width already.
+const ConversionKernels avx2Kernels = {
+    rgb565ToRGBA8RowAVX2,
+    rgb565ToRGBA8Row2xSSE2,
+    rgb565ToYRowSSE2,
+    rgb565ToUVRow2xSSE2,
+    rgb565ToYRow2xSSE2,
+    rgb565ToUVRow4xSSE2,
+    mono16ToMono8RowAVX2,
+    mono16ToMono8Row2xSSE2,
+    mono16ToFloatRowAVX2,
+    mono16ToFloatRow2xSSE2,
+};
+#endif
+
+#if VISIBLE_FRAME_CONVERSION_NEON
+const ConversionKernels neonKernels = {
+    rgb565ToRGBA8RowNEON,
+    rgb565ToRGBA8Row2xScalar,
+    rgb565ToYRowNEON,
+    rgb565ToUVRow2xScalar,
+    rgb565ToYRow2xScalar,
+    rgb565ToUVRow4xScalar,
+    mono16ToMono8RowNEON,
+    mono16ToMono8Row2xScalar,
+    mono16ToFloatRowNEON,
+    mono16ToFloatRow2xScalar,
+};
+#endif
+
+bool cpuSupports (VisibleFrameConversionBackend backend)
+{
+    switch (backend)
+    {
+        case VisibleFrameConversionBackend::Automatic:
+        case VisibleFrameConversionBackend::Scalar:
+            return true;
+
+        case VisibleFrameConversionBackend::SSE2:
+#if VISIBLE_FRAME_CONVERSION_SSE2
+            return true;
+#else
+            return false;
+#endif
+
+        case VisibleFrameConversionBackend::AVX2:
+#if VISIBLE_FRAME_CONVERSION_AVX2
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+
+        case VisibleFrameConversionBackend::NEON:
+#if VISIBLE_FRAME_CONVERSION_NEON
+            return true;
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+VisibleFrameConversionBackend bestBackend ()
+{
+    if (cpuSupports(VisibleFrameConversionBackend::AVX2))
+        return VisibleFrameConversionBackend::AVX2;
+    if (cpuSupports(VisibleFrameConversionBackend::SSE2))
+        return VisibleFrameConversionBackend::SSE2;
+    if (cpuSupports(VisibleFrameConversionBackend::NEON))
+        return VisibleFrameConversionBackend::NEON;
+    return VisibleFrameConversionBackend::Scalar;
+}
+
+const ConversionKernels* kernelsForBackend (VisibleFrameConversionBackend backend)
+{
+    switch (backend)
+    {
+#if VISIBLE_FRAME_CONVERSION_SSE2
+        case VisibleFrameConversionBackend::SSE2: return &sse2Kernels;
+#endif
+#if VISIBLE_FRAME_CONVERSION_AVX2
+        case VisibleFrameConversionBackend::AVX2: return &avx2Kernels;
+#endif
+#if VISIBLE_FRAME_CONVERSION_NEON
+        case VisibleFrameConversionBackend::NEON: return &neonKernels;
+#endif
+        default: return &scalarKernels;
+    }
+}
+
+std::atomic<int> selectedBackend (-1);
+
+VisibleFrameConversionBackend currentBackend ()
+{
+    int backend = selectedBackend.load(std::memory_order_acquire);
+    if (backend < 0)
+    {
+        // Racing threads all compute the same answer, no need for a lock.
+        backend = int(bestBackend());
+        selectedBackend.store(backend, std::memory_order_release);
+    }
+    return VisibleFrameConversionBackend(backend);
+}
+
+const ConversionKernels& kernels ()
+{
+    return *kernelsForBackend(currentBackend());
+}
+
+template <typename T>
+inline T* rowAt (T* base, size_t stride, int row)
+{
+    typedef typename std::conditional<std::is_const<T>::value, const uint8_t, uint8_t>::type Byte;
+    return reinterpret_cast<T*>(reinterpret_cast<Byte*>(base) + stride * size_t(row));
+}
+
+// Generic box filter for downscale factors without a dedicated kernel. Returns the rounded average.
+inline uint32_t boxAverage (const uint16_t* src, size_t srcStride, int x, int y, int downscale)
+{
+    uint32_t sum = 0;
+    for (int dy = 0; dy < downscale; ++dy)
+    {
+        const uint16_t* row = rowAt(src, srcStride, y * downscale + dy) + x * downscale;
+        for (int dx = 0; dx < downscale; ++dx)
+            sum += row[dx];
+    }
+
+    const uint32_t area = uint32_t(downscale * downscale);
+    return (sum + area / 2) / area;
+}
+
+inline void boxAverageRGB565 (const uint16_t* src, size_t srcStride, int x, int y, int downscale, int& r, int& g, int& b)
+{
+    int sumR = 0, sumG = 0, sumB = 0;
+    for (int dy = 0; dy < downscale; ++dy)
+    {
+        const uint16_t* row = rowAt(src, srcStride, y * downscale + dy) + x * downscale;
+        for (int dx = 0; dx < downscale; ++dx)
+        {
+            int pixelR, pixelG, pixelB;
+            decodeRGB565(row[dx], pixelR, pixelG, pixelB);
+            sumR += pixelR;
+            sumG += pixelG;
+            sumB += pixelB;
+        }
+    }
+
+    const int area = downscale * downscale;
+    r = (sumR + area / 2) / area;
+    g = (sumG + area / 2) / area;
+    b = (sumB + area / 2) / area;
+}
+
+void convertRGB565ToRGBA8Impl (const uint16_t* src, size_t srcStride, int width, int height,
+                               uint8_t* dst, size_t dstStride, int downscale, bool bgra)
+{
+    if (downscale < 1)
+        return;
+
+    const int outWidth = width / downscale;
+    const int outHeight = height / downscale;
+    const ConversionKernels& k = kernels();
+
+    for (int y = 0; y < outHeight; ++y)
+    {
+        uint8_t* out = rowAt(dst, dstStride, y);
+
+        if (downscale == 1)
+            k.rgb565ToRGBA8Row(rowAt(src, srcStride, y), out, outWidth, bgra);
+        else if (downscale == 2)
+            k.rgb565ToRGBA8Row2x(rowAt(src, srcStride, 2 * y), rowAt(src, srcStride, 2 * y + 1), out, outWidth, bgra);
+        else
+        {
+            for (int x = 0; x < outWidth; ++x)
+            {
+                int r, g, b;
+                boxAverageRGB565(src, srcStride, x, y, downscale, r, g, b);
+                writeRGBA8(out + 4 * x, r, g, b, bgra);
+            }
+        }
+    }
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+bool setVisibleFrameConversionBackend (VisibleFrameConversionBackend backend)
+{
+    if (!cpuSupports(backend))
+        return false;
+
+    if (backend == VisibleFrameConversionBackend::Automatic)
+        backend = bestBackend();
+
+    selectedBackend.store(int(backend), std::memory_order_release);
+    return true;
+}
+
+VisibleFrameConversionBackend visibleFrameConversionBackend ()
+{
+    return currentBackend();
+}
+
+const char* visibleFrameConversionBackendName (VisibleFrameConversionBackend backend)
+{
+    switch (backend)
+    {
+        case VisibleFrameConversionBackend::Automatic: return "Automatic";
+        case VisibleFrameConversionBackend::Scalar: return "Scalar";
+        case VisibleFrameConversionBackend::SSE2: return "SSE2";
+        case VisibleFrameConversionBackend::AVX2: return "AVX2";
+        case VisibleFrameConversionBackend::NEON: return "NEON";
+    }
+    return "Unknown";
+}
+
+void convertRGB565ToRGBA8 (const uint16_t* src, size_t srcStride, int width, int height,
+                           uint8_t* dst, size_t dstStride, int downscale)
+{
+    convertRGB565ToRGBA8Impl(src, srcStride, width, height, dst, dstStride, downscale, false);
+}
+
+void convertRGB565ToBGRA8 (const uint16_t* src, size_t srcStride, int width, int height,
+                           uint8_t* dst, size_t dstStride, int downscale)
+{
+    convertRGB565ToRGBA8Impl(src, srcStride, width, height, dst, dstStride, downscale, true);
+}
+
+void convertRGB565ToNV12 (const uint16_t* src, size_t srcStride, int width, int height,
+                          uint8_t* dstY, size_t dstYStride,
+                          uint8_t* dstUV, size_t dstUVStride, int downscale)
+{
+    if (downscale < 1)
+        return;
+
+    // NV12 needs even output dimensions for its 2x2 chroma subsampling.
+    const int outWidth = (width / downscale) & ~1;
+    const int outHeight = (height / downscale) & ~1;
+    const ConversionKernels& k = kernels();
+
+    if (downscale == 1)
+    {
+        for (int y = 0; y < outHeight; y += 2)
+        {
+            const uint16_t* row0 = rowAt(src, srcStride, y);
+            const uint16_t* row1 = rowAt(src, srcStride, y + 1);
+            k.rgb565ToYRow(row0, rowAt(dstY, dstYStride, y), outWidth);
+            k.rgb565ToYRow(row1, rowAt(dstY, dstYStride, y + 1), outWidth);
+            k.rgb565ToUVRow2x(row0, row1, rowAt(dstUV, dstUVStride, y / 2), outWidth / 2);
+        }
+        return;
+    }
+
+    if (downscale == 2)
+    {
+        for (int y = 0; y < outHeight; y += 2)
+        {
+            const uint16_t* const rows[4] = {
+                rowAt(src, srcStride, 2 * y),
+                rowAt(src, srcStride, 2 * y + 1),
+                rowAt(src, srcStride, 2 * y + 2),
+                rowAt(src, srcStride, 2 * y + 3),
+            };
+            k.rgb565ToYRow2x(rows[0], rows[1], rowAt(dstY, dstYStride, y), outWidth);
+            k.rgb565ToYRow2x(rows[2], rows[3], rowAt(dstY, dstYStride, y + 1), outWidth);
+            k.rgb565ToUVRow4x(rows, rowAt(dstUV, dstUVStride, y / 2), outWidth / 2);
+        }
+        return;
+    }
+
+    for (int y = 0; y < outHeight; ++y)
+    {
+        uint8_t* outY = rowAt(dstY, dstYStride, y);
+        for (int x = 0; x < outWidth; ++x)
+        {
+            int r, g, b;
+            boxAverageRGB565(src, srcStride, x, y, downscale, r, g, b);
+            outY[x] = lumaFromRGB(r, g, b);
+        }
+    }
+
+    // Chroma is a box over twice the downscale factor, read from the source directly so it stays a single pass over RGB.
+    for (int y = 0; y < outHeight / 2; ++y)
+    {
+        uint8_t* outUV = rowAt(dstUV, dstUVStride, y);
+        for (int x = 0; x < outWidth / 2; ++x)
+        {
+            int r, g, b;
+            boxAverageRGB565(src, srcStride, x, y, 2 * downscale, r, g, b);
+            outUV[2 * x] = cbFromRGB(r, g, b);
+            outUV[2 * x + 1] = crFromRGB(r, g, b);
+        }
+    }
+}
+
+void convertMono16ToMono8 (const uint16_t* src, size_t srcStride, int width, int height,
+                           uint8_t* dst, size_t dstStride,
+                           float gain, float offset, int downscale)
+{
+    if (downscale < 1)
+        return;
+
+    const int outWidth = width / downscale;
+    const int outHeight = height / downscale;
+    const ConversionKernels& k = kernels();
+
+    for (int y = 0; y < outHeight; ++y)
+    {
+        uint8_t* out = rowAt(dst, dstStride, y);
+
+        if (downscale == 1)
+            k.mono16ToMono8Row(rowAt(src, srcStride, y), out, outWidth, gain, offset);
+        else if (downscale == 2)
+            k.mono16ToMono8Row2x(rowAt(src, srcStride, 2 * y), rowAt(src, srcStride, 2 * y + 1), out, outWidth, gain, offset);
+        else
+        {
+            for (int x = 0; x < outWidth; ++x)
+                out[x] = mono8FromMono16(boxAverage(src, srcStride, x, y, downscale), gain, offset);
+        }
+    }
+}
+
+void convertMono16ToFloat (const uint16_t* src, size_t srcStride, int width, int height,
+                           float* dst, size_t dstStride,
+                           float scale, float offset, int downscale)
+{
+    if (downscale < 1)
+        return;
+
+    const int outWidth = width / downscale;
+    const int outHeight = height / downscale;
+    const ConversionKernels& k = kernels();
+
+    for (int y = 0; y < outHeight; ++y)
+    {
+        float* out = rowAt(dst, dstStride, y);
+
+        if (downscale == 1)
+            k.mono16ToFloatRow(rowAt(src, srcStride, y), out, outWidth, scale, offset);
+        else if (downscale == 2)
+            k.mono16ToFloatRow2x(rowAt(src, srcStride, 2 * y), rowAt(src, srcStride, 2 * y + 1), out, outWidth, scale, offset);
+        else
+        {
+            for (int x = 0; x < outWidth; ++x)
+                out[x] = floatFromMono16(boxAverage(src, srcStride, x, y, downscale), scale, offset);
+        }
+    }
+}
+
+} // oc namespace
@@ -0,0 +1,66 @@
+//
+//  VisibleFrameConversion.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/* Converts Structure Core visible frames (VisibleFrameFormat_RGB565 and VisibleFrameFormat_Monochrome16)
+   into the formats trackers, encoders and displays want.
+
+   Every function takes a downscale factor (1 = full resolution). Downscaling is a box filter fused
+   into the conversion, so the source is only read once. The output is (width / downscale) x
+   (height / downscale); leftover source rows/columns are ignored. Factors 1 and 2 have SSE2/AVX2
+   kernels for every format (NEON: full resolution only); larger factors use a scalar box.
+
+   Strides are in bytes. The best kernels available on the running CPU (SSE2, AVX2 or NEON) are
+   picked on first use. */
+
+namespace oc {
+
+enum class VisibleFrameConversionBackend
+{
+    Automatic, // best one the CPU supports
+    Scalar,
+    SSE2,
+    AVX2,
+    NEON,
+};
+
+// Forces a given backend, mostly for benchmarking and for checking the SIMD paths against the scalar one.
+// Returns false (and leaves the current backend alone) if the CPU does not support the requested backend.
+bool setVisibleFrameConversionBackend (VisibleFrameConversionBackend backend);
+
+VisibleFrameConversionBackend visibleFrameConversionBackend ();
+
+const char* visibleFrameConversionBackendName (VisibleFrameConversionBackend backend);
+
+// RGB565 to 32-bit RGBA (R in the lowest byte) with alpha = 255.
+void convertRGB565ToRGBA8 (const uint16_t* src, size_t srcStride, int width, int height,
+                           uint8_t* dst, size_t dstStride, int downscale = 1);
+
+// RGB565 to 32-bit BGRA (B in the lowest byte) with alpha = 255. This is what CoreVideo's kCVPixelFormatType_32BGRA expects.
+void convertRGB565ToBGRA8 (const uint16_t* src, size_t srcStride, int width, int height,
+                           uint8_t* dst, size_t dstStride, int downscale = 1);
+
+// RGB565 to NV12 with BT.601 video-range coefficients. The output dimensions must be even.
+void convertRGB565ToNV12 (const uint16_t* src, size_t srcStride, int width, int height,
+                          uint8_t* dstY, size_t dstYStride,
+                          uint8_t* dstUV, size_t dstUVStride, int downscale = 1);
+
+// Monochrome16 to 8 bits: dst = clamp(src * gain + offset, 0, 255), rounded to nearest.
+void convertMono16ToMono8 (const uint16_t* src, size_t srcStride, int width, int height,
+                           uint8_t* dst, size_t dstStride,
+                           float gain, float offset, int downscale = 1);
+
+// Monochrome16 to float: dst = src * scale + offset.
+void convertMono16ToFloat (const uint16_t* src, size_t srcStride, int width, int height,
+                           float* dst, size_t dstStride,
+                           float scale = 1.f, float offset = 0.f, int downscale = 1);
+
+} // oc namespace
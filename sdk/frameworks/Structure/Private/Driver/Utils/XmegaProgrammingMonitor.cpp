@@ -0,0 +1,99 @@
+//
+//  XmegaProgrammingMonitor.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "XmegaProgrammingMonitor.h"
+
+#include <algorithm>
+
+namespace oc {
+
+XmegaProgrammingMonitor::XmegaProgrammingMonitor (const Options& options, const uint8_t* image, size_t imageSize)
+: _options(options),
+  _image(imageSize >= options.totalBytes ? image : nullptr),
+  _crc(options.crcVariant, options.crcInitialValue),
+  _lastInterval(options.initialPollInterval)
+{
+}
+
+void XmegaProgrammingMonitor::start (double now)
+{
+    _lastProgressTime = now;
+}
+
+double XmegaProgrammingMonitor::onStatus (double now, size_t programmedBytes)
+{
+    ++_polls;
+    programmedBytes = std::min(programmedBytes, _options.totalBytes);
+
+    double interval;
+
+    if (programmedBytes > _programmedBytes)
+    {
+        const double elapsed = now - _lastProgressTime;
+        if (elapsed > 0)
+        {
+            const double sample = double(programmedBytes - _programmedBytes) / elapsed;
+            _bytesPerSecond = (_bytesPerSecond > 0) ? _options.rateSmoothing * sample + (1.0 - _options.rateSmoothing) * _bytesPerSecond
+                                                    : sample;
+        }
+
+        if (_image)
+            _crc.update(_image + _programmedBytes, programmedBytes - _programmedBytes);
+
+        _programmedBytes = programmedBytes;
+        _lastProgressTime = now;
+
+        if (_bytesPerSecond > 0)
+        {
+            // Aim for the next step boundary, so every poll has something new to report.
+            const size_t step = std::max<size_t>(1, _options.progressStepBytes);
+            const size_t target = std::min(_options.totalBytes, (_programmedBytes / step + 1) * step);
+            interval = double(target - _programmedBytes) / _bytesPerSecond;
+        }
+        else
+        {
+            interval = _options.initialPollInterval;
+        }
+    }
+    else
+    {
+        // Too early, or the xmega is between pages: back off.
+        interval = _lastInterval * 1.5;
+    }
+
+    // The final status (success or CRC failure) shows up shortly after the last page.
+    if (finished())
+        interval = _options.minPollInterval;
+
+    interval = std::max(_options.minPollInterval, std::min(_options.maxPollInterval, interval));
+
+    _lastInterval = interval;
+    return interval;
+}
+
+float XmegaProgrammingMonitor::progress () const
+{
+    if (_options.totalBytes == 0)
+        return 1.f;
+
+    return float(double(_programmedBytes) / double(_options.totalBytes));
+}
+
+double XmegaProgrammingMonitor::estimatedSecondsRemaining () const
+{
+    if (_bytesPerSecond <= 0)
+        return -1;
+
+    return double(_options.totalBytes - _programmedBytes) / _bytesPerSecond;
+}
+
+bool XmegaProgrammingMonitor::stalled (double now) const
+{
+    return !finished() && now - _lastProgressTime > _options.stallTimeout;
+}
+
+} // oc namespace
@@ -0,0 +1,87 @@
+//
+//  XmegaProgrammingMonitor.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include "CRC16.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace oc {
+
+/**
+ * Paces getXmegaProgrammingStatus: polls while the PS1080 programs the xmega, and keeps the image CRC up to date
+ * with what has been programmed.
+ *
+ * The PS1080 writes the pages itself from the uploaded image; all the host sees is programmedByteCount. Polling on a
+ * fixed timer either wastes control round trips (which delay the PS1080's own I2C traffic) or reacts late to the
+ * end of programming. The monitor estimates the write rate from the samples it gets and schedules the next poll for
+ * when the next progressStepBytes should be done, within [minPollInterval, maxPollInterval]. A poll that finds no
+ * progress backs off.
+ *
+ * If the image is given, the CRC of the programmed prefix advances with every status, so the final comparison with
+ * the expected file CRC costs nothing once the last page is acknowledged. An image shorter than totalBytes cannot be
+ * what is being programmed and is not used.
+ *
+ * Times are in seconds on any monotonic clock. Not thread safe: drive it from the polling timer.
+ */
+class XmegaProgrammingMonitor
+{
+public:
+    struct Options
+    {
+        size_t totalBytes = 0;
+        size_t progressStepBytes = 2048; // poll about every four xmega flash pages
+        double initialPollInterval = 0.1;
+        double minPollInterval = 0.02;
+        double maxPollInterval = 0.5;
+        double stallTimeout = 5.0;      // no progress for this long counts as a stall
+        double rateSmoothing = 0.3;     // weight of the newest rate sample
+
+        // Must match how the expected xmega image CRC is computed.
+        CRC16Variant crcVariant = CRC16Variant::CCITT;
+        uint16_t crcInitialValue = 0xffff;
+    };
+
+    // image may be null; it must outlive the monitor. Only image[0, totalBytes) is ever read.
+    XmegaProgrammingMonitor (const Options& options, const uint8_t* image = nullptr, size_t imageSize = 0);
+
+    void start (double now);
+
+    // Feeds a programmedByteCount from getXmegaProgrammingStatus: and returns the delay before the next poll.
+    double onStatus (double now, size_t programmedBytes);
+
+    size_t programmedBytes () const { return _programmedBytes; }
+    size_t totalBytes () const { return _options.totalBytes; }
+    float progress () const;
+    bool finished () const { return _programmedBytes >= _options.totalBytes; }
+
+    double bytesPerSecond () const { return _bytesPerSecond; }
+    double estimatedSecondsRemaining () const; // negative until there is a rate estimate
+    bool stalled (double now) const;
+
+    // False without a usable image, programmedCRC() then stays at the initial value.
+    bool verifiesCRC () const { return _image != nullptr; }
+    // CRC of image[0, programmedBytes()).
+    uint16_t programmedCRC () const { return _crc.value(); }
+
+    size_t pollCount () const { return _polls; }
+
+private:
+    const Options _options;
+    const uint8_t* _image;
+    CRC16 _crc;
+
+    size_t _programmedBytes = 0;
+    double _lastProgressTime = 0;
+    double _lastInterval = 0;
+    double _bytesPerSecond = 0;
+    size_t _polls = 0;
+};
+
+} // oc namespace
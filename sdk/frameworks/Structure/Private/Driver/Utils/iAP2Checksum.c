@@ -0,0 +1,104 @@
+/*
+ * iAP2Checksum.c
+ *
+ * Only the sum modulo 256 matters, so 8-bit lanes may wrap freely: blocks are added lane-wise with wrapping byte
+ * adds and folded into a scalar once at the end with a horizontal sum (psadbw / vaddv).
+ *
+ *  Author: Occipital
+ */
+
+#include "iAP2Checksum.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define IAP2_CHECKSUM_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IAP2_CHECKSUM_NEON 1
+#include <arm_neon.h>
+#endif
+
+uint8_t iAP2ChecksumAccumulateScalar(uint8_t sum, const uint8_t* data, size_t size)
+{
+	size_t i;
+	for (i = 0; i < size; ++i)
+		sum = (uint8_t)(sum + data[i]);
+	return sum;
+}
+
+#if IAP2_CHECKSUM_SSE2
+
+uint8_t iAP2ChecksumAccumulate(uint8_t sum, const uint8_t* data, size_t size)
+{
+	if (size >= 16) {
+		__m128i acc0 = _mm_setzero_si128();
+		__m128i acc1 = _mm_setzero_si128();
+		__m128i total;
+
+		while (size >= 64) {
+			acc0 = _mm_add_epi8(acc0, _mm_loadu_si128((const __m128i*)(data)));
+			acc1 = _mm_add_epi8(acc1, _mm_loadu_si128((const __m128i*)(data + 16)));
+			acc0 = _mm_add_epi8(acc0, _mm_loadu_si128((const __m128i*)(data + 32)));
+			acc1 = _mm_add_epi8(acc1, _mm_loadu_si128((const __m128i*)(data + 48)));
+			data += 64;
+			size -= 64;
+		}
+
+		while (size >= 16) {
+			acc0 = _mm_add_epi8(acc0, _mm_loadu_si128((const __m128i*)data));
+			data += 16;
+			size -= 16;
+		}
+
+		total = _mm_sad_epu8(_mm_add_epi8(acc0, acc1), _mm_setzero_si128());
+		sum = (uint8_t)(sum + _mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+	}
+
+	return iAP2ChecksumAccumulateScalar(sum, data, size);
+}
+
+#elif IAP2_CHECKSUM_NEON
+
+uint8_t iAP2ChecksumAccumulate(uint8_t sum, const uint8_t* data, size_t size)
+{
+	if (size >= 16) {
+		uint8x16_t acc0 = vdupq_n_u8(0);
+		uint8x16_t acc1 = vdupq_n_u8(0);
+		uint8x16_t acc;
+
+		while (size >= 64) {
+			acc0 = vaddq_u8(acc0, vld1q_u8(data));
+			acc1 = vaddq_u8(acc1, vld1q_u8(data + 16));
+			acc0 = vaddq_u8(acc0, vld1q_u8(data + 32));
+			acc1 = vaddq_u8(acc1, vld1q_u8(data + 48));
+			data += 64;
+			size -= 64;
+		}
+
+		while (size >= 16) {
+			acc0 = vaddq_u8(acc0, vld1q_u8(data));
+			data += 16;
+			size -= 16;
+		}
+
+		acc = vaddq_u8(acc0, acc1);
+#if defined(__aarch64__)
+		sum = (uint8_t)(sum + vaddvq_u8(acc));
+#else
+		{
+			const uint64x2_t wide = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+			sum = (uint8_t)(sum + vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1));
+		}
+#endif
+	}
+
+	return iAP2ChecksumAccumulateScalar(sum, data, size);
+}
+
+#else
+
+uint8_t iAP2ChecksumAccumulate(uint8_t sum, const uint8_t* data, size_t size)
+{
+	return iAP2ChecksumAccumulateScalar(sum, data, size);
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * iAP2Checksum.h
+ *
+ * iAP2 packet header and payload checksums: the byte that makes the sum of the covered bytes zero, modulo 256.
+ * Same results as iAP2ChecksumGet, but vectorized (SSE2 / NEON) and usable on payloads kept in several segments:
+ *
+ *     uint8_t sum = 0;
+ *     sum = iAP2ChecksumAccumulate(sum, segment0, size0);
+ *     sum = iAP2ChecksumAccumulate(sum, segment1, size1);
+ *     checksumByte = iAP2ChecksumFinish(sum);
+ *
+ *  Author: Occipital
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Adds data to a running byte sum (modulo 256). Start from 0. */
+uint8_t iAP2ChecksumAccumulate(uint8_t sum, const uint8_t* data, size_t size);
+
+/* The checksum byte for a running sum. */
+static inline uint8_t iAP2ChecksumFinish(uint8_t sum)
+{
+	return (uint8_t)(0u - sum);
+}
+
+/* Checksum byte of a contiguous buffer. */
+static inline uint8_t iAP2ChecksumCompute(const uint8_t* data, size_t size)
+{
+	return iAP2ChecksumFinish(iAP2ChecksumAccumulate(0, data, size));
+}
+
+/* Byte at a time, for reference. */
+uint8_t iAP2ChecksumAccumulateScalar(uint8_t sum, const uint8_t* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -74,6 +74,7 @@ struct iAP2MessageParameterHeader {
 extern "C" {
 #endif
 
+/* Byte at a time; iAP2Checksum.h has a vectorized equivalent that also takes segmented payloads. */
 int8_t iAP2ChecksumGet(struct ByteStream* buffer8, size_t packetSize);
 
 void iAP2PacketHeaderWrite(struct ByteStream* buffer, uint16_t payloadLength, uint8_t controlByte, uint8_t seqNumber, uint8_t ackNumber, uint8_t sessionID);
@@ -0,0 +1,497 @@
+//
+//  iAP2Link.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "iAP2Link.h"
+#include "iAP2Checksum.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace oc {
+
+namespace {
+
+    const uint8_t StartOfPacket0 = 0xff;
+    const uint8_t StartOfPacket1 = 0x5a;
+    const size_t PacketHeaderSize = 9;      // iAP2PacketHeaderSize
+    const size_t PayloadChecksumSize = 1;   // iAP2PacketPayloadChecksumSize
+
+    // IAP2_CONTROL_BYTE_* from iAP2Commands.h
+    const uint8_t ControlACK = 1 << 6;
+    const uint8_t ControlEAK = 1 << 5;
+    const uint8_t ControlRST = 1 << 4;
+
+    inline uint8_t checksum (const uint8_t* data, size_t size)
+    {
+        return iAP2ChecksumCompute(data, size);
+    }
+
+    // Sequence numbers are modulo 256: a is at or before b if b is less than half the space ahead.
+    inline bool sequenceAtOrBefore (uint8_t a, uint8_t b)
+    {
+        return uint8_t(b - a) < 128;
+    }
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+void appendiAP2Packet (std::vector<uint8_t>& out, uint8_t controlByte, uint8_t seqNumber, uint8_t ackNumber, uint8_t sessionID,
+                       const uint8_t* payload, size_t payloadSize)
+{
+    const size_t length = PacketHeaderSize + (payloadSize > 0 ? payloadSize + PayloadChecksumSize : 0);
+    const size_t start = out.size();
+
+    out.push_back(StartOfPacket0);
+    out.push_back(StartOfPacket1);
+    out.push_back(uint8_t(length >> 8));
+    out.push_back(uint8_t(length & 0xff));
+    out.push_back(controlByte);
+    out.push_back(seqNumber);
+    out.push_back(ackNumber);
+    out.push_back(sessionID);
+    out.push_back(checksum(out.data() + start, PacketHeaderSize - 1));
+
+    if (payloadSize > 0)
+    {
+        out.insert(out.end(), payload, payload + payloadSize);
+        out.push_back(checksum(payload, payloadSize));
+    }
+}
+
+void iAP2PacketDecoder::reset ()
+{
+    // From the packet callback the loop in feed() still walks the buffer; it skips past these bytes once it returns.
+    if (_feeding)
+    {
+        _resetWhileFeeding = true;
+        _resetPosition = _buffer.size();
+        return;
+    }
+
+    _buffer.clear();
+}
+
+void iAP2PacketDecoder::feed (const uint8_t* data, size_t size)
+{
+    _buffer.insert(_buffer.end(), data, data + size);
+
+    // Called from the packet callback: the loop below picks the bytes up, and _packet is not overwritten under it.
+    if (_feeding)
+        return;
+
+    _feeding = true;
+
+    size_t position = 0;
+    while (_buffer.size() - position >= PacketHeaderSize)
+    {
+        const uint8_t* p = _buffer.data() + position;
+
+        if (p[0] != StartOfPacket0 || p[1] != StartOfPacket1)
+        {
+            ++position;
+            continue;
+        }
+
+        const size_t length = size_t((p[2] << 8) | p[3]);
+        if (checksum(p, PacketHeaderSize - 1) != p[PacketHeaderSize - 1]
+            || length < PacketHeaderSize || length == PacketHeaderSize + PayloadChecksumSize)
+        {
+            ++_checksumErrors;
+            ++position;
+            continue;
+        }
+
+        if (_buffer.size() - position < length)
+            break;
+
+        const size_t payloadSize = length > PacketHeaderSize ? length - PacketHeaderSize - PayloadChecksumSize : 0;
+        const uint8_t* payload = p + PacketHeaderSize;
+
+        if (payloadSize > 0 && checksum(payload, payloadSize) != payload[payloadSize])
+        {
+            ++_checksumErrors;
+            ++position;
+            continue;
+        }
+
+        _packet.controlByte = p[4];
+        _packet.seqNumber = p[5];
+        _packet.ackNumber = p[6];
+        _packet.sessionID = p[7];
+        _packet.payload.assign(payload, payload + payloadSize);
+        position += length;
+
+        if (_packetReceived)
+            _packetReceived(_packet);
+
+        if (_resetWhileFeeding)
+        {
+            _resetWhileFeeding = false;
+            position = _resetPosition;
+        }
+    }
+
+    _buffer.erase(_buffer.begin(), _buffer.begin() + std::ptrdiff_t(position));
+    _feeding = false;
+}
+
+//------------------------------------------------------------------------------
+
+iAP2Link::iAP2Link (const Parameters& parameters, Callbacks callbacks)
+: _parameters(parameters),
+  _callbacks(std::move(callbacks)),
+  _decoder([this] (const iAP2LinkPacket& packet) { receivePacket(packet, _now); }),
+  _rto(parameters.initialRetransmitTimeout),
+  _held(256)
+{
+    _stats.retransmitTimeout = _rto;
+}
+
+void iAP2Link::start (uint8_t ourLastSeq, uint8_t peerLastSeq, double now)
+{
+    _started = true;
+    _failed = false;
+    _now = now;
+
+    _decoder.reset();
+
+    _nextSeq = uint8_t(ourLastSeq + 1);
+    _inFlight.clear();
+    _queue.clear();
+    _rto = _parameters.initialRetransmitTimeout;
+    _haveRTT = false;
+    _stats.smoothedRTT = 0;
+    _stats.rttVariance = 0;
+    _stats.retransmitTimeout = _rto;
+
+    _lastInOrder = peerLastSeq;
+    for (HeldPacket& held : _held)
+        held = HeldPacket();
+    _heldCount = 0;
+    _acksOwed = 0;
+    _ackDeadline = -1;
+    _eakOwed = false;
+}
+
+size_t iAP2Link::maxPayloadSize () const
+{
+    return _parameters.maxPacketLength > PacketHeaderSize + PayloadChecksumSize
+         ? _parameters.maxPacketLength - PacketHeaderSize - PayloadChecksumSize : 0;
+}
+
+bool iAP2Link::send (uint8_t sessionID, const uint8_t* payload, size_t size, double now)
+{
+    if (!_started || _failed || size == 0 || size > maxPayloadSize())
+        return false;
+
+    QueuedPayload queued;
+    queued.sessionID = sessionID;
+    queued.payload.assign(payload, payload + size);
+    _queue.push_back(std::move(queued));
+
+    fillWindow(now);
+
+    return true;
+}
+
+void iAP2Link::fillWindow (double now)
+{
+    const size_t window = std::max<size_t>(1, std::min<size_t>(_parameters.maxOutstandingPackets, 127));
+
+    while (!_failed && !_queue.empty() && _inFlight.size() < window)
+    {
+        OutgoingPacket packet;
+        packet.seq = _nextSeq++;
+        packet.sessionID = _queue.front().sessionID;
+        packet.payload = std::move(_queue.front().payload);
+        _queue.pop_front();
+
+        _inFlight.push_back(std::move(packet));
+        transmit(_inFlight.back(), now);
+    }
+}
+
+void iAP2Link::transmit (OutgoingPacket& packet, double now)
+{
+    // Data packets always carry our cumulative acknowledgement, which settles any delayed ACK.
+    _scratch.clear();
+    appendiAP2Packet(_scratch, ControlACK, packet.seq, _lastInOrder, packet.sessionID, packet.payload.data(), packet.payload.size());
+
+    packet.sentAt = now;
+    packet.deadline = now + _rto;
+    ++packet.transmissions;
+    ++_stats.packetsSent;
+
+    _acksOwed = 0;
+    if (!_eakOwed)
+        _ackDeadline = -1;
+
+    if (_callbacks.send)
+        _callbacks.send(_scratch.data(), _scratch.size());
+}
+
+void iAP2Link::sendAck ()
+{
+    std::vector<uint8_t> held;
+    if (_heldCount > 0)
+    {
+        for (uint8_t offset = 1; offset < 128 && held.size() < _heldCount; ++offset)
+        {
+            const uint8_t seq = uint8_t(_lastInOrder + offset);
+            if (_held[seq].present)
+                held.push_back(seq);
+        }
+        ++_stats.eaksSent;
+    }
+
+    // Pure acknowledgements do not consume a sequence number.
+    _scratch.clear();
+    appendiAP2Packet(_scratch, uint8_t(ControlACK | (held.empty() ? 0 : ControlEAK)), uint8_t(_nextSeq - 1), _lastInOrder, 0,
+                     held.data(), held.size());
+
+    _acksOwed = 0;
+    _ackDeadline = -1;
+    _eakOwed = false;
+
+    if (_callbacks.send)
+        _callbacks.send(_scratch.data(), _scratch.size());
+}
+
+void iAP2Link::receiveBytes (const uint8_t* data, size_t size, double now)
+{
+    _now = now;
+    _decoder.feed(data, size);
+}
+
+void iAP2Link::receivePacket (const iAP2LinkPacket& packet, double now)
+{
+    if (!_started || _failed)
+        return;
+
+    ++_stats.packetsReceived;
+
+    if (packet.controlByte & ControlRST)
+    {
+        fail();
+        return;
+    }
+
+    if (packet.controlByte & ControlACK)
+        handleAck(packet.ackNumber, now);
+
+    // An EAK's payload is its list of sequence numbers, not session data.
+    if (packet.controlByte & ControlEAK)
+        handleEak(packet.payload, now);
+    else if (!packet.payload.empty())
+        handleData(packet, now);
+
+    if (_failed)
+        return;
+
+    fillWindow(now);
+
+    if (_eakOwed || _acksOwed >= std::max<uint8_t>(1, _parameters.maxCumulativeAcks))
+        sendAck();
+}
+
+void iAP2Link::handleAck (uint8_t ackNumber, double now)
+{
+    while (!_inFlight.empty() && sequenceAtOrBefore(_inFlight.front().seq, ackNumber))
+    {
+        const OutgoingPacket& packet = _inFlight.front();
+
+        // Karn: an ACK for a retransmitted packet says nothing about the round trip.
+        if (packet.transmissions == 1 && !packet.selectivelyAcked)
+            sampleRTT(now - packet.sentAt);
+
+        _inFlight.pop_front();
+    }
+}
+
+void iAP2Link::handleEak (const std::vector<uint8_t>& seqs, double now)
+{
+    if (_inFlight.empty())
+        return;
+
+    const uint8_t first = _inFlight.front().seq;
+    size_t newest = 0;
+    bool any = false;
+
+    for (uint8_t seq : seqs)
+    {
+        const size_t index = uint8_t(seq - first);
+        if (index >= _inFlight.size())
+            continue;
+
+        OutgoingPacket& packet = _inFlight[index];
+        if (!packet.selectivelyAcked && packet.transmissions == 1)
+            sampleRTT(now - packet.sentAt);
+
+        packet.selectivelyAcked = true;
+        newest = std::max(newest, index);
+        any = true;
+    }
+
+    if (!any)
+        return;
+
+    // Everything before the newest packet the peer holds and is still missing was most likely lost.
+    for (size_t index = 0; index < newest; ++index)
+    {
+        OutgoingPacket& packet = _inFlight[index];
+        if (packet.selectivelyAcked || packet.fastRetransmitted)
+            continue;
+
+        if (packet.transmissions > _parameters.maxRetransmissions)
+        {
+            fail();
+            return;
+        }
+
+        packet.fastRetransmitted = true;
+        ++_stats.retransmissions;
+        ++_stats.fastRetransmissions;
+        transmit(packet, now);
+    }
+}
+
+void iAP2Link::handleData (const iAP2LinkPacket& packet, double now)
+{
+    const uint8_t distance = uint8_t(packet.seqNumber - _lastInOrder);
+    const uint8_t window = std::max<uint8_t>(1, std::min<uint8_t>(_parameters.maxOutstandingPackets, 127));
+
+    if (distance == 0 || distance > window)
+    {
+        // Old or outside the window: our ACK was probably lost, so send it again right away.
+        ++_stats.duplicatesReceived;
+        _acksOwed = _parameters.maxCumulativeAcks;
+        if (_heldCount > 0)
+            _eakOwed = true;
+        return;
+    }
+
+    if (distance > 1)
+    {
+        HeldPacket& held = _held[packet.seqNumber];
+        if (!held.present)
+        {
+            held.present = true;
+            held.sessionID = packet.sessionID;
+            held.payload = packet.payload;
+            ++_heldCount;
+            ++_stats.outOfOrderReceived;
+        }
+        _eakOwed = true;
+        return;
+    }
+
+    _lastInOrder = packet.seqNumber;
+    if (_callbacks.deliver)
+        _callbacks.deliver(packet.sessionID, packet.payload.data(), packet.payload.size());
+
+    // Release whatever was waiting for this one.
+    for (HeldPacket* next = &_held[uint8_t(_lastInOrder + 1)]; next->present; next = &_held[uint8_t(_lastInOrder + 1)])
+    {
+        ++_lastInOrder;
+        next->present = false;
+        --_heldCount;
+
+        std::vector<uint8_t> payload;
+        payload.swap(next->payload);
+        if (_callbacks.deliver)
+            _callbacks.deliver(next->sessionID, payload.data(), payload.size());
+    }
+
+    if (_heldCount > 0)
+        _eakOwed = true;
+
+    ++_acksOwed;
+    if (_ackDeadline < 0)
+        _ackDeadline = now + _parameters.cumulativeAckTimeout;
+}
+
+void iAP2Link::tick (double now)
+{
+    if (!_started || _failed)
+        return;
+
+    bool timedOut = false;
+    for (const OutgoingPacket& packet : _inFlight)
+        timedOut = timedOut || (!packet.selectivelyAcked && packet.deadline <= now);
+
+    if (timedOut)
+    {
+        _rto = std::min(_parameters.maxRetransmitTimeout, _rto * 2);
+        _stats.retransmitTimeout = _rto;
+
+        for (OutgoingPacket& packet : _inFlight)
+        {
+            if (packet.selectivelyAcked || packet.deadline > now)
+                continue;
+
+            if (packet.transmissions > _parameters.maxRetransmissions)
+            {
+                fail();
+                return;
+            }
+
+            packet.fastRetransmitted = false;
+            ++_stats.retransmissions;
+            transmit(packet, now);
+        }
+    }
+
+    if (_ackDeadline >= 0 && now >= _ackDeadline)
+        sendAck();
+}
+
+double iAP2Link::nextDeadline () const
+{
+    double deadline = _ackDeadline;
+
+    for (const OutgoingPacket& packet : _inFlight)
+    {
+        if (!packet.selectivelyAcked && (deadline < 0 || packet.deadline < deadline))
+            deadline = packet.deadline;
+    }
+
+    return deadline;
+}
+
+void iAP2Link::sampleRTT (double rtt)
+{
+    rtt = std::max(0.0, rtt);
+
+    if (!_haveRTT)
+    {
+        _stats.smoothedRTT = rtt;
+        _stats.rttVariance = rtt / 2;
+        _haveRTT = true;
+    }
+    else
+    {
+        _stats.rttVariance = 0.75 * _stats.rttVariance + 0.25 * std::fabs(_stats.smoothedRTT - rtt);
+        _stats.smoothedRTT = 0.875 * _stats.smoothedRTT + 0.125 * rtt;
+    }
+
+    _rto = std::max(_parameters.minRetransmitTimeout,
+                    std::min(_parameters.maxRetransmitTimeout, _stats.smoothedRTT + 4 * _stats.rttVariance));
+    _stats.retransmitTimeout = _rto;
+}
+
+void iAP2Link::fail ()
+{
+    if (_failed)
+        return;
+
+    _failed = true;
+    if (_callbacks.linkFailed)
+        _callbacks.linkFailed();
+}
+
+} // oc namespace
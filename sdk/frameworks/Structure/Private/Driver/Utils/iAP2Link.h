@@ -0,0 +1,209 @@
+//
+//  iAP2Link.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace oc {
+
+/* Serialized iAP2 packet fields. The control byte uses the IAP2_CONTROL_BYTE_* bits from iAP2Commands.h. */
+struct iAP2LinkPacket
+{
+    uint8_t controlByte = 0;
+    uint8_t seqNumber = 0;
+    uint8_t ackNumber = 0;
+    uint8_t sessionID = 0;
+    std::vector<uint8_t> payload;
+};
+
+/* Incremental decoder for iAP2 packets: resynchronizes on the start of packet and drops packets whose header or
+   payload checksum is wrong. feed() may be called again from the packet callback; those bytes are appended and
+   decoded once the callback returns, so the packet passed to it stays valid for the whole call. reset() drops the
+   bytes received so far, also from the packet callback (bytes fed after it are kept). */
+class iAP2PacketDecoder
+{
+public:
+    typedef std::function<void (const iAP2LinkPacket& packet)> PacketCallback;
+
+    explicit iAP2PacketDecoder (PacketCallback packetReceived) : _packetReceived(std::move(packetReceived)) {}
+
+    void feed (const uint8_t* data, size_t size);
+    void reset ();
+
+    uint64_t checksumErrors () const { return _checksumErrors; }
+
+private:
+    PacketCallback _packetReceived;
+    std::vector<uint8_t> _buffer;
+    iAP2LinkPacket _packet;
+    bool _feeding = false;
+    bool _resetWhileFeeding = false;
+    size_t _resetPosition = 0; // bytes before this were dropped by a reset() from the packet callback
+    uint64_t _checksumErrors = 0;
+};
+
+// Appends a complete packet (start of packet, header, header checksum, payload, payload checksum) to out.
+void appendiAP2Packet (std::vector<uint8_t>& out, uint8_t controlByte, uint8_t seqNumber, uint8_t ackNumber, uint8_t sessionID,
+                       const uint8_t* payload, size_t payloadSize);
+
+/**
+ * Host side of the iAP2 link layer after link synchronization: reliable, in-order delivery of session payloads with
+ * up to maxOutstandingPackets unacknowledged packets in flight, instead of one packet per round trip.
+ *
+ * Sending: payloads are queued and sent while the window has room. A cumulative ACK releases every packet up to
+ * ackNumber; an EAK lists the out-of-sequence packets the peer already holds, which are released individually, and
+ * unacknowledged packets older than the newest one listed are retransmitted at once rather than on timeout.
+ *
+ * Retransmit timing follows Jacobson/Karels: smoothed RTT and RTT variance from packets acknowledged on their first
+ * transmission (Karn's rule), RTO = SRTT + 4 * RTTVAR within [minRetransmitTimeout, maxRetransmitTimeout], doubled
+ * on every timeout. A packet sent more than maxRetransmissions times fails the link.
+ *
+ * Receiving: in-order packets are delivered at once, out-of-order ones inside the window are held and reported with
+ * an EAK, duplicates are re-acknowledged. Acknowledgements are delayed up to cumulativeAckTimeout or
+ * maxCumulativeAcks packets, and ride on outgoing data when there is any.
+ *
+ * Not thread safe: call everything from the thread that owns the accessory session. Times are in seconds on any
+ * monotonic clock; call tick() at least every few milliseconds while packets are outstanding (nextDeadline()).
+ * receiveBytes() may be called from the deliver callback (the bytes are handled after the current packet);
+ * receivePacket() may not.
+ */
+class iAP2Link
+{
+public:
+    struct Parameters
+    {
+        // Negotiated in the link synchronization (SYN) exchange.
+        uint8_t maxOutstandingPackets = 4;
+        uint16_t maxPacketLength = 4096;
+        uint8_t maxRetransmissions = 30;
+        uint8_t maxCumulativeAcks = 3;
+        double cumulativeAckTimeout = 0.022;
+
+        double initialRetransmitTimeout = 1.0;
+        double minRetransmitTimeout = 0.02;
+        double maxRetransmitTimeout = 2.0;
+    };
+
+    struct Callbacks
+    {
+        std::function<void (const uint8_t* bytes, size_t size)> send;
+        std::function<void (uint8_t sessionID, const uint8_t* payload, size_t size)> deliver;
+        std::function<void ()> linkFailed;
+    };
+
+    struct Stats
+    {
+        uint64_t packetsSent = 0;
+        uint64_t retransmissions = 0;
+        uint64_t fastRetransmissions = 0;
+        uint64_t packetsReceived = 0;
+        uint64_t duplicatesReceived = 0;
+        uint64_t outOfOrderReceived = 0;
+        uint64_t eaksSent = 0;
+        double smoothedRTT = 0;
+        double rttVariance = 0;
+        double retransmitTimeout = 0;
+    };
+
+    iAP2Link (const Parameters& parameters, Callbacks callbacks);
+
+    iAP2Link (const iAP2Link&) = delete;
+    iAP2Link& operator= (const iAP2Link&) = delete;
+
+    // After link synchronization: ourLastSeq is the sequence number of our SYN, peerLastSeq that of the peer's.
+    // Starts a new link: packets in flight, queued payloads, held packets, partially received packet bytes and the
+    // RTT estimate of any previous one are discarded. Stats counters keep counting.
+    void start (uint8_t ourLastSeq, uint8_t peerLastSeq, double now);
+
+    // Queues a session payload (at most maxPayloadSize() bytes) and sends it if the window allows. False if too big,
+    // or if the link is not started or has failed.
+    bool send (uint8_t sessionID, const uint8_t* payload, size_t size, double now);
+
+    // Bytes from the transport.
+    void receiveBytes (const uint8_t* data, size_t size, double now);
+    // An already decoded packet.
+    void receivePacket (const iAP2LinkPacket& packet, double now);
+
+    void tick (double now);
+
+    // Earliest time tick() has something to do, or a negative value if nothing is pending.
+    double nextDeadline () const;
+
+    size_t maxPayloadSize () const;
+    size_t packetsInFlight () const { return _inFlight.size(); }
+    size_t packetsQueued () const { return _queue.size(); }
+    bool failed () const { return _failed; }
+    const Stats& stats () const { return _stats; }
+
+private:
+    struct OutgoingPacket
+    {
+        uint8_t seq = 0;
+        uint8_t sessionID = 0;
+        std::vector<uint8_t> payload;
+        double sentAt = 0;
+        double deadline = 0;
+        int transmissions = 0;
+        bool selectivelyAcked = false;
+        bool fastRetransmitted = false;
+    };
+
+    struct QueuedPayload
+    {
+        uint8_t sessionID;
+        std::vector<uint8_t> payload;
+    };
+
+    struct HeldPacket
+    {
+        bool present = false;
+        uint8_t sessionID = 0;
+        std::vector<uint8_t> payload;
+    };
+
+    void fillWindow (double now);
+    void transmit (OutgoingPacket& packet, double now);
+    void sendAck ();
+    void handleAck (uint8_t ackNumber, double now);
+    void handleEak (const std::vector<uint8_t>& seqs, double now);
+    void handleData (const iAP2LinkPacket& packet, double now);
+    void sampleRTT (double rtt);
+    void fail ();
+
+    const Parameters _parameters;
+    Callbacks _callbacks;
+    iAP2PacketDecoder _decoder;
+
+    bool _started = false;
+    bool _failed = false;
+
+    // Sending
+    uint8_t _nextSeq = 0;
+    std::deque<OutgoingPacket> _inFlight; // in sequence order
+    std::deque<QueuedPayload> _queue;
+    double _rto = 0;
+    bool _haveRTT = false;
+
+    // Receiving
+    uint8_t _lastInOrder = 0;
+    std::vector<HeldPacket> _held;       // indexed by sequence number
+    size_t _heldCount = 0;
+    uint8_t _acksOwed = 0;
+    double _ackDeadline = -1;
+    bool _eakOwed = false;
+
+    std::vector<uint8_t> _scratch;
+    double _now = 0;
+    Stats _stats;
+};
+
+} // oc namespace
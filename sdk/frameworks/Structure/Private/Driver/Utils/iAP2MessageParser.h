@@ -22,6 +22,9 @@ typedef void (*iAP2MessageHeaderReceivedFunc)(struct iAP2MessageParser* __restri
 typedef void (*iAP2MessageParameterHeaderReceivedFunc)(struct iAP2MessageParser* __restrict parser);
 typedef void (*iAP2MessageParameterPayloadByteReceivedFunc)(struct iAP2MessageParser* __restrict parser, uint8_t newByte);
 typedef void (*iAP2MessageEndedFunc)(struct iAP2MessageParser* __restrict parser);
+/* A run of consecutive payload bytes of the current parameter. The pointer is into the buffer given to
+   iAP2MessageParserFeed and is only valid during the call. A parameter's payload may arrive in several runs. */
+typedef void (*iAP2MessageParameterPayloadRunReceivedFunc)(struct iAP2MessageParser* __restrict parser, const uint8_t* payload, uint16_t length);
 
 struct iAP2MessageParser {
 	/* Contains the parsed header */
@@ -46,5 +49,13 @@ void iAP2MessageParserInit(struct iAP2MessageParser* parser,
                            iAP2MessageParameterHeaderReceivedFunc parameterHeaderReceived,
                            iAP2MessageParameterPayloadByteReceivedFunc payloadByteReceived,
                            iAP2MessageEndedFunc messageEnded);
-/* Feed a byte into the parser.  It will digest the byte and call one of the callbacks below when appropriate */
+/* Feed a byte into the parser.  It will digest the byte and call one of the callbacks below when appropriate.
+   Kept for byte-at-a-time callers; new code should use iAP2MessageParserFeed. */
 void iAP2MessageParserPut(struct iAP2MessageParser* __restrict parser, uint8_t newByte);
+
+/* Feed a buffer into a parser set up with iAP2MessageParserInit. Headers are decoded in place and parameter payloads
+   handed over as (pointer, length) runs through payloadRunReceived, or byte by byte through the parser's
+   payloadByteReceived if payloadRunReceived is NULL. The parser state carries over between calls, so a buffer may end
+   anywhere. Callbacks come in the same order as with Put. */
+void iAP2MessageParserFeed(struct iAP2MessageParser* __restrict parser, const uint8_t* data, size_t length,
+                           iAP2MessageParameterPayloadRunReceivedFunc payloadRunReceived);
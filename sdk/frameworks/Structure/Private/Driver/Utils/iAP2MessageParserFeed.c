@@ -0,0 +1,137 @@
+/*
+ * iAP2MessageParserFeed.c
+ *
+ * Buffer-at-a-time companion to iAP2MessageParserPut: same state machine and callbacks, but payload bytes are
+ * handed over in runs and the start of message is found with memchr instead of one call per byte.
+ *
+ *  Author: Occipital
+ */
+
+#include "iAP2MessageParser.h"
+
+#include <string.h>
+
+#define iAP2StartOfMessageByte 0x40
+
+static void iAP2MessageParserResetState(struct iAP2MessageParser* __restrict parser)
+{
+	parser->state = iAP2MessageParserState_StartOfMessage;
+	parser->mostSignificantByte = true;
+	parser->remainingMessagePayload = 0;
+	parser->remainingMessageParameterPayload = 0;
+}
+
+/* Big endian 16-bit fields arrive one byte at a time. Returns true once the least significant byte is in. */
+static bool iAP2MessageParserTakeFieldByte(struct iAP2MessageParser* __restrict parser, uint16_t* field, uint8_t newByte)
+{
+	if (parser->mostSignificantByte) {
+		*field = (uint16_t)(newByte << 8);
+		parser->mostSignificantByte = false;
+		return false;
+	}
+
+	*field = (uint16_t)(*field | newByte);
+	parser->mostSignificantByte = true;
+	return true;
+}
+
+/* A parameter (or a message without parameters) is complete: either another parameter follows or the message ends. */
+static void iAP2MessageParserParameterEnded(struct iAP2MessageParser* __restrict parser)
+{
+	if (parser->remainingMessagePayload == 0) {
+		if (parser->messageEnded)
+			parser->messageEnded(parser);
+		iAP2MessageParserResetState(parser);
+	} else {
+		parser->state = iAP2MessageParserState_MessageParameterLength;
+	}
+}
+
+void iAP2MessageParserFeed(struct iAP2MessageParser* __restrict parser, const uint8_t* data, size_t length,
+                           iAP2MessageParameterPayloadRunReceivedFunc payloadRunReceived)
+{
+	const uint8_t* const end = data + length;
+
+	while (data < end) {
+		switch (parser->state) {
+		case iAP2MessageParserState_StartOfMessage:
+			if (parser->mostSignificantByte) {
+				const uint8_t* found = (const uint8_t*)memchr(data, iAP2StartOfMessageByte, (size_t)(end - data));
+				if (!found)
+					return;
+				data = found + 1;
+				parser->mostSignificantByte = false;
+			} else {
+				parser->mostSignificantByte = true;
+				if (*data++ == iAP2StartOfMessageByte)
+					parser->state = iAP2MessageParserState_MessageLength;
+			}
+			break;
+
+		case iAP2MessageParserState_MessageLength:
+			if (iAP2MessageParserTakeFieldByte(parser, &parser->header.messageLength, *data++)) {
+				if (parser->header.messageLength < iAP2MessageHeaderSize) {
+					iAP2LogErrorHere(iAP2Error_MessageHeaderLengthInvalid);
+					iAP2MessageParserResetState(parser);
+					break;
+				}
+				parser->remainingMessagePayload = (uint16_t)(parser->header.messageLength - iAP2MessageHeaderSize);
+				parser->state = iAP2MessageParserState_MessageID;
+			}
+			break;
+
+		case iAP2MessageParserState_MessageID:
+			if (iAP2MessageParserTakeFieldByte(parser, &parser->header.messageID, *data++)) {
+				if (parser->headerReceived)
+					parser->headerReceived(parser);
+				iAP2MessageParserParameterEnded(parser);
+			}
+			break;
+
+		case iAP2MessageParserState_MessageParameterLength:
+			if (iAP2MessageParserTakeFieldByte(parser, &parser->paramHeader.parameterLength, *data++)) {
+				const uint16_t parameterLength = parser->paramHeader.parameterLength;
+				if (parameterLength < iAP2MessageParameterHeaderSize || parameterLength > parser->remainingMessagePayload) {
+					iAP2LogErrorHere(iAP2Error_MessageParameterHeaderLengthInvalid);
+					iAP2MessageParserResetState(parser);
+					break;
+				}
+				parser->remainingMessagePayload = (uint16_t)(parser->remainingMessagePayload - parameterLength);
+				parser->remainingMessageParameterPayload = (uint16_t)(parameterLength - iAP2MessageParameterHeaderSize);
+				parser->state = iAP2MessageParserState_MessageParameterID;
+			}
+			break;
+
+		case iAP2MessageParserState_MessageParameterID:
+			if (iAP2MessageParserTakeFieldByte(parser, &parser->paramHeader.parameterID, *data++)) {
+				if (parser->parameterHeaderReceived)
+					parser->parameterHeaderReceived(parser);
+				if (parser->remainingMessageParameterPayload == 0)
+					iAP2MessageParserParameterEnded(parser);
+				else
+					parser->state = iAP2MessageParserState_MessageParameterPayload;
+			}
+			break;
+
+		case iAP2MessageParserState_MessageParameterPayload: {
+			const size_t available = (size_t)(end - data);
+			const uint16_t run = (available < parser->remainingMessageParameterPayload) ? (uint16_t)available
+			                                                                             : parser->remainingMessageParameterPayload;
+
+			if (payloadRunReceived) {
+				payloadRunReceived(parser, data, run);
+			} else if (parser->payloadByteReceived) {
+				uint16_t i;
+				for (i = 0; i < run; ++i)
+					parser->payloadByteReceived(parser, data[i]);
+			}
+
+			data += run;
+			parser->remainingMessageParameterPayload = (uint16_t)(parser->remainingMessageParameterPayload - run);
+			if (parser->remainingMessageParameterPayload == 0)
+				iAP2MessageParserParameterEnded(parser);
+			break;
+		}
+		}
+	}
+}
@@ -38,7 +38,9 @@
 
 //------------------------------------------------------------------------------
 
-/* WARNING: this class is not thread safe */
+/* WARNING: this class is not thread safe
+   It allocates an iAP2Message, a dictionary and an NSData per parameter for every message; iAP2MessageViewReader.h
+   does the same parsing without allocating. */
 @interface iAP2MessageReader : NSObject
 
 -(NSArray*) newMessagesFromData:(const void*)data size:(size_t)dataSize;
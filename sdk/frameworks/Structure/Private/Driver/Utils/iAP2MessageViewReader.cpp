@@ -0,0 +1,191 @@
+//
+//  iAP2MessageViewReader.cpp
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#include "iAP2MessageViewReader.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace oc {
+
+namespace {
+
+    const uint8_t StartOfMessageByte = 0x40;   // iAP2StartOfMessage is 0x4040
+    const size_t MessageHeaderSize = 6;        // iAP2MessageHeaderSize
+    const size_t ParameterHeaderSize = 4;      // iAP2MessageParameterHeaderSize
+    const size_t LengthFieldEnd = 4;           // start of message + message length
+
+    inline uint16_t readBigEndian16 (const uint8_t* p)
+    {
+        return uint16_t((p[0] << 8) | p[1]);
+    }
+
+} // anonymous namespace
+
+iAP2MessageViewReader::iAP2MessageViewReader (size_t arenaBytes, size_t maxParameters)
+: _arenaCapacity(std::max(std::min<size_t>(arenaBytes, MaxMessageSize), MessageHeaderSize)),
+  _maxParameters(std::max<size_t>(1, maxParameters)),
+  _arena(new uint8_t[_arenaCapacity]),
+  _parameters(new iAP2ParameterView[_maxParameters])
+{
+}
+
+void iAP2MessageViewReader::reset ()
+{
+    _pendingBytes = 0;
+    _skipBytes = 0;
+}
+
+size_t iAP2MessageViewReader::step (const uint8_t* data, size_t size, iAP2MessageView& view, bool& complete)
+{
+    if (_skipBytes > 0)
+    {
+        const size_t skip = std::min(_skipBytes, size);
+        _skipBytes -= skip;
+        _skippedBytes += skip;
+        return skip;
+    }
+
+    if (_pendingBytes > 0)
+        return stepPending(data, size, view, complete);
+
+    // Resynchronize on the start of message.
+    if (data[0] != StartOfMessageByte || (size > 1 && data[1] != StartOfMessageByte))
+    {
+        const void* next = std::memchr(data + 1, StartOfMessageByte, size - 1);
+        const size_t skip = next ? size_t(static_cast<const uint8_t*>(next) - data) : size;
+        _skippedBytes += skip;
+        return skip;
+    }
+
+    if (size < LengthFieldEnd)
+    {
+        std::memcpy(_arena.get(), data, size);
+        _pendingBytes = size;
+        return size;
+    }
+
+    const size_t length = readBigEndian16(data + 2);
+    if (length < MessageHeaderSize)
+    {
+        ++_malformedMessages;
+        _skippedBytes += 1;
+        return 1;
+    }
+
+    if (length <= size)
+    {
+        complete = parse(data, length, view);
+        return length;
+    }
+
+    if (length > _arenaCapacity)
+    {
+        ++_oversizedMessages;
+        _skipBytes = length - size;
+        _skippedBytes += size;
+        return size;
+    }
+
+    std::memcpy(_arena.get(), data, size);
+    _pendingBytes = size;
+    return size;
+}
+
+size_t iAP2MessageViewReader::stepPending (const uint8_t* data, size_t size, iAP2MessageView& view, bool& complete)
+{
+    uint8_t* arena = _arena.get();
+
+    // A lone start byte: only keep it if the second one follows.
+    if (_pendingBytes == 1 && data[0] != StartOfMessageByte)
+    {
+        _pendingBytes = 0;
+        _skippedBytes += 1;
+        return 0;
+    }
+
+    size_t consumed = 0;
+
+    if (_pendingBytes < LengthFieldEnd)
+    {
+        consumed = std::min(LengthFieldEnd - _pendingBytes, size);
+        std::memcpy(arena + _pendingBytes, data, consumed);
+        _pendingBytes += consumed;
+
+        if (_pendingBytes < LengthFieldEnd)
+            return consumed;
+
+        const size_t length = readBigEndian16(arena + 2);
+        if (length < MessageHeaderSize)
+        {
+            ++_malformedMessages;
+            _skippedBytes += _pendingBytes;
+            _pendingBytes = 0;
+            return consumed;
+        }
+
+        if (length > _arenaCapacity)
+        {
+            ++_oversizedMessages;
+            _skippedBytes += _pendingBytes;
+            _skipBytes = length - _pendingBytes;
+            _pendingBytes = 0;
+            return consumed;
+        }
+    }
+
+    const size_t length = readBigEndian16(arena + 2);
+    const size_t copy = std::min(length - _pendingBytes, size - consumed);
+    std::memcpy(arena + _pendingBytes, data + consumed, copy);
+    _pendingBytes += copy;
+    consumed += copy;
+
+    if (_pendingBytes == length)
+    {
+        _pendingBytes = 0;
+        complete = parse(arena, length, view);
+    }
+
+    return consumed;
+}
+
+bool iAP2MessageViewReader::parse (const uint8_t* message, size_t size, iAP2MessageView& view)
+{
+    size_t count = 0;
+    size_t position = MessageHeaderSize;
+
+    while (position < size)
+    {
+        if (size - position < ParameterHeaderSize || count == _maxParameters)
+        {
+            ++_malformedMessages;
+            return false;
+        }
+
+        const size_t length = readBigEndian16(message + position);
+        if (length < ParameterHeaderSize || length > size - position)
+        {
+            ++_malformedMessages;
+            return false;
+        }
+
+        iAP2ParameterView& parameter = _parameters[count++];
+        parameter.parameterID = readBigEndian16(message + position + 2);
+        parameter.payload = message + position + ParameterHeaderSize;
+        parameter.payloadSize = uint16_t(length - ParameterHeaderSize);
+
+        position += length;
+    }
+
+    view.messageID = readBigEndian16(message + 4);
+    view.parameters = _parameters.get();
+    view.parameterCount = count;
+    ++_messagesRead;
+    return true;
+}
+
+} // oc namespace
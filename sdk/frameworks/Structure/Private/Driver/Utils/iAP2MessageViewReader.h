@@ -0,0 +1,114 @@
+//
+//  iAP2MessageViewReader.h
+//  Structure
+//
+//  Copyright (c) 2018 Occipital. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace oc {
+
+struct iAP2ParameterView
+{
+    uint16_t parameterID;
+    const uint8_t* payload;
+    uint16_t payloadSize;
+};
+
+/* One iAP2 message: pointers into the caller's buffer, or into the reader's arena for a message that was split
+   across reads. Only valid during the handler call. */
+struct iAP2MessageView
+{
+    uint16_t messageID = 0;
+    const iAP2ParameterView* parameters = nullptr;
+    size_t parameterCount = 0;
+
+    // First parameter with that ID, or null.
+    const iAP2ParameterView* find (uint16_t parameterID) const
+    {
+        for (size_t i = 0; i < parameterCount; ++i)
+            if (parameters[i].parameterID == parameterID)
+                return &parameters[i];
+        return nullptr;
+    }
+};
+
+/**
+ * Allocation-free replacement for iAP2MessageReader: bytes in, message views out.
+ *
+ * Messages that lie entirely inside the buffer passed to read() are parsed in place. The tail of a message cut off
+ * at the end of a buffer is copied into a fixed arena and completed from the next read(), so the only copies are of
+ * split messages. The arena and the parameter table are allocated once, in the constructor. The default arena holds
+ * the largest message the 16-bit length field allows, so no valid message is lost to a split; with a smaller arena,
+ * split messages larger than it are skipped and counted, as are messages with more parameters than the table holds.
+ *
+ * Instances share nothing, so one per thread (or per EA session) needs no locking; a single instance is not thread safe.
+ *
+ *     iAP2MessageViewReader reader;
+ *     reader.read(bytes, size, [&] (const iAP2MessageView& message) { ... });
+ */
+class iAP2MessageViewReader
+{
+public:
+    enum : size_t { MaxMessageSize = 0xffff }; // iAP2MessageHeader::messageLength is 16 bits
+
+    explicit iAP2MessageViewReader (size_t arenaBytes = MaxMessageSize, size_t maxParameters = 64);
+
+    // Calls handler(const iAP2MessageView&) for every message completed by these bytes. Returns how many.
+    template <class Handler>
+    size_t read (const uint8_t* data, size_t size, Handler&& handler)
+    {
+        size_t messages = 0;
+        iAP2MessageView view;
+
+        while (size > 0)
+        {
+            bool complete = false;
+            const size_t consumed = step(data, size, view, complete);
+            data += consumed;
+            size -= consumed;
+
+            if (complete)
+            {
+                handler(static_cast<const iAP2MessageView&>(view));
+                ++messages;
+            }
+        }
+
+        return messages;
+    }
+
+    // Forgets any partial message, e.g. after a link reset.
+    void reset ();
+
+    uint64_t messagesRead () const { return _messagesRead; }
+    uint64_t malformedMessages () const { return _malformedMessages; }
+    uint64_t oversizedMessages () const { return _oversizedMessages; }
+    uint64_t skippedBytes () const { return _skippedBytes; }
+
+private:
+    // Consumes some bytes and sets complete (and fills view) when that finished a message.
+    size_t step (const uint8_t* data, size_t size, iAP2MessageView& view, bool& complete);
+    size_t stepPending (const uint8_t* data, size_t size, iAP2MessageView& view, bool& complete);
+    bool parse (const uint8_t* message, size_t size, iAP2MessageView& view);
+
+    const size_t _arenaCapacity;
+    const size_t _maxParameters;
+    std::unique_ptr<uint8_t[]> _arena;
+    std::unique_ptr<iAP2ParameterView[]> _parameters;
+
+    size_t _pendingBytes = 0;   // bytes of a split message in the arena
+    size_t _skipBytes = 0;      // rest of an oversized message still to be thrown away
+
+    uint64_t _messagesRead = 0;
+    uint64_t _malformedMessages = 0;
+    uint64_t _oversizedMessages = 0;
+    uint64_t _skippedBytes = 0;
+};
+
+} // oc namespace
@@ -109,6 +109,10 @@ typedef void (^CompletionBlock)(NSError* error);
 - (void)uploadCalibrationWithData:(GeneralStoreCalibrationData&) calData;
 - (int)writeGeneralStoreFile:(uint8_t*)generalStoreData
                     withSize:(uint32_t)generalStoreDataSize;
+/* When YES, uploadCalibrationWithData: and writeGeneralStoreFile:withSize: only rewrite the parts of the General Store
+ that differ from the cached on-sensor copy (uploadFileDelta:...), falling back to a full upload when there is no
+ cached copy for the current file table change counter. Defaults to NO. */
+@property (nonatomic) BOOL generalStoreDeltaUploadEnabled;
 - (void) deleteGeneralStoreFile:(CompletionBlock) completionBlock;
 - (void) resetConnectionState;
 